@@ -19,6 +19,10 @@ const volatile __u64 stack_flags = 0;
 const volatile bool wa_missing_free = false;
 /* dwunw-added: runtime knob indicating whether to emit DWARF events */
 const volatile bool dwunw_enabled = false;
+/* dwunw-added: bytes of user stack copied into each event, 0 = registers only */
+const volatile __u32 dwunw_stack_bytes = 0;
+/* dwunw-added: events lost because dwunw_events was full (read via skel->bss) */
+__u64 dwunw_ringbuf_drops = 0;
 
 struct {
 	__uint(type, BPF_MAP_TYPE_HASH);
@@ -59,22 +63,32 @@ struct {
 	__uint(max_entries, 1 << 22);
 } dwunw_events SEC(".maps");
 
-/* dwunw-added: helper to snapshot registers for dwunw_capture */
+/* dwunw-added: helper to snapshot registers (and optionally the top of the
+ * user stack) for dwunw_capture */
 static __always_inline void emit_dwunw_event(struct pt_regs *ctx)
 {
 	if (!dwunw_enabled)
 		return;
 
-	struct memleak_dwunw_event *evt = bpf_ringbuf_reserve(&dwunw_events,
-	                                                    sizeof(*evt), 0);
-	if (!evt)
+	/* reserve only the configured copy, not the full stack[] bound; the
+	 * rodata value is a known constant to the verifier */
+	__u32 snapshot = dwunw_stack_bytes;
+	if (snapshot > MEMLEAK_DWUNW_STACK_MAX)
+		snapshot = MEMLEAK_DWUNW_STACK_MAX;
+
+	struct memleak_dwunw_event *evt;
+	evt = bpf_ringbuf_reserve(&dwunw_events,
+	                          offsetof(struct memleak_dwunw_event, stack) + snapshot, 0);
+	if (!evt) {
+		__sync_fetch_and_add(&dwunw_ringbuf_drops, 1);
 		return;
+	}
 
 	const __u64 pid_tgid = bpf_get_current_pid_tgid();
 	evt->pid = pid_tgid & 0xffffffff;
 	evt->tgid = pid_tgid >> 32;
 	evt->arch = MEMLEAK_DWUNW_ARCH_X86_64;
-	evt->reserved = 0;
+	evt->stack_size = 0;
 	bpf_get_current_comm(&evt->comm, sizeof(evt->comm));
 
 	__builtin_memset(&evt->regset, 0, sizeof(evt->regset));
@@ -82,13 +96,42 @@ static __always_inline void emit_dwunw_event(struct pt_regs *ctx)
 	evt->regset.version = MEMLEAK_DWUNW_REGSET_VERSION;
 	evt->regset.sp = PT_REGS_SP(ctx);
 	evt->regset.pc = PT_REGS_IP(ctx);
-	evt->regset.regs[0] = BPF_CORE_READ(ctx, bp);
-	evt->regset.regs[1] = BPF_CORE_READ(ctx, ax);
-	evt->regset.regs[2] = BPF_CORE_READ(ctx, bx);
-	evt->regset.regs[3] = BPF_CORE_READ(ctx, cx);
-	evt->regset.regs[4] = BPF_CORE_READ(ctx, dx);
-	evt->regset.regs[5] = BPF_CORE_READ(ctx, si);
-	evt->regset.regs[6] = BPF_CORE_READ(ctx, di);
+	/* x86-64 psABI DWARF numbering, as dwunw_cfi_eval() indexes regs[] */
+	evt->regset.regs[0] = BPF_CORE_READ(ctx, ax);
+	evt->regset.regs[1] = BPF_CORE_READ(ctx, dx);
+	evt->regset.regs[2] = BPF_CORE_READ(ctx, cx);
+	evt->regset.regs[3] = BPF_CORE_READ(ctx, bx);
+	evt->regset.regs[4] = BPF_CORE_READ(ctx, si);
+	evt->regset.regs[5] = BPF_CORE_READ(ctx, di);
+	evt->regset.regs[6] = BPF_CORE_READ(ctx, bp);
+	evt->regset.regs[7] = evt->regset.sp;
+	evt->regset.regs[8] = BPF_CORE_READ(ctx, r8);
+	evt->regset.regs[9] = BPF_CORE_READ(ctx, r9);
+	evt->regset.regs[10] = BPF_CORE_READ(ctx, r10);
+	evt->regset.regs[11] = BPF_CORE_READ(ctx, r11);
+	evt->regset.regs[12] = BPF_CORE_READ(ctx, r12);
+	evt->regset.regs[13] = BPF_CORE_READ(ctx, r13);
+	evt->regset.regs[14] = BPF_CORE_READ(ctx, r14);
+	evt->regset.regs[15] = BPF_CORE_READ(ctx, r15);
+	evt->regset.regs[16] = evt->regset.pc;
+
+	if (snapshot) {
+		__u32 want = snapshot;
+
+		/* a copy running past the top of the stack faults as a whole,
+		 * so retry smaller for threads with shallow stacks */
+#pragma unroll
+		for (int i = 0; i < 4; i++) {
+			if (want < 8)
+				break;
+			if (!bpf_probe_read_user(evt->stack, want,
+						 (const void *)evt->regset.sp)) {
+				evt->stack_size = want;
+				break;
+			}
+			want >>= 1;
+		}
+	}
 
 	bpf_ringbuf_submit(evt, 0);
 }
@@ -11,6 +11,8 @@
 #define MEMLEAK_DWUNW_REGSET_VERSION 1
 #define MEMLEAK_DWUNW_REGSET_SLOTS 32
 #define MEMLEAK_DWUNW_ARCH_X86_64 1
+/* Largest user stack copy an event can carry (see dwunw_stack_bytes). */
+#define MEMLEAK_DWUNW_STACK_MAX 16384
 
 struct memleak_dwunw_regset_snapshot {
     __u16 arch;
@@ -18,16 +20,19 @@ struct memleak_dwunw_regset_snapshot {
     __u32 flags;
     __u64 sp;
     __u64 pc;
-    __u64 regs[MEMLEAK_DWUNW_REGSET_SLOTS];
+    __u64 regs[MEMLEAK_DWUNW_REGSET_SLOTS]; /* DWARF register numbering */
 };
 
 struct memleak_dwunw_event {
     __u32 pid;
     __u32 tgid;
     __u32 arch;
-    __u32 reserved;
+    __u32 stack_size; /* valid bytes of stack[], copied from regset.sp up */
     char comm[16];
     struct memleak_dwunw_regset_snapshot regset;
+    /* Records carry dwunw_stack_bytes of it (register-only events end
+     * here); only the first stack_size bytes are valid. */
+    __u8 stack[MEMLEAK_DWUNW_STACK_MAX];
 };
 
 #endif /* MEMLEAK_DWUNW_EVENTS_H */
@@ -9,8 +9,12 @@
 #include <argp.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h> /* dwunw-added: unwind worker pool */
+#include <semaphore.h> /* dwunw-added: worker wakeups */
 #include <signal.h>
+#include <stdatomic.h> /* dwunw-added: lock-free event queues */
 #include <stdbool.h>
+#include <stddef.h> /* dwunw-added: for offsetof */
 #include <stdio.h>
 #include <stdint.h>
 #include <stdarg.h>
@@ -32,6 +36,7 @@
 #include "trace_helpers.h"
 #include "dwunw/dwunw_api.h" /* dwunw-added: libdwunw integration */
 #include "dwunw/unwind.h" /* dwunw-added: libdwunw frame capture */
+#include "dwunw/stack_table.h" /* dwunw-added: stack ids */
 
 #define DWUNW_ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
 
@@ -108,15 +113,70 @@ static const char *const dwunw_mode_text[] = {
 	[DWUNW_MODE_FORCE] = "force",
 };
 
+/* dwunw-added: events each worker queue holds before the poll thread drops */
+#define DWUNW_QUEUE_DEPTH 256
+
+/* dwunw-added: trie nodes per stack table (16 bytes each) */
+#define DWUNW_STACK_TABLE_NODES (1u << 20)
+
+/* dwunw-added: queued copy of one ring buffer record */
+struct dwunw_slot {
+	uint64_t enqueue_ns;
+	uint32_t size;
+	uint32_t pad;
+	uint8_t data[];
+};
+
+/* dwunw-added: unwind thread fed by the poll thread through a SPSC ring */
+struct dwunw_worker {
+	pthread_t thread;
+	bool started;
+	struct dwunw_context ctx; /* private; modules come from dwunw_rt.store */
+	bool ctx_ready;
+	struct dwunw_stack_table stacks; /* keyed by ctx's module ids */
+	unsigned int index; /* printed with stack ids: they are per worker */
+	sem_t ready; /* posted once per queued event, plus once to stop */
+	uint8_t *slots; /* DWUNW_QUEUE_DEPTH slots of slot_size bytes */
+	size_t slot_size;
+	_Atomic uint32_t head; /* next slot the poll thread fills */
+	_Atomic uint32_t tail; /* next slot this worker drains */
+};
+
+/* dwunw-added: pipeline counters, printed every interval */
+struct dwunw_pipeline_stats {
+	_Atomic uint64_t received; /* records pulled off dwunw_events */
+	_Atomic uint64_t dropped; /* records discarded because a worker queue was full */
+	_Atomic uint64_t unwound;
+	_Atomic uint64_t failed;
+	_Atomic uint64_t stacks; /* distinct stacks per worker, summed over workers */
+	_Atomic uint64_t latency_ns; /* poll-to-output time summed over unwound+failed */
+	_Atomic uint64_t latency_max_ns;
+};
+
 struct dwunw_runtime {
 	enum dwunw_mode mode;
-	struct dwunw_context ctx;
+	bool attach; /* ptrace-stop threads while unwinding */
+	long stack_window_kib; /* prefetch window above SP, -1 = library default */
+	long stack_snapshot_kib; /* user stack copied by BPF per event, 0 = off */
+	long workers; /* unwind threads behind a poll thread, 0 = unwind inline */
+	struct dwunw_context ctx; /* inline mode only */
 	bool ctx_ready;
+	struct dwunw_stack_table stacks; /* inline mode only */
+	struct dwunw_module_store store; /* parsed modules shared by the workers */
+	bool store_ready;
+	struct dwunw_worker *pool;
+	pthread_t poll_thread;
+	bool poll_started;
+	atomic_bool stop;
+	struct dwunw_pipeline_stats stats;
+	struct memleak_dwunw_bpf *skel;
 	struct ring_buffer *rb;
 };
 
 static struct dwunw_runtime dwunw_rt = {
 	.mode = DWUNW_MODE_FALLBACK,
+	.stack_window_kib = -1,
+	.workers = 2,
 	.ctx_ready = false,
 	.rb = NULL,
 };
@@ -140,6 +200,7 @@ static int setup_dwunw_runtime(struct memleak_dwunw_bpf *skel);
 static void teardown_dwunw_runtime(void);
 static int handle_dwunw_event(void *ctx, void *data, size_t data_sz);
 static void dwunw_maybe_poll(void);
+static void dwunw_print_stats(void);
 static size_t clamp_to_top_stacks(size_t count);
 
 #define __ATTACH_UPROBE(skel, sym_name, prog_name, is_retprobe) \
@@ -245,6 +306,11 @@ const char argp_args_doc[] =
 "        Emit DWARF-based stacks via libdwunw alongside memleak summaries\n"
 "";
 
+#define OPT_DWUNW_ATTACH 0x100 /* dwunw-added: long-only option */
+#define OPT_DWUNW_STACK_WINDOW 0x101 /* dwunw-added: long-only option */
+#define OPT_DWUNW_STACK_SNAPSHOT 0x102 /* dwunw-added: long-only option */
+#define OPT_DWUNW_WORKERS 0x103 /* dwunw-added: long-only option */
+
 static const struct argp_option argp_options[] = {
 	// name/longopt:str, key/shortopt:int, arg:str, flags:int, doc:str
 	{"pid", 'p', "PID", 0, "process ID to trace. if not specified, trace kernel allocs", 0 },
@@ -263,6 +329,10 @@ static const struct argp_option argp_options[] = {
 	{"symbols-prefix", 'S', "SYMBOLS_PREFIX", 0, "memory allocator symbols prefix", 0 },
 	{"verbose", 'v', NULL, 0, "verbose debug output", 0 },
 	{"dwunw-mode", 'W', "MODE", 0, "dwunw unwinding mode: off|fallback|force", 0 }, /* dwunw-added */
+	{"dwunw-attach", OPT_DWUNW_ATTACH, NULL, 0, "ptrace-stop each thread while unwinding (consistent, but pauses the workload)", 0 }, /* dwunw-added */
+	{"dwunw-stack-window", OPT_DWUNW_STACK_WINDOW, "KIB", 0, "stack bytes copied above SP per capture: 0 (off) or 16..64 KiB", 0 }, /* dwunw-added */
+	{"dwunw-stack-snapshot", OPT_DWUNW_STACK_SNAPSHOT, "KIB", 0, "copy this much user stack in BPF and unwind from the copy (0..16 KiB, no ptrace/process_vm_readv)", 0 }, /* dwunw-added */
+	{"dwunw-workers", OPT_DWUNW_WORKERS, "N", 0, "unwind threads fed by a ring buffer poll thread (default 2, 0 = unwind in the poll callback)", 0 }, /* dwunw-added */
 	{},
 };
 
@@ -362,6 +432,7 @@ struct syms_cache *syms_cache;
 	skel->rodata->stack_flags = env.kernel_trace ? 0 : BPF_F_USER_STACK;
 	skel->rodata->wa_missing_free = env.wa_missing_free;
 	skel->rodata->dwunw_enabled = dwunw_rt.mode != DWUNW_MODE_OFF; /* dwunw-added */
+	skel->rodata->dwunw_stack_bytes = (__u32)dwunw_rt.stack_snapshot_kib * 1024; /* dwunw-added */
 
 	bpf_map__set_value_size(skel->maps.stack_traces,
 				env.perf_max_stack_depth * sizeof(unsigned long));
@@ -466,6 +537,7 @@ struct syms_cache *syms_cache;
 			print_outstanding_combined_allocs(combined_allocs_fd, stack_traces_fd);
 		else
 			print_outstanding_allocs(allocs_fd, stack_traces_fd);
+		dwunw_print_stats(); /* dwunw-added */
 	}
 
 	// after loop ends, check for child process and cleanup accordingly
@@ -562,6 +634,33 @@ error_t argp_parse_arg(int key, char *arg, struct argp_state *state)
 	case 'W':
 		dwunw_rt.mode = parse_dwunw_mode(arg); /* dwunw-added */
 		break;
+	case OPT_DWUNW_ATTACH:
+		dwunw_rt.attach = true; /* dwunw-added */
+		break;
+	case OPT_DWUNW_STACK_WINDOW:
+		dwunw_rt.stack_window_kib = argp_parse_long(key, arg, state); /* dwunw-added */
+		if (dwunw_rt.stack_window_kib != 0 &&
+		    (dwunw_rt.stack_window_kib < DWUNW_STACK_WINDOW_MIN / 1024 ||
+		     dwunw_rt.stack_window_kib > DWUNW_STACK_WINDOW_MAX / 1024)) {
+			fprintf(stderr, "invalid --dwunw-stack-window: %s\n", arg);
+			argp_usage(state);
+		}
+		break;
+	case OPT_DWUNW_STACK_SNAPSHOT:
+		dwunw_rt.stack_snapshot_kib = argp_parse_long(key, arg, state); /* dwunw-added */
+		if (dwunw_rt.stack_snapshot_kib < 0 ||
+		    dwunw_rt.stack_snapshot_kib * 1024 > MEMLEAK_DWUNW_STACK_MAX) {
+			fprintf(stderr, "invalid --dwunw-stack-snapshot: %s\n", arg);
+			argp_usage(state);
+		}
+		break;
+	case OPT_DWUNW_WORKERS:
+		dwunw_rt.workers = argp_parse_long(key, arg, state); /* dwunw-added */
+		if (dwunw_rt.workers < 0 || dwunw_rt.workers > 64) {
+			fprintf(stderr, "invalid --dwunw-workers: %s\n", arg);
+			argp_usage(state);
+		}
+		break;
 	case 'T':
 		env.top_stacks = argp_parse_long(key, arg, state);
 		break;
@@ -737,51 +836,85 @@ static void copy_dwunw_regset(struct dwunw_regset *dst,
 }
 
 /* dwunw-added: pretty print DWARF frames */
-static void dwunw_print_frames(const struct dwunw_frame *frames, size_t count)
+static void dwunw_print_frames(const struct dwunw_context *ctx,
+			       const struct dwunw_compact_frame *frames, size_t count)
 {
 	for (size_t i = 0; i < count; ++i) {
-		const struct dwunw_frame *f = &frames[i];
-		printf("  [dwunw] #%zu pc=0x%llx sp=0x%llx ra=0x%llx flags=0x%x module=%s\n",
+		const struct dwunw_compact_frame *f = &frames[i];
+		const char *module = dwunw_module_name(ctx, f->module_id);
+		printf("  [dwunw] #%zu pc=0x%llx cfa=0x%llx rel_pc=0x%llx flags=0x%x module=%s\n",
 		       i,
 		       (unsigned long long)f->pc,
-		       (unsigned long long)f->sp,
-		       (unsigned long long)f->ra,
+		       (unsigned long long)f->cfa,
+		       (unsigned long long)f->rel_pc,
 		       f->flags,
-		       f->module_path);
+		       module ? module : "?");
 	}
 }
 
-/* dwunw-added: ring buffer callback pumping events into dwunw_capture */
-static int handle_dwunw_event(void *ctx __attribute__((unused)), void *data, size_t data_sz)
+/* dwunw-added: bytes of a ring buffer record worth keeping, 0 if malformed */
+static size_t dwunw_event_size(const void *data, size_t data_sz)
 {
-	if (data_sz < sizeof(struct memleak_dwunw_event) || !dwunw_rt.ctx_ready)
+	const size_t head = offsetof(struct memleak_dwunw_event, stack);
+	if (data_sz < head)
 		return 0;
 
 	const struct memleak_dwunw_event *evt = data;
+	if (evt->stack_size > MEMLEAK_DWUNW_STACK_MAX || data_sz < head + evt->stack_size)
+		return 0;
+	return head + evt->stack_size;
+}
+
+/* dwunw-added: monotonic clock for the latency counters */
+static uint64_t dwunw_now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* dwunw-added: unwind one validated event and print it; false on failure */
+static bool dwunw_unwind_event(struct dwunw_context *ctx,
+			       struct dwunw_stack_table *stacks,
+			       unsigned int worker,
+			       const struct memleak_dwunw_event *evt)
+{
 	struct dwunw_regset regset = {};
 	if (dwunw_regset_prepare(&regset, (enum dwunw_arch_id)evt->arch) != DWUNW_OK)
-		return 0;
+		return false;
 	copy_dwunw_regset(&regset, &evt->regset);
 
-	struct dwunw_frame frames[8];
+	/* compact frames: modules come back as ids into ctx's name table */
+	struct dwunw_compact_frame frames[8];
 	memset(frames, 0, sizeof(frames));
 	char module_path[DWUNW_MAX_PATH_LEN];
 	snprintf(module_path, sizeof(module_path), "/proc/%u/exe", evt->tgid);
 	struct dwunw_unwind_request req = {
 		.module_path = module_path,
 		.regs = &regset,
-		.frames = frames,
+		.compact_frames = frames,
 		.max_frames = DWUNW_ARRAY_SIZE(frames),
 		.options = DWUNW_OPTION_NONE,
 	};
 
 	if (dwunw_rt.mode != DWUNW_MODE_OFF) {
+		/* resolve every frame through the process's maps (PIE + .so) */
+		req.module_path = NULL;
 		req.pid = (pid_t)evt->tgid;
 		req.tid = (pid_t)evt->pid;
 	}
 
+	/* stack copied at probe time: consistent, and no syscalls to read it */
+	struct dwunw_stack_snapshot snapshot = {
+		.base = evt->regset.sp,
+		.data = evt->stack,
+		.size = evt->stack_size,
+	};
+	if (evt->stack_size > 0)
+		req.stack = &snapshot;
+
 	size_t written = 0;
-	dwunw_status_t st = dwunw_capture(&dwunw_rt.ctx, &req, &written);
+	dwunw_status_t st = dwunw_capture(ctx, &req, &written);
 	if (st != DWUNW_OK && req.pid > 0) {
 		if (dwunw_rt.mode == DWUNW_MODE_FORCE) {
 			fprintf(stderr,
@@ -789,7 +922,7 @@ static int handle_dwunw_event(void *ctx __attribute__((unused)), void *data, siz
 			        evt->tgid,
 			        evt->comm,
 			        st);
-			return 0;
+			return false;
 		}
 
 		if (dwunw_rt.mode == DWUNW_MODE_FALLBACK) {
@@ -798,11 +931,12 @@ static int handle_dwunw_event(void *ctx __attribute__((unused)), void *data, siz
 			        evt->tgid,
 			        evt->comm,
 			        st);
+			req.module_path = module_path;
 			req.pid = 0;
 			req.tid = 0;
 			memset(frames, 0, sizeof(frames));
 			written = 0;
-			st = dwunw_capture(&dwunw_rt.ctx, &req, &written);
+			st = dwunw_capture(ctx, &req, &written);
 		}
 	}
 
@@ -812,30 +946,232 @@ static int handle_dwunw_event(void *ctx __attribute__((unused)), void *data, siz
 		        evt->tgid,
 		        evt->comm,
 		        st);
-		return 0;
+		return false;
 	}
 
-	printf("[dwunw] pid=%u comm=%s frames=%zu\n",
+	/* frames are printed the first time a stack shows up in this worker;
+	 * repeats only name worker/id (id 0 when the table is full) */
+	uint32_t stack_id = 0;
+	bool inserted = false;
+	if (dwunw_stack_table_intern_compact(stacks, frames, written, &stack_id,
+					     &inserted) != DWUNW_OK)
+		stack_id = 0;
+	if (inserted)
+		atomic_fetch_add_explicit(&dwunw_rt.stats.stacks, 1, memory_order_relaxed);
+
+	/* workers print concurrently; keep each stack in one block */
+	flockfile(stdout);
+	printf("[dwunw] pid=%u comm=%s frames=%zu stack=%u/%u%s\n",
 	       evt->tgid,
 	       evt->comm,
-	       written);
-	dwunw_print_frames(frames, written);
+	       written,
+	       worker,
+	       stack_id,
+	       stack_id && !inserted ? " (seen)" : "");
+	if (inserted || !stack_id)
+		dwunw_print_frames(ctx, frames, written);
+	funlockfile(stdout);
+	return true;
+}
+
+/* dwunw-added: account one finished event against the pipeline counters */
+static void dwunw_account(bool ok, uint64_t start_ns)
+{
+	struct dwunw_pipeline_stats *stats = &dwunw_rt.stats;
+	uint64_t lat = dwunw_now_ns() - start_ns;
+
+	atomic_fetch_add_explicit(ok ? &stats->unwound : &stats->failed, 1,
+				  memory_order_relaxed);
+	atomic_fetch_add_explicit(&stats->latency_ns, lat, memory_order_relaxed);
+	uint64_t max = atomic_load_explicit(&stats->latency_max_ns, memory_order_relaxed);
+	while (lat > max &&
+	       !atomic_compare_exchange_weak_explicit(&stats->latency_max_ns, &max, lat,
+						      memory_order_relaxed,
+						      memory_order_relaxed))
+		;
+}
+
+/* dwunw-added: copy a record into the worker's ring; false when full */
+static bool dwunw_queue_push(struct dwunw_worker *w, const void *data, size_t size)
+{
+	uint32_t head = atomic_load_explicit(&w->head, memory_order_relaxed);
+	uint32_t tail = atomic_load_explicit(&w->tail, memory_order_acquire);
+	if (head - tail == DWUNW_QUEUE_DEPTH ||
+	    size > w->slot_size - sizeof(struct dwunw_slot))
+		return false;
+
+	struct dwunw_slot *slot =
+		(struct dwunw_slot *)(w->slots + (head % DWUNW_QUEUE_DEPTH) * w->slot_size);
+	slot->enqueue_ns = dwunw_now_ns();
+	slot->size = (uint32_t)size;
+	memcpy(slot->data, data, size);
+	atomic_store_explicit(&w->head, head + 1, memory_order_release);
+	sem_post(&w->ready);
+	return true;
+}
+
+static void *dwunw_worker_main(void *arg)
+{
+	struct dwunw_worker *w = arg;
+
+	for (;;) {
+		while (sem_wait(&w->ready) != 0 && errno == EINTR)
+			;
+		uint32_t tail = atomic_load_explicit(&w->tail, memory_order_relaxed);
+		/* the only post without an event is the stop request, and it
+		 * comes after everything already queued */
+		if (tail == atomic_load_explicit(&w->head, memory_order_acquire))
+			break;
+
+		const struct dwunw_slot *slot = (const struct dwunw_slot *)
+			(w->slots + (tail % DWUNW_QUEUE_DEPTH) * w->slot_size);
+		bool ok = dwunw_unwind_event(&w->ctx, &w->stacks, w->index,
+					     (const struct memleak_dwunw_event *)slot->data);
+		dwunw_account(ok, slot->enqueue_ns);
+		atomic_store_explicit(&w->tail, tail + 1, memory_order_release);
+	}
+	return NULL;
+}
+
+/* dwunw-added: ring buffer callback; hands events to a worker, or unwinds
+ * inline when --dwunw-workers=0 */
+static int handle_dwunw_event(void *ctx __attribute__((unused)), void *data, size_t data_sz)
+{
+	size_t size = dwunw_event_size(data, data_sz);
+	if (size == 0)
+		return 0;
+	atomic_fetch_add_explicit(&dwunw_rt.stats.received, 1, memory_order_relaxed);
+
+	const struct memleak_dwunw_event *evt = data;
+	if (dwunw_rt.pool) {
+		/* shard by process: per-process order holds and each worker
+		 * keeps its processes' modules warm in its own cache */
+		struct dwunw_worker *w = &dwunw_rt.pool[evt->tgid % dwunw_rt.workers];
+		if (!dwunw_queue_push(w, data, size))
+			atomic_fetch_add_explicit(&dwunw_rt.stats.dropped, 1,
+						  memory_order_relaxed);
+		return 0;
+	}
+
+	if (!dwunw_rt.ctx_ready)
+		return 0;
+	uint64_t start = dwunw_now_ns();
+	dwunw_account(dwunw_unwind_event(&dwunw_rt.ctx, &dwunw_rt.stacks, 0, evt), start);
 	return 0;
 }
 
-/* dwunw-added: lazy init dwunw context and ring buffer */
+/* dwunw-added: apply CLI reader options to a freshly initialised context */
+static void dwunw_configure_context(struct dwunw_context *ctx)
+{
+	/* a tracer samples the same modules for its whole run, so the up-front
+	 * table compile pays for itself */
+	ctx->module_cache.flags |= DWUNW_MODULE_CACHE_COMPILE_TABLES;
+	/* default reader never stops the target; attach is opt-in */
+	if (dwunw_rt.attach)
+		dwunw_stack_reader_set_mode(&ctx->stack_reader,
+					    DWUNW_STACK_READER_MODE_ATTACH);
+	if (dwunw_rt.stack_window_kib >= 0)
+		dwunw_stack_reader_set_window(&ctx->stack_reader,
+					      (uint32_t)dwunw_rt.stack_window_kib * 1024u);
+}
+
+static void *dwunw_poll_main(void *arg __attribute__((unused)))
+{
+	while (!atomic_load(&dwunw_rt.stop)) {
+		int err = ring_buffer__poll(dwunw_rt.rb, 100);
+		if (err < 0 && err != -EINTR && err != -EAGAIN) {
+			fprintf(stderr, "dwunw ring buffer poll err=%d\n", err);
+			if (dwunw_rt.mode == DWUNW_MODE_FORCE) {
+				exiting = 1;
+				break;
+			}
+		}
+	}
+	return NULL;
+}
+
+/* dwunw-added: shared module store plus one context and queue per worker */
+static int setup_dwunw_pool(void)
+{
+	dwunw_status_t st = dwunw_module_store_init(&dwunw_rt.store);
+	if (st != DWUNW_OK) {
+		fprintf(stderr, "failed to init dwunw module store: %d\n", st);
+		return -1;
+	}
+	dwunw_rt.store_ready = true;
+	dwunw_rt.store.cache.flags |= DWUNW_MODULE_CACHE_COMPILE_TABLES;
+
+	dwunw_rt.pool = calloc((size_t)dwunw_rt.workers, sizeof(*dwunw_rt.pool));
+	if (!dwunw_rt.pool) {
+		perror("calloc");
+		return -1;
+	}
+
+	/* register-only events are small; size slots for the largest record */
+	size_t record = offsetof(struct memleak_dwunw_event, stack) +
+			(size_t)dwunw_rt.stack_snapshot_kib * 1024;
+	size_t slot_size = (sizeof(struct dwunw_slot) + record + 7) & ~(size_t)7;
+	for (long i = 0; i < dwunw_rt.workers; ++i) {
+		struct dwunw_worker *w = &dwunw_rt.pool[i];
+		st = dwunw_init_shared(&w->ctx, &dwunw_rt.store);
+		if (st != DWUNW_OK) {
+			fprintf(stderr, "failed to init dwunw worker context: %d\n", st);
+			return -1;
+		}
+		w->ctx_ready = true;
+		dwunw_configure_context(&w->ctx);
+		dwunw_stack_table_init(&w->stacks, DWUNW_STACK_TABLE_NODES);
+		w->index = (unsigned int)i;
+		if (sem_init(&w->ready, 0, 0) != 0) {
+			perror("sem_init");
+			return -1;
+		}
+		w->slot_size = slot_size;
+		w->slots = malloc(slot_size * DWUNW_QUEUE_DEPTH);
+		if (!w->slots) {
+			sem_destroy(&w->ready);
+			perror("malloc");
+			return -1;
+		}
+	}
+
+	/* SIGINT/SIGTERM must reach the main loop, not a pipeline thread */
+	sigset_t all, old;
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &old);
+	int err = 0;
+	for (long i = 0; i < dwunw_rt.workers && !err; ++i) {
+		err = pthread_create(&dwunw_rt.pool[i].thread, NULL,
+				     dwunw_worker_main, &dwunw_rt.pool[i]);
+		dwunw_rt.pool[i].started = err == 0;
+	}
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (err) {
+		fprintf(stderr, "failed to start dwunw workers: %s\n", strerror(err));
+		return -1;
+	}
+	return 0;
+}
+
+/* dwunw-added: lazy init dwunw contexts, ring buffer and pipeline threads */
 static int setup_dwunw_runtime(struct memleak_dwunw_bpf *skel)
 {
 	if (dwunw_rt.mode == DWUNW_MODE_OFF)
 		return 0;
+	dwunw_rt.skel = skel;
 
-	if (!dwunw_rt.ctx_ready) {
+	if (dwunw_rt.workers > 0) {
+		if (!dwunw_rt.pool && setup_dwunw_pool())
+			return -1;
+	} else if (!dwunw_rt.ctx_ready) {
 		dwunw_status_t st = dwunw_init(&dwunw_rt.ctx);
 		if (st != DWUNW_OK) {
 			fprintf(stderr, "failed to init dwunw context: %d\n", st);
 			return -1;
 		}
 		dwunw_rt.ctx_ready = true;
+		dwunw_configure_context(&dwunw_rt.ctx);
+		dwunw_stack_table_init(&dwunw_rt.stacks, DWUNW_STACK_TABLE_NODES);
 	}
 
 	if (!dwunw_rt.rb) {
@@ -851,26 +1187,69 @@ static int setup_dwunw_runtime(struct memleak_dwunw_bpf *skel)
 		}
 	}
 
+	if (dwunw_rt.pool && !dwunw_rt.poll_started) {
+		sigset_t all, old;
+		sigfillset(&all);
+		pthread_sigmask(SIG_BLOCK, &all, &old);
+		int err = pthread_create(&dwunw_rt.poll_thread, NULL, dwunw_poll_main, NULL);
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+		if (err) {
+			fprintf(stderr, "failed to start dwunw poll thread: %s\n", strerror(err));
+			return -1;
+		}
+		dwunw_rt.poll_started = true;
+	}
+
 	return 0;
 }
 
-/* dwunw-added: release dwunw resources */
+/* dwunw-added: stop the pipeline (draining queued events) and release
+ * dwunw resources */
 static void teardown_dwunw_runtime(void)
 {
+	atomic_store(&dwunw_rt.stop, true);
+	if (dwunw_rt.poll_started) {
+		pthread_join(dwunw_rt.poll_thread, NULL);
+		dwunw_rt.poll_started = false;
+	}
+	if (dwunw_rt.pool) {
+		for (long i = 0; i < dwunw_rt.workers; ++i) {
+			struct dwunw_worker *w = &dwunw_rt.pool[i];
+			if (w->started) {
+				sem_post(&w->ready);
+				pthread_join(w->thread, NULL);
+			}
+			if (w->slots)
+				sem_destroy(&w->ready);
+			free(w->slots);
+			if (w->ctx_ready) {
+				dwunw_stack_table_flush(&w->stacks);
+				dwunw_shutdown(&w->ctx);
+			}
+		}
+		free(dwunw_rt.pool);
+		dwunw_rt.pool = NULL;
+	}
 	if (dwunw_rt.rb) {
 		ring_buffer__free(dwunw_rt.rb);
 		dwunw_rt.rb = NULL;
 	}
 	if (dwunw_rt.ctx_ready) {
+		dwunw_stack_table_flush(&dwunw_rt.stacks);
 		dwunw_shutdown(&dwunw_rt.ctx);
 		dwunw_rt.ctx_ready = false;
 	}
+	if (dwunw_rt.store_ready) {
+		dwunw_module_store_destroy(&dwunw_rt.store);
+		dwunw_rt.store_ready = false;
+	}
 }
 
-/* dwunw-added: poll ring buffer while honoring force mode */
+/* dwunw-added: poll ring buffer while honoring force mode; the poll thread
+ * owns the ring buffer when workers are running */
 static void dwunw_maybe_poll(void)
 {
-	if (!dwunw_rt.rb)
+	if (!dwunw_rt.rb || dwunw_rt.poll_started)
 		return;
 	int err = ring_buffer__poll(dwunw_rt.rb, 10);
 	if (err < 0 && err != -EINTR && err != -EAGAIN) {
@@ -880,6 +1259,97 @@ static void dwunw_maybe_poll(void)
 	}
 }
 
+/* dwunw-added: bucket index -> upper bound in us of the capture latency
+ * histogram (bucket 0 is < 1us, bucket i is [2^(i-1), 2^i) us) */
+static uint64_t dwunw_latency_quantile_us(const struct dwunw_stats *lib, double q)
+{
+	uint64_t total = 0, seen = 0;
+	for (int i = 0; i < DWUNW_STATS_LATENCY_BUCKETS; ++i)
+		total += lib->latency[i];
+	for (int i = 0; i < DWUNW_STATS_LATENCY_BUCKETS; ++i) {
+		seen += lib->latency[i];
+		if (total && seen >= q * total)
+			return 1ull << i;
+	}
+	return 0;
+}
+
+/* dwunw-added: library counters summed over every unwinding context */
+static void dwunw_print_lib_stats(void)
+{
+	struct dwunw_stats lib, one;
+	memset(&lib, 0, sizeof(lib));
+	if (dwunw_rt.ctx_ready && dwunw_stats_snapshot(&dwunw_rt.ctx, &one) == DWUNW_OK)
+		dwunw_stats_merge(&lib, &one);
+	for (long i = 0; dwunw_rt.pool && i < dwunw_rt.workers; ++i) {
+		if (dwunw_rt.pool[i].ctx_ready &&
+		    dwunw_stats_snapshot(&dwunw_rt.pool[i].ctx, &one) == DWUNW_OK)
+			dwunw_stats_merge(&lib, &one);
+	}
+
+	uint64_t modules = lib.module_hits + lib.module_misses;
+	uint64_t steps = lib.table_lookups + lib.fde_lookups;
+	uint64_t rules = lib.rule_hits + lib.rule_misses;
+	printf("[dwunw] captures=%llu frames=%llu module_hit_rate=%.1f%% evictions=%llu "
+	       "fp_steps=%llu rule_hit_rate=%.1f%% table_steps=%.1f%% cfi_ops=%llu mem_reads=%llu mem_kib=%llu syscalls=%llu "
+	       "latency_avg_us=%.1f p50_us<%llu p99_us<%llu\n",
+	       (unsigned long long)lib.captures,
+	       (unsigned long long)lib.frames,
+	       modules ? 100.0 * lib.module_hits / modules : 0.0,
+	       (unsigned long long)lib.module_evictions,
+	       (unsigned long long)lib.fp_steps,
+	       rules ? 100.0 * lib.rule_hits / rules : 0.0,
+	       steps ? 100.0 * lib.table_lookups / steps : 0.0,
+	       (unsigned long long)lib.cfi_ops,
+	       (unsigned long long)lib.mem_reads,
+	       (unsigned long long)(lib.mem_bytes / 1024),
+	       (unsigned long long)lib.syscalls,
+	       lib.captures ? (double)lib.latency_ns / lib.captures / 1000.0 : 0.0,
+	       (unsigned long long)dwunw_latency_quantile_us(&lib, 0.5),
+	       (unsigned long long)dwunw_latency_quantile_us(&lib, 0.99));
+
+	bool failures = false;
+	for (int i = 1; i < DWUNW_STATS_STATUS_SLOTS; ++i) {
+		if (!lib.status[i])
+			continue;
+		printf("%s status%d=%llu", failures ? "" : "[dwunw] failures:", -i,
+		       (unsigned long long)lib.status[i]);
+		failures = true;
+	}
+	if (failures)
+		printf("\n");
+}
+
+/* dwunw-added: cumulative pipeline counters, once per interval */
+static void dwunw_print_stats(void)
+{
+	if (!dwunw_rt.rb)
+		return;
+
+	const struct dwunw_pipeline_stats *stats = &dwunw_rt.stats;
+	uint64_t unwound = atomic_load(&stats->unwound);
+	uint64_t failed = atomic_load(&stats->failed);
+	uint64_t done = unwound + failed;
+	uint64_t queued = 0;
+	for (long i = 0; dwunw_rt.pool && i < dwunw_rt.workers; ++i)
+		queued += (uint32_t)(atomic_load(&dwunw_rt.pool[i].head) -
+				     atomic_load(&dwunw_rt.pool[i].tail));
+
+	printf("[dwunw] events=%llu unwound=%llu failed=%llu stacks=%llu queued=%llu "
+	       "queue_drops=%llu ringbuf_drops=%llu latency_avg_us=%.1f latency_max_us=%.1f\n",
+	       (unsigned long long)atomic_load(&stats->received),
+	       (unsigned long long)unwound,
+	       (unsigned long long)failed,
+	       (unsigned long long)atomic_load(&stats->stacks),
+	       (unsigned long long)queued,
+	       (unsigned long long)atomic_load(&stats->dropped),
+	       (unsigned long long)__atomic_load_n(&dwunw_rt.skel->bss->dwunw_ringbuf_drops,
+						   __ATOMIC_RELAXED),
+	       done ? (double)atomic_load(&stats->latency_ns) / done / 1000.0 : 0.0,
+	       (double)atomic_load(&stats->latency_max_ns) / 1000.0);
+	dwunw_print_lib_stats();
+}
+
 #ifdef USE_BLAZESYM
 void print_stack_frame_by_blazesym(size_t frame, uint64_t addr, const blazesym_csym *sym)
 {
@@ -0,0 +1,100 @@
+// SPDX-License-Identifier: MIT
+#ifndef DWUNW_ADDR_SPACE_H
+#define DWUNW_ADDR_SPACE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "dwunw/config.h"
+#include "dwunw/status.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* One executable, file-backed line of /proc/<pid>/maps. */
+struct dwunw_addr_space_mapping {
+    uint64_t start;       /* runtime [start, end) */
+    uint64_t end;
+    uint64_t offset;      /* file offset mapped at start */
+    uint64_t bias;        /* runtime pc - bias = link-time pc, once known */
+    uint32_t path_offset; /* into dwunw_addr_space.paths */
+    uint8_t bias_state;   /* DWUNW_ADDR_SPACE_BIAS_* */
+};
+
+enum {
+    DWUNW_ADDR_SPACE_BIAS_UNKNOWN = 0,
+    DWUNW_ADDR_SPACE_BIAS_KNOWN   = 1,
+    DWUNW_ADDR_SPACE_BIAS_FAILED  = 2,  /* module unusable, do not retry */
+};
+
+/* Immutable-layout snapshot of a process's code mappings, sorted by start.
+ * Only the per-mapping bias is filled in lazily by the unwinder. */
+struct dwunw_addr_space {
+    pid_t pid;
+    uint64_t generation;  /* bumped every time a snapshot is (re)built */
+    size_t count;
+    struct dwunw_addr_space_mapping *mappings;
+    char *paths;          /* NUL-separated pathnames */
+    size_t paths_size;
+};
+
+/* What tells a reused pid or an exec'd image apart from the process a
+ * snapshot was taken of. */
+struct dwunw_addr_space_identity {
+    uint64_t start_time;  /* /proc/<pid>/stat starttime, clock ticks */
+    uint64_t exe_dev;     /* /proc/<pid>/exe, 0 for kernel threads */
+    uint64_t exe_ino;
+};
+
+struct dwunw_addr_space_slot {
+    struct dwunw_addr_space space;
+    struct dwunw_addr_space_identity identity;
+    uint64_t checked_ns;  /* CLOCK_MONOTONIC time identity was last matched */
+    uint64_t last_use;
+    uint8_t in_use;
+};
+
+/* Per-context pid -> snapshot cache, so /proc/<pid>/maps is parsed once per
+ * process rather than once per event. */
+struct dwunw_addr_space_cache {
+    struct dwunw_addr_space_slot slots[DWUNW_ADDR_SPACE_CACHE_CAPACITY];
+    uint64_t clock;
+    uint64_t generation;
+};
+
+/* Parse /proc/<pid>/maps into a fresh snapshot (generation left at 0). */
+dwunw_status_t dwunw_addr_space_load(pid_t pid, struct dwunw_addr_space *space);
+void dwunw_addr_space_free(struct dwunw_addr_space *space);
+
+struct dwunw_addr_space_mapping *
+dwunw_addr_space_lookup(const struct dwunw_addr_space *space, uint64_t pc);
+
+const char *dwunw_addr_space_path(const struct dwunw_addr_space *space,
+                                  const struct dwunw_addr_space_mapping *mapping);
+
+void dwunw_addr_space_cache_init(struct dwunw_addr_space_cache *cache);
+void dwunw_addr_space_cache_flush(struct dwunw_addr_space_cache *cache);
+
+/* Cached snapshot for pid, loading it on first use. A cached snapshot is
+ * reloaded when the pid no longer names the same process image (checked at
+ * most every DWUNW_ADDR_SPACE_RECHECK_NS). The pointer stays valid until the
+ * next get/refresh/invalidate of that pid or a cache flush. */
+dwunw_status_t dwunw_addr_space_get(struct dwunw_addr_space_cache *cache,
+                                    pid_t pid,
+                                    struct dwunw_addr_space **space_out);
+
+/* Re-read /proc/<pid>/maps (e.g. after dlopen) under a new generation. */
+dwunw_status_t dwunw_addr_space_refresh(struct dwunw_addr_space_cache *cache,
+                                        pid_t pid,
+                                        struct dwunw_addr_space **space_out);
+
+/* Drop the snapshot of pid (exec/exit); the next get() reloads it. */
+void dwunw_addr_space_invalidate(struct dwunw_addr_space_cache *cache, pid_t pid);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DWUNW_ADDR_SPACE_H */
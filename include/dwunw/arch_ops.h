@@ -41,6 +41,10 @@ struct dwunw_arch_ops {
     enum dwunw_arch_id arch;
     const char *name;
     size_t gpr_count;
+    uint16_t elf_machine; /* e_machine of modules built for this arch */
+    uint16_t sp_reg;      /* DWARF register numbers, index into regs[] */
+    uint16_t fp_reg;
+    uint16_t ra_reg;
     dwunw_arch_normalize_fn normalize;
     dwunw_arch_compute_cfa_fn compute_cfa;
     dwunw_arch_read_ra_fn read_return_addr;
@@ -49,6 +53,7 @@ struct dwunw_arch_ops {
 
 const struct dwunw_arch_ops *dwunw_arch_resolve(enum dwunw_arch_id arch);
 const struct dwunw_arch_ops *dwunw_arch_from_regset(const struct dwunw_regset *regset);
+const struct dwunw_arch_ops *dwunw_arch_from_elf_machine(uint16_t machine);
 
 dwunw_status_t dwunw_regset_prepare(struct dwunw_regset *regset,
                                     enum dwunw_arch_id arch_id);
@@ -12,6 +12,17 @@
  */
 #define DWUNW_MAX_ARCH_COUNT 3
 #define DWUNW_MAX_PATH_LEN 512
-#define DWUNW_MODULE_CACHE_CAPACITY 16
+#define DWUNW_MODULE_CACHE_BUDGET (512u * 1024u * 1024u)
+#define DWUNW_MODULE_CACHE_MIN_BUCKETS 16
+#define DWUNW_BUILD_ID_MAX 32
+#define DWUNW_ADDR_SPACE_CACHE_CAPACITY 64
+#define DWUNW_ADDR_SPACE_RECHECK_NS (100u * 1000u * 1000u) /* pid identity */
+#define DWUNW_STACK_READER_MAX_IOV 64
+#define DWUNW_STACK_WINDOW_MIN (16u * 1024u)
+#define DWUNW_STACK_WINDOW_MAX (64u * 1024u)
+#define DWUNW_STACK_WINDOW_DEFAULT (32u * 1024u)
+#define DWUNW_STATS_STATUS_SLOTS 8      /* DWUNW_OK down to DWUNW_ERR_CACHE_FULL */
+#define DWUNW_STATS_LATENCY_BUCKETS 16
+#define DWUNW_RULE_CACHE_SLOTS 256      /* power of two */
 
 #endif /* DWUNW_CONFIG_H */
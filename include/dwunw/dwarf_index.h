@@ -7,13 +7,27 @@
 
 struct dwunw_cie_record;
 struct dwunw_fde_record;
+struct dwunw_cfi_lazy;
+struct dwunw_unwind_table;
+
+enum {
+    /* .eh_frame is served on demand through .eh_frame_hdr */
+    DWUNW_DWARF_INDEX_FLAG_LAZY_EH_FRAME = 1u << 0,
+    /* every FDE has been flattened into the compact row table */
+    DWUNW_DWARF_INDEX_FLAG_COMPILED      = 1u << 1,
+    /* the row table is mapped from the on-disk cache */
+    DWUNW_DWARF_INDEX_FLAG_TABLE_CACHED  = 1u << 2,
+};
 
 struct dwunw_dwarf_index {
     struct dwunw_dwarf_sections sections;
+    struct dwunw_cfi_lazy *lazy;
     struct dwunw_cie_record *cies;
     size_t cie_count;
     struct dwunw_fde_record *fdes;
+    uint64_t *fde_pcs;    /* pc_begin of fdes[i], kept apart for lookups */
     size_t fde_count;
+    struct dwunw_unwind_table *table;  /* compiled rows, NULL until compiled */
     uint32_t flags;
 };
 
@@ -21,4 +35,29 @@ dwunw_status_t dwunw_dwarf_index_init(struct dwunw_dwarf_index *index,
                                       const struct dwunw_elf_handle *handle);
 void dwunw_dwarf_index_reset(struct dwunw_dwarf_index *index);
 
+/* Copy the FDE covering pc into fde_out; DWUNW_ERR_NO_DEBUG_DATA when the
+ * module has no CFI for that address. */
+dwunw_status_t dwunw_dwarf_index_find_fde(const struct dwunw_dwarf_index *index,
+                                          uint64_t pc,
+                                          struct dwunw_fde_record *fde_out);
+
+/* Flatten all CFI of the module into the compact row table used by the
+ * unwinder's fast path. Optional: without it every frame is interpreted. */
+dwunw_status_t dwunw_dwarf_index_compile(struct dwunw_dwarf_index *index,
+                                         const struct dwunw_elf_handle *handle);
+
+/* Like dwunw_dwarf_index_compile(), but first try to map a table stored in
+ * cache_dir under the module's build-id, and persist freshly compiled tables
+ * there for the next process. Modules without a build-id are compiled in
+ * memory only. */
+dwunw_status_t dwunw_dwarf_index_compile_cached(struct dwunw_dwarf_index *index,
+                                                const struct dwunw_elf_handle *handle,
+                                                const char *cache_dir);
+
+/* Only map a table already stored in cache_dir; never decodes the CFI.
+ * DWUNW_ERR_NO_DEBUG_DATA when there is no usable table file. */
+dwunw_status_t dwunw_dwarf_index_load_cached(struct dwunw_dwarf_index *index,
+                                             const struct dwunw_elf_handle *handle,
+                                             const char *cache_dir);
+
 #endif /* DWUNW_DWARF_INDEX_H */
@@ -7,12 +7,14 @@
 struct dwunw_dwarf_section {
     const uint8_t *data;
     size_t size;
+    uint64_t addr;        /* sh_addr, base for pc-relative encodings */
 };
 
 struct dwunw_dwarf_sections {
     struct dwunw_dwarf_section debug_info;
     struct dwunw_dwarf_section debug_frame;
     struct dwunw_dwarf_section eh_frame;
+    struct dwunw_dwarf_section eh_frame_hdr;
 };
 
 #endif /* DWUNW_DWARF_SECTIONS_H */
@@ -4,15 +4,20 @@
 #include <stddef.h>
 #include <stdint.h>
 
+#include "dwunw/addr_space.h"
 #include "dwunw/config.h"
 #include "dwunw/module_cache.h"
+#include "dwunw/module_names.h"
 #include "dwunw/stack_reader.h"
+#include "dwunw/stats.h"
 #include "dwunw/status.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+struct dwunw_rule_cache;
+
 struct dwunw_context {
     uint32_t abi_tag;
     uint32_t reserved;
@@ -20,6 +25,10 @@ struct dwunw_context {
     uint8_t module_cache_ready;
     struct dwunw_stack_reader stack_reader;
     uint8_t stack_reader_ready;
+    struct dwunw_addr_space_cache addr_spaces;
+    struct dwunw_stats stats;  /* read with dwunw_stats_snapshot() */
+    struct dwunw_module_names module_names;  /* ids of compact frames */
+    struct dwunw_rule_cache *rule_cache;     /* resolved rules by PC, or NULL */
 };
 
 static inline uint32_t
@@ -32,6 +41,12 @@ DWUNW_API_VERSION(void)
 
 /* Library lifecycle ------------------------------------------------------- */
 dwunw_status_t dwunw_init(struct dwunw_context *ctx);
+
+/* Lightweight per-thread context whose modules come from a shared store.
+ * Contexts are not thread-safe themselves: use one per worker thread, all
+ * pointing at the same store, which must outlive them. */
+dwunw_status_t dwunw_init_shared(struct dwunw_context *ctx,
+                                 struct dwunw_module_store *store);
 void dwunw_shutdown(struct dwunw_context *ctx);
 
 #ifdef __cplusplus
@@ -8,26 +8,81 @@
 #include "dwunw/dwarf_sections.h"
 #include "dwunw/status.h"
 
+/* Identity of the file behind a handle, independent of the path used to
+ * reach it (symlinks, /proc/<pid>/exe, bind mounts). */
+struct dwunw_file_id {
+    uint64_t dev;
+    uint64_t ino;
+    int64_t mtime_ns;
+    uint64_t size;
+};
+
+/* Sections the loader indexes while opening a module. */
+enum dwunw_elf_section_id {
+    DWUNW_ELF_SECTION_DEBUG_INFO = 0,
+    DWUNW_ELF_SECTION_DEBUG_FRAME,
+    DWUNW_ELF_SECTION_EH_FRAME,
+    DWUNW_ELF_SECTION_EH_FRAME_HDR,
+    DWUNW_ELF_SECTION_BUILD_ID,
+    DWUNW_ELF_SECTION_COUNT
+};
+
+/* Selection masks for dwunw_elf_collect_sections(). */
+#define DWUNW_ELF_WANT(id) (1u << (id))
+#define DWUNW_ELF_WANT_UNWIND (DWUNW_ELF_WANT(DWUNW_ELF_SECTION_DEBUG_FRAME) | \
+                               DWUNW_ELF_WANT(DWUNW_ELF_SECTION_EH_FRAME) | \
+                               DWUNW_ELF_WANT(DWUNW_ELF_SECTION_EH_FRAME_HDR))
+#define DWUNW_ELF_WANT_ALL (DWUNW_ELF_WANT_UNWIND | \
+                            DWUNW_ELF_WANT(DWUNW_ELF_SECTION_DEBUG_INFO))
+
 struct dwunw_elf_handle {
     char path[DWUNW_MAX_PATH_LEN];
     void *image;
     size_t size;
+    uint8_t mapped;       /* image is an mmap() view rather than a heap copy */
     uint8_t elf_class;
     uint8_t elf_data;
+    uint16_t machine;     /* e_machine */
     size_t shoff;
     uint16_t shentsize;
     uint16_t shnum;
     uint16_t shstrndx;
     const uint8_t *shstrtab;
+    size_t shstrtab_size;
+    uint16_t sections[DWUNW_ELF_SECTION_COUNT]; /* header index, 0 = absent */
+    uint8_t build_id[DWUNW_BUILD_ID_MAX]; /* NT_GNU_BUILD_ID payload */
+    uint8_t build_id_len;                 /* 0 when the module has none */
+    struct dwunw_file_id file_id;         /* fstat() of the opened file */
 };
 
 dwunw_status_t dwunw_elf_open(const char *path, struct dwunw_elf_handle *out);
 void dwunw_elf_close(struct dwunw_elf_handle *handle);
 
+/* stat() path (following symlinks) into the identity dwunw_elf_open() would
+ * record, without mapping anything. */
+dwunw_status_t dwunw_elf_file_id(const char *path, struct dwunw_file_id *out);
+
+/* Load bias of a module mapped at map_start from file offset map_offset:
+ * runtime address - bias = link-time virtual address. */
+dwunw_status_t dwunw_elf_load_bias(const struct dwunw_elf_handle *handle,
+                                   uint64_t map_start,
+                                   uint64_t map_offset,
+                                   uint64_t map_size,
+                                   uint64_t *bias_out);
+
 dwunw_status_t dwunw_elf_get_section(const struct dwunw_elf_handle *handle,
                                      const char *name,
                                      struct dwunw_dwarf_section *out);
 
+/* Slice the sections selected by wanted (DWUNW_ELF_WANT_* bits) out of the
+ * image; everything else stays untouched and zeroed in *sections.
+ * DWUNW_ERR_NO_DEBUG_DATA when neither .eh_frame nor .debug_frame was found
+ * among them (.debug_info or .eh_frame_hdr alone cannot unwind anything). */
+dwunw_status_t dwunw_elf_collect_sections(const struct dwunw_elf_handle *handle,
+                                          unsigned wanted,
+                                          struct dwunw_dwarf_sections *sections);
+
+/* dwunw_elf_collect_sections(handle, DWUNW_ELF_WANT_ALL, sections). */
 dwunw_status_t dwunw_elf_collect_dwarf(const struct dwunw_elf_handle *handle,
                                        struct dwunw_dwarf_sections *sections);
 
@@ -1,9 +1,13 @@
 #ifndef DWUNW_MODULE_CACHE_H
 #define DWUNW_MODULE_CACHE_H
 
+#include <pthread.h>
+#include <stddef.h>
+
 #include "dwunw/config.h"
 #include "dwunw/dwarf_index.h"
 #include "dwunw/elf_loader.h"
+#include "dwunw/stats.h"
 #include "dwunw/status.h"
 
 struct dwunw_module_handle {
@@ -18,22 +22,99 @@ enum dwunw_module_slot_state {
     DWUNW_MODULE_SLOT_WARM   = 2,
 };
 
+struct dwunw_module_store;
+struct dwunw_module_cache_entry;
+
+/* Another file found to hold the same module (same build-id), so acquiring
+ * it again resolves to the entry without reopening the file. */
+struct dwunw_module_cache_alias {
+    struct dwunw_file_id id;
+    struct dwunw_module_cache_entry *entry;
+    struct dwunw_module_cache_alias *next;     /* entry's other aliases */
+    struct dwunw_module_cache_alias *id_next;  /* file-id hash chain */
+};
+
 struct dwunw_module_cache_entry {
-    char path[DWUNW_MAX_PATH_LEN];
+    char path[DWUNW_MAX_PATH_LEN];  /* first path the module was opened by */
     struct dwunw_module_handle handle;
+    /* Module borrowed from the cache's store (one store reference held for
+     * as long as the slot is in use); handle is unused then. */
+    struct dwunw_module_handle *shared;
     uint32_t refcnt;
     uint8_t state;
-    uint64_t warm_seq;
+    size_t bytes;         /* image + parsed tables, charged to the budget */
+    struct dwunw_module_cache_entry *id_next;   /* file-id hash chain */
+    struct dwunw_module_cache_entry *bid_next;  /* build-id hash chain */
+    struct dwunw_module_cache_alias *aliases;   /* freed with the entry */
+    struct dwunw_module_cache_entry *lru_prev;  /* warm list, newest first */
+    struct dwunw_module_cache_entry *lru_next;
 };
 
+enum {
+    /* compile each module's CFI into the compact row table on first open;
+     * off by default because it decodes every FDE up front, which only
+     * pays off for long-running samplers */
+    DWUNW_MODULE_CACHE_COMPILE_TABLES = 1u << 0,
+    /* unwind return addresses by following the frame pointer in modules
+     * whose row table found them built to keep one */
+    DWUNW_MODULE_CACHE_FRAME_POINTER = 1u << 1,
+};
+
+/*
+ * Entries are heap-allocated and indexed twice: by file identity for
+ * acquire/release, and by build-id for copies of an already parsed module.
+ * A copy found that way is remembered as an alias in a third table keyed by
+ * its own file identity. All tables share one power-of-two bucket count
+ * that doubles with the entry count. Active entries are never evicted; warm ones sit on an LRU
+ * list and are closed oldest first while the cache holds more than budget
+ * bytes, so the budget bounds what is kept around, not what is in use.
+ */
 struct dwunw_module_cache {
-    struct dwunw_module_cache_entry entries[DWUNW_MODULE_CACHE_CAPACITY];
-    uint64_t warm_clock;
+    struct dwunw_module_cache_entry **id_buckets;
+    struct dwunw_module_cache_entry **bid_buckets;
+    struct dwunw_module_cache_alias **alias_buckets;  /* keyed like id_buckets */
+    size_t bucket_count;  /* 0 until the first module is cached */
+    size_t count;         /* entries in use or warm */
+    size_t bytes;         /* sum of entry->bytes */
+    size_t budget;        /* DWUNW_MODULE_CACHE_BUDGET unless set */
+    struct dwunw_module_cache_entry *lru_head;  /* most recently released */
+    struct dwunw_module_cache_entry *lru_tail;  /* next to evict */
+    uint32_t flags;       /* DWUNW_MODULE_CACHE_* */
+    char table_dir[DWUNW_MAX_PATH_LEN]; /* on-disk row tables, "" = off */
+    struct dwunw_module_store *store;   /* shared backing, not owned */
+    struct dwunw_stats *stats;          /* owning context's counters or NULL */
+    /* Bumped whenever a module is closed, so anything keyed by a handle or
+     * index address can tell a reused allocation from the module it saw. */
+    uint64_t epoch;
+};
+
+/*
+ * Modules parsed once per process and shared by any number of per-thread
+ * caches. A thread's cache only reaches the store on its own misses and
+ * keeps the borrowed module referenced while the slot stays warm, so the
+ * steady-state acquire/release path touches no shared state at all. Parsed
+ * modules are immutable apart from the lock-free CIE memo, so lookups need
+ * no lock either; the mutex only guards the store's tables. A miss maps
+ * and parses its module unlocked and publishes it afterwards, dropping its
+ * copy if another thread published the same module first.
+ */
+struct dwunw_module_store {
+    struct dwunw_module_cache cache;
+    pthread_mutex_t lock;
 };
 
 void dwunw_module_cache_init(struct dwunw_module_cache *cache);
 void dwunw_module_cache_flush(struct dwunw_module_cache *cache);
 
+/* Byte budget for warm modules (image + index + row table). Lowering it
+ * evicts right away; 0 closes every module as soon as it is released. */
+void dwunw_module_cache_set_budget(struct dwunw_module_cache *cache, size_t bytes);
+
+/* Persist compiled row tables under dir, keyed by build-id, and reuse them
+ * across processes. Pass NULL or "" to keep tables in memory only. */
+dwunw_status_t dwunw_module_cache_set_table_dir(struct dwunw_module_cache *cache,
+                                                const char *dir);
+
 dwunw_status_t dwunw_module_cache_acquire(struct dwunw_module_cache *cache,
                                           const char *path,
                                           struct dwunw_module_handle **handle_out);
@@ -41,4 +122,27 @@ dwunw_status_t dwunw_module_cache_acquire(struct dwunw_module_cache *cache,
 dwunw_status_t dwunw_module_cache_release(struct dwunw_module_cache *cache,
                                           struct dwunw_module_handle *handle);
 
+/* Serve cache misses from store instead of opening modules privately. Set
+ * it on an empty cache; the store must outlive the cache. */
+dwunw_status_t dwunw_module_cache_set_store(struct dwunw_module_cache *cache,
+                                            struct dwunw_module_store *store);
+
+/* Like the cache of dwunw_init(), modules only get row tables found in the
+ * table directory; set DWUNW_MODULE_CACHE_COMPILE_TABLES in
+ * store->cache.flags before sharing to compile them on open. */
+dwunw_status_t dwunw_module_store_init(struct dwunw_module_store *store);
+void dwunw_module_store_destroy(struct dwunw_module_store *store);
+
+/* dwunw_module_cache_set_table_dir() for the store: modules the store opens
+ * from then on persist and reuse their row tables under dir. */
+dwunw_status_t dwunw_module_store_set_table_dir(struct dwunw_module_store *store,
+                                                const char *dir);
+
+dwunw_status_t dwunw_module_store_acquire(struct dwunw_module_store *store,
+                                          const char *path,
+                                          struct dwunw_module_handle **handle_out);
+
+dwunw_status_t dwunw_module_store_release(struct dwunw_module_store *store,
+                                          struct dwunw_module_handle *handle);
+
 #endif /* DWUNW_MODULE_CACHE_H */
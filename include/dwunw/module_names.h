@@ -0,0 +1,45 @@
+// SPDX-License-Identifier: MIT
+#ifndef DWUNW_MODULE_NAMES_H
+#define DWUNW_MODULE_NAMES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dwunw/status.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Interned module paths: each distinct path gets a small id, stable for the
+ * lifetime of the table, so frames can name their module in 4 bytes. Id 0
+ * is reserved for "no module" and maps to "". */
+struct dwunw_module_names {
+    char *names;          /* NUL-terminated paths back to back */
+    size_t names_size;
+    size_t names_capacity;
+    uint32_t *offsets;    /* offsets[id - 1] into names */
+    uint32_t count;       /* ids handed out, 0 excluded */
+    uint32_t capacity;
+    uint32_t *buckets;    /* open addressing over ids, 0 = empty slot */
+    uint32_t bucket_count;  /* power of two, 0 until the first intern */
+};
+
+void dwunw_module_names_init(struct dwunw_module_names *names);
+void dwunw_module_names_flush(struct dwunw_module_names *names);
+
+/* Id of path, adding it on first sight. "" always yields 0. */
+dwunw_status_t dwunw_module_names_intern(struct dwunw_module_names *names,
+                                         const char *path,
+                                         uint32_t *id_out);
+
+/* Path of id, or NULL for an id the table never handed out. The string
+ * moves when later interning grows the table; copy it to keep it. */
+const char *dwunw_module_names_lookup(const struct dwunw_module_names *names,
+                                      uint32_t id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DWUNW_MODULE_NAMES_H */
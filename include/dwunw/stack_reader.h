@@ -8,13 +8,27 @@
 #include <sys/types.h>
 
 #include "dwunw/status.h"
+#include "dwunw/unwind.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+enum dwunw_stack_reader_mode {
+    /* Read the live stack with process_vm_readv (falling back to
+     * /proc/<pid>/mem) without stopping the target; needs CAP_SYS_PTRACE or
+     * a ptrace-permitted relationship. Frames may be torn if the thread
+     * keeps running while we read. */
+    DWUNW_STACK_READER_MODE_NONSTOP = 0,
+    /* PTRACE_ATTACH + waitpid per capture: consistent reads, but the thread
+     * is frozen for the whole unwind. Opt-in only. */
+    DWUNW_STACK_READER_MODE_ATTACH  = 1,
+};
+
 struct dwunw_stack_reader {
-    uint32_t reserved;
+    uint32_t mode;        /* dwunw_stack_reader_mode */
+    uint32_t window_size; /* bytes prefetched above SP, 0 disables */
+    uint8_t *window;      /* reused by every session of this reader */
 };
 
 struct dwunw_stack_reader_session {
@@ -23,11 +37,28 @@ struct dwunw_stack_reader_session {
     int mem_fd;
     unsigned int backend;
     bool attached;
+    /* Copy of [window_start, window_start + window_len) taken on the first
+     * read after dwunw_stack_reader_set_sp(); reads inside it never reach
+     * the target. */
+    uint8_t *window;
+    uint32_t window_capacity;
+    uint32_t window_len;
+    uint64_t window_start;
+    bool window_pending;
+    uint32_t syscalls;    /* remote reads issued by this session */
 };
 
 dwunw_status_t dwunw_stack_reader_init(struct dwunw_stack_reader *reader);
 void dwunw_stack_reader_shutdown(struct dwunw_stack_reader *reader);
 
+dwunw_status_t dwunw_stack_reader_set_mode(struct dwunw_stack_reader *reader,
+                                           enum dwunw_stack_reader_mode mode);
+
+/* size == 0 disables prefetching; otherwise it must lie within
+ * [DWUNW_STACK_WINDOW_MIN, DWUNW_STACK_WINDOW_MAX]. */
+dwunw_status_t dwunw_stack_reader_set_window(struct dwunw_stack_reader *reader,
+                                             uint32_t size);
+
 dwunw_status_t dwunw_stack_reader_attach(struct dwunw_stack_reader *reader,
                                          pid_t pid,
                                          pid_t tid,
@@ -35,11 +66,23 @@ dwunw_status_t dwunw_stack_reader_attach(struct dwunw_stack_reader *reader,
 
 void dwunw_stack_reader_detach(struct dwunw_stack_reader_session *session);
 
+/* Anchor the prefetch window at the thread's SP. Nothing is read until the
+ * first dwunw_stack_reader_read/readv, which then copies the whole window
+ * with a single syscall. */
+void dwunw_stack_reader_set_sp(struct dwunw_stack_reader_session *session, uint64_t sp);
+
 dwunw_status_t dwunw_stack_reader_read(struct dwunw_stack_reader_session *session,
                                        uint64_t address,
                                        void *dst,
                                        size_t size);
 
+/* Read every entry of iov; batches of up to DWUNW_STACK_READER_MAX_IOV
+ * entries cost one process_vm_readv() call. Succeeds only when every byte
+ * was read. */
+dwunw_status_t dwunw_stack_reader_readv(struct dwunw_stack_reader_session *session,
+                                        const struct dwunw_read_iov *iov,
+                                        size_t count);
+
 #ifdef __cplusplus
 }
 #endif
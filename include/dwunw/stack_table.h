@@ -0,0 +1,76 @@
+// SPDX-License-Identifier: MIT
+#ifndef DWUNW_STACK_TABLE_H
+#define DWUNW_STACK_TABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dwunw/status.h"
+#include "dwunw/unwind.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* One frame of an interned stack. Nodes form a trie rooted at the
+ * outermost caller, so stacks that share their callers share storage. */
+struct dwunw_stack_node {
+    uint64_t pc;          /* pc, or rel_pc for compact frames */
+    uint32_t module_id;   /* 0 for plain PCs */
+    uint32_t parent;      /* caller's node, 0 above the outermost frame */
+};
+
+/*
+ * Unwound stacks -> dense stack ids, the user-space counterpart of
+ * BPF_MAP_TYPE_STACK_TRACE: aggregators count per id in an array and
+ * memory grows with distinct call paths rather than with events. A stack
+ * id is the node of its innermost frame, so ids are stable for the table's
+ * lifetime and lie in [1, count]. Not thread-safe; give each worker its
+ * own table or lock around it.
+ */
+struct dwunw_stack_table {
+    struct dwunw_stack_node *nodes;  /* nodes[id - 1] */
+    uint32_t count;       /* nodes in use */
+    uint32_t capacity;
+    uint32_t max_nodes;   /* 0 = unlimited */
+    uint32_t stacks;      /* distinct stacks interned so far */
+    uint64_t *ends;       /* bit per node: some stack ends there */
+    uint32_t *buckets;    /* open addressing over node ids, 0 = empty */
+    uint32_t bucket_count;
+};
+
+/* max_nodes bounds the trie (0 = unlimited); interning beyond it fails with
+ * DWUNW_ERR_CACHE_FULL while already known stacks keep resolving. */
+void dwunw_stack_table_init(struct dwunw_stack_table *table, uint32_t max_nodes);
+void dwunw_stack_table_flush(struct dwunw_stack_table *table);
+
+/* Intern count PCs, innermost first as captured. *inserted (optional) tells
+ * whether this is the first time the stack was seen. An empty stack is id 0. */
+dwunw_status_t dwunw_stack_table_intern(struct dwunw_stack_table *table,
+                                        const uint64_t *pcs,
+                                        size_t count,
+                                        uint32_t *id_out,
+                                        bool *inserted);
+
+/* Same, keyed by (module_id, rel_pc): stacks of one binary match across
+ * processes regardless of where it was loaded. */
+dwunw_status_t dwunw_stack_table_intern_compact(struct dwunw_stack_table *table,
+                                                const struct dwunw_compact_frame *frames,
+                                                size_t count,
+                                                uint32_t *id_out,
+                                                bool *inserted);
+
+/* Frames of stack id, innermost first. At most max are written; *depth_out
+ * always receives the full depth. */
+dwunw_status_t dwunw_stack_table_get(const struct dwunw_stack_table *table,
+                                     uint32_t id,
+                                     struct dwunw_stack_node *frames,
+                                     size_t max,
+                                     size_t *depth_out);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DWUNW_STACK_TABLE_H */
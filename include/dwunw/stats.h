@@ -0,0 +1,56 @@
+#ifndef DWUNW_STATS_H
+#define DWUNW_STATS_H
+
+#include <stdint.h>
+
+#include "dwunw/config.h"
+#include "dwunw/status.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Counters of one dwunw_context. Only the thread using the context updates
+ * them (relaxed atomic stores, no locked instructions), so any other thread
+ * may take a dwunw_stats_snapshot() at any time; each counter is read
+ * atomically, the snapshot as a whole is not a consistent cut.
+ *
+ * Every member is a uint64_t so snapshots and merges can treat the block as
+ * an array of counters.
+ */
+struct dwunw_stats {
+    uint64_t captures;          /* dwunw_capture() calls plus batch requests */
+    uint64_t frames;            /* frames written, root frames included */
+    uint64_t status[DWUNW_STATS_STATUS_SLOTS];  /* captures by -status */
+    /* Capture latency: bucket 0 is < 1us, bucket i is [2^(i-1), 2^i) us,
+     * the last one is open-ended. */
+    uint64_t latency[DWUNW_STATS_LATENCY_BUCKETS];
+    uint64_t latency_ns;        /* sum over all captures */
+    uint64_t module_hits;       /* modules served from the context's cache */
+    uint64_t module_misses;     /* opened, parsed or borrowed from the store */
+    uint64_t module_evictions;  /* warm modules dropped over the budget */
+    uint64_t fp_steps;          /* steps that followed the frame pointer */
+    uint64_t rule_hits;         /* steps replayed from the rule cache */
+    uint64_t rule_misses;       /* steps that had to resolve their rules */
+    uint64_t table_lookups;     /* steps resolved by a compiled row */
+    uint64_t fde_lookups;       /* steps that searched the FDE index */
+    uint64_t cfi_ops;           /* CFA opcodes interpreted */
+    uint64_t mem_reads;         /* target-memory reads (iov entries) */
+    uint64_t mem_bytes;         /* bytes those reads asked for */
+    uint64_t syscalls;          /* issued by the built-in stack reader */
+};
+
+struct dwunw_context;
+
+dwunw_status_t dwunw_stats_snapshot(const struct dwunw_context *ctx,
+                                    struct dwunw_stats *out);
+
+/* Add src to dst, e.g. to total the contexts of several worker threads. */
+void dwunw_stats_merge(struct dwunw_stats *dst, const struct dwunw_stats *src);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* DWUNW_STATS_H */
@@ -18,14 +18,73 @@ struct dwunw_frame {
     char module_path[DWUNW_MAX_PATH_LEN];
 };
 
+/* Frame without the inline path: 32 bytes instead of sizeof(struct
+ * dwunw_frame), so deep captures stay cache-resident. The module is an id
+ * into the capturing context's name table, see dwunw_module_name(). */
+struct dwunw_compact_frame {
+    uint64_t pc;
+    uint64_t cfa;
+    uint64_t rel_pc;      /* pc minus the module's load bias (link-time pc) */
+    uint32_t module_id;   /* 0 when pc lies in no known module */
+    uint32_t flags;       /* DWUNW_FRAME_FLAG_* */
+};
+
+/* One element of a vectored target-memory read: size bytes at address in the
+ * target are copied to dst. */
+struct dwunw_read_iov {
+    uint64_t address;
+    void *dst;
+    size_t size;
+};
+
+/* Target memory access used for every stack read of a capture. A reader
+ * fills dst with size bytes from address, or fails with any non-OK status;
+ * DWUNW_ERR_NO_DEBUG_DATA ends the walk cleanly, anything else is returned
+ * from dwunw_capture(). */
+typedef dwunw_status_t (*dwunw_memory_read_fn)(void *ctx,
+                                               uint64_t address,
+                                               void *dst,
+                                               size_t size);
+
+/* Vectored form: all entries are read or the call fails. A frame's saved
+ * registers are requested in one call, so a remote reader can serve them
+ * with a single round trip. */
+typedef dwunw_status_t (*dwunw_memory_readv_fn)(void *ctx,
+                                                const struct dwunw_read_iov *iov,
+                                                size_t count);
+
+/* Copy of the target's stack taken at sample time (e.g. by an eBPF program
+ * with bpf_probe_read_user): size bytes that lived at [base, base + size).
+ * Unwinding from it needs no syscalls and sees one consistent stack. */
+struct dwunw_stack_snapshot {
+    uint64_t base;        /* usually the sampled SP */
+    const void *data;
+    size_t size;
+};
+
 struct dwunw_unwind_request {
+    /* Module the PCs belong to (link-time addresses, no load bias). NULL
+     * with pid > 0 resolves every frame through /proc/<pid>/maps instead,
+     * which handles PIE load bias and shared libraries. */
     const char *module_path;
     const struct dwunw_regset *regs;
+    /* Output, exactly one of the two: full frames with their module path
+     * inline, or compact frames naming the module by id. */
     struct dwunw_frame *frames;
+    struct dwunw_compact_frame *compact_frames;
     size_t max_frames;
     uint32_t options;
     pid_t pid;
     pid_t tid;
+    /* When set, every stack read is served from this snapshot instead of
+     * the live process; pid is then only needed to resolve modules. */
+    const struct dwunw_stack_snapshot *stack;
+    /* Caller-supplied reader (shared memory, core file, ...), taking
+     * precedence over stack and the built-in ptrace reader. read_memory_v
+     * is optional and requires read_memory. */
+    dwunw_memory_read_fn read_memory;
+    dwunw_memory_readv_fn read_memory_v;
+    void *reader_ctx;
 };
 
 enum {
@@ -38,8 +97,36 @@ enum {
 
 struct dwunw_context;
 
+/* Memory readers backed by a dwunw_stack_snapshot passed as ctx. Reads
+ * that leave the snapshot fail with DWUNW_ERR_NO_DEBUG_DATA, which ends the
+ * walk cleanly at the last frame the snapshot can explain. */
+dwunw_status_t dwunw_stack_snapshot_read(void *ctx,
+                                         uint64_t address,
+                                         void *dst,
+                                         size_t size);
+
+dwunw_status_t dwunw_stack_snapshot_readv(void *ctx,
+                                          const struct dwunw_read_iov *iov,
+                                          size_t count);
+
+/* Path behind a dwunw_compact_frame module_id of ctx ("" for id 0), or NULL
+ * for an unknown id. Ids stay valid for the context's lifetime; the string
+ * may move with the next capture on ctx, so copy it if it must outlive that. */
+const char *dwunw_module_name(const struct dwunw_context *ctx, uint32_t module_id);
+
 dwunw_status_t dwunw_capture(struct dwunw_context *ctx,
                              const struct dwunw_unwind_request *request,
                              size_t *frames_written);
 
+/* Capture count independent requests in one call. Requests are processed
+ * grouped by pid/tid/module so module handles and reader sessions are set up
+ * once per group; frames_written[i] and statuses[i] (either may be NULL)
+ * receive the per-request results. Returns DWUNW_OK when every request
+ * succeeded, otherwise the status of the first failing one. */
+dwunw_status_t dwunw_capture_batch(struct dwunw_context *ctx,
+                                   const struct dwunw_unwind_request *requests,
+                                   size_t count,
+                                   size_t *frames_written,
+                                   dwunw_status_t *statuses);
+
 #endif /* DWUNW_UNWIND_H */
@@ -1,3 +1,4 @@
+#include <elf.h>
 #include <stddef.h>
 
 #include "dwunw/arch_ops.h"
@@ -5,6 +6,7 @@
 
 #define ARM64_REG_FP 29u
 #define ARM64_REG_LR 30u
+#define ARM64_REG_SP 31u
 #define ARM64_FRAME_RECORD_SIZE 16u
 
 static int
@@ -94,6 +96,10 @@ dwunw_arch_ops_arm64(void)
         .arch = DWUNW_ARCH_ARM64,
         .name = "arm64",
         .gpr_count = 31,
+        .elf_machine = EM_AARCH64,
+        .sp_reg = ARM64_REG_SP,
+        .fp_reg = ARM64_REG_FP,
+        .ra_reg = ARM64_REG_LR,
         .normalize = arm64_normalize,
         .compute_cfa = arm64_compute_cfa,
         .read_return_addr = arm64_read_return_addr,
@@ -1,8 +1,10 @@
+#include <elf.h>
 #include <stddef.h>
 
 #include "dwunw/arch_ops.h"
 #include "../arch_ops_internal.h"
 
+#define MIPS32_REG_SP 29u
 #define MIPS32_REG_FP 30u
 #define MIPS32_REG_RA 31u
 #define MIPS32_FRAME_RECORD_SIZE 8u
@@ -90,6 +92,10 @@ dwunw_arch_ops_mips32(void)
         .arch = DWUNW_ARCH_MIPS32,
         .name = "mips32",
         .gpr_count = 32,
+        .elf_machine = EM_MIPS,
+        .sp_reg = MIPS32_REG_SP,
+        .fp_reg = MIPS32_REG_FP,
+        .ra_reg = MIPS32_REG_RA,
         .normalize = mips32_normalize,
         .compute_cfa = mips32_compute_cfa,
         .read_return_addr = mips32_read_return_addr,
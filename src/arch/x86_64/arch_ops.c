@@ -1,8 +1,14 @@
+#include <elf.h>
 #include <string.h>
 
 #include "dwunw/arch_ops.h"
 #include "../arch_ops_internal.h"
 
+/* DWARF register numbers from the x86-64 psABI. */
+#define X86_64_REG_FP 6u
+#define X86_64_REG_SP 7u
+#define X86_64_REG_RA 16u
+
 static dwunw_status_t
 x86_64_normalize(struct dwunw_regset *regs)
 {
@@ -58,6 +64,10 @@ dwunw_arch_ops_x86_64(void)
         .arch = DWUNW_ARCH_X86_64,
         .name = "x86_64",
         .gpr_count = 16,
+        .elf_machine = EM_X86_64,
+        .sp_reg = X86_64_REG_SP,
+        .fp_reg = X86_64_REG_FP,
+        .ra_reg = X86_64_REG_RA,
         .normalize = x86_64_normalize,
         .compute_cfa = x86_64_compute_cfa,
         .read_return_addr = x86_64_read_return_addr,
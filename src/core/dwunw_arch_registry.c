@@ -53,3 +53,22 @@ dwunw_arch_from_regset(const struct dwunw_regset *regset)
 
     return dwunw_arch_resolve((enum dwunw_arch_id)regset->arch);
 }
+
+const struct dwunw_arch_ops *
+dwunw_arch_from_elf_machine(uint16_t machine)
+{
+    static const enum dwunw_arch_id ids[] = {
+        DWUNW_ARCH_X86_64,
+        DWUNW_ARCH_ARM64,
+        DWUNW_ARCH_MIPS32,
+    };
+
+    for (size_t i = 0; i < sizeof(ids) / sizeof(ids[0]); ++i) {
+        const struct dwunw_arch_ops *ops = dwunw_arch_resolve(ids[i]);
+        if (ops && ops->elf_machine == machine) {
+            return ops;
+        }
+    }
+
+    return NULL;
+}
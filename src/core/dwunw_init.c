@@ -1,6 +1,7 @@
 #include <string.h>
 
 #include "dwunw/dwunw_api.h"
+#include "dwarf/rule_cache.h"
 
 dwunw_status_t
 dwunw_init(struct dwunw_context *ctx)
@@ -11,7 +12,13 @@ dwunw_init(struct dwunw_context *ctx)
 
     memset(ctx, 0, sizeof(*ctx));
     dwunw_module_cache_init(&ctx->module_cache);
+    ctx->module_cache.flags = DWUNW_MODULE_CACHE_FRAME_POINTER;
+    ctx->module_cache.stats = &ctx->stats;
     ctx->module_cache_ready = 1;
+    dwunw_addr_space_cache_init(&ctx->addr_spaces);
+    dwunw_module_names_init(&ctx->module_names);
+    /* Only an accelerator: without it every step resolves its rules. */
+    ctx->rule_cache = dwunw_rule_cache_create();
 
     if (dwunw_stack_reader_init(&ctx->stack_reader) == DWUNW_OK) {
         ctx->stack_reader_ready = 1;
@@ -19,6 +26,27 @@ dwunw_init(struct dwunw_context *ctx)
     return DWUNW_OK;
 }
 
+dwunw_status_t
+dwunw_init_shared(struct dwunw_context *ctx, struct dwunw_module_store *store)
+{
+    dwunw_status_t status;
+
+    if (!ctx || !store) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    status = dwunw_init(ctx);
+    if (status != DWUNW_OK) {
+        return status;
+    }
+
+    status = dwunw_module_cache_set_store(&ctx->module_cache, store);
+    if (status != DWUNW_OK) {
+        dwunw_shutdown(ctx);
+    }
+    return status;
+}
+
 void
 dwunw_shutdown(struct dwunw_context *ctx)
 {
@@ -31,6 +59,11 @@ dwunw_shutdown(struct dwunw_context *ctx)
         ctx->module_cache_ready = 0;
     }
 
+    dwunw_addr_space_cache_flush(&ctx->addr_spaces);
+    dwunw_module_names_flush(&ctx->module_names);
+    dwunw_rule_cache_destroy(ctx->rule_cache);
+    ctx->rule_cache = NULL;
+
     if (ctx->stack_reader_ready) {
         dwunw_stack_reader_shutdown(&ctx->stack_reader);
         ctx->stack_reader_ready = 0;
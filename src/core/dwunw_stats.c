@@ -0,0 +1,47 @@
+#include <string.h>
+
+#include "dwunw/dwunw_api.h"
+#include "dwunw/stats.h"
+
+#define DWUNW_STATS_COUNTERS (sizeof(struct dwunw_stats) / sizeof(uint64_t))
+
+_Static_assert(sizeof(struct dwunw_stats) % sizeof(uint64_t) == 0,
+               "struct dwunw_stats must only hold uint64_t counters");
+
+dwunw_status_t
+dwunw_stats_snapshot(const struct dwunw_context *ctx, struct dwunw_stats *out)
+{
+    const uint64_t *src;
+    uint64_t *dst;
+    size_t i;
+
+    if (!ctx || !out) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    src = (const uint64_t *)&ctx->stats;
+    dst = (uint64_t *)out;
+    /* Pairs with the single-writer stores in dwunw_stats_add(). */
+    for (i = 0; i < DWUNW_STATS_COUNTERS; ++i) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+    return DWUNW_OK;
+}
+
+void
+dwunw_stats_merge(struct dwunw_stats *dst, const struct dwunw_stats *src)
+{
+    const uint64_t *from;
+    uint64_t *to;
+    size_t i;
+
+    if (!dst || !src) {
+        return;
+    }
+
+    from = (const uint64_t *)src;
+    to = (uint64_t *)dst;
+    for (i = 0; i < DWUNW_STATS_COUNTERS; ++i) {
+        to[i] += from[i];
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef DWUNW_STATS_INTERNAL_H
+#define DWUNW_STATS_INTERNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dwunw/stats.h"
+
+/* Bump a counter of the calling thread's own context.
+ *
+ * Contract: every counter has exactly one writer, the thread currently
+ * using the owning dwunw_context (contexts are not shared between threads;
+ * a shared dwunw_module_store has no stats of its own). The increment is
+ * therefore a relaxed load followed by a relaxed store, not a single
+ * read-modify-write: no update can be lost, no locked instruction lands on
+ * the hot path, and dwunw_stats_snapshot() on another thread still reads
+ * each counter untorn. Two threads adding to one context would lose counts.
+ *
+ * The counters stay plain uint64_t (GCC/Clang __atomic builtins rather
+ * than C11 _Atomic) because struct dwunw_stats is part of the public
+ * header, which is also included from C++. */
+static inline void
+dwunw_stats_add(uint64_t *counter, uint64_t n)
+{
+    __atomic_store_n(counter,
+                     __atomic_load_n(counter, __ATOMIC_RELAXED) + n,
+                     __ATOMIC_RELAXED);
+}
+
+/* Same, for components whose stats pointer is NULL when nobody counts. */
+#define DWUNW_STATS_ADD(stats, field, n) \
+    do { \
+        struct dwunw_stats *dwunw_stats_ = (stats); \
+        if (dwunw_stats_) { \
+            dwunw_stats_add(&dwunw_stats_->field, (n)); \
+        } \
+    } while (0)
+
+#endif /* DWUNW_STATS_INTERNAL_H */
@@ -1,11 +1,13 @@
 #define _POSIX_C_SOURCE 200809L
 #include <limits.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
 
 #include "cfi.h"
+#include "core/stats_internal.h"
 
 #define DW_CFA_OPCODE_MASK      0xc0
 #define DW_CFA_OPERAND_MASK     0x3f
@@ -18,9 +20,9 @@
 #define DW_EH_PE_udata2  0x02
 #define DW_EH_PE_udata4  0x03
 #define DW_EH_PE_udata8  0x04
-#define DW_EH_PE_sdata2  0x05
-#define DW_EH_PE_sdata4  0x06
-#define DW_EH_PE_sdata8  0x07
+#define DW_EH_PE_sdata2  0x0a
+#define DW_EH_PE_sdata4  0x0b
+#define DW_EH_PE_sdata8  0x0c
 #define DW_EH_PE_signed  0x08
 
 #define DW_EH_PE_pcrel   0x10
@@ -30,24 +32,12 @@
 #define DW_EH_PE_aligned 0x50
 
 #define DW_EH_PE_indirect 0x80
+#define DW_EH_PE_omit     0xff
 
-enum rule_kind {
-	RULE_UNDEFINED = 0,
-	RULE_SAME_VALUE,
-	RULE_OFFSET,
-};
-
-struct reg_rule {
-	enum rule_kind kind;
-	int64_t offset;
-};
+#define EH_FRAME_HDR_VERSION 1
 
-/* Tracks the DWARF virtual machine state while replaying CIE/FDE programs. */
-struct cfa_state {
-	uint16_t cfa_reg;
-	int64_t cfa_offset;
-	struct reg_rule regs[DWUNW_REGSET_SLOTS];
-};
+/* FDEs decoded backwards from a lazy miss looking for an enclosing one. */
+#define CFI_LAZY_NEST_DEPTH 4
 
 /* Simple growable arrays keep parsing logic independent from libc extras. */
 struct cie_vector {
@@ -62,16 +52,34 @@ struct fde_vector {
 	size_t capacity;
 };
 
+/* Row sinks observe the rule table every time the location counter moves,
+ * which lets the table compiler snapshot a whole FDE in one pass. */
+struct cfi_row_sink {
+	dwunw_cfi_row_fn fn;
+	void *ctx;
+};
+
+static dwunw_status_t
+execute_cfi(const struct dwunw_cie_record *cie,
+		const uint8_t *program,
+		size_t program_size,
+		uint64_t pc_begin,
+		uint64_t target_pc,
+		struct dwunw_cfa_state *state,
+		const struct dwunw_cfa_state *initial,
+		const struct cfi_row_sink *sink,
+		uint64_t *ops);
+
 /* Establish the DWARF-specified defaults before executing any opcode. */
 static void
-cfa_state_reset(struct cfa_state *state)
+cfa_state_reset(struct dwunw_cfa_state *state)
 {
 	size_t i;
 
 	state->cfa_reg = UINT16_MAX;
 	state->cfa_offset = 0;
 	for (i = 0; i < DWUNW_REGSET_SLOTS; ++i) {
-		state->regs[i].kind = RULE_SAME_VALUE;
+		state->regs[i].kind = DWUNW_CFI_RULE_SAME_VALUE;
 		state->regs[i].offset = 0;
 	}
 }
@@ -133,13 +141,15 @@ fde_vector_append(struct fde_vector *vec, const struct dwunw_fde_record *rec)
 	return DWUNW_OK;
 }
 
+/* CIE offsets are only unique within one section, so the origin flag takes
+ * part in the match when both .eh_frame and .debug_frame are present. */
 static const struct dwunw_cie_record *
-find_cie(const struct cie_vector *vec, uint64_t offset)
+find_cie(const struct cie_vector *vec, uint64_t offset, uint8_t flags)
 {
 	size_t i;
 
 	for (i = 0; i < vec->count; ++i) {
-		if (vec->data[i].offset == offset) {
+		if (vec->data[i].offset == offset && vec->data[i].flags == flags) {
 			return &vec->data[i];
 		}
 	}
@@ -244,17 +254,21 @@ read_fixed_size(const uint8_t **cursor, const uint8_t *end, size_t size, uint64_
 }
 
 /* .eh_frame encodes pointers relative to different bases; this routine
- * normalizes them into absolute addresses understood by the unwinder. */
+ * normalizes them into link-time virtual addresses understood by the
+ * unwinder. pc-relative values are resolved against the section's sh_addr
+ * and data-relative ones against data_base (the .eh_frame_hdr address). */
 static dwunw_status_t
 read_encoded_pointer(uint8_t encoding,
 			 const uint8_t **cursor,
-			 const uint8_t *section_start,
+			 const struct dwunw_dwarf_section *section,
 			 const uint8_t *end,
+			 uint64_t data_base,
 			 uint64_t *value)
 {
 	uint64_t base = 0;
 	uint64_t raw = 0;
 	dwunw_status_t st;
+	const uint8_t *field = *cursor;
 	uint8_t format = encoding & 0x0f;
 	uint8_t application = encoding & 0x70;
 
@@ -276,18 +290,21 @@ read_encoded_pointer(uint8_t encoding,
 	case DW_EH_PE_uleb128:
 		st = read_uleb(cursor, end, &raw);
 		break;
-	case DW_EH_PE_sdata4: {
-		int64_t tmp;
-		st = read_fixed_size(cursor, end, 4, (uint64_t *)&tmp);
-		raw = (uint64_t)tmp;
+	case DW_EH_PE_sdata2: {
+		uint64_t tmp = 0;
+		st = read_fixed_size(cursor, end, 2, &tmp);
+		raw = (uint64_t)(int64_t)(int16_t)tmp;
 		break;
 	}
-	case DW_EH_PE_sdata8: {
-		int64_t tmp;
-		st = read_fixed_size(cursor, end, 8, (uint64_t *)&tmp);
-		raw = (uint64_t)tmp;
+	case DW_EH_PE_sdata4: {
+		uint64_t tmp = 0;
+		st = read_fixed_size(cursor, end, 4, &tmp);
+		raw = (uint64_t)(int64_t)(int32_t)tmp;
 		break;
 	}
+	case DW_EH_PE_sdata8:
+		st = read_fixed_size(cursor, end, 8, &raw);
+		break;
 	default:
 		return DWUNW_ERR_NOT_IMPLEMENTED;
 	}
@@ -301,7 +318,10 @@ read_encoded_pointer(uint8_t encoding,
 		base = 0;
 		break;
 	case DW_EH_PE_pcrel:
-		base = (uint64_t)(section_start + (*cursor - section_start));
+		base = section->addr + (uint64_t)(field - section->data);
+		break;
+	case DW_EH_PE_datarel:
+		base = data_base;
 		break;
 	default:
 		return DWUNW_ERR_NOT_IMPLEMENTED;
@@ -314,19 +334,21 @@ read_encoded_pointer(uint8_t encoding,
 /* A CIE describes shared defaults for a batch of FDEs. Capture only the
  * fields we need later when executing unwind bytecode. */
 static dwunw_status_t
-parse_cie(const struct dwunw_dwarf_section *section,
-	  const uint8_t *entry_start,
-	  const uint8_t *payload,
-	  const uint8_t *entry_end,
-	  bool is_eh,
-	  struct cie_vector *cies)
+decode_cie(const struct dwunw_dwarf_section *section,
+	   const uint8_t *entry_start,
+	   const uint8_t *payload,
+	   const uint8_t *entry_end,
+	   bool is_eh,
+	   struct dwunw_cie_record *out)
 {
 	struct dwunw_cie_record cie;
+	struct dwunw_cfa_state defaults;
 	const char *augmentation;
 	size_t aug_len;
 	dwunw_status_t st;
 
 	memset(&cie, 0, sizeof(cie));
+	cie.flags = is_eh ? DWUNW_CFI_FROM_EH_FRAME : 0;
 	cie.offset = (uint64_t)(entry_start - section->data);
 	cie.ptr_encoding = DW_EH_PE_absptr;
 	cie.address_size = 8;
@@ -404,49 +426,82 @@ parse_cie(const struct dwunw_dwarf_section *section,
 	cie.instructions = payload;
 	cie.instructions_size = (size_t)(entry_end - payload);
 
-	return cie_vector_append(cies, &cie);
+	/* The initial instructions do not depend on any FDE, so replay them
+	 * once here and let every evaluation start from the memoized state. */
+	cfa_state_reset(&defaults);
+	cie.initial = defaults;
+	cie.initial_status = execute_cfi(&cie,
+									 cie.instructions,
+									 cie.instructions_size,
+									 0,
+									 UINT64_MAX,
+									 &cie.initial,
+									 &defaults,
+									 NULL,
+									 NULL);
+
+	*out = cie;
+	return DWUNW_OK;
 }
 
-/* Each FDE covers a PC range; link it back to its parent CIE and cache the
- * decoded instruction stream for later evaluation. */
 static dwunw_status_t
-parse_fde(const struct dwunw_dwarf_section *section,
+parse_cie(const struct dwunw_dwarf_section *section,
 	  const uint8_t *entry_start,
-	  uint32_t cie_pointer,
 	  const uint8_t *payload,
 	  const uint8_t *entry_end,
 	  bool is_eh,
-	  const struct cie_vector *cies,
-	  struct fde_vector *fdes)
+	  struct cie_vector *cies)
 {
-	const struct dwunw_cie_record *cie;
-	struct dwunw_fde_record fde;
-	uint64_t cie_offset;
+	struct dwunw_cie_record cie;
 	dwunw_status_t st;
-	uint8_t default_encoding;
-	const uint8_t *section_start = section->data;
 
-	if (is_eh) {
-		uint64_t field_offset = (uint64_t)(payload - section_start);
-		cie_offset = field_offset - cie_pointer;
-	} else {
-		cie_offset = cie_pointer;
+	st = decode_cie(section, entry_start, payload, entry_end, is_eh, &cie);
+	if (st != DWUNW_OK) {
+		return st;
 	}
 
-	cie = find_cie(cies, cie_offset);
-	if (!cie) {
-		return DWUNW_ERR_BAD_FORMAT;
+	return cie_vector_append(cies, &cie);
+}
+
+/* Offset of the CIE an FDE points at; .eh_frame stores a self-relative
+ * back pointer while .debug_frame stores a section offset. */
+static uint64_t
+fde_cie_offset(const struct dwunw_dwarf_section *section,
+	       const uint8_t *payload,
+	       uint32_t cie_pointer,
+	       bool is_eh)
+{
+	if (is_eh) {
+		return (uint64_t)(payload - section->data) - cie_pointer;
 	}
+	return cie_pointer;
+}
+
+/* Each FDE covers a PC range; link it back to its parent CIE and cache the
+ * decoded instruction stream for later evaluation. */
+static dwunw_status_t
+decode_fde(const struct dwunw_dwarf_section *section,
+	   const uint8_t *entry_start,
+	   const uint8_t *payload,
+	   const uint8_t *entry_end,
+	   const struct dwunw_cie_record *cie,
+	   struct dwunw_fde_record *out)
+{
+	struct dwunw_fde_record fde;
+	dwunw_status_t st;
+	uint8_t default_encoding;
 
 	memset(&fde, 0, sizeof(fde));
 	fde.cie = cie;
-	fde.offset = (uint64_t)(entry_start - section_start);
+	fde.flags = cie->flags;
+	fde.offset = (uint64_t)(entry_start - section->data);
 	default_encoding = cie->ptr_encoding ? cie->ptr_encoding : DW_EH_PE_absptr;
 
 	st = read_encoded_pointer(default_encoding,
 							  &payload,
-							  section_start,
+							  section,
 							  entry_end,
+							  0,
 							  &fde.pc_begin);
 	if (st != DWUNW_OK) {
 		return st;
@@ -454,8 +509,9 @@ parse_fde(const struct dwunw_dwarf_section *section,
 
 	st = read_encoded_pointer(default_encoding & 0x0f,
 							  &payload,
-							  section_start,
+							  section,
 							  entry_end,
+							  0,
 							  &fde.pc_range);
 	if (st != DWUNW_OK) {
 		return st;
@@ -475,14 +531,54 @@ parse_fde(const struct dwunw_dwarf_section *section,
 
 	fde.instructions = payload;
 	fde.instructions_size = (size_t)(entry_end - payload);
+	*out = fde;
+	return DWUNW_OK;
+}
+
+static dwunw_status_t
+parse_fde(const struct dwunw_dwarf_section *section,
+	  const uint8_t *entry_start,
+	  uint32_t cie_pointer,
+	  const uint8_t *payload,
+	  const uint8_t *entry_end,
+	  bool is_eh,
+	  const struct cie_vector *cies,
+	  struct fde_vector *fdes)
+{
+	const struct dwunw_cie_record *cie;
+	struct dwunw_fde_record fde;
+	uint64_t cie_offset;
+	dwunw_status_t st;
+
+	/* payload still points just past the CIE pointer here; step back so the
+	 * .eh_frame back pointer is measured from its own field. */
+	cie_offset = fde_cie_offset(section, payload - 4, cie_pointer, is_eh);
+	cie = find_cie(cies, cie_offset, is_eh ? DWUNW_CFI_FROM_EH_FRAME : 0);
+	if (!cie) {
+		return DWUNW_ERR_BAD_FORMAT;
+	}
+
+	st = decode_fde(section, entry_start, payload, entry_end, cie, &fde);
+	if (st != DWUNW_OK) {
+		return st;
+	}
+
 	return fde_vector_append(fdes, &fde);
 }
 
+enum parse_pass {
+	PARSE_CIES,
+	PARSE_FDES,
+};
+
 /* Walk an entire .debug_frame or .eh_frame section, demultiplexing the mixed
- * stream of CIEs and FDEs into separate tables. */
+ * stream of CIEs and FDEs into separate tables. CIEs are collected in a
+ * first pass so the FDE pass can hold pointers into a vector that no longer
+ * reallocates. */
 static dwunw_status_t
 parse_section(const struct dwunw_dwarf_section *section,
 	  bool is_eh,
+	  enum parse_pass pass,
 	  struct cie_vector *cies,
 	  struct fde_vector *fdes)
 {
@@ -514,6 +610,10 @@ parse_section(const struct dwunw_dwarf_section *section,
 		ptr += 4;
 
 		if ((is_eh && id == 0) || (!is_eh && id == 0xffffffff)) {
+			if (pass != PARSE_CIES) {
+				ptr = entry_end;
+				continue;
+			}
 			dwunw_status_t st = parse_cie(section,
 										  entry_start,
 										  ptr,
@@ -523,7 +623,7 @@ parse_section(const struct dwunw_dwarf_section *section,
 			if (st != DWUNW_OK) {
 				return st;
 			}
-		} else {
+		} else if (pass == PARSE_FDES) {
 			dwunw_status_t st = parse_fde(section,
 										  entry_start,
 										  id,
@@ -543,6 +643,71 @@ parse_section(const struct dwunw_dwarf_section *section,
 	return DWUNW_OK;
 }
 
+/* Order by start PC; identical starts prefer .eh_frame (what the runtime
+ * itself uses) and then section order so the result never depends on the
+ * qsort implementation. */
+static int
+fde_compare(const void *lhs, const void *rhs)
+{
+	const struct dwunw_fde_record *a = lhs;
+	const struct dwunw_fde_record *b = rhs;
+	uint32_t a_eh = a->flags & DWUNW_CFI_FROM_EH_FRAME;
+	uint32_t b_eh = b->flags & DWUNW_CFI_FROM_EH_FRAME;
+
+	if (a->pc_begin != b->pc_begin) {
+		return a->pc_begin < b->pc_begin ? -1 : 1;
+	}
+	if (a_eh != b_eh) {
+		return a_eh ? -1 : 1;
+	}
+	if (a->offset != b->offset) {
+		return a->offset < b->offset ? -1 : 1;
+	}
+	return 0;
+}
+
+/* Sort the FDE table once so lookups can binary search. Empty ranges (left
+ * behind by --gc-sections) are dropped and only the first FDE per start PC
+ * is kept, which makes overlapping .eh_frame/.debug_frame coverage resolve
+ * the same way on every build. FDEs starting inside an earlier one are
+ * flagged DWUNW_CFI_NESTED for fde_lookup(). */
+static void
+sort_fdes(struct fde_vector *fdes)
+{
+	size_t in;
+	size_t out = 0;
+	uint64_t reach = 0;
+
+	if (fdes->count == 0) {
+		return;
+	}
+
+	qsort(fdes->data, fdes->count, sizeof(*fdes->data), fde_compare);
+
+	for (in = 0; in < fdes->count; ++in) {
+		const struct dwunw_fde_record *fde = &fdes->data[in];
+
+		if (fde->pc_range == 0) {
+			continue;
+		}
+		if (out > 0 && fdes->data[out - 1].pc_begin == fde->pc_begin) {
+			continue;
+		}
+		fdes->data[out] = *fde;
+		if (reach > fde->pc_begin) {
+			fdes->data[out].flags |= DWUNW_CFI_NESTED;
+		}
+		if (fde->pc_range > UINT64_MAX - fde->pc_begin) {
+			reach = UINT64_MAX;
+		} else if (fde->pc_begin + fde->pc_range > reach) {
+			reach = fde->pc_begin + fde->pc_range;
+		}
+		out++;
+	}
+
+	fdes->count = out;
+}
+
 dwunw_status_t
 dwunw_cfi_build(const struct dwunw_dwarf_sections *sections,
 				struct dwunw_cie_record **cies_out,
@@ -563,18 +728,21 @@ dwunw_cfi_build(const struct dwunw_dwarf_sections *sections,
 	*fdes_out = NULL;
 	*fde_count = 0;
 
-	st = parse_section(&sections->eh_frame, true, &cies, &fdes);
-	if (st != DWUNW_OK) {
-		dwunw_cfi_free(cies.data, fdes.data);
-		return st;
-	}
+	for (int pass = PARSE_CIES; pass <= PARSE_FDES; ++pass) {
+		st = parse_section(&sections->eh_frame, true, pass, &cies, &fdes);
+		if (st != DWUNW_OK) {
+			dwunw_cfi_free(cies.data, fdes.data);
+			return st;
+		}
 
-	st = parse_section(&sections->debug_frame, false, &cies, &fdes);
-	if (st != DWUNW_OK) {
-		dwunw_cfi_free(cies.data, fdes.data);
-		return st;
+		st = parse_section(&sections->debug_frame, false, pass, &cies, &fdes);
+		if (st != DWUNW_OK) {
+			dwunw_cfi_free(cies.data, fdes.data);
+			return st;
+		}
 	}
 
+	sort_fdes(&fdes);
 	if (fdes.count == 0) {
 		dwunw_cfi_free(cies.data, fdes.data);
 		return DWUNW_ERR_NO_DEBUG_DATA;
@@ -595,25 +763,396 @@ dwunw_cfi_free(struct dwunw_cie_record *cies,
 	free(fdes);
 }
 
+/* Index of the last FDE whose start is <= pc, or count when none is. */
+static size_t
+fde_upper_index(const struct dwunw_fde_record *fdes,
+		const uint64_t *pc_keys,
+		size_t count,
+		uint64_t pc)
+{
+	size_t lo = 0;
+	size_t hi = count;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		uint64_t key = pc_keys ? pc_keys[mid] : fdes[mid].pc_begin;
+
+		if (key <= pc) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo == 0 ? count : lo - 1;
+}
+
+static const struct dwunw_fde_record *
+fde_lookup(const struct dwunw_fde_record *fdes,
+	   const uint64_t *pc_keys,
+	   size_t count,
+	   uint64_t pc)
+{
+	const struct dwunw_fde_record *fde;
+	size_t idx;
+
+	if (!fdes || count == 0) {
+		return NULL;
+	}
+
+	idx = fde_upper_index(fdes, pc_keys, count, pc);
+	if (idx == count) {
+		return NULL;
+	}
+
+	/* Past the end of a nested FDE an enclosing one may still cover pc.
+	 * Everything between that one and idx starts inside it and is flagged,
+	 * so the walk ends at the first unflagged FDE. */
+	for (;;) {
+		fde = &fdes[idx];
+		if (pc - fde->pc_begin < fde->pc_range) {
+			return fde;
+		}
+		if (!(fde->flags & DWUNW_CFI_NESTED) || idx == 0) {
+			return NULL;
+		}
+		idx--;
+	}
+}
+
 const struct dwunw_fde_record *
 dwunw_cfi_find_fde(const struct dwunw_fde_record *fdes,
 				   size_t count,
 				   uint64_t pc)
 {
-	size_t i;
+	return fde_lookup(fdes, NULL, count, pc);
+}
 
-	if (!fdes) {
+const struct dwunw_fde_record *
+dwunw_cfi_find_fde_keyed(const uint64_t *pc_keys,
+						 const struct dwunw_fde_record *fdes,
+						 size_t count,
+						 uint64_t pc)
+{
+	if (!pc_keys) {
 		return NULL;
 	}
 
-	for (i = 0; i < count; ++i) {
-		const struct dwunw_fde_record *fde = &fdes[i];
-		if (pc >= fde->pc_begin && pc < fde->pc_begin + fde->pc_range) {
-			return fde;
+	return fde_lookup(fdes, pc_keys, count, pc);
+}
+
+/* Memoized CIEs live in individually allocated nodes so the pointers handed
+ * out through dwunw_fde_record::cie stay valid for the index lifetime. The
+ * list only ever grows, by publishing a fully decoded node at the head with
+ * a CAS, so threads sharing one index look CIEs up without locking. */
+struct cie_node {
+	struct dwunw_cie_record cie;
+	struct cie_node *next;
+};
+
+struct dwunw_cfi_lazy {
+	struct dwunw_dwarf_section eh_frame;
+	uint64_t hdr_addr;
+	const uint8_t *table;     /* (initial_location, fde) sdata4 pairs */
+	size_t count;
+	_Atomic(struct cie_node *) cies;
+};
+
+dwunw_status_t
+dwunw_cfi_lazy_open(const struct dwunw_dwarf_sections *sections,
+					struct dwunw_cfi_lazy **lazy_out)
+{
+	const struct dwunw_dwarf_section *hdr;
+	const uint8_t *cursor;
+	const uint8_t *end;
+	struct dwunw_cfi_lazy *lazy;
+	uint8_t ptr_enc;
+	uint8_t count_enc;
+	uint8_t table_enc;
+	uint64_t eh_frame_ptr;
+	uint64_t count;
+	dwunw_status_t st;
+
+	if (!sections || !lazy_out) {
+		return DWUNW_ERR_INVALID_ARG;
+	}
+
+	*lazy_out = NULL;
+	hdr = &sections->eh_frame_hdr;
+	if (!hdr->data || hdr->size < 4 || !sections->eh_frame.data) {
+		return DWUNW_ERR_NO_DEBUG_DATA;
+	}
+
+	cursor = hdr->data;
+	end = hdr->data + hdr->size;
+	if (cursor[0] != EH_FRAME_HDR_VERSION) {
+		return DWUNW_ERR_NOT_IMPLEMENTED;
+	}
+	ptr_enc = cursor[1];
+	count_enc = cursor[2];
+	table_enc = cursor[3];
+	cursor += 4;
+
+	/* Only the fixed-width datarel/sdata4 table emitted by binutils, gold
+	 * and lld can be binary searched in place. */
+	if (ptr_enc == DW_EH_PE_omit || count_enc == DW_EH_PE_omit ||
+		table_enc != (DW_EH_PE_datarel | DW_EH_PE_sdata4)) {
+		return DWUNW_ERR_NOT_IMPLEMENTED;
+	}
+
+	st = read_encoded_pointer(ptr_enc, &cursor, hdr, end, hdr->addr, &eh_frame_ptr);
+	if (st != DWUNW_OK) {
+		return st;
+	}
+	st = read_encoded_pointer(count_enc, &cursor, hdr, end, hdr->addr, &count);
+	if (st != DWUNW_OK) {
+		return st;
+	}
+
+	if (eh_frame_ptr != sections->eh_frame.addr ||
+		count > (uint64_t)(end - cursor) / 8) {
+		return DWUNW_ERR_BAD_FORMAT;
+	}
+
+	lazy = calloc(1, sizeof(*lazy));
+	if (!lazy) {
+		return DWUNW_ERR_IO;
+	}
+
+	atomic_init(&lazy->cies, NULL);
+	lazy->eh_frame = sections->eh_frame;
+	lazy->hdr_addr = hdr->addr;
+	lazy->table = cursor;
+	lazy->count = (size_t)count;
+	*lazy_out = lazy;
+	return DWUNW_OK;
+}
+
+void
+dwunw_cfi_lazy_free(struct dwunw_cfi_lazy *lazy)
+{
+	struct cie_node *node;
+
+	if (!lazy) {
+		return;
+	}
+
+	node = atomic_load_explicit(&lazy->cies, memory_order_acquire);
+	while (node) {
+		struct cie_node *next = node->next;
+		free(node);
+		node = next;
+	}
+	free(lazy);
+}
+
+size_t
+dwunw_cfi_lazy_count(const struct dwunw_cfi_lazy *lazy)
+{
+	return lazy ? lazy->count : 0;
+}
+
+static uint64_t
+lazy_table_field(const struct dwunw_cfi_lazy *lazy, size_t index, size_t field)
+{
+	int32_t rel;
+
+	memcpy(&rel, lazy->table + index * 8 + field * 4, sizeof(rel));
+	return lazy->hdr_addr + (uint64_t)(int64_t)rel;
+}
+
+/* Split a length-prefixed .eh_frame entry at the given section offset. */
+static dwunw_status_t
+lazy_entry_at(const struct dwunw_cfi_lazy *lazy,
+			  uint64_t offset,
+			  const uint8_t **entry_start,
+			  const uint8_t **payload,
+			  const uint8_t **entry_end,
+			  uint32_t *id)
+{
+	const struct dwunw_dwarf_section *section = &lazy->eh_frame;
+	uint32_t length;
+
+	if (offset > section->size || section->size - offset < 8) {
+		return DWUNW_ERR_BAD_FORMAT;
+	}
+
+	*entry_start = section->data + offset;
+	length = read_u32(*entry_start);
+	if (length < 4 || length == 0xffffffff ||
+		length > section->size - offset - 4) {
+		return DWUNW_ERR_BAD_FORMAT;
+	}
+
+	*entry_end = *entry_start + 4 + length;
+	*id = read_u32(*entry_start + 4);
+	*payload = *entry_start + 8;
+	return DWUNW_OK;
+}
+
+static dwunw_status_t
+lazy_get_cie(struct dwunw_cfi_lazy *lazy,
+			 uint64_t offset,
+			 const struct dwunw_cie_record **cie_out)
+{
+	const uint8_t *entry_start;
+	const uint8_t *payload;
+	const uint8_t *entry_end;
+	struct cie_node *head;
+	struct cie_node *node;
+	uint32_t id;
+	dwunw_status_t st;
+
+	head = atomic_load_explicit(&lazy->cies, memory_order_acquire);
+	for (node = head; node; node = node->next) {
+		if (node->cie.offset == offset) {
+			*cie_out = &node->cie;
+			return DWUNW_OK;
 		}
 	}
 
-	return NULL;
+	st = lazy_entry_at(lazy, offset, &entry_start, &payload, &entry_end, &id);
+	if (st != DWUNW_OK) {
+		return st;
+	}
+	if (id != 0) {
+		return DWUNW_ERR_BAD_FORMAT;
+	}
+
+	node = calloc(1, sizeof(*node));
+	if (!node) {
+		return DWUNW_ERR_IO;
+	}
+
+	st = decode_cie(&lazy->eh_frame, entry_start, payload, entry_end, true, &node->cie);
+	if (st != DWUNW_OK) {
+		free(node);
+		return st;
+	}
+
+	/* Another thread may have published the same CIE meanwhile; a duplicate
+	 * node is harmless, both decode to the same record. */
+	node->next = head;
+	while (!atomic_compare_exchange_weak_explicit(&lazy->cies,
+												  &node->next,
+												  node,
+												  memory_order_release,
+												  memory_order_acquire)) {
+	}
+	*cie_out = &node->cie;
+	return DWUNW_OK;
+}
+
+static dwunw_status_t
+lazy_decode_fde(struct dwunw_cfi_lazy *lazy,
+				size_t index,
+				struct dwunw_fde_record *fde_out)
+{
+	const struct dwunw_cie_record *cie;
+	const uint8_t *entry_start;
+	const uint8_t *payload;
+	const uint8_t *entry_end;
+	uint64_t fde_addr;
+	uint32_t id;
+	dwunw_status_t st;
+
+	fde_addr = lazy_table_field(lazy, index, 1);
+	if (fde_addr < lazy->eh_frame.addr) {
+		return DWUNW_ERR_BAD_FORMAT;
+	}
+
+	st = lazy_entry_at(lazy,
+					   fde_addr - lazy->eh_frame.addr,
+					   &entry_start,
+					   &payload,
+					   &entry_end,
+					   &id);
+	if (st != DWUNW_OK) {
+		return st;
+	}
+	if (id == 0) {
+		return DWUNW_ERR_BAD_FORMAT;
+	}
+
+	st = lazy_get_cie(lazy,
+					  fde_cie_offset(&lazy->eh_frame, payload - 4, id, true),
+					  &cie);
+	if (st != DWUNW_OK) {
+		return st;
+	}
+
+	return decode_fde(&lazy->eh_frame, entry_start, payload, entry_end, cie, fde_out);
+}
+
+dwunw_status_t
+dwunw_cfi_lazy_find_fde(struct dwunw_cfi_lazy *lazy,
+						uint64_t pc,
+						struct dwunw_fde_record *fde_out)
+{
+	size_t lo = 0;
+	size_t hi;
+	size_t depth;
+	dwunw_status_t st;
+
+	if (!lazy || !fde_out) {
+		return DWUNW_ERR_INVALID_ARG;
+	}
+
+	hi = lazy->count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+
+		if (lazy_table_field(lazy, mid, 0) <= pc) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == 0) {
+		return DWUNW_ERR_NO_DEBUG_DATA;
+	}
+
+	st = lazy_decode_fde(lazy, lo - 1, fde_out);
+	if (st != DWUNW_OK) {
+		return st;
+	}
+
+	/* .eh_frame_hdr only lists start PCs, so an FDE enclosing a nested one
+	 * can only be found by decoding backwards; a few steps cover the
+	 * nesting hand-written code produces. */
+	for (depth = 0; pc - fde_out->pc_begin >= fde_out->pc_range; ++depth) {
+		lo--;
+		if (lo == 0 || depth == CFI_LAZY_NEST_DEPTH ||
+		    lazy_decode_fde(lazy, lo - 1, fde_out) != DWUNW_OK) {
+			return DWUNW_ERR_NO_DEBUG_DATA;
+		}
+	}
+
+	return DWUNW_OK;
+}
+
+dwunw_status_t
+dwunw_cfi_lazy_fde_at(struct dwunw_cfi_lazy *lazy,
+					  size_t index,
+					  struct dwunw_fde_record *fde_out)
+{
+	if (!lazy || !fde_out || index >= lazy->count) {
+		return DWUNW_ERR_INVALID_ARG;
+	}
+
+	return lazy_decode_fde(lazy, index, fde_out);
+}
+
+/* The caller's stack pointer is the CFA; mirror it into the DWARF sp slot so
+ * the next frame can define its CFA relative to that register. */
+void
+dwunw_cfi_sync_sp(struct dwunw_regset *regs)
+{
+	const struct dwunw_arch_ops *ops = dwunw_arch_from_regset(regs);
+
+	if (ops && ops->sp_reg < DWUNW_REGSET_SLOTS) {
+		regs->regs[ops->sp_reg] = regs->sp;
+	}
 }
 
 static uint64_t
@@ -628,27 +1167,50 @@ reg_value(const struct dwunw_regset *regs, uint16_t reg)
 	return 0;
 }
 
-/* Resolve a DW_CFA rule into an actual register value by reading memory
- * relative to the computed CFA. */
-static dwunw_status_t
-apply_rule(enum rule_kind kind,
-	   int64_t offset,
-	   uint64_t cfa,
-	   dwunw_memory_read_fn reader,
-	   void *reader_ctx,
-	   uint64_t *out_value)
+dwunw_status_t
+dwunw_memory_read_batch(const struct dwunw_memory_reader *mem,
+			const struct dwunw_read_iov *iov,
+			size_t count)
 {
 	dwunw_status_t st;
 
-	switch (kind) {
-	case RULE_OFFSET: {
-		uint64_t addr = cfa + offset;
-		st = reader(reader_ctx, addr, out_value, sizeof(*out_value));
-		return st;
+	if (!mem || !mem->read || (count > 0 && !iov)) {
+		return DWUNW_ERR_INVALID_ARG;
 	}
-	default:
-		return DWUNW_ERR_NOT_IMPLEMENTED;
+	if (count == 0) {
+		return DWUNW_OK;
+	}
+	if (mem->stats) {
+		uint64_t bytes = 0;
+
+		for (size_t i = 0; i < count; ++i) {
+			bytes += iov[i].size;
+		}
+		dwunw_stats_add(&mem->stats->mem_reads, count);
+		dwunw_stats_add(&mem->stats->mem_bytes, bytes);
+	}
+	if (mem->readv) {
+		return mem->readv(mem->ctx, iov, count);
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		st = mem->read(mem->ctx, iov[i].address, iov[i].dst, iov[i].size);
+		if (st != DWUNW_OK) {
+			return st;
+		}
+	}
+	return DWUNW_OK;
+}
+
+static dwunw_status_t
+emit_row(const struct cfi_row_sink *sink,
+	 uint64_t pc,
+	 const struct dwunw_cfa_state *state)
+{
+	if (!sink) {
+		return DWUNW_OK;
 	}
+	return sink->fn(sink->ctx, pc, state);
 }
 
 /* Interpret the DWARF call-frame opcodes until we either finish the program
@@ -659,8 +1221,10 @@ execute_cfi(const struct dwunw_cie_record *cie,
 		size_t program_size,
 		uint64_t pc_begin,
 		uint64_t target_pc,
-		struct cfa_state *state,
-		const struct cfa_state *initial)
+		struct dwunw_cfa_state *state,
+		const struct dwunw_cfa_state *initial,
+		const struct cfi_row_sink *sink,
+		uint64_t *ops)
 {
 	const uint8_t *cursor = program;
 	const uint8_t *end = program + program_size;
@@ -669,8 +1233,15 @@ execute_cfi(const struct dwunw_cie_record *cie,
 	while (cursor < end) {
 		uint8_t opcode = *cursor++;
 
+		if (ops) {
+			(*ops)++;
+		}
 		if ((opcode & DW_CFA_OPCODE_MASK) == DW_CFA_ADVANCE_LOC) {
 			uint8_t delta = opcode & DW_CFA_OPERAND_MASK;
+			dwunw_status_t st = emit_row(sink, pc_begin + pc_offset, state);
+			if (st != DWUNW_OK) {
+				return st;
+			}
 			pc_offset += delta * cie->code_align;
 			if (pc_begin + pc_offset > target_pc) {
 				break;
@@ -686,7 +1257,7 @@ execute_cfi(const struct dwunw_cie_record *cie,
 				return st;
 			}
 			if (reg < DWUNW_REGSET_SLOTS) {
-				state->regs[reg].kind = RULE_OFFSET;
+				state->regs[reg].kind = DWUNW_CFI_RULE_OFFSET;
 				state->regs[reg].offset = (int64_t)offset * cie->data_align;
 			}
 			continue;
@@ -712,6 +1283,10 @@ execute_cfi(const struct dwunw_cie_record *cie,
 			if (st != DWUNW_OK) {
 				return st;
 			}
+			st = emit_row(sink, pc_begin + pc_offset, state);
+			if (st != DWUNW_OK) {
+				return st;
+			}
 			pc_offset = loc - pc_begin;
 			if (pc_begin + pc_offset > target_pc) {
 				cursor = end;
@@ -724,6 +1299,10 @@ execute_cfi(const struct dwunw_cie_record *cie,
 			if (st != DWUNW_OK) {
 				return st;
 			}
+			st = emit_row(sink, pc_begin + pc_offset, state);
+			if (st != DWUNW_OK) {
+				return st;
+			}
 			pc_offset += delta * cie->code_align;
 			if (pc_begin + pc_offset > target_pc) {
 				cursor = end;
@@ -736,6 +1315,10 @@ execute_cfi(const struct dwunw_cie_record *cie,
 			if (st != DWUNW_OK) {
 				return st;
 			}
+			st = emit_row(sink, pc_begin + pc_offset, state);
+			if (st != DWUNW_OK) {
+				return st;
+			}
 			pc_offset += delta * cie->code_align;
 			if (pc_begin + pc_offset > target_pc) {
 				cursor = end;
@@ -748,6 +1331,10 @@ execute_cfi(const struct dwunw_cie_record *cie,
 			if (st != DWUNW_OK) {
 				return st;
 			}
+			st = emit_row(sink, pc_begin + pc_offset, state);
+			if (st != DWUNW_OK) {
+				return st;
+			}
 			pc_offset += delta * cie->code_align;
 			if (pc_begin + pc_offset > target_pc) {
 				cursor = end;
@@ -805,7 +1392,7 @@ execute_cfi(const struct dwunw_cie_record *cie,
 				return st;
 			}
 			if (reg < DWUNW_REGSET_SLOTS) {
-				state->regs[reg].kind = RULE_OFFSET;
+				state->regs[reg].kind = DWUNW_CFI_RULE_OFFSET;
 				state->regs[reg].offset = (int64_t)offset * cie->data_align;
 			}
 			break;
@@ -850,25 +1437,53 @@ execute_cfi(const struct dwunw_cie_record *cie,
 		}
 	}
 
-	return DWUNW_OK;
+	return emit_row(sink, pc_begin + pc_offset, state);
 }
 
 dwunw_status_t
-dwunw_cfi_eval(const struct dwunw_fde_record *fde,
-			   uint64_t pc,
-			   struct dwunw_regset *regs,
-			   dwunw_memory_read_fn reader,
-			   void *reader_ctx,
-			   struct dwunw_frame *frame)
+dwunw_cfi_walk_rows(const struct dwunw_fde_record *fde,
+					dwunw_cfi_row_fn fn,
+					void *ctx)
+{
+	struct cfi_row_sink sink = {
+		.fn = fn,
+		.ctx = ctx,
+	};
+	struct dwunw_cfa_state current;
+
+	if (!fde || !fde->cie || !fn) {
+		return DWUNW_ERR_INVALID_ARG;
+	}
+
+	if (fde->cie->initial_status != DWUNW_OK) {
+		return fde->cie->initial_status;
+	}
+
+	current = fde->cie->initial;
+	return execute_cfi(fde->cie,
+					   fde->instructions,
+					   fde->instructions_size,
+					   fde->pc_begin,
+					   UINT64_MAX,
+					   &current,
+					   &fde->cie->initial,
+					   &sink,
+					   NULL);
+}
+
+dwunw_status_t
+dwunw_cfi_resolve(const struct dwunw_fde_record *fde,
+				  uint64_t pc,
+				  const struct dwunw_memory_reader *mem,
+				  struct dwunw_cfi_rules *rules)
 {
     /* Replay the CIE defaults and FDE instructions to recover caller state. */
-	struct cfa_state current;
-	struct cfa_state initial;
+	struct dwunw_cfa_state current;
+	uint64_t ops = 0;
 	dwunw_status_t st;
-	uint64_t cfa_value;
-	uint64_t ra_value;
+	uint8_t return_reg;
 
-	if (!fde || !frame || !regs || !reader) {
+	if (!fde || !rules) {
 		return DWUNW_ERR_INVALID_ARG;
 	}
 
@@ -876,21 +1491,12 @@ dwunw_cfi_eval(const struct dwunw_fde_record *fde,
 		return DWUNW_ERR_INVALID_ARG;
 	}
 
-	cfa_state_reset(&current);
-	initial = current;
-
-	/* Apply CIE defaults */
-	st = execute_cfi(fde->cie,
-					 fde->cie->instructions,
-					 fde->cie->instructions_size,
-					 fde->pc_begin,
-					 UINT64_MAX,
-					 &current,
-					 &initial);
+	/* Start from the CIE defaults computed once in decode_cie(). */
+	st = fde->cie->initial_status;
 	if (st != DWUNW_OK && st != DWUNW_ERR_NOT_IMPLEMENTED) {
 		return st;
 	}
-	initial = current;
+	current = fde->cie->initial;
 
 	/* Apply FDE instructions up to target PC */
 	st = execute_cfi(fde->cie,
@@ -899,7 +1505,12 @@ dwunw_cfi_eval(const struct dwunw_fde_record *fde,
 					 fde->pc_begin,
 					 pc,
 					 &current,
-					 &initial);
+					 &fde->cie->initial,
+					 NULL,
+					 mem && mem->stats ? &ops : NULL);
+	if (mem && mem->stats) {
+		dwunw_stats_add(&mem->stats->cfi_ops, ops);
+	}
 	if (st != DWUNW_OK && st != DWUNW_ERR_NOT_IMPLEMENTED) {
 		return st;
 	}
@@ -908,25 +1519,79 @@ dwunw_cfi_eval(const struct dwunw_fde_record *fde,
 		return DWUNW_ERR_NOT_IMPLEMENTED;
 	}
 
-	cfa_value = reg_value(regs, current.cfa_reg) + current.cfa_offset;
+	return_reg = fde->cie->return_reg;
+	if (return_reg >= DWUNW_REGSET_SLOTS ||
+		(current.regs[return_reg].kind != DWUNW_CFI_RULE_SAME_VALUE &&
+		 current.regs[return_reg].kind != DWUNW_CFI_RULE_OFFSET)) {
+		return DWUNW_ERR_NOT_IMPLEMENTED;
+	}
 
-	switch (current.regs[fde->cie->return_reg].kind) {
-	case RULE_SAME_VALUE:
-		ra_value = regs->regs[fde->cie->return_reg];
-		break;
-	case RULE_OFFSET:
-		st = apply_rule(RULE_OFFSET,
-						current.regs[fde->cie->return_reg].offset,
-						cfa_value,
-						reader,
-						reader_ctx,
-						&ra_value);
-		if (st != DWUNW_OK) {
-			return st;
+	memset(rules, 0, sizeof(*rules));
+	rules->cfa_reg = current.cfa_reg;
+	rules->cfa_offset = current.cfa_offset;
+	rules->return_reg = return_reg;
+
+	for (uint16_t reg = 0; reg < DWUNW_REGSET_SLOTS; ++reg) {
+		switch (current.regs[reg].kind) {
+		case DWUNW_CFI_RULE_SAME_VALUE:
+			break;
+		case DWUNW_CFI_RULE_OFFSET:
+			if (rules->saved_count == DWUNW_CFI_RULES_MAX_SAVED ||
+				current.regs[reg].offset < INT32_MIN ||
+				current.regs[reg].offset > INT32_MAX) {
+				return DWUNW_ERR_NOT_IMPLEMENTED;
+			}
+			rules->saved_reg[rules->saved_count] = (uint8_t)reg;
+			rules->saved_offset[rules->saved_count] =
+				(int32_t)current.regs[reg].offset;
+			rules->saved_count++;
+			break;
+		default:
+			rules->undefined |= UINT32_C(1) << reg;
+			break;
+		}
+	}
+
+	return DWUNW_OK;
+}
+
+dwunw_status_t
+dwunw_cfi_rules_apply(const struct dwunw_cfi_rules *rules,
+					  struct dwunw_regset *regs,
+					  const struct dwunw_memory_reader *mem,
+					  struct dwunw_frame *frame)
+{
+	struct dwunw_read_iov iov[DWUNW_CFI_RULES_MAX_SAVED];
+	uint64_t saved[DWUNW_CFI_RULES_MAX_SAVED];
+	dwunw_status_t st;
+	uint64_t cfa_value;
+	uint64_t ra_value;
+
+	if (!rules || !frame || !regs || !mem || !mem->read) {
+		return DWUNW_ERR_INVALID_ARG;
+	}
+
+	cfa_value = reg_value(regs, rules->cfa_reg) + rules->cfa_offset;
+
+	/* Every register saved on the stack, the return address included, is
+	 * fetched in a single batch: one process_vm_readv() per frame instead
+	 * of one per saved slot. */
+	for (uint8_t i = 0; i < rules->saved_count; ++i) {
+		iov[i].address = cfa_value + rules->saved_offset[i];
+		iov[i].dst = &saved[i];
+		iov[i].size = sizeof(saved[i]);
+	}
+
+	st = dwunw_memory_read_batch(mem, iov, rules->saved_count);
+	if (st != DWUNW_OK) {
+		return st;
+	}
+
+	ra_value = regs->regs[rules->return_reg];
+	for (uint8_t i = 0; i < rules->saved_count; ++i) {
+		if (rules->saved_reg[i] == rules->return_reg) {
+			ra_value = saved[i];
 		}
-		break;
-	default:
-		return DWUNW_ERR_NOT_IMPLEMENTED;
 	}
 
 	frame->pc = ra_value;
@@ -936,32 +1601,39 @@ dwunw_cfi_eval(const struct dwunw_fde_record *fde,
 	frame->flags = 0;
 
 	/* Update register snapshot for caller frame */
-	for (uint16_t reg = 0; reg < DWUNW_REGSET_SLOTS; ++reg) {
-		switch (current.regs[reg].kind) {
-		case RULE_SAME_VALUE:
-			break;
-		case RULE_OFFSET: {
-			uint64_t value;
-			st = apply_rule(current.regs[reg].kind,
-							current.regs[reg].offset,
-							cfa_value,
-							reader,
-							reader_ctx,
-							&value);
-			if (st != DWUNW_OK) {
-				return st;
-			}
-			regs->regs[reg] = value;
-			break;
-		}
-		default:
+	for (uint8_t i = 0; i < rules->saved_count; ++i) {
+		regs->regs[rules->saved_reg[i]] = saved[i];
+	}
+	for (uint32_t lost = rules->undefined, reg = 0; lost; lost >>= 1, ++reg) {
+		if (lost & 1u) {
 			regs->regs[reg] = 0;
-			break;
 		}
 	}
 
 	regs->pc = ra_value;
 	regs->sp = cfa_value;
+	dwunw_cfi_sync_sp(regs);
 
 	return DWUNW_OK;
 }
+
+dwunw_status_t
+dwunw_cfi_eval(const struct dwunw_fde_record *fde,
+			   uint64_t pc,
+			   struct dwunw_regset *regs,
+			   const struct dwunw_memory_reader *mem,
+			   struct dwunw_frame *frame)
+{
+	struct dwunw_cfi_rules rules;
+	dwunw_status_t st;
+
+	if (!fde || !frame || !regs || !mem || !mem->read) {
+		return DWUNW_ERR_INVALID_ARG;
+	}
+
+	st = dwunw_cfi_resolve(fde, pc, mem, &rules);
+	if (st != DWUNW_OK) {
+		return st;
+	}
+	return dwunw_cfi_rules_apply(&rules, regs, mem, frame);
+}
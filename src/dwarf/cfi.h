@@ -5,15 +5,51 @@
 
 #include "dwunw/dwarf_sections.h"
 #include "dwunw/elf_loader.h"
+#include "dwunw/stats.h"
 #include "dwunw/status.h"
 #include "dwunw/unwind.h"
 
-typedef dwunw_status_t (*dwunw_memory_read_fn)(void *ctx,
-                                               uint64_t address,
-                                               void *dst,
-                                               size_t size);
+/* Reader callbacks (declared in dwunw/unwind.h) bundled for the evaluator. */
+struct dwunw_memory_reader {
+    dwunw_memory_read_fn read;     /* required */
+    dwunw_memory_readv_fn readv;   /* optional, preferred for batches */
+    void *ctx;
+    struct dwunw_stats *stats;     /* optional, counts reads and CFA opcodes */
+};
+
+/* Issue iov through readv when present, else one read per entry. */
+dwunw_status_t
+dwunw_memory_read_batch(const struct dwunw_memory_reader *mem,
+                        const struct dwunw_read_iov *iov,
+                        size_t count);
+
+enum {
+    DWUNW_CFI_FROM_EH_FRAME = 1u << 0,
+    /* starts inside an earlier FDE of the sorted table, so pcs past its
+     * end may still belong to that one */
+    DWUNW_CFI_NESTED        = 1u << 1,
+};
+
+enum dwunw_cfi_rule_kind {
+    DWUNW_CFI_RULE_UNDEFINED = 0,
+    DWUNW_CFI_RULE_SAME_VALUE,
+    DWUNW_CFI_RULE_OFFSET,
+};
+
+struct dwunw_cfi_reg_rule {
+    enum dwunw_cfi_rule_kind kind;
+    int64_t offset;
+};
+
+/* Tracks the DWARF virtual machine state while replaying CIE/FDE programs. */
+struct dwunw_cfa_state {
+    uint16_t cfa_reg;
+    int64_t cfa_offset;
+    struct dwunw_cfi_reg_rule regs[DWUNW_REGSET_SLOTS];
+};
 
 struct dwunw_cie_record {
+    uint8_t flags;        /* DWUNW_CFI_FROM_* */
     uint8_t version;
     uint8_t address_size;
     uint8_t return_reg;
@@ -25,10 +61,14 @@ struct dwunw_cie_record {
     size_t augmentation_len;
     const uint8_t *instructions;
     size_t instructions_size;
+    /* Rule table after the initial instructions, shared by all its FDEs. */
+    struct dwunw_cfa_state initial;
+    dwunw_status_t initial_status;
 };
 
 struct dwunw_fde_record {
     const struct dwunw_cie_record *cie;
+    uint32_t flags;       /* DWUNW_CFI_FROM_* */
     uint64_t offset;
     uint64_t pc_begin;
     uint64_t pc_range;
@@ -47,15 +87,99 @@ void
 dwunw_cfi_free(struct dwunw_cie_record *cies,
                struct dwunw_fde_record *fdes);
 
+/* Both lookups expect the table produced by dwunw_cfi_build(): sorted by
+ * pc_begin with duplicate starts removed and nested FDEs flagged. Of the
+ * FDEs covering pc, the one with the greatest pc_begin wins, so an inner
+ * FDE shadows its enclosing one only over its own range. */
 const struct dwunw_fde_record *
 dwunw_cfi_find_fde(const struct dwunw_fde_record *fdes,
                    size_t count,
                    uint64_t pc);
 
+/* Same lookup over a compact parallel array of pc_begin keys, so the binary
+ * search touches 8 bytes per probe instead of a whole record. */
+const struct dwunw_fde_record *
+dwunw_cfi_find_fde_keyed(const uint64_t *pc_keys,
+                         const struct dwunw_fde_record *fdes,
+                         size_t count,
+                         uint64_t pc);
+
+/* Lazy .eh_frame access through the .eh_frame_hdr binary search table:
+ * opening is O(1) and FDEs (plus their CIEs, memoized) are only decoded for
+ * the PCs that are actually looked up. */
+struct dwunw_cfi_lazy;
+
+dwunw_status_t
+dwunw_cfi_lazy_open(const struct dwunw_dwarf_sections *sections,
+                    struct dwunw_cfi_lazy **lazy_out);
+
+void
+dwunw_cfi_lazy_free(struct dwunw_cfi_lazy *lazy);
+
+size_t
+dwunw_cfi_lazy_count(const struct dwunw_cfi_lazy *lazy);
+
+dwunw_status_t
+dwunw_cfi_lazy_find_fde(struct dwunw_cfi_lazy *lazy,
+                        uint64_t pc,
+                        struct dwunw_fde_record *fde_out);
+
+/* Decode the index-th FDE of the search table (sorted by pc_begin). */
+dwunw_status_t
+dwunw_cfi_lazy_fde_at(struct dwunw_cfi_lazy *lazy,
+                      size_t index,
+                      struct dwunw_fde_record *fde_out);
+
+/* Replay an FDE program once, reporting the rule table that becomes active
+ * at each location. Rows are reported in increasing PC order and may repeat
+ * a PC or run past the FDE range; callers clip and merge. */
+typedef dwunw_status_t (*dwunw_cfi_row_fn)(void *ctx,
+                                           uint64_t pc,
+                                           const struct dwunw_cfa_state *state);
+
+dwunw_status_t
+dwunw_cfi_walk_rows(const struct dwunw_fde_record *fde,
+                    dwunw_cfi_row_fn fn,
+                    void *ctx);
+
+void
+dwunw_cfi_sync_sp(struct dwunw_regset *regs);
+
+#define DWUNW_CFI_RULES_MAX_SAVED 20
+
+/* Everything needed to restore the caller at one PC, flattened out of the
+ * CFA state so it can be cached and replayed without the FDE. */
+struct dwunw_cfi_rules {
+    int64_t cfa_offset;
+    uint16_t cfa_reg;
+    uint8_t return_reg;
+    uint8_t saved_count;
+    uint32_t undefined;   /* bit per register the caller does not get back */
+    uint8_t saved_reg[DWUNW_CFI_RULES_MAX_SAVED];
+    int32_t saved_offset[DWUNW_CFI_RULES_MAX_SAVED];  /* from the CFA */
+};
+
+/* Replay the FDE up to pc and flatten the result. DWUNW_ERR_NOT_IMPLEMENTED
+ * for rule sets the evaluator cannot restore (no CFA, unsupported return
+ * address rule, more saved registers than fit). */
+dwunw_status_t
+dwunw_cfi_resolve(const struct dwunw_fde_record *fde,
+                  uint64_t pc,
+                  const struct dwunw_memory_reader *mem,
+                  struct dwunw_cfi_rules *rules);
+
+/* Restore the caller of the frame described by regs: one batched read for
+ * every saved register, then the same register/frame updates as
+ * dwunw_cfi_eval(). */
+dwunw_status_t
+dwunw_cfi_rules_apply(const struct dwunw_cfi_rules *rules,
+                      struct dwunw_regset *regs,
+                      const struct dwunw_memory_reader *mem,
+                      struct dwunw_frame *frame);
+
 dwunw_status_t
 dwunw_cfi_eval(const struct dwunw_fde_record *fde,
                uint64_t pc,
                struct dwunw_regset *regs,
-               dwunw_memory_read_fn reader,
-               void *reader_ctx,
+               const struct dwunw_memory_reader *mem,
                struct dwunw_frame *frame);
\ No newline at end of file
@@ -1,8 +1,11 @@
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "dwunw/dwarf_index.h"
 
 #include "cfi.h"
+#include "unwind_table.h"
 
 /* Tear down any cached CIE/FDE tables before reusing the index. */
 void
@@ -15,14 +18,21 @@ dwunw_dwarf_index_reset(struct dwunw_dwarf_index *index)
     if (index->cies || index->fdes) {
         dwunw_cfi_free(index->cies, index->fdes);
     }
+    free(index->fde_pcs);
+    dwunw_cfi_lazy_free(index->lazy);
+    dwunw_unwind_table_free(index->table);
     memset(index, 0, sizeof(*index));
 }
 
-/* Harvest the DWARF sections and pre-parse their call-frame tables. */
+/* Harvest the DWARF sections and prepare their call-frame tables. When the
+ * module ships a usable .eh_frame_hdr, .eh_frame is left untouched and FDEs
+ * are decoded on demand; only .debug_frame (which has no search table) is
+ * pre-parsed. */
 dwunw_status_t
 dwunw_dwarf_index_init(struct dwunw_dwarf_index *index,
                       const struct dwunw_elf_handle *handle)
 {
+    struct dwunw_dwarf_sections eager;
     dwunw_status_t status;
 
     if (!index || !handle) {
@@ -31,15 +41,31 @@ dwunw_dwarf_index_init(struct dwunw_dwarf_index *index,
 
     dwunw_dwarf_index_reset(index);
 
-    /* Snapshot the raw section slices we care about (.debug_* + .eh_frame). */
-    status = dwunw_elf_collect_dwarf(handle, &index->sections);
+    /* Snapshot only the call-frame sections; .debug_info is not needed to
+     * unwind, so stripped modules with just .eh_frame index fine. */
+    status = dwunw_elf_collect_sections(handle, DWUNW_ELF_WANT_UNWIND, &index->sections);
     if (status != DWUNW_OK) {
         return status;
     }
 
+    eager = index->sections;
+    status = dwunw_cfi_lazy_open(&index->sections, &index->lazy);
+    if (status == DWUNW_OK) {
+        memset(&eager.eh_frame, 0, sizeof(eager.eh_frame));
+    } else {
+        switch (status) {
+        case DWUNW_ERR_NO_DEBUG_DATA:
+        case DWUNW_ERR_NOT_IMPLEMENTED:
+        case DWUNW_ERR_BAD_FORMAT:
+            break;
+        default:
+            return status;
+        }
+    }
+
     /* Build the lightweight arrays of CIE/FDE records so future lookups can
      * reuse the decoded metadata instead of reparsing the sections. */
-    status = dwunw_cfi_build(&index->sections,
+    status = dwunw_cfi_build(&eager,
                              &index->cies,
                              &index->cie_count,
                              &index->fdes,
@@ -56,6 +82,167 @@ dwunw_dwarf_index_init(struct dwunw_dwarf_index *index,
         }
     }
 
-    index->flags = 0;
+    /* dwunw_cfi_build() hands back a sorted table; mirror its start PCs into
+     * a dense key array so lookups binary search over a few cache lines. */
+    if (index->fde_count > 0) {
+        size_t i;
+
+        index->fde_pcs = malloc(index->fde_count * sizeof(*index->fde_pcs));
+        if (!index->fde_pcs) {
+            dwunw_dwarf_index_reset(index);
+            return DWUNW_ERR_IO;
+        }
+        for (i = 0; i < index->fde_count; ++i) {
+            index->fde_pcs[i] = index->fdes[i].pc_begin;
+        }
+    }
+
+    index->flags = index->lazy ? DWUNW_DWARF_INDEX_FLAG_LAZY_EH_FRAME : 0;
+    return DWUNW_OK;
+}
+
+dwunw_status_t
+dwunw_dwarf_index_find_fde(const struct dwunw_dwarf_index *index,
+                           uint64_t pc,
+                           struct dwunw_fde_record *fde_out)
+{
+    const struct dwunw_fde_record *fde;
+    dwunw_status_t status;
+
+    if (!index || !fde_out) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    if (index->lazy) {
+        status = dwunw_cfi_lazy_find_fde(index->lazy, pc, fde_out);
+        if (status != DWUNW_ERR_NO_DEBUG_DATA) {
+            return status;
+        }
+    }
+
+    fde = dwunw_cfi_find_fde_keyed(index->fde_pcs,
+                                   index->fdes,
+                                   index->fde_count,
+                                   pc);
+    if (!fde) {
+        return DWUNW_ERR_NO_DEBUG_DATA;
+    }
+
+    *fde_out = *fde;
+    return DWUNW_OK;
+}
+
+dwunw_status_t
+dwunw_dwarf_index_compile(struct dwunw_dwarf_index *index,
+                          const struct dwunw_elf_handle *handle)
+{
+    dwunw_status_t status;
+
+    if (!index || !handle) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    if (index->table) {
+        return DWUNW_OK;
+    }
+
+    status = dwunw_unwind_table_build(index, handle->machine, &index->table);
+    if (status != DWUNW_OK) {
+        return status;
+    }
+
+    index->flags |= DWUNW_DWARF_INDEX_FLAG_COMPILED;
+    return DWUNW_OK;
+}
+
+/* <cache_dir>/<hex build-id>.dwunw-table */
+static dwunw_status_t
+table_cache_path(const struct dwunw_elf_handle *handle,
+                 const char *cache_dir,
+                 char *path,
+                 size_t path_size)
+{
+    char hex[DWUNW_BUILD_ID_MAX * 2 + 1];
+    size_t i;
+    int len;
+
+    for (i = 0; i < handle->build_id_len; ++i) {
+        snprintf(&hex[i * 2], 3, "%02x", handle->build_id[i]);
+    }
+    hex[handle->build_id_len * 2] = '\0';
+
+    len = snprintf(path, path_size, "%s/%s.dwunw-table", cache_dir, hex);
+    if (len < 0 || (size_t)len >= path_size) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    return DWUNW_OK;
+}
+
+dwunw_status_t
+dwunw_dwarf_index_load_cached(struct dwunw_dwarf_index *index,
+                              const struct dwunw_elf_handle *handle,
+                              const char *cache_dir)
+{
+    char path[DWUNW_MAX_PATH_LEN];
+
+    if (!index || !handle) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    if (index->table) {
+        return DWUNW_OK;
+    }
+    if (!cache_dir || cache_dir[0] == '\0' || handle->build_id_len == 0 ||
+        table_cache_path(handle, cache_dir, path, sizeof(path)) != DWUNW_OK) {
+        return DWUNW_ERR_NO_DEBUG_DATA;
+    }
+
+    if (dwunw_unwind_table_load(path,
+                                handle->machine,
+                                handle->build_id,
+                                handle->build_id_len,
+                                &index->table) != DWUNW_OK) {
+        return DWUNW_ERR_NO_DEBUG_DATA;
+    }
+
+    index->flags |= DWUNW_DWARF_INDEX_FLAG_COMPILED |
+                    DWUNW_DWARF_INDEX_FLAG_TABLE_CACHED;
+    return DWUNW_OK;
+}
+
+dwunw_status_t
+dwunw_dwarf_index_compile_cached(struct dwunw_dwarf_index *index,
+                                 const struct dwunw_elf_handle *handle,
+                                 const char *cache_dir)
+{
+    char path[DWUNW_MAX_PATH_LEN];
+    dwunw_status_t status;
+
+    if (!index || !handle) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    if (index->table || !cache_dir || cache_dir[0] == '\0' ||
+        handle->build_id_len == 0 ||
+        table_cache_path(handle, cache_dir, path, sizeof(path)) != DWUNW_OK) {
+        return dwunw_dwarf_index_compile(index, handle);
+    }
+
+    if (dwunw_dwarf_index_load_cached(index, handle, cache_dir) == DWUNW_OK) {
+        return DWUNW_OK;
+    }
+
+    status = dwunw_dwarf_index_compile(index, handle);
+    if (status != DWUNW_OK) {
+        return status;
+    }
+
+    /* Best effort: a read-only or full cache directory only costs the next
+     * process a recompile. */
+    (void)dwunw_unwind_table_store(index->table,
+                                   path,
+                                   handle->build_id,
+                                   handle->build_id_len);
     return DWUNW_OK;
 }
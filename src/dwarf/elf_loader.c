@@ -2,19 +2,44 @@
 #include <elf.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "dwunw/elf_loader.h"
 
-/* Pull the entire ELF image into memory so later section slices are
- * O(1) pointer math instead of repeat syscalls. */
+/* Map the ELF image read-only so section slices stay O(1) pointer math
+ * while only the pages we actually parse get faulted in. Identical binaries
+ * opened by several contexts share the page cache instead of heap copies. */
+static dwunw_status_t
+dwunw_elf_map_image(struct dwunw_elf_handle *handle, int fd, size_t size)
+{
+    void *image;
+
+    image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (image == MAP_FAILED) {
+        return DWUNW_ERR_IO;
+    }
+
+    /* Section access is sparse (headers, then a few CFI sections), so
+     * disable the kernel's sequential readahead for the whole mapping. */
+    (void)posix_madvise(image, size, POSIX_MADV_RANDOM);
+
+    handle->image = image;
+    handle->size = size;
+    handle->mapped = 1;
+    return DWUNW_OK;
+}
+
+/* Fallback for files that cannot be mapped (e.g. some pseudo filesystems):
+ * pull the entire image into a heap buffer. */
 static dwunw_status_t
 dwunw_elf_load_image(struct dwunw_elf_handle *handle, int fd, size_t size)
 {
@@ -33,6 +58,7 @@ dwunw_elf_load_image(struct dwunw_elf_handle *handle, int fd, size_t size)
     }
 
     handle->size = size;
+    handle->mapped = 0;
     return DWUNW_OK;
 }
 
@@ -62,6 +88,7 @@ dwunw_elf_parse_headers(struct dwunw_elf_handle *handle)
             return DWUNW_ERR_BAD_FORMAT;
         }
         const Elf64_Ehdr *eh = (const Elf64_Ehdr *)image;
+        handle->machine = eh->e_machine;
         handle->shoff = eh->e_shoff;
         handle->shentsize = eh->e_shentsize;
         handle->shnum = eh->e_shnum;
@@ -71,6 +98,7 @@ dwunw_elf_parse_headers(struct dwunw_elf_handle *handle)
             return DWUNW_ERR_BAD_FORMAT;
         }
         const Elf32_Ehdr *eh = (const Elf32_Ehdr *)image;
+        handle->machine = eh->e_machine;
         handle->shoff = eh->e_shoff;
         handle->shentsize = eh->e_shentsize;
         handle->shnum = eh->e_shnum;
@@ -120,17 +148,167 @@ dwunw_elf_locate_shstrtab(struct dwunw_elf_handle *handle)
             return DWUNW_ERR_BAD_FORMAT;
         }
         handle->shstrtab = (const uint8_t *)handle->image + hdr->sh_offset;
+        handle->shstrtab_size = (size_t)hdr->sh_size;
     } else {
         const Elf32_Shdr *hdr = (const Elf32_Shdr *)sh;
         if ((uint64_t)hdr->sh_offset + hdr->sh_size > handle->size) {
             return DWUNW_ERR_BAD_FORMAT;
         }
         handle->shstrtab = (const uint8_t *)handle->image + hdr->sh_offset;
+        handle->shstrtab_size = (size_t)hdr->sh_size;
     }
 
     return DWUNW_OK;
 }
 
+/* Name of a section header, or NULL when sh_name does not point at a
+ * NUL-terminated string inside .shstrtab. */
+static const char *
+dwunw_elf_section_name(const struct dwunw_elf_handle *handle, const uint8_t *sh)
+{
+    uint32_t name;
+
+    if (handle->elf_class == ELFCLASS64) {
+        name = ((const Elf64_Shdr *)sh)->sh_name;
+    } else {
+        name = ((const Elf32_Shdr *)sh)->sh_name;
+    }
+
+    if (name >= handle->shstrtab_size ||
+        !memchr(handle->shstrtab + name, '\0', handle->shstrtab_size - name)) {
+        return NULL;
+    }
+
+    return (const char *)handle->shstrtab + name;
+}
+
+static const char *const dwunw_elf_section_names[DWUNW_ELF_SECTION_COUNT] = {
+    [DWUNW_ELF_SECTION_DEBUG_INFO] = ".debug_info",
+    [DWUNW_ELF_SECTION_DEBUG_FRAME] = ".debug_frame",
+    [DWUNW_ELF_SECTION_EH_FRAME] = ".eh_frame",
+    [DWUNW_ELF_SECTION_EH_FRAME_HDR] = ".eh_frame_hdr",
+    [DWUNW_ELF_SECTION_BUILD_ID] = ".note.gnu.build-id",
+};
+
+static int
+dwunw_elf_section_id(const char *name)
+{
+    int id;
+
+    for (id = 0; id < DWUNW_ELF_SECTION_COUNT; ++id) {
+        if (strcmp(name, dwunw_elf_section_names[id]) == 0) {
+            return id;
+        }
+    }
+
+    return -1;
+}
+
+/* Walk the section header table once and remember where the sections we
+ * care about live, so later lookups skip the name comparisons. SHT_NOBITS
+ * placeholders (e.g. in --only-keep-debug files) have no bytes to slice and
+ * count as absent. */
+static void
+dwunw_elf_index_sections(struct dwunw_elf_handle *handle)
+{
+    uint16_t i;
+
+    for (i = 1; i < handle->shnum; ++i) {
+        const uint8_t *sh = dwunw_elf_section_header(handle, i);
+        const char *name;
+        uint32_t type;
+        int id;
+
+        if (!sh) {
+            break;
+        }
+
+        if (handle->elf_class == ELFCLASS64) {
+            type = ((const Elf64_Shdr *)sh)->sh_type;
+        } else {
+            type = ((const Elf32_Shdr *)sh)->sh_type;
+        }
+        if (type == SHT_NOBITS || type == SHT_NULL) {
+            continue;
+        }
+
+        name = dwunw_elf_section_name(handle, sh);
+        if (!name) {
+            continue;
+        }
+
+        id = dwunw_elf_section_id(name);
+        if (id >= 0 && handle->sections[id] == 0) {
+            handle->sections[id] = i;
+        }
+    }
+}
+
+static dwunw_status_t
+dwunw_elf_section_slice(const struct dwunw_elf_handle *handle,
+                      struct dwunw_dwarf_section *out,
+                      const uint8_t *sh);
+
+/* Slice an indexed section; DWUNW_ERR_NO_DEBUG_DATA when it is absent. */
+static dwunw_status_t
+dwunw_elf_indexed_section(const struct dwunw_elf_handle *handle,
+                          int id,
+                          struct dwunw_dwarf_section *out)
+{
+    const uint8_t *sh;
+
+    if (handle->sections[id] == 0) {
+        return DWUNW_ERR_NO_DEBUG_DATA;
+    }
+
+    sh = dwunw_elf_section_header(handle, handle->sections[id]);
+    if (!sh) {
+        return DWUNW_ERR_BAD_FORMAT;
+    }
+
+    return dwunw_elf_section_slice(handle, out, sh);
+}
+
+/* Pick the GNU build-id out of .note.gnu.build-id. Its absence is not an
+ * error; callers that key caches on it simply skip those modules. */
+static void
+dwunw_elf_read_build_id(struct dwunw_elf_handle *handle)
+{
+    struct dwunw_dwarf_section note;
+    size_t offset = 0;
+
+    if (dwunw_elf_indexed_section(handle, DWUNW_ELF_SECTION_BUILD_ID, &note) != DWUNW_OK) {
+        return;
+    }
+
+    while (offset + 12 <= note.size) {
+        uint32_t namesz;
+        uint32_t descsz;
+        uint32_t type;
+        size_t name_off = offset + 12;
+        size_t desc_off;
+
+        memcpy(&namesz, note.data + offset, sizeof(namesz));
+        memcpy(&descsz, note.data + offset + 4, sizeof(descsz));
+        memcpy(&type, note.data + offset + 8, sizeof(type));
+
+        desc_off = name_off + (((size_t)namesz + 3u) & ~(size_t)3u);
+        if (desc_off > note.size || descsz > note.size - desc_off) {
+            return;
+        }
+
+        if (type == NT_GNU_BUILD_ID && namesz == 4 &&
+            memcmp(note.data + name_off, "GNU", 4) == 0 &&
+            descsz > 0 && descsz <= sizeof(handle->build_id)) {
+            memcpy(handle->build_id, note.data + desc_off, descsz);
+            handle->build_id_len = (uint8_t)descsz;
+            return;
+        }
+
+        offset = desc_off + (((size_t)descsz + 3u) & ~(size_t)3u);
+    }
+}
+
 static dwunw_status_t
 dwunw_elf_initialize(struct dwunw_elf_handle *handle)
 {
@@ -146,6 +324,34 @@ dwunw_elf_initialize(struct dwunw_elf_handle *handle)
         return status;
     }
 
+    dwunw_elf_index_sections(handle);
+    dwunw_elf_read_build_id(handle);
+    return DWUNW_OK;
+}
+
+static void
+dwunw_elf_fill_file_id(const struct stat *st, struct dwunw_file_id *out)
+{
+    out->dev = (uint64_t)st->st_dev;
+    out->ino = (uint64_t)st->st_ino;
+    out->mtime_ns = (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+    out->size = (uint64_t)st->st_size;
+}
+
+dwunw_status_t
+dwunw_elf_file_id(const char *path, struct dwunw_file_id *out)
+{
+    struct stat st;
+
+    if (!path || !out) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    if (stat(path, &st) < 0) {
+        return DWUNW_ERR_IO;
+    }
+
+    dwunw_elf_fill_file_id(&st, out);
     return DWUNW_OK;
 }
 
@@ -177,7 +383,10 @@ dwunw_elf_open(const char *path, struct dwunw_elf_handle *out)
         return DWUNW_ERR_BAD_FORMAT;
     }
 
-    status = dwunw_elf_load_image(out, fd, (size_t)st.st_size);
+    status = dwunw_elf_map_image(out, fd, (size_t)st.st_size);
+    if (status != DWUNW_OK) {
+        status = dwunw_elf_load_image(out, fd, (size_t)st.st_size);
+    }
     if (status != DWUNW_OK) {
         close(fd);
         return status;
@@ -190,6 +399,7 @@ dwunw_elf_open(const char *path, struct dwunw_elf_handle *out)
         return status;
     }
 
+    dwunw_elf_fill_file_id(&st, &out->file_id);
     strncpy(out->path, path, sizeof(out->path) - 1);
     close(fd);
     return DWUNW_OK;
@@ -203,12 +413,36 @@ dwunw_elf_close(struct dwunw_elf_handle *handle)
     }
 
     if (handle->image) {
-        free(handle->image);
+        if (handle->mapped) {
+            munmap(handle->image, handle->size);
+        } else {
+            free(handle->image);
+        }
     }
 
     memset(handle, 0, sizeof(*handle));
 }
 
+/* Ask the kernel to start reading a call-frame section we are about to
+ * parse; everything else (.debug_info, symbols, ...) keeps the
+ * POSIX_MADV_RANDOM hint and is only faulted in if someone reads it. */
+static void
+dwunw_elf_prefetch(const struct dwunw_elf_handle *handle,
+                   const struct dwunw_dwarf_section *section)
+{
+    uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+    uintptr_t start;
+    uintptr_t end;
+
+    if (!handle->mapped || !section->data || section->size == 0 || page == 0) {
+        return;
+    }
+
+    start = (uintptr_t)section->data & ~(page - 1);
+    end = (uintptr_t)section->data + section->size;
+    (void)posix_madvise((void *)start, end - start, POSIX_MADV_WILLNEED);
+}
+
 /* Convert an ELF section header into a DWARF slice pointing inside the image. */
 static dwunw_status_t
 dwunw_elf_section_slice(const struct dwunw_elf_handle *handle,
@@ -217,6 +451,7 @@ dwunw_elf_section_slice(const struct dwunw_elf_handle *handle,
 {
     out->data = NULL;
     out->size = 0;
+    out->addr = 0;
 
     if (handle->elf_class == ELFCLASS64) {
         const Elf64_Shdr *hdr = (const Elf64_Shdr *)sh;
@@ -225,6 +460,7 @@ dwunw_elf_section_slice(const struct dwunw_elf_handle *handle,
         }
         out->data = (const uint8_t *)handle->image + hdr->sh_offset;
         out->size = (size_t)hdr->sh_size;
+        out->addr = hdr->sh_addr;
     } else {
         const Elf32_Shdr *hdr = (const Elf32_Shdr *)sh;
         if ((uint64_t)hdr->sh_offset + hdr->sh_size > handle->size) {
@@ -232,87 +468,193 @@ dwunw_elf_section_slice(const struct dwunw_elf_handle *handle,
         }
         out->data = (const uint8_t *)handle->image + hdr->sh_offset;
         out->size = (size_t)hdr->sh_size;
+        out->addr = hdr->sh_addr;
     }
 
     return DWUNW_OK;
 }
 
+/* Program header i of either class, normalized to the fields we need. */
+static bool
+dwunw_elf_program_header(const struct dwunw_elf_handle *handle,
+                         uint16_t index,
+                         uint32_t *type,
+                         uint64_t *offset,
+                         uint64_t *vaddr,
+                         uint64_t *filesz)
+{
+    const uint8_t *image = handle->image;
+    uint64_t phoff;
+    uint16_t phentsize;
+    uint16_t phnum;
+    uint64_t at;
+
+    if (handle->elf_class == ELFCLASS64) {
+        const Elf64_Ehdr *eh = (const Elf64_Ehdr *)image;
+        phoff = eh->e_phoff;
+        phentsize = eh->e_phentsize;
+        phnum = eh->e_phnum;
+    } else {
+        const Elf32_Ehdr *eh = (const Elf32_Ehdr *)image;
+        phoff = eh->e_phoff;
+        phentsize = eh->e_phentsize;
+        phnum = eh->e_phnum;
+    }
+
+    if (index >= phnum || phentsize == 0) {
+        return false;
+    }
+    at = phoff + (uint64_t)index * phentsize;
+
+    if (handle->elf_class == ELFCLASS64) {
+        const Elf64_Phdr *ph;
+        if (phentsize < sizeof(*ph) || at + sizeof(*ph) > handle->size) {
+            return false;
+        }
+        ph = (const Elf64_Phdr *)(image + at);
+        *type = ph->p_type;
+        *offset = ph->p_offset;
+        *vaddr = ph->p_vaddr;
+        *filesz = ph->p_filesz;
+    } else {
+        const Elf32_Phdr *ph;
+        if (phentsize < sizeof(*ph) || at + sizeof(*ph) > handle->size) {
+            return false;
+        }
+        ph = (const Elf32_Phdr *)(image + at);
+        *type = ph->p_type;
+        *offset = ph->p_offset;
+        *vaddr = ph->p_vaddr;
+        *filesz = ph->p_filesz;
+    }
+
+    return true;
+}
+
+dwunw_status_t
+dwunw_elf_load_bias(const struct dwunw_elf_handle *handle,
+                    uint64_t map_start,
+                    uint64_t map_offset,
+                    uint64_t map_size,
+                    uint64_t *bias_out)
+{
+    uint16_t i;
+
+    if (!handle || !handle->image || !bias_out) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    /* Find the PT_LOAD backing this file range; runtime and link-time
+     * addresses of any byte in it then differ by the same constant. */
+    for (i = 0; i < UINT16_MAX; ++i) {
+        uint32_t type;
+        uint64_t offset;
+        uint64_t vaddr;
+        uint64_t filesz;
+
+        if (!dwunw_elf_program_header(handle, i, &type, &offset, &vaddr, &filesz)) {
+            break;
+        }
+        if (type != PT_LOAD) {
+            continue;
+        }
+
+        if ((offset >= map_offset && offset < map_offset + map_size) ||
+            (offset <= map_offset && map_offset < offset + filesz)) {
+            *bias_out = map_start - map_offset - vaddr + offset;
+            return DWUNW_OK;
+        }
+    }
+
+    return DWUNW_ERR_NO_DEBUG_DATA;
+}
+
 dwunw_status_t
 dwunw_elf_get_section(const struct dwunw_elf_handle *handle,
                       const char *name,
                       struct dwunw_dwarf_section *out)
 {
     uint16_t i;
+    int id;
 
     if (!handle || !name || !out) {
         return DWUNW_ERR_INVALID_ARG;
     }
 
+    id = dwunw_elf_section_id(name);
+    if (id >= 0) {
+        return dwunw_elf_indexed_section(handle, id, out);
+    }
+
     for (i = 0; i < handle->shnum; ++i) {
         const uint8_t *sh = dwunw_elf_section_header(handle, i);
         const char *sh_name;
-        dwunw_status_t status;
 
         if (!sh) {
             continue;
         }
 
-        if (handle->elf_class == ELFCLASS64) {
-            const Elf64_Shdr *hdr = (const Elf64_Shdr *)sh;
-            sh_name = (const char *)handle->shstrtab + hdr->sh_name;
-        } else {
-            const Elf32_Shdr *hdr = (const Elf32_Shdr *)sh;
-            sh_name = (const char *)handle->shstrtab + hdr->sh_name;
-        }
-
-        if (strcmp(sh_name, name) != 0) {
+        sh_name = dwunw_elf_section_name(handle, sh);
+        if (!sh_name || strcmp(sh_name, name) != 0) {
             continue;
         }
 
-        status = dwunw_elf_section_slice(handle, out, sh);
-        if (status != DWUNW_OK) {
-            return status;
-        }
-
-        return DWUNW_OK;
+        return dwunw_elf_section_slice(handle, out, sh);
     }
 
     return DWUNW_ERR_NO_DEBUG_DATA;
 }
 
 dwunw_status_t
-dwunw_elf_collect_dwarf(const struct dwunw_elf_handle *handle,
-                        struct dwunw_dwarf_sections *sections)
+dwunw_elf_collect_sections(const struct dwunw_elf_handle *handle,
+                           unsigned wanted,
+                           struct dwunw_dwarf_sections *sections)
 {
-    dwunw_status_t status;
+    struct dwunw_dwarf_section *slots[DWUNW_ELF_SECTION_BUILD_ID];
+    bool found = false;
+    int id;
 
-    if (!sections) {
+    if (!handle || !sections) {
         return DWUNW_ERR_INVALID_ARG;
     }
 
     memset(sections, 0, sizeof(*sections));
+    slots[DWUNW_ELF_SECTION_DEBUG_INFO] = &sections->debug_info;
+    slots[DWUNW_ELF_SECTION_DEBUG_FRAME] = &sections->debug_frame;
+    slots[DWUNW_ELF_SECTION_EH_FRAME] = &sections->eh_frame;
+    slots[DWUNW_ELF_SECTION_EH_FRAME_HDR] = &sections->eh_frame_hdr;
+
+    /* Missing sections stay as empty descriptors so upstream callers do not
+     * need special cases; unselected ones are never touched (or prefetched). */
+    for (id = 0; id < DWUNW_ELF_SECTION_BUILD_ID; ++id) {
+        dwunw_status_t status;
 
-    /* .debug_info is the minimum required payload for any DWARF walk. */
-    status = dwunw_elf_get_section(handle, ".debug_info", &sections->debug_info);
-    if (status != DWUNW_OK) {
-        return status;
-    }
+        if (!(wanted & DWUNW_ELF_WANT(id))) {
+            continue;
+        }
 
-    /* The frame sections are optional; normalize missing ones to an empty
-     * descriptor so upstream callers do not need special cases. */
-    status = dwunw_elf_get_section(handle, ".debug_frame", &sections->debug_frame);
-    if (status == DWUNW_ERR_NO_DEBUG_DATA) {
-        memset(&sections->debug_frame, 0, sizeof(sections->debug_frame));
-    } else if (status != DWUNW_OK) {
-        return status;
+        status = dwunw_elf_indexed_section(handle, id, slots[id]);
+        if (status == DWUNW_ERR_NO_DEBUG_DATA) {
+            continue;
+        }
+        if (status != DWUNW_OK) {
+            return status;
+        }
+        if (id != DWUNW_ELF_SECTION_DEBUG_INFO) {
+            dwunw_elf_prefetch(handle, slots[id]);
+        }
+        /* Only CFI makes a module usable for unwinding. */
+        if (id == DWUNW_ELF_SECTION_EH_FRAME || id == DWUNW_ELF_SECTION_DEBUG_FRAME) {
+            found = true;
+        }
     }
 
-    status = dwunw_elf_get_section(handle, ".eh_frame", &sections->eh_frame);
-    if (status == DWUNW_ERR_NO_DEBUG_DATA) {
-        memset(&sections->eh_frame, 0, sizeof(sections->eh_frame));
-    } else if (status != DWUNW_OK) {
-        return status;
-    }
+    return found ? DWUNW_OK : DWUNW_ERR_NO_DEBUG_DATA;
+}
 
-    return DWUNW_OK;
+dwunw_status_t
+dwunw_elf_collect_dwarf(const struct dwunw_elf_handle *handle,
+                        struct dwunw_dwarf_sections *sections)
+{
+    return dwunw_elf_collect_sections(handle, DWUNW_ELF_WANT_ALL, sections);
 }
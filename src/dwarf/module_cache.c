@@ -1,65 +1,507 @@
+#include <stdbool.h>
 #include <stddef.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "dwunw/module_cache.h"
 
+#include "core/stats_internal.h"
+#include "cfi.h"
+#include "unwind_table.h"
+
+/* Where the module of a slot lives: in the slot or in the backing store. */
+static struct dwunw_module_handle *
+dwunw_module_cache_entry_handle(struct dwunw_module_cache_entry *entry)
+{
+    return entry->shared ? entry->shared : &entry->handle;
+}
+
+/* Memory a module keeps alive: the ELF image plus everything parsed out of
+ * it. Store-borrowed entries are charged the same, since the local
+ * reference is what pins them in the store. */
+static size_t
+dwunw_module_handle_bytes(const struct dwunw_module_handle *handle)
+{
+    const struct dwunw_dwarf_index *index = &handle->index;
+    const struct dwunw_unwind_table *table = index->table;
+    size_t bytes = handle->elf.size;
+
+    bytes += index->cie_count * sizeof(struct dwunw_cie_record);
+    bytes += index->fde_count * (sizeof(struct dwunw_fde_record) + sizeof(uint64_t));
+    if (table) {
+        bytes += table->map ? table->map_size
+                            : table->count * (sizeof(uint64_t) + sizeof(struct dwunw_unwind_row));
+    }
+    return bytes;
+}
+
+static bool
+dwunw_file_id_equal(const struct dwunw_file_id *a, const struct dwunw_file_id *b)
+{
+    return a->dev == b->dev && a->ino == b->ino &&
+           a->mtime_ns == b->mtime_ns && a->size == b->size;
+}
+
+static uint64_t
+dwunw_hash_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+static size_t
+dwunw_file_id_bucket(const struct dwunw_module_cache *cache, const struct dwunw_file_id *id)
+{
+    uint64_t h = dwunw_hash_mix(id->dev ^ dwunw_hash_mix(id->ino));
+
+    h = dwunw_hash_mix(h ^ (uint64_t)id->mtime_ns ^ (id->size << 1));
+    return (size_t)h & (cache->bucket_count - 1);
+}
+
+/* FNV-1a; build-ids are hashes already but their length varies. */
+static size_t
+dwunw_build_id_bucket(const struct dwunw_module_cache *cache, const struct dwunw_elf_handle *elf)
+{
+    uint64_t h = 0xcbf29ce484222325ull ^ elf->machine;
+    size_t i;
+
+    for (i = 0; i < elf->build_id_len; ++i) {
+        h = (h ^ elf->build_id[i]) * 0x100000001b3ull;
+    }
+    return (size_t)dwunw_hash_mix(h) & (cache->bucket_count - 1);
+}
+
 static void
-dwunw_module_cache_entry_reset(struct dwunw_module_cache_entry *entry)
+dwunw_module_cache_link(struct dwunw_module_cache *cache,
+                        struct dwunw_module_cache_entry *entry)
 {
-    dwunw_elf_close(&entry->handle.elf);
-    dwunw_dwarf_index_reset(&entry->handle.index);
-    memset(entry->path, 0, sizeof(entry->path));
-    entry->refcnt = 0;
-    entry->state = DWUNW_MODULE_SLOT_UNUSED;
-    entry->warm_seq = 0;
+    const struct dwunw_elf_handle *elf = &dwunw_module_cache_entry_handle(entry)->elf;
+    size_t b = dwunw_file_id_bucket(cache, &elf->file_id);
+
+    struct dwunw_module_cache_alias *alias;
+
+    entry->id_next = cache->id_buckets[b];
+    cache->id_buckets[b] = entry;
+    if (elf->build_id_len > 0) {
+        b = dwunw_build_id_bucket(cache, elf);
+        entry->bid_next = cache->bid_buckets[b];
+        cache->bid_buckets[b] = entry;
+    }
+    for (alias = entry->aliases; alias; alias = alias->next) {
+        b = dwunw_file_id_bucket(cache, &alias->id);
+        alias->id_next = cache->alias_buckets[b];
+        cache->alias_buckets[b] = alias;
+    }
 }
 
-/* Linear probe over the fixed-size cache; capacity is tiny (16 entries) so
- * a scan keeps the code simple and deterministic. */
-static struct dwunw_module_cache_entry *
-dwunw_module_cache_find(struct dwunw_module_cache *cache, const char *path)
+static void
+dwunw_module_cache_unlink(struct dwunw_module_cache *cache,
+                          struct dwunw_module_cache_entry *entry)
 {
+    const struct dwunw_elf_handle *elf = &dwunw_module_cache_entry_handle(entry)->elf;
+    struct dwunw_module_cache_entry **link;
+    struct dwunw_module_cache_alias *alias;
+
+    link = &cache->id_buckets[dwunw_file_id_bucket(cache, &elf->file_id)];
+    while (*link != entry) {
+        link = &(*link)->id_next;
+    }
+    *link = entry->id_next;
+
+    if (elf->build_id_len > 0) {
+        link = &cache->bid_buckets[dwunw_build_id_bucket(cache, elf)];
+        while (*link != entry) {
+            link = &(*link)->bid_next;
+        }
+        *link = entry->bid_next;
+    }
+
+    for (alias = entry->aliases; alias; alias = alias->next) {
+        struct dwunw_module_cache_alias **alink;
+
+        alink = &cache->alias_buckets[dwunw_file_id_bucket(cache, &alias->id)];
+        while (*alink != alias) {
+            alink = &(*alink)->id_next;
+        }
+        *alink = alias->id_next;
+    }
+}
+
+/* Keep at most one entry per bucket on average. */
+static dwunw_status_t
+dwunw_module_cache_reserve(struct dwunw_module_cache *cache)
+{
+    struct dwunw_module_cache_entry **old_ids = cache->id_buckets;
+    struct dwunw_module_cache_entry **old_bids = cache->bid_buckets;
+    struct dwunw_module_cache_alias **old_aliases = cache->alias_buckets;
+    size_t old_count = cache->bucket_count;
+    size_t count;
     size_t i;
 
-    for (i = 0; i < DWUNW_MODULE_CACHE_CAPACITY; ++i) {
-        struct dwunw_module_cache_entry *entry = &cache->entries[i];
-        if (entry->state == DWUNW_MODULE_SLOT_UNUSED) {
-            continue;
+    if (cache->count < old_count) {
+        return DWUNW_OK;
+    }
+
+    count = old_count ? old_count * 2 : DWUNW_MODULE_CACHE_MIN_BUCKETS;
+    cache->id_buckets = calloc(count, sizeof(*cache->id_buckets));
+    cache->bid_buckets = calloc(count, sizeof(*cache->bid_buckets));
+    cache->alias_buckets = calloc(count, sizeof(*cache->alias_buckets));
+    if (!cache->id_buckets || !cache->bid_buckets || !cache->alias_buckets) {
+        free(cache->id_buckets);
+        free(cache->bid_buckets);
+        free(cache->alias_buckets);
+        cache->id_buckets = old_ids;
+        cache->bid_buckets = old_bids;
+        cache->alias_buckets = old_aliases;
+        /* A full table still works, just with longer chains. */
+        return old_count ? DWUNW_OK : DWUNW_ERR_IO;
+    }
+    cache->bucket_count = count;
+
+    for (i = 0; i < old_count; ++i) {
+        struct dwunw_module_cache_entry *entry = old_ids[i];
+        while (entry) {
+            struct dwunw_module_cache_entry *next = entry->id_next;
+            dwunw_module_cache_link(cache, entry);
+            entry = next;
         }
-        if (strncmp(entry->path, path, DWUNW_MAX_PATH_LEN) == 0) {
+    }
+    free(old_ids);
+    free(old_bids);
+    free(old_aliases);
+    return DWUNW_OK;
+}
+
+static void
+dwunw_module_cache_lru_remove(struct dwunw_module_cache *cache,
+                              struct dwunw_module_cache_entry *entry)
+{
+    if (entry->lru_prev) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        cache->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        cache->lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = NULL;
+    entry->lru_next = NULL;
+}
+
+static void
+dwunw_module_cache_lru_push(struct dwunw_module_cache *cache,
+                            struct dwunw_module_cache_entry *entry)
+{
+    entry->lru_prev = NULL;
+    entry->lru_next = cache->lru_head;
+    if (cache->lru_head) {
+        cache->lru_head->lru_prev = entry;
+    } else {
+        cache->lru_tail = entry;
+    }
+    cache->lru_head = entry;
+}
+
+/* Close the module of an entry that is no longer indexed. */
+static void
+dwunw_module_cache_entry_reset(struct dwunw_module_cache *cache,
+                               struct dwunw_module_cache_entry *entry)
+{
+    cache->epoch++;
+    if (entry->shared) {
+        dwunw_module_store_release(cache->store, entry->shared);
+        entry->shared = NULL;
+    } else {
+        dwunw_elf_close(&entry->handle.elf);
+        dwunw_dwarf_index_reset(&entry->handle.index);
+    }
+}
+
+static void
+dwunw_module_cache_free_aliases(struct dwunw_module_cache_entry *entry)
+{
+    while (entry->aliases) {
+        struct dwunw_module_cache_alias *next = entry->aliases->next;
+
+        free(entry->aliases);
+        entry->aliases = next;
+    }
+}
+
+static void
+dwunw_module_cache_evict(struct dwunw_module_cache *cache,
+                         struct dwunw_module_cache_entry *entry)
+{
+    dwunw_module_cache_unlink(cache, entry);
+    if (entry->state == DWUNW_MODULE_SLOT_WARM) {
+        dwunw_module_cache_lru_remove(cache, entry);
+    }
+    cache->count--;
+    cache->bytes -= entry->bytes;
+    dwunw_module_cache_entry_reset(cache, entry);
+    dwunw_module_cache_free_aliases(entry);
+    free(entry);
+    DWUNW_STATS_ADD(cache->stats, module_evictions, 1);
+}
+
+/* Drop warm modules, oldest first, until the cache fits its budget. */
+static void
+dwunw_module_cache_trim(struct dwunw_module_cache *cache)
+{
+    while (cache->bytes > cache->budget && cache->lru_tail) {
+        dwunw_module_cache_evict(cache, cache->lru_tail);
+    }
+}
+
+/* Modules are identified by the file behind the path, not the path string:
+ * /proc/<pid>/exe of every process running the same binary resolves to one
+ * (dev, inode, mtime) and therefore one parsed index. */
+static struct dwunw_module_cache_entry *
+dwunw_module_cache_find(struct dwunw_module_cache *cache, const struct dwunw_file_id *id)
+{
+    struct dwunw_module_cache_entry *entry;
+    struct dwunw_module_cache_alias *alias;
+    size_t b;
+
+    if (cache->count == 0) {
+        return NULL;
+    }
+
+    b = dwunw_file_id_bucket(cache, id);
+    for (entry = cache->id_buckets[b]; entry; entry = entry->id_next) {
+        if (dwunw_file_id_equal(&dwunw_module_cache_entry_handle(entry)->elf.file_id, id)) {
             return entry;
         }
     }
+    for (alias = cache->alias_buckets[b]; alias; alias = alias->id_next) {
+        if (dwunw_file_id_equal(&alias->id, id)) {
+            return alias->entry;
+        }
+    }
 
     return NULL;
 }
 
-/* First look for an unused slot; otherwise evict the oldest warm slot. */
+/* Remember that id holds entry's module. Best effort: without the alias the
+ * next acquire of id just reopens the file and finds entry by build-id. */
+static void
+dwunw_module_cache_alias(struct dwunw_module_cache *cache,
+                         struct dwunw_module_cache_entry *entry,
+                         const struct dwunw_file_id *id)
+{
+    struct dwunw_module_cache_alias *alias = malloc(sizeof(*alias));
+    size_t b;
+
+    if (!alias) {
+        return;
+    }
+
+    alias->id = *id;
+    alias->entry = entry;
+    alias->next = entry->aliases;
+    entry->aliases = alias;
+    b = dwunw_file_id_bucket(cache, id);
+    alias->id_next = cache->alias_buckets[b];
+    cache->alias_buckets[b] = alias;
+}
+
+/* Second chance for distinct files with identical contents (copies, other
+ * mount namespaces): same build-id means same CFI. */
 static struct dwunw_module_cache_entry *
-dwunw_module_cache_alloc(struct dwunw_module_cache *cache)
+dwunw_module_cache_find_build_id(struct dwunw_module_cache *cache,
+                                 const struct dwunw_elf_handle *elf)
 {
-    size_t i;
-    struct dwunw_module_cache_entry *victim = NULL;
+    struct dwunw_module_cache_entry *entry;
+
+    if (elf->build_id_len == 0 || cache->count == 0) {
+        return NULL;
+    }
+
+    for (entry = cache->bid_buckets[dwunw_build_id_bucket(cache, elf)]; entry;
+         entry = entry->bid_next) {
+        const struct dwunw_elf_handle *other = &dwunw_module_cache_entry_handle(entry)->elf;
 
-    for (i = 0; i < DWUNW_MODULE_CACHE_CAPACITY; ++i) {
-        struct dwunw_module_cache_entry *entry = &cache->entries[i];
-        if (entry->state == DWUNW_MODULE_SLOT_UNUSED) {
+        if (other->build_id_len == elf->build_id_len &&
+            other->machine == elf->machine &&
+            memcmp(other->build_id, elf->build_id, elf->build_id_len) == 0) {
             return entry;
         }
+    }
+
+    return NULL;
+}
+
+/* The entry whose module is handle, found through the handle's own file
+ * identity so release costs one bucket walk. */
+static struct dwunw_module_cache_entry *
+dwunw_module_cache_find_handle(struct dwunw_module_cache *cache,
+                               struct dwunw_module_handle *handle)
+{
+    struct dwunw_module_cache_entry *entry;
+
+    if (cache->count == 0) {
+        return NULL;
+    }
 
-        if (entry->state == DWUNW_MODULE_SLOT_WARM) {
-            if (!victim || entry->warm_seq < victim->warm_seq) {
-                victim = entry;
-            }
+    for (entry = cache->id_buckets[dwunw_file_id_bucket(cache, &handle->elf.file_id)]; entry;
+         entry = entry->id_next) {
+        if (dwunw_module_cache_entry_handle(entry) == handle) {
+            return entry;
         }
     }
 
-    if (!victim) {
+    return NULL;
+}
+
+/* Hand out another reference to an existing entry. */
+static void
+dwunw_module_cache_ref(struct dwunw_module_cache *cache,
+                       struct dwunw_module_cache_entry *entry)
+{
+    if (entry->state == DWUNW_MODULE_SLOT_WARM) {
+        dwunw_module_cache_lru_remove(cache, entry);
+        entry->refcnt = 1;
+        entry->state = DWUNW_MODULE_SLOT_ACTIVE;
+    } else {
+        /* Bump the refcount so callers must balance with _release. */
+        entry->refcnt++;
+    }
+}
+
+/* A fresh entry, not yet indexed; NULL when out of memory. */
+static struct dwunw_module_cache_entry *
+dwunw_module_cache_alloc(struct dwunw_module_cache *cache)
+{
+    if (dwunw_module_cache_reserve(cache) != DWUNW_OK) {
+        return NULL;
+    }
+    return calloc(1, sizeof(struct dwunw_module_cache_entry));
+}
+
+/* Index a loaded entry as active with one reference, then make room for
+ * it among the warm ones. */
+static void
+dwunw_module_cache_insert(struct dwunw_module_cache *cache,
+                          struct dwunw_module_cache_entry *entry,
+                          const char *path)
+{
+    strncpy(entry->path, path, sizeof(entry->path) - 1);
+    entry->refcnt = 1;
+    entry->state = DWUNW_MODULE_SLOT_ACTIVE;
+    entry->bytes = dwunw_module_handle_bytes(dwunw_module_cache_entry_handle(entry));
+    dwunw_module_cache_link(cache, entry);
+    cache->count++;
+    cache->bytes += entry->bytes;
+    dwunw_module_cache_trim(cache);
+}
+
+/* Reference the module cached for id, if any, and count the lookup. */
+static struct dwunw_module_handle *
+dwunw_module_cache_lookup(struct dwunw_module_cache *cache, const struct dwunw_file_id *id)
+{
+    struct dwunw_module_cache_entry *entry = dwunw_module_cache_find(cache, id);
+
+    if (!entry) {
+        DWUNW_STATS_ADD(cache->stats, module_misses, 1);
         return NULL;
     }
 
-    dwunw_module_cache_entry_reset(victim);
-    return victim;
+    dwunw_module_cache_ref(cache, entry);
+    DWUNW_STATS_ADD(cache->stats, module_hits, 1);
+    return dwunw_module_cache_entry_handle(entry);
+}
+
+/* Index the image entry->handle.elf maps. Touches nothing but the entry,
+ * so the store runs it unlocked; on failure the image is closed and the
+ * entry itself is left to the caller. */
+static dwunw_status_t
+dwunw_module_cache_parse(struct dwunw_module_cache_entry *entry,
+                         uint32_t flags,
+                         const char *table_dir)
+{
+    dwunw_status_t status;
+
+    /* Parse DWARF metadata eagerly so future acquisitions are instant. */
+    status = dwunw_dwarf_index_init(&entry->handle.index, &entry->handle.elf);
+    if (status != DWUNW_OK) {
+        dwunw_elf_close(&entry->handle.elf);
+        return status;
+    }
+
+    /* The row table is an accelerator only; modules it cannot describe keep
+     * unwinding through the interpreter. Compiling decodes every FDE, so it
+     * is opt-in; a table some earlier process stored is always worth
+     * mapping since that costs no decoding. */
+    if (flags & DWUNW_MODULE_CACHE_COMPILE_TABLES) {
+        status = dwunw_dwarf_index_compile_cached(&entry->handle.index,
+                                                  &entry->handle.elf,
+                                                  table_dir);
+        if (status == DWUNW_ERR_IO) {
+            dwunw_elf_close(&entry->handle.elf);
+            dwunw_dwarf_index_reset(&entry->handle.index);
+            return status;
+        }
+    } else {
+        (void)dwunw_dwarf_index_load_cached(&entry->handle.index,
+                                            &entry->handle.elf,
+                                            table_dir);
+    }
+
+    return DWUNW_OK;
+}
+
+/* Drop an entry the store parsed but never published. */
+static void
+dwunw_module_cache_discard(struct dwunw_module_cache_entry *entry)
+{
+    dwunw_elf_close(&entry->handle.elf);
+    dwunw_dwarf_index_reset(&entry->handle.index);
+    free(entry);
+}
+
+/* Miss in a store-backed cache: borrow the module from the store and keep
+ * the store reference in a local slot. */
+static dwunw_status_t
+dwunw_module_cache_acquire_shared(struct dwunw_module_cache *cache,
+                                  const char *path,
+                                  const struct dwunw_file_id *id,
+                                  struct dwunw_module_handle **handle_out)
+{
+    struct dwunw_module_cache_entry *entry;
+    struct dwunw_module_handle *shared = NULL;
+    dwunw_status_t status;
+
+    status = dwunw_module_store_acquire(cache->store, path, &shared);
+    if (status != DWUNW_OK) {
+        return status;
+    }
+
+    /* The store matched another file we already borrowed (same build-id). */
+    entry = dwunw_module_cache_find_handle(cache, shared);
+    if (entry) {
+        dwunw_module_store_release(cache->store, shared);
+        dwunw_module_cache_alias(cache, entry, id);
+        dwunw_module_cache_ref(cache, entry);
+        *handle_out = shared;
+        return DWUNW_OK;
+    }
+
+    entry = dwunw_module_cache_alloc(cache);
+    if (!entry) {
+        dwunw_module_store_release(cache->store, shared);
+        return DWUNW_ERR_IO;
+    }
+
+    entry->shared = shared;
+    dwunw_module_cache_insert(cache, entry, path);
+    *handle_out = shared;
+    return DWUNW_OK;
 }
 
 void
@@ -70,6 +512,7 @@ dwunw_module_cache_init(struct dwunw_module_cache *cache)
     }
 
     memset(cache, 0, sizeof(*cache));
+    cache->budget = DWUNW_MODULE_CACHE_BUDGET;
 }
 
 void
@@ -81,17 +524,58 @@ dwunw_module_cache_flush(struct dwunw_module_cache *cache)
         return;
     }
 
-    for (i = 0; i < DWUNW_MODULE_CACHE_CAPACITY; ++i) {
-        struct dwunw_module_cache_entry *entry = &cache->entries[i];
-        if (entry->state == DWUNW_MODULE_SLOT_UNUSED) {
-            continue;
+    for (i = 0; i < cache->bucket_count; ++i) {
+        struct dwunw_module_cache_entry *entry = cache->id_buckets[i];
+        while (entry) {
+            struct dwunw_module_cache_entry *next = entry->id_next;
+            /* Release both the ELF image and parsed DWARF tables. */
+            dwunw_module_cache_entry_reset(cache, entry);
+            dwunw_module_cache_free_aliases(entry);
+            free(entry);
+            entry = next;
         }
-        /* Release both the ELF image and parsed DWARF tables before marking
-         * the slot idle. */
-        dwunw_module_cache_entry_reset(entry);
     }
 
-    cache->warm_clock = 0;
+    free(cache->id_buckets);
+    free(cache->bid_buckets);
+    free(cache->alias_buckets);
+    cache->id_buckets = NULL;
+    cache->bid_buckets = NULL;
+    cache->alias_buckets = NULL;
+    cache->bucket_count = 0;
+    cache->count = 0;
+    cache->bytes = 0;
+    cache->lru_head = NULL;
+    cache->lru_tail = NULL;
+}
+
+void
+dwunw_module_cache_set_budget(struct dwunw_module_cache *cache, size_t bytes)
+{
+    if (!cache) {
+        return;
+    }
+
+    cache->budget = bytes;
+    dwunw_module_cache_trim(cache);
+}
+
+dwunw_status_t
+dwunw_module_cache_set_table_dir(struct dwunw_module_cache *cache, const char *dir)
+{
+    if (!cache) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    if (!dir) {
+        dir = "";
+    }
+    if (strlen(dir) >= sizeof(cache->table_dir)) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    strcpy(cache->table_dir, dir);
+    return DWUNW_OK;
 }
 
 dwunw_status_t
@@ -100,49 +584,58 @@ dwunw_module_cache_acquire(struct dwunw_module_cache *cache,
                           struct dwunw_module_handle **handle_out)
 {
     struct dwunw_module_cache_entry *entry;
+    struct dwunw_elf_handle elf;
+    struct dwunw_file_id id;
     dwunw_status_t status;
 
     if (!cache || !path || !handle_out) {
         return DWUNW_ERR_INVALID_ARG;
     }
 
-    entry = dwunw_module_cache_find(cache, path);
-    if (entry) {
-        if (entry->state == DWUNW_MODULE_SLOT_WARM) {
-            entry->refcnt = 1;
-            entry->state = DWUNW_MODULE_SLOT_ACTIVE;
-            entry->warm_seq = 0;
-        } else {
-            /* Bump the refcount so callers must balance with _release. */
-            entry->refcnt++;
-        }
-        *handle_out = &entry->handle;
+    status = dwunw_elf_file_id(path, &id);
+    if (status != DWUNW_OK) {
+        return status;
+    }
+
+    *handle_out = dwunw_module_cache_lookup(cache, &id);
+    if (*handle_out) {
         return DWUNW_OK;
     }
 
-    entry = dwunw_module_cache_alloc(cache);
-    if (!entry) {
-        return DWUNW_ERR_CACHE_FULL;
+    if (cache->store) {
+        return dwunw_module_cache_acquire_shared(cache, path, &id, handle_out);
     }
 
-    /* Opening the ELF can still fail (permission, IO, truncation). */
-    status = dwunw_elf_open(path, &entry->handle.elf);
+    /* Opening only maps the file and reads its headers; the expensive part
+     * (index + table) is what the build-id check below lets us share. */
+    status = dwunw_elf_open(path, &elf);
     if (status != DWUNW_OK) {
         return status;
     }
 
-    /* Parse DWARF metadata eagerly so future acquisitions are instant. */
-    status = dwunw_dwarf_index_init(&entry->handle.index, &entry->handle.elf);
+    entry = dwunw_module_cache_find_build_id(cache, &elf);
+    if (entry) {
+        dwunw_elf_close(&elf);
+        dwunw_module_cache_alias(cache, entry, &id);
+        dwunw_module_cache_ref(cache, entry);
+        *handle_out = &entry->handle;
+        return DWUNW_OK;
+    }
+
+    entry = dwunw_module_cache_alloc(cache);
+    if (!entry) {
+        dwunw_elf_close(&elf);
+        return DWUNW_ERR_IO;
+    }
+    entry->handle.elf = elf;
+
+    status = dwunw_module_cache_parse(entry, cache->flags, cache->table_dir);
     if (status != DWUNW_OK) {
-        dwunw_elf_close(&entry->handle.elf);
-        memset(&entry->handle, 0, sizeof(entry->handle));
+        free(entry);
         return status;
     }
 
-    strncpy(entry->path, path, sizeof(entry->path) - 1);
-    entry->refcnt = 1;
-    entry->state = DWUNW_MODULE_SLOT_ACTIVE;
-    entry->warm_seq = 0;
+    dwunw_module_cache_insert(cache, entry, path);
     *handle_out = &entry->handle;
     return DWUNW_OK;
 }
@@ -151,33 +644,185 @@ dwunw_status_t
 dwunw_module_cache_release(struct dwunw_module_cache *cache,
                           struct dwunw_module_handle *handle)
 {
-    size_t i;
+    struct dwunw_module_cache_entry *entry;
 
     if (!cache || !handle) {
         return DWUNW_ERR_INVALID_ARG;
     }
 
-    for (i = 0; i < DWUNW_MODULE_CACHE_CAPACITY; ++i) {
-        struct dwunw_module_cache_entry *entry = &cache->entries[i];
-        if (entry->state == DWUNW_MODULE_SLOT_UNUSED) {
-            continue;
+    entry = dwunw_module_cache_find_handle(cache, handle);
+    if (!entry || entry->refcnt == 0) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    entry->refcnt--;
+    if (entry->refcnt == 0) {
+        entry->state = DWUNW_MODULE_SLOT_WARM;
+        dwunw_module_cache_lru_push(cache, entry);
+        dwunw_module_cache_trim(cache);
+    }
+
+    return DWUNW_OK;
+}
+
+dwunw_status_t
+dwunw_module_cache_set_store(struct dwunw_module_cache *cache,
+                             struct dwunw_module_store *store)
+{
+    if (!cache || (store && &store->cache == cache) || cache->count > 0) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    cache->store = store;
+    return DWUNW_OK;
+}
+
+dwunw_status_t
+dwunw_module_store_init(struct dwunw_module_store *store)
+{
+    if (!store) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    dwunw_module_cache_init(&store->cache);
+    if (pthread_mutex_init(&store->lock, NULL) != 0) {
+        return DWUNW_ERR_IO;
+    }
+    return DWUNW_OK;
+}
+
+void
+dwunw_module_store_destroy(struct dwunw_module_store *store)
+{
+    if (!store) {
+        return;
+    }
+
+    dwunw_module_cache_flush(&store->cache);
+    pthread_mutex_destroy(&store->lock);
+}
+
+dwunw_status_t
+dwunw_module_store_set_table_dir(struct dwunw_module_store *store, const char *dir)
+{
+    dwunw_status_t status;
+
+    if (!store) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    pthread_mutex_lock(&store->lock);
+    status = dwunw_module_cache_set_table_dir(&store->cache, dir);
+    pthread_mutex_unlock(&store->lock);
+    return status;
+}
+
+dwunw_status_t
+dwunw_module_store_acquire(struct dwunw_module_store *store,
+                           const char *path,
+                           struct dwunw_module_handle **handle_out)
+{
+    struct dwunw_module_cache *cache;
+    struct dwunw_module_cache_entry *entry;
+    struct dwunw_module_cache_entry *winner;
+    struct dwunw_file_id id;
+    char table_dir[DWUNW_MAX_PATH_LEN];
+    uint32_t flags;
+    dwunw_status_t status;
+
+    if (!store || !path || !handle_out) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+    cache = &store->cache;
+
+    status = dwunw_elf_file_id(path, &id);
+    if (status != DWUNW_OK) {
+        return status;
+    }
+
+    pthread_mutex_lock(&store->lock);
+    *handle_out = dwunw_module_cache_lookup(cache, &id);
+    flags = cache->flags;
+    memcpy(table_dir, cache->table_dir, sizeof(table_dir));
+    pthread_mutex_unlock(&store->lock);
+    if (*handle_out) {
+        return DWUNW_OK;
+    }
+
+    /* Mapping, indexing and compiling run unlocked so one large module
+     * does not stall every other thread's miss; the lock is only retaken
+     * to look for an existing copy and to publish the result. */
+    entry = calloc(1, sizeof(*entry));
+    if (!entry) {
+        return DWUNW_ERR_IO;
+    }
+
+    status = dwunw_elf_open(path, &entry->handle.elf);
+    if (status != DWUNW_OK) {
+        free(entry);
+        return status;
+    }
+
+    pthread_mutex_lock(&store->lock);
+    winner = dwunw_module_cache_find_build_id(cache, &entry->handle.elf);
+    if (winner) {
+        dwunw_module_cache_alias(cache, winner, &id);
+        dwunw_module_cache_ref(cache, winner);
+        *handle_out = &winner->handle;
+    }
+    pthread_mutex_unlock(&store->lock);
+    if (winner) {
+        dwunw_elf_close(&entry->handle.elf);
+        free(entry);
+        return DWUNW_OK;
+    }
+
+    status = dwunw_module_cache_parse(entry, flags, table_dir);
+    if (status != DWUNW_OK) {
+        free(entry);
+        return status;
+    }
+
+    /* Another thread may have published the same module meanwhile; the
+     * first one in wins and later copies are dropped. */
+    pthread_mutex_lock(&store->lock);
+    winner = dwunw_module_cache_find(cache, &id);
+    if (!winner) {
+        winner = dwunw_module_cache_find_build_id(cache, &entry->handle.elf);
+        if (winner) {
+            dwunw_module_cache_alias(cache, winner, &id);
         }
-        if (&entry->handle != handle) {
-            continue;
+    }
+    if (winner) {
+        dwunw_module_cache_ref(cache, winner);
+        *handle_out = &winner->handle;
+    } else {
+        status = dwunw_module_cache_reserve(cache);
+        if (status == DWUNW_OK) {
+            dwunw_module_cache_insert(cache, entry, path);
+            *handle_out = &entry->handle;
         }
+    }
+    pthread_mutex_unlock(&store->lock);
 
-        if (entry->refcnt == 0) {
-            return DWUNW_ERR_INVALID_ARG;
-        }
+    if (winner || status != DWUNW_OK) {
+        dwunw_module_cache_discard(entry);
+    }
+    return status;
+}
 
-        entry->refcnt--;
-        if (entry->refcnt == 0) {
-            entry->state = DWUNW_MODULE_SLOT_WARM;
-            entry->warm_seq = ++cache->warm_clock;
-        }
+dwunw_status_t
+dwunw_module_store_release(struct dwunw_module_store *store,
+                           struct dwunw_module_handle *handle)
+{
+    dwunw_status_t status;
 
-        return DWUNW_OK;
+    if (!store) {
+        return DWUNW_ERR_INVALID_ARG;
     }
 
-    return DWUNW_ERR_INVALID_ARG;
+    pthread_mutex_lock(&store->lock);
+    status = dwunw_module_cache_release(&store->cache, handle);
+    pthread_mutex_unlock(&store->lock);
+    return status;
 }
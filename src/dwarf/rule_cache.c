@@ -0,0 +1,15 @@
+#include <stdlib.h>
+
+#include "rule_cache.h"
+
+struct dwunw_rule_cache *
+dwunw_rule_cache_create(void)
+{
+    return calloc(1, sizeof(struct dwunw_rule_cache));
+}
+
+void
+dwunw_rule_cache_destroy(struct dwunw_rule_cache *cache)
+{
+    free(cache);
+}
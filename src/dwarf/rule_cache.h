@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "dwunw/config.h"
+#include "dwunw/dwarf_index.h"
+
+#include "cfi.h"
+
+/*
+ * Direct-mapped cache of resolved unwind rules, one per context. A sampled
+ * workload keeps returning to the same few thousand call sites, so a step
+ * whose (module, PC) is already cached replays its rules without searching
+ * the row table or FDE index and without running any CFA program.
+ *
+ * Entries are keyed by the address of the module's index plus the module
+ * cache epoch at fill time: once a module is closed its address may come
+ * back for another one, and the epoch bump makes every older entry miss.
+ */
+struct dwunw_rule_cache_entry {
+    const struct dwunw_dwarf_index *index;  /* NULL = empty slot */
+    uint64_t pc;                            /* module-relative */
+    uint64_t epoch;
+    struct dwunw_cfi_rules rules;
+};
+
+struct dwunw_rule_cache {
+    struct dwunw_rule_cache_entry slots[DWUNW_RULE_CACHE_SLOTS];
+};
+
+_Static_assert((DWUNW_RULE_CACHE_SLOTS & (DWUNW_RULE_CACHE_SLOTS - 1)) == 0,
+               "DWUNW_RULE_CACHE_SLOTS must be a power of two");
+
+/* NULL when allocation fails; callers then resolve every step. */
+struct dwunw_rule_cache *dwunw_rule_cache_create(void);
+void dwunw_rule_cache_destroy(struct dwunw_rule_cache *cache);
+
+static inline struct dwunw_rule_cache_entry *
+dwunw_rule_cache_slot(struct dwunw_rule_cache *cache,
+                      const struct dwunw_dwarf_index *index,
+                      uint64_t pc)
+{
+    uint64_t h = (pc ^ ((uint64_t)(uintptr_t)index >> 4)) * 0x9e3779b97f4a7c15ull;
+
+    return &cache->slots[(h >> 32) & (DWUNW_RULE_CACHE_SLOTS - 1)];
+}
+
+static inline const struct dwunw_cfi_rules *
+dwunw_rule_cache_find(struct dwunw_rule_cache *cache,
+                      const struct dwunw_dwarf_index *index,
+                      uint64_t pc,
+                      uint64_t epoch)
+{
+    const struct dwunw_rule_cache_entry *entry =
+        dwunw_rule_cache_slot(cache, index, pc);
+
+    if (entry->index == index && entry->pc == pc && entry->epoch == epoch) {
+        return &entry->rules;
+    }
+    return NULL;
+}
+
+/* Overwrites whatever the slot held. */
+static inline void
+dwunw_rule_cache_store(struct dwunw_rule_cache *cache,
+                       const struct dwunw_dwarf_index *index,
+                       uint64_t pc,
+                       uint64_t epoch,
+                       const struct dwunw_cfi_rules *rules)
+{
+    struct dwunw_rule_cache_entry *entry = dwunw_rule_cache_slot(cache, index, pc);
+
+    entry->index = index;
+    entry->pc = pc;
+    entry->epoch = epoch;
+    entry->rules = *rules;
+}
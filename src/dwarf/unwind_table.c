@@ -0,0 +1,795 @@
+#define _POSIX_C_SOURCE 200809L
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "unwind_table.h"
+
+struct row_vector {
+    uint64_t *pcs;
+    struct dwunw_unwind_row *rows;
+    size_t count;
+    size_t capacity;
+};
+
+/* Per-FDE compilation state handed to dwunw_cfi_walk_rows(). */
+struct row_compiler {
+    const struct dwunw_unwind_table *table;
+    const struct dwunw_fde_record *fde;
+    uint64_t limit;            /* end of the range this FDE owns */
+    bool resume;               /* an earlier FDE still covers limit */
+    struct row_vector scratch;
+    int64_t fp_word;           /* frame record slot size, 0 = not classified */
+    bool fp_frame;             /* some row has the frame record in place */
+    bool fp_pushed;            /* some SP-based row has the caller's FP saved */
+    bool fp_unsafe;            /* some row could make a call without it */
+};
+
+/* FDE ranges where frame-pointer walking is unsafe, merged while no safe FDE
+ * separates them. */
+struct range_vector {
+    struct dwunw_unwind_range *ranges;
+    size_t count;
+    bool overflow;             /* more than DWUNW_UNWIND_FP_EXCEPTIONS_MAX */
+    bool merge;                /* no safe FDE since ranges[count - 1] */
+};
+
+static dwunw_status_t
+row_vector_reserve(struct row_vector *vec)
+{
+    uint64_t *pcs;
+    struct dwunw_unwind_row *rows;
+    size_t capacity;
+
+    if (vec->count < vec->capacity) {
+        return DWUNW_OK;
+    }
+
+    capacity = vec->capacity ? vec->capacity * 2 : 64;
+    pcs = realloc(vec->pcs, capacity * sizeof(*pcs));
+    if (!pcs) {
+        return DWUNW_ERR_IO;
+    }
+    vec->pcs = pcs;
+
+    rows = realloc(vec->rows, capacity * sizeof(*rows));
+    if (!rows) {
+        return DWUNW_ERR_IO;
+    }
+    vec->rows = rows;
+    vec->capacity = capacity;
+    return DWUNW_OK;
+}
+
+static bool
+row_equal(const struct dwunw_unwind_row *a, const struct dwunw_unwind_row *b)
+{
+    return a->cfa_offset == b->cfa_offset &&
+           a->ra_offset == b->ra_offset &&
+           a->fp_offset == b->fp_offset &&
+           a->cfa_reg == b->cfa_reg &&
+           a->ra_rule == b->ra_rule &&
+           a->fp_rule == b->fp_rule &&
+           a->flags == b->flags;
+}
+
+/* Append a row; a row at the same PC replaces the previous one and a row
+ * identical to its predecessor is folded into it. */
+static dwunw_status_t
+row_vector_push(struct row_vector *vec,
+                uint64_t pc,
+                const struct dwunw_unwind_row *row)
+{
+    dwunw_status_t st;
+
+    if (vec->count > 0 && vec->pcs[vec->count - 1] == pc) {
+        vec->count--;
+    }
+    if (vec->count > 0 && row_equal(&vec->rows[vec->count - 1], row)) {
+        return DWUNW_OK;
+    }
+
+    st = row_vector_reserve(vec);
+    if (st != DWUNW_OK) {
+        return st;
+    }
+
+    vec->pcs[vec->count] = pc;
+    vec->rows[vec->count] = *row;
+    vec->count++;
+    return DWUNW_OK;
+}
+
+static bool
+fits_int32(int64_t value)
+{
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+/* Squeeze a DWARF rule table into a row, or mark it FALLBACK when it needs
+ * more than CFA/RA/FP to be restored faithfully. */
+static void
+compile_row(const struct dwunw_unwind_table *table,
+            const struct dwunw_cie_record *cie,
+            const struct dwunw_cfa_state *state,
+            struct dwunw_unwind_row *row)
+{
+    static const struct dwunw_unwind_row fallback = {
+        .flags = DWUNW_UNWIND_ROW_FALLBACK,
+    };
+    uint16_t reg;
+
+    memset(row, 0, sizeof(*row));
+
+    if (cie->return_reg != table->ra_reg ||
+        (state->cfa_reg != table->sp_reg && state->cfa_reg != table->fp_reg) ||
+        !fits_int32(state->cfa_offset)) {
+        *row = fallback;
+        return;
+    }
+    row->cfa_reg = (uint8_t)state->cfa_reg;
+    row->cfa_offset = (int32_t)state->cfa_offset;
+
+    for (reg = 0; reg < DWUNW_REGSET_SLOTS; ++reg) {
+        const struct dwunw_cfi_reg_rule *rule = &state->regs[reg];
+
+        if (rule->kind == DWUNW_CFI_RULE_SAME_VALUE) {
+            continue;
+        }
+        if (rule->kind != DWUNW_CFI_RULE_OFFSET || !fits_int32(rule->offset)) {
+            *row = fallback;
+            return;
+        }
+        if (reg == table->ra_reg) {
+            row->ra_rule = DWUNW_UNWIND_RULE_OFFSET;
+            row->ra_offset = (int32_t)rule->offset;
+        } else if (reg == table->fp_reg) {
+            row->fp_rule = DWUNW_UNWIND_RULE_OFFSET;
+            row->fp_offset = (int32_t)rule->offset;
+        } else {
+            *row = fallback;
+            return;
+        }
+    }
+}
+
+/* A return address can be unwound through the frame record only if its
+ * function cannot make a call before the record is set up. SP-based rows
+ * qualify while only the return address sits above the CFA, where no
+ * ABI-aligned call is possible, or the caller's FP was just pushed by a
+ * function that goes on to make FP the CFA register (checked per FDE:
+ * without that, FP is an ordinary callee-saved register). */
+static void
+classify_fp_row(struct row_compiler *compiler, const struct dwunw_cfa_state *state)
+{
+    const struct dwunw_unwind_table *table = compiler->table;
+    const struct dwunw_cfi_reg_rule *fp = &state->regs[table->fp_reg];
+    const struct dwunw_cfi_reg_rule *ra = &state->regs[table->ra_reg];
+    int64_t word = compiler->fp_word;
+    bool fp_saved = fp->kind == DWUNW_CFI_RULE_OFFSET && fp->offset == -2 * word;
+
+    if (state->cfa_reg == table->fp_reg) {
+        if (state->cfa_offset == 2 * word && fp_saved &&
+            ra->kind == DWUNW_CFI_RULE_OFFSET && ra->offset == -word) {
+            compiler->fp_frame = true;
+            return;
+        }
+    } else if (state->cfa_reg == table->sp_reg) {
+        if (state->cfa_offset <= word) {
+            return;
+        }
+        if (state->cfa_offset == 2 * word && fp_saved) {
+            compiler->fp_pushed = true;
+            return;
+        }
+    }
+    compiler->fp_unsafe = true;
+}
+
+static dwunw_status_t
+collect_row(void *ctx, uint64_t pc, const struct dwunw_cfa_state *state)
+{
+    struct row_compiler *compiler = ctx;
+    struct dwunw_unwind_row row;
+
+    /* Locations outside the FDE's own range never get looked up here. */
+    if (pc < compiler->fde->pc_begin || pc >= compiler->limit) {
+        return DWUNW_OK;
+    }
+
+    if (compiler->fp_word) {
+        classify_fp_row(compiler, state);
+    }
+    compile_row(compiler->table, compiler->fde->cie, state, &row);
+    return row_vector_push(&compiler->scratch, pc, &row);
+}
+
+static int
+fde_compare(const void *lhs, const void *rhs)
+{
+    const struct dwunw_fde_record *a = lhs;
+    const struct dwunw_fde_record *b = rhs;
+    uint32_t a_eh = a->flags & DWUNW_CFI_FROM_EH_FRAME;
+    uint32_t b_eh = b->flags & DWUNW_CFI_FROM_EH_FRAME;
+
+    if (a->pc_begin != b->pc_begin) {
+        return a->pc_begin < b->pc_begin ? -1 : 1;
+    }
+    if (a_eh != b_eh) {
+        return a_eh ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Gather lazy .eh_frame entries and eager .debug_frame records into one
+ * array ordered like the lookup path prefers them. */
+static dwunw_status_t
+gather_fdes(const struct dwunw_dwarf_index *index,
+            struct dwunw_fde_record **fdes_out,
+            size_t *count_out)
+{
+    struct dwunw_fde_record *fdes;
+    size_t lazy_count = dwunw_cfi_lazy_count(index->lazy);
+    size_t total = lazy_count + index->fde_count;
+    size_t count = 0;
+    size_t i;
+
+    *fdes_out = NULL;
+    *count_out = 0;
+    if (total == 0) {
+        return DWUNW_ERR_NO_DEBUG_DATA;
+    }
+
+    fdes = malloc(total * sizeof(*fdes));
+    if (!fdes) {
+        return DWUNW_ERR_IO;
+    }
+
+    for (i = 0; i < lazy_count; ++i) {
+        /* Entries that fail to decode stay uncovered, just like lookups
+         * through dwunw_dwarf_index_find_fde() would treat them. */
+        if (dwunw_cfi_lazy_fde_at(index->lazy, i, &fdes[count]) == DWUNW_OK) {
+            count++;
+        }
+    }
+    for (i = 0; i < index->fde_count; ++i) {
+        fdes[count++] = index->fdes[i];
+    }
+
+    qsort(fdes, count, sizeof(*fdes), fde_compare);
+    *fdes_out = fdes;
+    *count_out = count;
+    return DWUNW_OK;
+}
+
+static const struct dwunw_unwind_row end_row = {
+    .flags = DWUNW_UNWIND_ROW_END,
+};
+
+static const struct dwunw_unwind_row fallback = {
+    .flags = DWUNW_UNWIND_ROW_FALLBACK,
+};
+
+static dwunw_status_t
+compile_fde(struct row_compiler *compiler, struct row_vector *out)
+{
+    const struct dwunw_fde_record *fde = compiler->fde;
+    dwunw_status_t st;
+    size_t i;
+
+    compiler->scratch.count = 0;
+    compiler->fp_frame = false;
+    compiler->fp_pushed = false;
+    compiler->fp_unsafe = fde->cie->return_reg != compiler->table->ra_reg;
+    st = dwunw_cfi_walk_rows(fde, collect_row, compiler);
+    if (st == DWUNW_ERR_IO) {
+        return st;
+    }
+    if (compiler->fp_pushed && !compiler->fp_frame) {
+        compiler->fp_unsafe = true;
+    }
+
+    if (st != DWUNW_OK || compiler->scratch.count == 0 ||
+        compiler->scratch.pcs[0] != fde->pc_begin) {
+        /* Unsupported opcodes or odd location programs: keep the range
+         * covered but let the interpreter deal with it. */
+        compiler->fp_unsafe = true;
+        st = row_vector_push(out, fde->pc_begin, &fallback);
+    } else {
+        for (i = 0; i < compiler->scratch.count && st == DWUNW_OK; ++i) {
+            st = row_vector_push(out,
+                                 compiler->scratch.pcs[i],
+                                 &compiler->scratch.rows[i]);
+        }
+    }
+    if (st != DWUNW_OK) {
+        return st;
+    }
+
+    /* Terminate the range; the next FDE overwrites this row when it starts
+     * right here. Past a nested FDE the enclosing one applies again, which
+     * only the interpreter's lookup resolves. */
+    return row_vector_push(out, compiler->limit, compiler->resume ? &fallback : &end_row);
+}
+
+static dwunw_status_t
+range_vector_note(struct range_vector *vec, uint64_t begin, uint64_t end, bool unsafe)
+{
+    if (!unsafe) {
+        vec->merge = false;
+        return DWUNW_OK;
+    }
+    if (vec->merge) {
+        vec->ranges[vec->count - 1].end = end;
+        return DWUNW_OK;
+    }
+    if (vec->count == DWUNW_UNWIND_FP_EXCEPTIONS_MAX) {
+        vec->overflow = true;
+        return DWUNW_OK;
+    }
+    if (!vec->ranges) {
+        vec->ranges = calloc(DWUNW_UNWIND_FP_EXCEPTIONS_MAX, sizeof(*vec->ranges));
+        if (!vec->ranges) {
+            return DWUNW_ERR_IO;
+        }
+    }
+    vec->ranges[vec->count].begin = begin;
+    vec->ranges[vec->count].end = end;
+    vec->count++;
+    vec->merge = true;
+    return DWUNW_OK;
+}
+
+dwunw_status_t
+dwunw_unwind_table_build(const struct dwunw_dwarf_index *index,
+                         uint16_t machine,
+                         struct dwunw_unwind_table **table_out)
+{
+    const struct dwunw_arch_ops *ops;
+    struct dwunw_unwind_table *table;
+    struct row_compiler compiler;
+    struct row_vector rows;
+    struct range_vector fp_exceptions;
+    struct dwunw_fde_record *fdes;
+    size_t fde_count;
+    size_t fp_frames = 0;
+    uint64_t reach = 0;
+    bool resumed = false;
+    dwunw_status_t st = DWUNW_OK;
+    size_t i;
+
+    if (!index || !table_out) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+    *table_out = NULL;
+
+    ops = dwunw_arch_from_elf_machine(machine);
+    if (!ops) {
+        return DWUNW_ERR_UNSUPPORTED_ARCH;
+    }
+
+    table = calloc(1, sizeof(*table));
+    if (!table) {
+        return DWUNW_ERR_IO;
+    }
+    table->machine = machine;
+    table->sp_reg = ops->sp_reg;
+    table->fp_reg = ops->fp_reg;
+    table->ra_reg = ops->ra_reg;
+
+    st = gather_fdes(index, &fdes, &fde_count);
+    if (st != DWUNW_OK) {
+        free(table);
+        return st;
+    }
+
+    memset(&compiler, 0, sizeof(compiler));
+    memset(&rows, 0, sizeof(rows));
+    memset(&fp_exceptions, 0, sizeof(fp_exceptions));
+    compiler.table = table;
+    /* Both LP64 targets keep the frame record as {caller FP, return
+     * address} at FP; MIPS frames have no fixed layout. */
+    if (ops->arch == DWUNW_ARCH_X86_64 || ops->arch == DWUNW_ARCH_ARM64) {
+        compiler.fp_word = 8;
+    }
+
+    for (i = 0; i < fde_count; ++i) {
+        const struct dwunw_fde_record *fde = &fdes[i];
+        uint64_t end = fde->pc_begin + fde->pc_range;
+        size_t next = i + 1;
+
+        if (fde->pc_range == 0 ||
+            (i > 0 && fdes[i - 1].pc_begin == fde->pc_begin)) {
+            continue;
+        }
+
+        /* The FDEs enclosing a range handed back to the interpreter end
+         * before this one starts: close it there. */
+        if (resumed && reach <= fde->pc_begin) {
+            resumed = false;
+            st = row_vector_push(&rows, reach, &end_row);
+            if (st != DWUNW_OK) {
+                break;
+            }
+        }
+
+        /* A later FDE starting inside this one takes over from there on. */
+        while (next < fde_count &&
+               (fdes[next].pc_begin == fde->pc_begin || fdes[next].pc_range == 0)) {
+            next++;
+        }
+
+        compiler.fde = fde;
+        compiler.limit = end;
+        if (next < fde_count && fdes[next].pc_begin < end) {
+            compiler.limit = fdes[next].pc_begin;
+        }
+        compiler.resume = reach > compiler.limit;
+        if (end > reach) {
+            reach = end;
+        }
+        resumed = compiler.resume;
+
+        st = compile_fde(&compiler, &rows);
+        if (st == DWUNW_OK && compiler.fp_word) {
+            fp_frames += compiler.fp_frame && !compiler.fp_unsafe;
+            st = range_vector_note(&fp_exceptions,
+                                   fde->pc_begin,
+                                   compiler.limit,
+                                   compiler.fp_unsafe);
+        }
+        if (st != DWUNW_OK) {
+            break;
+        }
+    }
+
+    if (st == DWUNW_OK && resumed) {
+        st = row_vector_push(&rows, reach, &end_row);
+    }
+
+    free(compiler.scratch.pcs);
+    free(compiler.scratch.rows);
+    free(fdes);
+
+    if (st != DWUNW_OK) {
+        free(rows.pcs);
+        free(rows.rows);
+        free(fp_exceptions.ranges);
+        free(table);
+        return st;
+    }
+
+    table->pcs = rows.pcs;
+    table->rows = rows.rows;
+    table->count = rows.count;
+    if (fp_frames > 0 && !fp_exceptions.overflow) {
+        table->flags |= DWUNW_UNWIND_TABLE_FRAME_POINTER;
+        table->fp_exceptions = fp_exceptions.ranges;
+        table->fp_exception_count = fp_exceptions.count;
+    } else {
+        free(fp_exceptions.ranges);
+    }
+    *table_out = table;
+    return DWUNW_OK;
+}
+
+void
+dwunw_unwind_table_free(struct dwunw_unwind_table *table)
+{
+    if (!table) {
+        return;
+    }
+
+    if (table->map) {
+        munmap(table->map, table->map_size);
+    } else {
+        free((void *)table->pcs);
+        free((void *)table->rows);
+        free((void *)table->fp_exceptions);
+    }
+    free(table);
+}
+
+static dwunw_status_t
+write_all(int fd, const void *data, size_t size)
+{
+    const uint8_t *cursor = data;
+
+    while (size > 0) {
+        ssize_t written = write(fd, cursor, size);
+        if (written < 0) {
+            return DWUNW_ERR_IO;
+        }
+        cursor += written;
+        size -= (size_t)written;
+    }
+
+    return DWUNW_OK;
+}
+
+dwunw_status_t
+dwunw_unwind_table_store(const struct dwunw_unwind_table *table,
+                         const char *path,
+                         const uint8_t *build_id,
+                         size_t build_id_len)
+{
+    struct dwunw_unwind_table_file_header header;
+    char tmp_path[DWUNW_MAX_PATH_LEN];
+    dwunw_status_t st;
+    int fd;
+    int len;
+
+    if (!table || !path || !build_id || build_id_len == 0 ||
+        build_id_len > sizeof(header.build_id)) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, DWUNW_UNWIND_TABLE_MAGIC, sizeof(DWUNW_UNWIND_TABLE_MAGIC));
+    header.version = DWUNW_UNWIND_TABLE_VERSION;
+    header.byte_order = 0x01020304u;
+    header.header_size = sizeof(header);
+    header.row_size = sizeof(struct dwunw_unwind_row);
+    header.machine = table->machine;
+    header.sp_reg = table->sp_reg;
+    header.fp_reg = table->fp_reg;
+    header.ra_reg = table->ra_reg;
+    header.count = table->count;
+    header.build_id_len = (uint8_t)build_id_len;
+    header.flags = (uint8_t)table->flags;
+    header.fp_exception_count = (uint32_t)table->fp_exception_count;
+    memcpy(header.build_id, build_id, build_id_len);
+
+    /* Readers only ever see a complete file: write aside, then rename. */
+    len = snprintf(tmp_path, sizeof(tmp_path), "%s.%ld.tmp", path, (long)getpid());
+    if (len < 0 || (size_t)len >= sizeof(tmp_path)) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return DWUNW_ERR_IO;
+    }
+
+    st = write_all(fd, &header, sizeof(header));
+    if (st == DWUNW_OK) {
+        st = write_all(fd, table->pcs, table->count * sizeof(*table->pcs));
+    }
+    if (st == DWUNW_OK) {
+        st = write_all(fd, table->rows, table->count * sizeof(*table->rows));
+    }
+    if (st == DWUNW_OK && table->fp_exception_count) {
+        st = write_all(fd,
+                       table->fp_exceptions,
+                       table->fp_exception_count * sizeof(*table->fp_exceptions));
+    }
+    if (close(fd) != 0 && st == DWUNW_OK) {
+        st = DWUNW_ERR_IO;
+    }
+    if (st == DWUNW_OK && rename(tmp_path, path) != 0) {
+        st = DWUNW_ERR_IO;
+    }
+    if (st != DWUNW_OK) {
+        unlink(tmp_path);
+    }
+
+    return st;
+}
+
+/* Both arrays are binary searched straight from the mapping; a file that is
+ * stale or corrupt in a way the header cannot tell must not yield wrong
+ * rows, so check the ordering once. */
+static bool
+table_ordered(const uint64_t *pcs,
+              size_t count,
+              const struct dwunw_unwind_range *ranges,
+              size_t range_count)
+{
+    size_t i;
+
+    for (i = 1; i < count; ++i) {
+        if (pcs[i - 1] >= pcs[i]) {
+            return false;
+        }
+    }
+    for (i = 0; i < range_count; ++i) {
+        if (ranges[i].begin >= ranges[i].end ||
+            (i > 0 && ranges[i - 1].end > ranges[i].begin)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+dwunw_status_t
+dwunw_unwind_table_load(const char *path,
+                        uint16_t machine,
+                        const uint8_t *build_id,
+                        size_t build_id_len,
+                        struct dwunw_unwind_table **table_out)
+{
+    const struct dwunw_unwind_table_file_header *header;
+    struct dwunw_unwind_table *table;
+    const struct dwunw_unwind_range *ranges;
+    const struct dwunw_unwind_row *rows;
+    const uint64_t *pcs;
+    const uint8_t *base;
+    struct stat st;
+    size_t size;
+    void *map;
+    int fd;
+
+    if (!path || !build_id || !table_out) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+    *table_out = NULL;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return DWUNW_ERR_IO;
+    }
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return DWUNW_ERR_IO;
+    }
+    size = (size_t)st.st_size;
+    if (size < sizeof(*header)) {
+        close(fd);
+        return DWUNW_ERR_BAD_FORMAT;
+    }
+
+    map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return DWUNW_ERR_IO;
+    }
+
+    base = map;
+    header = map;
+    if (memcmp(header->magic, DWUNW_UNWIND_TABLE_MAGIC, sizeof(DWUNW_UNWIND_TABLE_MAGIC)) != 0 ||
+        header->version != DWUNW_UNWIND_TABLE_VERSION ||
+        header->byte_order != 0x01020304u ||
+        header->header_size != sizeof(*header) ||
+        header->row_size != sizeof(struct dwunw_unwind_row) ||
+        header->machine != machine ||
+        header->build_id_len != build_id_len ||
+        memcmp(header->build_id, build_id, build_id_len) != 0 ||
+        header->count == 0 ||
+        header->count > (size - sizeof(*header)) /
+                        (sizeof(uint64_t) + sizeof(struct dwunw_unwind_row)) ||
+        header->fp_exception_count > DWUNW_UNWIND_FP_EXCEPTIONS_MAX ||
+        size != sizeof(*header) +
+                header->count * (sizeof(uint64_t) + sizeof(struct dwunw_unwind_row)) +
+                header->fp_exception_count * sizeof(struct dwunw_unwind_range)) {
+        munmap(map, size);
+        return DWUNW_ERR_BAD_FORMAT;
+    }
+
+    pcs = (const uint64_t *)(const void *)(base + sizeof(*header));
+    rows = (const struct dwunw_unwind_row *)(const void *)(pcs + header->count);
+    ranges = (const struct dwunw_unwind_range *)(const void *)(rows + header->count);
+    if (!table_ordered(pcs, (size_t)header->count, ranges, header->fp_exception_count)) {
+        munmap(map, size);
+        return DWUNW_ERR_BAD_FORMAT;
+    }
+
+    table = calloc(1, sizeof(*table));
+    if (!table) {
+        munmap(map, size);
+        return DWUNW_ERR_IO;
+    }
+
+    table->machine = header->machine;
+    table->sp_reg = header->sp_reg;
+    table->fp_reg = header->fp_reg;
+    table->ra_reg = header->ra_reg;
+    table->count = (size_t)header->count;
+    table->pcs = pcs;
+    table->rows = rows;
+    table->flags = header->flags & DWUNW_UNWIND_TABLE_FRAME_POINTER;
+    table->fp_exception_count = header->fp_exception_count;
+    table->fp_exceptions = ranges;
+    table->map = map;
+    table->map_size = size;
+    *table_out = table;
+    return DWUNW_OK;
+}
+
+const struct dwunw_unwind_row *
+dwunw_unwind_table_find(const struct dwunw_unwind_table *table, uint64_t pc)
+{
+    const struct dwunw_unwind_row *row;
+    size_t lo = 0;
+    size_t hi;
+
+    if (!table) {
+        return NULL;
+    }
+
+    hi = table->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (table->pcs[mid] <= pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return NULL;
+    }
+
+    row = &table->rows[lo - 1];
+    return (row->flags & DWUNW_UNWIND_ROW_END) ? NULL : row;
+}
+
+bool
+dwunw_unwind_table_fp_safe(const struct dwunw_unwind_table *table, uint64_t pc)
+{
+    const struct dwunw_unwind_row *row;
+    size_t lo = 0;
+    size_t hi;
+
+    if (!table || !(table->flags & DWUNW_UNWIND_TABLE_FRAME_POINTER)) {
+        return false;
+    }
+    /* Gaps between FDEs (PLT stubs, hand-written asm) carry an END row:
+     * nothing says such code keeps a frame record. FALLBACK rows were never
+     * classified either. */
+    row = dwunw_unwind_table_find(table, pc);
+    if (!row || (row->flags & DWUNW_UNWIND_ROW_FALLBACK)) {
+        return false;
+    }
+
+    hi = table->fp_exception_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (pc < table->fp_exceptions[mid].begin) {
+            hi = mid;
+        } else if (pc >= table->fp_exceptions[mid].end) {
+            lo = mid + 1;
+        } else {
+            return false;
+        }
+    }
+    return true;
+}
+
+dwunw_status_t
+dwunw_unwind_row_rules(const struct dwunw_unwind_table *table,
+                       const struct dwunw_unwind_row *row,
+                       struct dwunw_cfi_rules *rules)
+{
+    if (!table || !row || !rules) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+    if (row->flags & (DWUNW_UNWIND_ROW_END | DWUNW_UNWIND_ROW_FALLBACK)) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+    if (row->cfa_reg >= DWUNW_REGSET_SLOTS ||
+        table->ra_reg >= DWUNW_REGSET_SLOTS ||
+        table->fp_reg >= DWUNW_REGSET_SLOTS) {
+        return DWUNW_ERR_BAD_FORMAT;
+    }
+
+    memset(rules, 0, sizeof(*rules));
+    rules->cfa_reg = row->cfa_reg;
+    rules->cfa_offset = row->cfa_offset;
+    rules->return_reg = (uint8_t)table->ra_reg;
+    if (row->ra_rule == DWUNW_UNWIND_RULE_OFFSET) {
+        rules->saved_reg[rules->saved_count] = (uint8_t)table->ra_reg;
+        rules->saved_offset[rules->saved_count++] = row->ra_offset;
+    }
+    if (row->fp_rule == DWUNW_UNWIND_RULE_OFFSET) {
+        rules->saved_reg[rules->saved_count] = (uint8_t)table->fp_reg;
+        rules->saved_offset[rules->saved_count++] = row->fp_offset;
+    }
+    return DWUNW_OK;
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "dwunw/arch_ops.h"
+#include "dwunw/dwarf_index.h"
+#include "dwunw/status.h"
+#include "dwunw/unwind.h"
+
+#include "cfi.h"
+
+/*
+ * Compiled unwind table, modelled after the kernel's ORC format: every CIE/FDE
+ * program of a module is replayed once and flattened into rows sorted by the
+ * PC at which they become active. A lookup is a binary search over pcs[]
+ * followed by a handful of loads; no DWARF bytecode runs on the hot path.
+ *
+ * Rows only restore CFA, return address and frame pointer. Anything richer
+ * (other callee-saved registers, CFA based on a general register, expression
+ * rules) is marked FALLBACK and left to dwunw_cfi_eval(), as is the rest of
+ * an FDE past the end of one nested inside it.
+ */
+
+enum {
+    DWUNW_UNWIND_ROW_END      = 1u << 0, /* no CFI covers this range */
+    DWUNW_UNWIND_ROW_FALLBACK = 1u << 1, /* interpret the FDE instead */
+};
+
+enum {
+    /* Outside fp_exceptions[], every function whose CFI the table was built
+     * from keeps the standard frame record (saved FP at [FP], return
+     * address at [FP + 8], CFA = FP + 16) wherever it can make a call. */
+    DWUNW_UNWIND_TABLE_FRAME_POINTER = 1u << 0,
+};
+
+/* Modules with more FDEs outside the frame-pointer convention than this
+ * are left to the row table and interpreter entirely. */
+#define DWUNW_UNWIND_FP_EXCEPTIONS_MAX 64
+
+struct dwunw_unwind_range {
+    uint64_t begin;
+    uint64_t end;         /* exclusive */
+};
+
+enum dwunw_unwind_rule {
+    DWUNW_UNWIND_RULE_SAME_VALUE = 0,
+    DWUNW_UNWIND_RULE_OFFSET     = 1,  /* saved at CFA + offset */
+};
+
+struct dwunw_unwind_row {
+    int32_t cfa_offset;
+    int32_t ra_offset;
+    int32_t fp_offset;
+    uint8_t cfa_reg;      /* DWARF register number, index into regs[] */
+    uint8_t ra_rule;      /* dwunw_unwind_rule */
+    uint8_t fp_rule;      /* dwunw_unwind_rule */
+    uint8_t flags;        /* DWUNW_UNWIND_ROW_* */
+};
+
+struct dwunw_unwind_table {
+    uint16_t machine;     /* e_machine the register numbers belong to */
+    uint16_t sp_reg;
+    uint16_t fp_reg;
+    uint16_t ra_reg;
+    uint32_t flags;       /* DWUNW_UNWIND_TABLE_* */
+    size_t count;
+    const uint64_t *pcs;  /* start PC of rows[i], kept apart for lookups */
+    const struct dwunw_unwind_row *rows;
+    /* Sorted, disjoint ranges where frame-pointer walking is not safe; only
+     * meaningful with DWUNW_UNWIND_TABLE_FRAME_POINTER. */
+    size_t fp_exception_count;
+    const struct dwunw_unwind_range *fp_exceptions;
+    void *map;            /* backing file mapping when loaded from disk */
+    size_t map_size;
+};
+
+/*
+ * On-disk form, written by dwunw_unwind_table_store(): a fixed header
+ * followed by pcs[count], rows[count] and fp_exceptions[fp_exception_count]
+ * exactly as they sit in memory, so a loaded table is a read-only mmap() of
+ * the file with no decoding step. The file is host-endian; the byte-order
+ * probe and version reject foreign or stale files, which are then simply
+ * recompiled.
+ */
+#define DWUNW_UNWIND_TABLE_MAGIC   "DWUNWTB"
+#define DWUNW_UNWIND_TABLE_VERSION 2u
+
+struct dwunw_unwind_table_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;  /* 0x01020304 in the producer's byte order */
+    uint32_t header_size;
+    uint32_t row_size;
+    uint16_t machine;
+    uint16_t sp_reg;
+    uint16_t fp_reg;
+    uint16_t ra_reg;
+    uint64_t count;
+    uint8_t build_id_len;
+    uint8_t flags;        /* DWUNW_UNWIND_TABLE_* */
+    uint8_t reserved[2];
+    uint32_t fp_exception_count;
+    uint8_t build_id[DWUNW_BUILD_ID_MAX];
+};
+
+/* Compile every FDE reachable through the index (lazy .eh_frame entries and
+ * eagerly parsed .debug_frame records). Where both sections describe the same
+ * start PC the .eh_frame entry wins, matching dwunw_dwarf_index_find_fde(). */
+dwunw_status_t
+dwunw_unwind_table_build(const struct dwunw_dwarf_index *index,
+                         uint16_t machine,
+                         struct dwunw_unwind_table **table_out);
+
+void
+dwunw_unwind_table_free(struct dwunw_unwind_table *table);
+
+/* Serialize the table to path (atomically, through a temporary file). */
+dwunw_status_t
+dwunw_unwind_table_store(const struct dwunw_unwind_table *table,
+                         const char *path,
+                         const uint8_t *build_id,
+                         size_t build_id_len);
+
+/* Map a table written by dwunw_unwind_table_store(). Fails with
+ * DWUNW_ERR_BAD_FORMAT when the file belongs to another build, machine or
+ * format version. */
+dwunw_status_t
+dwunw_unwind_table_load(const char *path,
+                        uint16_t machine,
+                        const uint8_t *build_id,
+                        size_t build_id_len,
+                        struct dwunw_unwind_table **table_out);
+
+/* Row in effect at pc, or NULL when no CFI covers it. */
+const struct dwunw_unwind_row *
+dwunw_unwind_table_find(const struct dwunw_unwind_table *table, uint64_t pc);
+
+/* Whether pc, a return address inside the module, may be unwound by
+ * following the frame-pointer chain instead of looking up its row. PCs
+ * without CFI are never FP-safe. */
+bool
+dwunw_unwind_table_fp_safe(const struct dwunw_unwind_table *table, uint64_t pc);
+
+/* A non-FALLBACK row as CFI rules for dwunw_cfi_rules_apply(), so rows
+ * and FDEs share one step and one rule cache. */
+dwunw_status_t
+dwunw_unwind_row_rules(const struct dwunw_unwind_table *table,
+                       const struct dwunw_unwind_row *row,
+                       struct dwunw_cfi_rules *rules);
@@ -1,11 +1,20 @@
+#define _POSIX_C_SOURCE 200809L
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
+#include "dwunw/addr_space.h"
 #include "dwunw/dwunw_api.h"
 #include "dwunw/module_cache.h"
 #include "dwunw/stack_reader.h"
 #include "dwunw/unwind.h"
+#include "core/stats_internal.h"
 #include "dwarf/cfi.h"
+#include "dwarf/rule_cache.h"
+#include "dwarf/unwind_table.h"
 
 static dwunw_status_t
 default_stack_reader_mem(void *ctx, uint64_t address, void *dst, size_t size)
@@ -14,6 +23,13 @@ default_stack_reader_mem(void *ctx, uint64_t address, void *dst, size_t size)
     return dwunw_stack_reader_read(session, address, dst, size);
 }
 
+static dwunw_status_t
+default_stack_reader_memv(void *ctx, const struct dwunw_read_iov *iov, size_t count)
+{
+    struct dwunw_stack_reader_session *session = ctx;
+    return dwunw_stack_reader_readv(session, iov, count);
+}
+
 static dwunw_status_t
 prepare_root_frame(const struct dwunw_regset *regs, struct dwunw_frame *frame)
 {
@@ -59,123 +75,762 @@ prepare_root_frame(const struct dwunw_regset *regs, struct dwunw_frame *frame)
     return DWUNW_OK;
 }
 
-dwunw_status_t
-dwunw_capture(struct dwunw_context *ctx,
-              const struct dwunw_unwind_request *request,
-              size_t *frames_written)
+/* Rules for rel_pc (link-time address inside the current module): the
+ * compiled row when the module has one, else the DWARF interpreter (rows
+ * marked FALLBACK, modules without a table). */
+static dwunw_status_t
+resolve_step(const struct dwunw_dwarf_index *index,
+             const struct dwunw_arch_ops *ops,
+             uint64_t rel_pc,
+             const struct dwunw_memory_reader *mem,
+             struct dwunw_cfi_rules *rules)
+{
+    struct dwunw_fde_record fde;
+    dwunw_status_t status;
+
+    if (index->table && ops && ops->elf_machine == index->table->machine) {
+        const struct dwunw_unwind_row *row = dwunw_unwind_table_find(index->table,
+                                                                     rel_pc);
+        if (!row) {
+            return DWUNW_ERR_NO_DEBUG_DATA;
+        }
+        if (!(row->flags & DWUNW_UNWIND_ROW_FALLBACK)) {
+            DWUNW_STATS_ADD(mem->stats, table_lookups, 1);
+            return dwunw_unwind_row_rules(index->table, row, rules);
+        }
+    }
+
+    DWUNW_STATS_ADD(mem->stats, fde_lookups, 1);
+    status = dwunw_dwarf_index_find_fde(index, rel_pc, &fde);
+    if (status != DWUNW_OK) {
+        return status;
+    }
+
+    return dwunw_cfi_resolve(&fde, rel_pc, mem, rules);
+}
+
+/* Follow the frame record at FP: caller's FP at [FP], return address at
+ * [FP + 8], CFA = FP + 16. A record that cannot belong to an outer frame
+ * yields DWUNW_ERR_NOT_IMPLEMENTED so the caller falls back to the CFI. */
+static dwunw_status_t
+fp_step(const struct dwunw_unwind_table *table,
+        struct dwunw_regset *regs,
+        const struct dwunw_memory_reader *mem,
+        struct dwunw_frame *frame)
+{
+    struct dwunw_read_iov iov[2];
+    uint64_t fp = regs->regs[table->fp_reg];
+    uint64_t saved_fp;
+    uint64_t ra;
+    dwunw_status_t status;
+
+    if (fp < regs->sp || (fp & 7u) || fp > UINT64_MAX - 16) {
+        return DWUNW_ERR_NOT_IMPLEMENTED;
+    }
+
+    iov[0].address = fp;
+    iov[0].dst = &saved_fp;
+    iov[0].size = sizeof(saved_fp);
+    iov[1].address = fp + 8;
+    iov[1].dst = &ra;
+    iov[1].size = sizeof(ra);
+    status = dwunw_memory_read_batch(mem, iov, 2);
+    if (status != DWUNW_OK) {
+        return status;
+    }
+
+    regs->regs[table->fp_reg] = saved_fp;
+    regs->regs[table->ra_reg] = ra;
+    regs->regs[table->sp_reg] = fp + 16;
+    regs->pc = ra;
+    regs->sp = fp + 16;
+
+    frame->pc = ra;
+    frame->ra = ra;
+    frame->sp = fp + 16;
+    frame->cfa = fp + 16;
+    frame->flags = 0;
+    return DWUNW_OK;
+}
+
+/* Recover the caller of the frame at rel_pc. A return address (any frame
+ * but the innermost) inside a module compiled to keep frame pointers sits
+ * at a call site with the frame record in place, so the walk just follows
+ * FP there. Otherwise rules found in the context's cache are replayed
+ * directly, and anything else is resolved once and cached for the next time
+ * a walk passes through the same PC. */
+static dwunw_status_t
+unwind_step(struct dwunw_context *ctx,
+            const struct dwunw_dwarf_index *index,
+            const struct dwunw_arch_ops *ops,
+            uint64_t rel_pc,
+            bool return_address,
+            struct dwunw_regset *regs,
+            const struct dwunw_memory_reader *mem,
+            struct dwunw_frame *frame)
+{
+    struct dwunw_cfi_rules rules;
+    uint64_t epoch = ctx->module_cache.epoch;
+    dwunw_status_t status;
+
+    /* rel_pc - 1 stays inside the caller when the call was its last
+     * instruction. */
+    if (return_address && (ctx->module_cache.flags & DWUNW_MODULE_CACHE_FRAME_POINTER) &&
+        index->table && ops &&
+        ops->elf_machine == index->table->machine &&
+        dwunw_unwind_table_fp_safe(index->table, rel_pc - 1)) {
+        status = fp_step(index->table, regs, mem, frame);
+        if (status != DWUNW_ERR_NOT_IMPLEMENTED) {
+            DWUNW_STATS_ADD(mem->stats, fp_steps, status == DWUNW_OK);
+            return status;
+        }
+    }
+
+    if (ctx->rule_cache) {
+        const struct dwunw_cfi_rules *cached =
+            dwunw_rule_cache_find(ctx->rule_cache, index, rel_pc, epoch);
+        if (cached) {
+            DWUNW_STATS_ADD(mem->stats, rule_hits, 1);
+            return dwunw_cfi_rules_apply(cached, regs, mem, frame);
+        }
+        DWUNW_STATS_ADD(mem->stats, rule_misses, 1);
+    }
+
+    status = resolve_step(index, ops, rel_pc, mem, &rules);
+    if (status != DWUNW_OK) {
+        return status;
+    }
+    if (ctx->rule_cache) {
+        dwunw_rule_cache_store(ctx->rule_cache, index, rel_pc, epoch, &rules);
+    }
+    return dwunw_cfi_rules_apply(&rules, regs, mem, frame);
+}
+
+/* Tracks which module the walk is currently in. With a fixed module_path
+ * the handle never changes and the bias is zero; with an address space the
+ * cursor follows each PC into the mapping (and module) that contains it. */
+struct module_cursor {
+    struct dwunw_context *ctx;
+    struct dwunw_addr_space *space;
+    struct dwunw_addr_space_mapping *mapping;
+    struct dwunw_module_handle *handle;
+    const char *path;
+    uint64_t bias;
+    pid_t pid;
+    bool refreshed;
+    /* path that module_id was interned for; reset with the mapping, since
+     * a released address space may hand the same storage to another path */
+    const char *interned_path;
+    uint32_t module_id;
+};
+
+static void
+module_cursor_release(struct module_cursor *cursor)
+{
+    if (cursor->handle) {
+        dwunw_module_cache_release(&cursor->ctx->module_cache, cursor->handle);
+    }
+    cursor->handle = NULL;
+    cursor->mapping = NULL;
+    cursor->path = "";
+    cursor->bias = 0;
+    cursor->interned_path = NULL;
+}
+
+/* Acquire the module behind mapping, preferring the process's own view of
+ * the filesystem so binaries in other mount namespaces resolve correctly. */
+static dwunw_status_t
+module_cursor_open(struct module_cursor *cursor,
+                   const char *path,
+                   struct dwunw_module_handle **handle_out)
+{
+    char rooted[DWUNW_MAX_PATH_LEN];
+    dwunw_status_t status = DWUNW_ERR_IO;
+    int len;
+
+    len = snprintf(rooted, sizeof(rooted), "/proc/%d/root%s", (int)cursor->pid, path);
+    if (len > 0 && (size_t)len < sizeof(rooted)) {
+        status = dwunw_module_cache_acquire(&cursor->ctx->module_cache, rooted, handle_out);
+    }
+    if (status == DWUNW_ERR_IO) {
+        status = dwunw_module_cache_acquire(&cursor->ctx->module_cache, path, handle_out);
+    }
+
+    return status;
+}
+
+/* Point the cursor at the module containing pc; DWUNW_ERR_NO_DEBUG_DATA
+ * when pc lies outside every usable file-backed mapping. */
+static dwunw_status_t
+module_cursor_seek(struct module_cursor *cursor, uint64_t pc)
 {
-    const struct dwunw_unwind_request *effective = request;
+    struct dwunw_addr_space_mapping *mapping;
     struct dwunw_module_handle *handle = NULL;
-    struct dwunw_stack_reader_session session;
-    dwunw_memory_read_fn reader_fn = NULL;
-    void *reader_ctx = NULL;
-    bool using_stack_reader = false;
-    dwunw_status_t reader_status = DWUNW_OK;
-    dwunw_status_t status = DWUNW_OK;
-    size_t produced = 0;
+    const char *path;
+    dwunw_status_t status;
 
-    if (frames_written) {
-        *frames_written = 0;
+    if (!cursor->space) {
+        return DWUNW_OK;
     }
 
-    if (!ctx || !request || !request->regs || !request->frames ||
-        request->max_frames == 0 || !request->module_path) {
-        return DWUNW_ERR_INVALID_ARG;
+    mapping = cursor->mapping;
+    if (mapping && pc >= mapping->start && pc < mapping->end) {
+        return DWUNW_OK;
     }
 
-    if (!ctx->module_cache_ready) {
-        return DWUNW_ERR_INVALID_ARG;
+    mapping = dwunw_addr_space_lookup(cursor->space, pc);
+    if (!mapping && !cursor->refreshed) {
+        /* Possibly a library mapped after the snapshot; re-read once. */
+        cursor->refreshed = true;
+        module_cursor_release(cursor);
+        status = dwunw_addr_space_refresh(&cursor->ctx->addr_spaces,
+                                          cursor->pid,
+                                          &cursor->space);
+        if (status != DWUNW_OK) {
+            cursor->space = NULL;
+            return DWUNW_ERR_NO_DEBUG_DATA;
+        }
+        mapping = dwunw_addr_space_lookup(cursor->space, pc);
+    }
+    if (!mapping) {
+        module_cursor_release(cursor);
+        return DWUNW_ERR_NO_DEBUG_DATA;
+    }
+
+    path = dwunw_addr_space_path(cursor->space, mapping);
+    if (mapping->bias_state == DWUNW_ADDR_SPACE_BIAS_FAILED) {
+        module_cursor_release(cursor);
+        cursor->path = path;
+        return DWUNW_ERR_NO_DEBUG_DATA;
     }
 
-    if (ctx->stack_reader_ready &&
-        effective->pid > 0 && effective->max_frames > 1) {
-        dwunw_status_t attach_status = dwunw_stack_reader_attach(&ctx->stack_reader,
-                                                                 effective->pid,
-                                                                 effective->tid,
-                                                                 &session);
-        if (attach_status == DWUNW_OK) {
-            reader_fn = default_stack_reader_mem;
-            reader_ctx = &session;
-            using_stack_reader = true;
+    if (cursor->handle && cursor->mapping &&
+        cursor->mapping->path_offset == mapping->path_offset) {
+        handle = cursor->handle;
+        cursor->handle = NULL;
+    } else {
+        module_cursor_release(cursor);
+        /* Frames keep naming the module even when it cannot be unwound. */
+        cursor->path = path;
+        status = module_cursor_open(cursor, path, &handle);
+        if (status != DWUNW_OK) {
+            if (status != DWUNW_ERR_CACHE_FULL) {
+                mapping->bias_state = DWUNW_ADDR_SPACE_BIAS_FAILED;
+                status = DWUNW_ERR_NO_DEBUG_DATA;
+            }
+            return status;
+        }
+    }
+
+    if (mapping->bias_state == DWUNW_ADDR_SPACE_BIAS_UNKNOWN) {
+        if (dwunw_elf_load_bias(&handle->elf,
+                                mapping->start,
+                                mapping->offset,
+                                mapping->end - mapping->start,
+                                &mapping->bias) == DWUNW_OK) {
+            mapping->bias_state = DWUNW_ADDR_SPACE_BIAS_KNOWN;
         } else {
-            reader_status = attach_status;
+            mapping->bias_state = DWUNW_ADDR_SPACE_BIAS_FAILED;
+            dwunw_module_cache_release(&cursor->ctx->module_cache, handle);
+            module_cursor_release(cursor);
+            cursor->path = path;
+            return DWUNW_ERR_NO_DEBUG_DATA;
         }
     }
 
-    status = dwunw_module_cache_acquire(&ctx->module_cache,
-                                        effective->module_path,
-                                        &handle);
-    if (status != DWUNW_OK) {
-        if (using_stack_reader) {
-            dwunw_stack_reader_detach(&session);
+    cursor->handle = handle;
+    cursor->mapping = mapping;
+    cursor->path = path;
+    cursor->bias = mapping->bias;
+    return DWUNW_OK;
+}
+
+static void
+frame_set_module(struct dwunw_frame *frame, const char *path)
+{
+    strncpy(frame->module_path, path, sizeof(frame->module_path) - 1);
+    frame->module_path[sizeof(frame->module_path) - 1] = '\0';
+}
+
+/* State shared by the requests of one dwunw_capture_batch() call; a plain
+ * dwunw_capture() is a batch of one. Requests are processed grouped by
+ * thread and module, so consecutive ones keep the reader session and the
+ * module handles of their predecessor instead of setting them up again. */
+struct capture_batch {
+    struct dwunw_context *ctx;
+    struct module_cursor cursor;
+    const char *fixed_path;   /* module_path the cursor holds, if any */
+    struct dwunw_stack_reader_session session;
+    bool session_open;
+    pid_t attach_pid;         /* thread of the last attach attempt */
+    pid_t attach_tid;
+    dwunw_status_t attach_status;
+};
+
+static void
+capture_batch_init(struct capture_batch *batch, struct dwunw_context *ctx)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->ctx = ctx;
+    batch->cursor.ctx = ctx;
+    batch->cursor.path = "";
+}
+
+static void
+capture_batch_drop_cursor(struct capture_batch *batch)
+{
+    module_cursor_release(&batch->cursor);
+    batch->cursor.space = NULL;
+    batch->cursor.pid = 0;
+    batch->fixed_path = NULL;
+}
+
+static void
+capture_batch_drop_session(struct capture_batch *batch)
+{
+    if (batch->session_open) {
+        dwunw_stats_add(&batch->ctx->stats.syscalls, batch->session.syscalls);
+        dwunw_stack_reader_detach(&batch->session);
+        batch->session_open = false;
+    }
+    batch->attach_pid = 0;
+    batch->attach_tid = 0;
+    batch->attach_status = DWUNW_OK;
+}
+
+static void
+capture_batch_finish(struct capture_batch *batch)
+{
+    capture_batch_drop_cursor(batch);
+    capture_batch_drop_session(batch);
+}
+
+/* Pick the reader for request: caller callbacks, then a stack snapshot,
+ * then the built-in reader, whose session is kept while the thread stays
+ * the same. Attach failures are remembered for that thread too. */
+static dwunw_status_t
+capture_batch_reader(struct capture_batch *batch,
+                     const struct dwunw_unwind_request *request,
+                     struct dwunw_memory_reader *mem)
+{
+    struct dwunw_context *ctx = batch->ctx;
+    pid_t tid = request->tid > 0 ? request->tid : request->pid;
+
+    mem->read = NULL;
+    mem->readv = NULL;
+    mem->ctx = NULL;
+    mem->stats = &ctx->stats;
+
+    if (request->read_memory) {
+        mem->read = request->read_memory;
+        mem->readv = request->read_memory_v;
+        mem->ctx = request->reader_ctx;
+        return DWUNW_OK;
+    }
+
+    if (request->stack) {
+        /* Sampled stack: no target access at all. */
+        mem->read = dwunw_stack_snapshot_read;
+        mem->readv = dwunw_stack_snapshot_readv;
+        mem->ctx = (void *)request->stack;
+        return DWUNW_OK;
+    }
+
+    if (!ctx->stack_reader_ready || request->pid <= 0 || request->max_frames <= 1) {
+        return DWUNW_OK;
+    }
+
+    if (batch->attach_pid != request->pid || batch->attach_tid != tid) {
+        capture_batch_drop_session(batch);
+        batch->attach_pid = request->pid;
+        batch->attach_tid = tid;
+        batch->attach_status = dwunw_stack_reader_attach(&ctx->stack_reader,
+                                                         request->pid,
+                                                         tid,
+                                                         &batch->session);
+        batch->session_open = batch->attach_status == DWUNW_OK;
+    }
+
+    if (!batch->session_open) {
+        return batch->attach_status;
+    }
+
+    mem->read = default_stack_reader_mem;
+    mem->readv = default_stack_reader_memv;
+    mem->ctx = &batch->session;
+    /* The window is refetched: the stack has moved since the last event. */
+    dwunw_stack_reader_set_sp(&batch->session, request->regs->sp);
+    return DWUNW_OK;
+}
+
+/* Position the cursor on the root frame's module, reusing what the previous
+ * request left behind when it names the same module or process. */
+static dwunw_status_t
+capture_batch_cursor(struct capture_batch *batch,
+                     const struct dwunw_unwind_request *request)
+{
+    struct module_cursor *cursor = &batch->cursor;
+    dwunw_status_t status;
+
+    if (request->module_path) {
+        if (batch->fixed_path && cursor->handle &&
+            strcmp(batch->fixed_path, request->module_path) == 0) {
+            batch->fixed_path = request->module_path;
+            cursor->path = request->module_path;
+            return DWUNW_OK;
         }
+
+        capture_batch_drop_cursor(batch);
+        status = dwunw_module_cache_acquire(&batch->ctx->module_cache,
+                                            request->module_path,
+                                            &cursor->handle);
+        if (status != DWUNW_OK) {
+            cursor->handle = NULL;
+            return status;
+        }
+        batch->fixed_path = request->module_path;
+        cursor->path = request->module_path;
+        return DWUNW_OK;
+    }
+
+    /* Without an explicit module the PCs are resolved through the process's
+     * cached address-space snapshot. */
+    if (batch->fixed_path || !cursor->space || cursor->pid != request->pid) {
+        capture_batch_drop_cursor(batch);
+        cursor->pid = request->pid;
+        status = dwunw_addr_space_get(&batch->ctx->addr_spaces, request->pid, &cursor->space);
+        if (status != DWUNW_OK) {
+            cursor->space = NULL;
+            return status;
+        }
+    }
+
+    /* Each request may re-read the maps once. */
+    cursor->refreshed = false;
+    status = module_cursor_seek(cursor, request->regs->pc);
+    if (status == DWUNW_ERR_NO_DEBUG_DATA) {
+        status = DWUNW_OK;
+    }
+    return status;
+}
+
+/* Store frame as output index of request, naming the module the cursor is
+ * on: full frames were written in place and only get the path copied,
+ * compact ones are converted with the module's interned id. */
+static dwunw_status_t
+capture_emit(struct capture_batch *batch,
+             const struct dwunw_unwind_request *request,
+             size_t index,
+             const struct dwunw_frame *frame)
+{
+    struct module_cursor *cursor = &batch->cursor;
+    struct dwunw_compact_frame *out;
+
+    if (!request->compact_frames) {
+        frame_set_module(&request->frames[index], cursor->path);
+        return DWUNW_OK;
+    }
+
+    /* Consecutive frames mostly share a module: intern once per switch. */
+    if (cursor->interned_path != cursor->path) {
+        dwunw_status_t status = dwunw_module_names_intern(&batch->ctx->module_names,
+                                                          cursor->path,
+                                                          &cursor->module_id);
+        if (status != DWUNW_OK) {
+            return status;
+        }
+        cursor->interned_path = cursor->path;
+    }
+
+    out = &request->compact_frames[index];
+    out->pc = frame->pc;
+    out->cfa = frame->cfa;
+    out->rel_pc = frame->pc - cursor->bias;
+    out->module_id = cursor->module_id;
+    out->flags = frame->flags;
+    return DWUNW_OK;
+}
+
+static dwunw_status_t
+capture_validate(const struct dwunw_unwind_request *request)
+{
+    if (!request || !request->regs ||
+        !request->frames == !request->compact_frames ||
+        request->max_frames == 0 || (!request->module_path && request->pid <= 0) ||
+        (request->read_memory_v && !request->read_memory)) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    return DWUNW_OK;
+}
+
+static dwunw_status_t
+capture_walk(struct capture_batch *batch,
+             const struct dwunw_unwind_request *request,
+             size_t *frames_written)
+{
+    struct module_cursor *cursor = &batch->cursor;
+    struct dwunw_memory_reader mem;
+    struct dwunw_frame scratch;
+    struct dwunw_frame *frame;
+    dwunw_status_t reader_status;
+    dwunw_status_t status;
+    size_t produced = 0;
+
+    *frames_written = 0;
+
+    status = capture_validate(request);
+    if (status != DWUNW_OK) {
         return status;
     }
 
-    status = prepare_root_frame(effective->regs, &effective->frames[0]);
+    reader_status = capture_batch_reader(batch, request, &mem);
+
+    status = capture_batch_cursor(batch, request);
+    if (status != DWUNW_OK) {
+        capture_batch_drop_cursor(batch);
+        return status;
+    }
+
+    /* Compact output goes through one scratch frame, which never gets a
+     * module path copied into it. */
+    frame = request->frames ? &request->frames[0] : &scratch;
+    status = prepare_root_frame(request->regs, frame);
+    if (status == DWUNW_OK) {
+        status = capture_emit(batch, request, 0, frame);
+    }
     if (status == DWUNW_OK) {
-        strncpy(effective->frames[0].module_path,
-                effective->module_path,
-                sizeof(effective->frames[0].module_path) - 1);
-        effective->frames[0].module_path[sizeof(effective->frames[0].module_path) - 1] = '\0';
         produced = 1;
 
-        if (effective->max_frames > 1 && handle->index.fde_count > 0 &&
-            reader_fn) {
-            struct dwunw_regset cursor_regs = *effective->regs;
+        if (request->max_frames > 1 && cursor->handle && mem.read) {
+            struct dwunw_regset cursor_regs = *request->regs;
             const struct dwunw_arch_ops *ops = dwunw_arch_from_regset(&cursor_regs);
 
-            while (produced < effective->max_frames) {
-                const struct dwunw_fde_record *fde;
-                struct dwunw_frame *cursor_frame;
+            while (produced < request->max_frames) {
+                struct dwunw_frame *cursor_frame = request->frames ? &request->frames[produced]
+                                                                   : &scratch;
                 dwunw_status_t unwind_status;
+                dwunw_status_t emit_status;
 
-                fde = dwunw_cfi_find_fde(handle->index.fdes,
-                                         handle->index.fde_count,
-                                         cursor_regs.pc);
-                if (!fde) {
+                unwind_status = module_cursor_seek(cursor, cursor_regs.pc);
+                if (unwind_status == DWUNW_OK) {
+                    unwind_status = unwind_step(cursor->ctx,
+                                                &cursor->handle->index,
+                                                ops,
+                                                cursor_regs.pc - cursor->bias,
+                                                produced > 1,
+                                                &cursor_regs,
+                                                &mem,
+                                                cursor_frame);
+                }
+                if (unwind_status == DWUNW_ERR_NO_DEBUG_DATA) {
                     break;
                 }
-
-                cursor_frame = &effective->frames[produced];
-                unwind_status = dwunw_cfi_eval(fde,
-                                               cursor_regs.pc,
-                                               &cursor_regs,
-                                               reader_fn,
-                                               reader_ctx,
-                                               cursor_frame);
                 if (unwind_status != DWUNW_OK) {
                     status = unwind_status;
                     break;
                 }
 
                 cursor_frame->flags &= ~DWUNW_FRAME_FLAG_PARTIAL;
-                strncpy(cursor_frame->module_path,
-                        effective->module_path,
-                        sizeof(cursor_frame->module_path) - 1);
-                cursor_frame->module_path[sizeof(cursor_frame->module_path) - 1] = '\0';
-                produced++;
 
                 if (ops && ops->normalize) {
                     ops->normalize(&cursor_regs);
                 }
+
+                /* Report the module the caller's PC lives in. */
+                unwind_status = module_cursor_seek(cursor, cursor_regs.pc);
+                emit_status = capture_emit(batch, request, produced, cursor_frame);
+                if (emit_status != DWUNW_OK) {
+                    status = emit_status;
+                    break;
+                }
+                produced++;
+                if (unwind_status != DWUNW_OK) {
+                    if (unwind_status != DWUNW_ERR_NO_DEBUG_DATA) {
+                        status = unwind_status;
+                    }
+                    break;
+                }
             }
         }
     }
 
-    dwunw_module_cache_release(&ctx->module_cache, handle);
+    if (status == DWUNW_OK && reader_status != DWUNW_OK) {
+        status = reader_status;
+    }
+
+    *frames_written = produced;
+    return status;
+}
+
+static uint64_t
+capture_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Bucket 0 is < 1us, bucket i covers [2^(i-1), 2^i) us. */
+static size_t
+capture_latency_bucket(uint64_t ns)
+{
+    uint64_t us = ns / 1000;
+    size_t bucket = 0;
+
+    while (us && bucket < DWUNW_STATS_LATENCY_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static dwunw_status_t
+capture_one(struct capture_batch *batch,
+            const struct dwunw_unwind_request *request,
+            size_t *frames_written)
+{
+    struct dwunw_stats *stats = &batch->ctx->stats;
+    uint64_t start = capture_now_ns();
+    uint64_t elapsed;
+    dwunw_status_t status;
+    size_t slot;
+
+    status = capture_walk(batch, request, frames_written);
 
-    if (using_stack_reader) {
-        dwunw_stack_reader_detach(&session);
+    elapsed = capture_now_ns() - start;
+    slot = (size_t)-(int)status;
+    dwunw_stats_add(&stats->captures, 1);
+    dwunw_stats_add(&stats->frames, *frames_written);
+    if (slot < DWUNW_STATS_STATUS_SLOTS) {
+        dwunw_stats_add(&stats->status[slot], 1);
     }
+    dwunw_stats_add(&stats->latency[capture_latency_bucket(elapsed)], 1);
+    dwunw_stats_add(&stats->latency_ns, elapsed);
+    return status;
+}
 
-    if (status == DWUNW_OK && reader_status != DWUNW_OK) {
-        status = reader_status;
+const char *
+dwunw_module_name(const struct dwunw_context *ctx, uint32_t module_id)
+{
+    if (!ctx) {
+        return NULL;
+    }
+    return dwunw_module_names_lookup(&ctx->module_names, module_id);
+}
+
+dwunw_status_t
+dwunw_capture(struct dwunw_context *ctx,
+              const struct dwunw_unwind_request *request,
+              size_t *frames_written)
+{
+    struct capture_batch batch;
+    dwunw_status_t status;
+    size_t produced = 0;
+
+    if (frames_written) {
+        *frames_written = 0;
+    }
+
+    if (!ctx || capture_validate(request) != DWUNW_OK || !ctx->module_cache_ready) {
+        return DWUNW_ERR_INVALID_ARG;
     }
 
+    capture_batch_init(&batch, ctx);
+    status = capture_one(&batch, request, &produced);
+    capture_batch_finish(&batch);
+
     if (frames_written) {
         *frames_written = produced;
     }
 
     return status;
 }
+
+struct batch_entry {
+    const struct dwunw_unwind_request *request;
+    size_t index;
+};
+
+static int
+module_path_cmp(const char *a, const char *b)
+{
+    if (!a || !b) {
+        return (a != NULL) - (b != NULL);
+    }
+    return strcmp(a, b);
+}
+
+/* Group by process, then thread (reader session), then module. */
+static int
+batch_entry_cmp(const void *lhs, const void *rhs)
+{
+    const struct batch_entry *a = lhs;
+    const struct batch_entry *b = rhs;
+    int cmp;
+
+    if (a->request->pid != b->request->pid) {
+        return a->request->pid < b->request->pid ? -1 : 1;
+    }
+    if (a->request->tid != b->request->tid) {
+        return a->request->tid < b->request->tid ? -1 : 1;
+    }
+    cmp = module_path_cmp(a->request->module_path, b->request->module_path);
+    if (cmp != 0) {
+        return cmp;
+    }
+    /* Keep input order among equals; qsort is not stable. */
+    return a->index < b->index ? -1 : (a->index > b->index);
+}
+
+dwunw_status_t
+dwunw_capture_batch(struct dwunw_context *ctx,
+                    const struct dwunw_unwind_request *requests,
+                    size_t count,
+                    size_t *frames_written,
+                    dwunw_status_t *statuses)
+{
+    struct capture_batch batch;
+    struct batch_entry *order;
+    dwunw_status_t first_error = DWUNW_OK;
+    size_t first_index = count;
+    size_t i;
+
+    if (!ctx || (count > 0 && !requests) || !ctx->module_cache_ready ||
+        count > SIZE_MAX / sizeof(*order)) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    /* Without the scratch array the batch still runs, just in input order. */
+    order = malloc(count * sizeof(*order));
+    if (order) {
+        for (i = 0; i < count; ++i) {
+            order[i].request = &requests[i];
+            order[i].index = i;
+        }
+        qsort(order, count, sizeof(*order), batch_entry_cmp);
+    }
+
+    capture_batch_init(&batch, ctx);
+    for (i = 0; i < count; ++i) {
+        size_t index = order ? order[i].index : i;
+        size_t produced = 0;
+        dwunw_status_t status = capture_one(&batch, &requests[index], &produced);
+
+        if (frames_written) {
+            frames_written[index] = produced;
+        }
+        if (statuses) {
+            statuses[index] = status;
+        }
+        if (status != DWUNW_OK && index < first_index) {
+            first_error = status;
+            first_index = index;
+        }
+    }
+    capture_batch_finish(&batch);
+
+    free(order);
+    return first_error;
+}
@@ -0,0 +1,453 @@
+// SPDX-License-Identifier: MIT
+#define _GNU_SOURCE
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "dwunw/addr_space.h"
+
+struct mapping_vector {
+    struct dwunw_addr_space_mapping *data;
+    size_t count;
+    size_t capacity;
+    char *paths;
+    size_t paths_size;
+    size_t paths_capacity;
+};
+
+static dwunw_status_t
+mapping_vector_push(struct mapping_vector *vec,
+                    const struct dwunw_addr_space_mapping *mapping,
+                    const char *path)
+{
+    size_t path_len = strlen(path) + 1;
+
+    if (vec->count == vec->capacity) {
+        size_t capacity = vec->capacity ? vec->capacity * 2 : 32;
+        struct dwunw_addr_space_mapping *data = realloc(vec->data, capacity * sizeof(*data));
+        if (!data) {
+            return DWUNW_ERR_IO;
+        }
+        vec->data = data;
+        vec->capacity = capacity;
+    }
+
+    /* Consecutive mappings of one module share its path string. */
+    if (vec->count > 0 &&
+        strcmp(vec->paths + vec->data[vec->count - 1].path_offset, path) == 0) {
+        vec->data[vec->count] = *mapping;
+        vec->data[vec->count].path_offset = vec->data[vec->count - 1].path_offset;
+        vec->count++;
+        return DWUNW_OK;
+    }
+
+    if (vec->paths_size + path_len > vec->paths_capacity) {
+        size_t capacity = vec->paths_capacity ? vec->paths_capacity * 2 : 1024;
+        char *paths;
+
+        while (capacity < vec->paths_size + path_len) {
+            capacity *= 2;
+        }
+        paths = realloc(vec->paths, capacity);
+        if (!paths) {
+            return DWUNW_ERR_IO;
+        }
+        vec->paths = paths;
+        vec->paths_capacity = capacity;
+    }
+
+    memcpy(vec->paths + vec->paths_size, path, path_len);
+    vec->data[vec->count] = *mapping;
+    vec->data[vec->count].path_offset = (uint32_t)vec->paths_size;
+    vec->paths_size += path_len;
+    vec->count++;
+    return DWUNW_OK;
+}
+
+/* Accept "start-end perms offset dev inode path" lines for executable,
+ * file-backed mappings; everything else cannot hold unwindable code. */
+static int
+parse_maps_line(char *line, struct dwunw_addr_space_mapping *mapping, const char **path)
+{
+    char perms[5];
+    int consumed = 0;
+    size_t len;
+
+    memset(mapping, 0, sizeof(*mapping));
+    if (sscanf(line,
+               "%" SCNx64 "-%" SCNx64 " %4s %" SCNx64 " %*s %*s %n",
+               &mapping->start,
+               &mapping->end,
+               perms,
+               &mapping->offset,
+               &consumed) < 4 || consumed == 0) {
+        return 0;
+    }
+
+    if (perms[2] != 'x' || line[consumed] != '/' || mapping->end <= mapping->start) {
+        return 0;
+    }
+
+    len = strlen(line + consumed);
+    if (len > 0 && line[consumed + len - 1] == '\n') {
+        line[consumed + len - 1] = '\0';
+    }
+
+    *path = line + consumed;
+    return 1;
+}
+
+dwunw_status_t
+dwunw_addr_space_load(pid_t pid, struct dwunw_addr_space *space)
+{
+    struct mapping_vector vec;
+    char maps_path[64];
+    char *line = NULL;
+    size_t line_cap = 0;
+    dwunw_status_t status = DWUNW_OK;
+    FILE *maps;
+
+    if (!space || pid <= 0) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    memset(space, 0, sizeof(*space));
+    snprintf(maps_path, sizeof(maps_path), "/proc/%d/maps", (int)pid);
+    maps = fopen(maps_path, "re");
+    if (!maps) {
+        return DWUNW_ERR_IO;
+    }
+
+    memset(&vec, 0, sizeof(vec));
+    while (getline(&line, &line_cap, maps) > 0) {
+        struct dwunw_addr_space_mapping mapping;
+        const char *path;
+
+        if (!parse_maps_line(line, &mapping, &path)) {
+            continue;
+        }
+
+        status = mapping_vector_push(&vec, &mapping, path);
+        if (status != DWUNW_OK) {
+            break;
+        }
+    }
+
+    free(line);
+    fclose(maps);
+
+    if (status != DWUNW_OK) {
+        free(vec.data);
+        free(vec.paths);
+        return status;
+    }
+
+    /* The kernel already lists mappings in address order. */
+    space->pid = pid;
+    space->count = vec.count;
+    space->mappings = vec.data;
+    space->paths = vec.paths;
+    space->paths_size = vec.paths_size;
+    return DWUNW_OK;
+}
+
+void
+dwunw_addr_space_free(struct dwunw_addr_space *space)
+{
+    if (!space) {
+        return;
+    }
+
+    free(space->mappings);
+    free(space->paths);
+    memset(space, 0, sizeof(*space));
+}
+
+struct dwunw_addr_space_mapping *
+dwunw_addr_space_lookup(const struct dwunw_addr_space *space, uint64_t pc)
+{
+    size_t lo = 0;
+    size_t hi;
+
+    if (!space) {
+        return NULL;
+    }
+
+    hi = space->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+
+        if (space->mappings[mid].start <= pc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if (lo == 0 || pc >= space->mappings[lo - 1].end) {
+        return NULL;
+    }
+
+    return &space->mappings[lo - 1];
+}
+
+const char *
+dwunw_addr_space_path(const struct dwunw_addr_space *space,
+                      const struct dwunw_addr_space_mapping *mapping)
+{
+    if (!space || !mapping || mapping->path_offset >= space->paths_size) {
+        return NULL;
+    }
+
+    return space->paths + mapping->path_offset;
+}
+
+void
+dwunw_addr_space_cache_init(struct dwunw_addr_space_cache *cache)
+{
+    if (!cache) {
+        return;
+    }
+
+    memset(cache, 0, sizeof(*cache));
+}
+
+void
+dwunw_addr_space_cache_flush(struct dwunw_addr_space_cache *cache)
+{
+    size_t i;
+
+    if (!cache) {
+        return;
+    }
+
+    for (i = 0; i < DWUNW_ADDR_SPACE_CACHE_CAPACITY; ++i) {
+        if (cache->slots[i].in_use) {
+            dwunw_addr_space_free(&cache->slots[i].space);
+            cache->slots[i].in_use = 0;
+        }
+    }
+}
+
+static struct dwunw_addr_space_slot *
+addr_space_cache_find(struct dwunw_addr_space_cache *cache, pid_t pid)
+{
+    size_t i;
+
+    for (i = 0; i < DWUNW_ADDR_SPACE_CACHE_CAPACITY; ++i) {
+        if (cache->slots[i].in_use && cache->slots[i].space.pid == pid) {
+            return &cache->slots[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* Free slot, or the least recently used one. */
+static struct dwunw_addr_space_slot *
+addr_space_cache_victim(struct dwunw_addr_space_cache *cache)
+{
+    struct dwunw_addr_space_slot *victim = &cache->slots[0];
+    size_t i;
+
+    for (i = 0; i < DWUNW_ADDR_SPACE_CACHE_CAPACITY; ++i) {
+        struct dwunw_addr_space_slot *slot = &cache->slots[i];
+
+        if (!slot->in_use) {
+            return slot;
+        }
+        if (slot->last_use < victim->last_use) {
+            victim = slot;
+        }
+    }
+
+    dwunw_addr_space_free(&victim->space);
+    victim->in_use = 0;
+    return victim;
+}
+
+static uint64_t
+addr_space_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Start time from /proc/<pid>/stat plus the file behind /proc/<pid>/exe:
+ * the first changes when the pid is reused, the second on exec. */
+static dwunw_status_t
+addr_space_identity(pid_t pid, struct dwunw_addr_space_identity *identity)
+{
+    char path[64];
+    char buf[1024];
+    struct stat st;
+    const char *field;
+    size_t len;
+    int i;
+    FILE *stat_file;
+
+    memset(identity, 0, sizeof(*identity));
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)pid);
+    stat_file = fopen(path, "re");
+    if (!stat_file) {
+        return DWUNW_ERR_IO;
+    }
+    len = fread(buf, 1, sizeof(buf) - 1, stat_file);
+    fclose(stat_file);
+    buf[len] = '\0';
+
+    /* comm may hold spaces and parentheses; fields resume after the last
+     * ')', starting at field 3 (state). starttime is field 22. */
+    field = strrchr(buf, ')');
+    if (!field) {
+        return DWUNW_ERR_BAD_FORMAT;
+    }
+    for (i = 3; i <= 22 && field; ++i) {
+        field = strchr(field + 1, ' ');
+    }
+    if (!field || sscanf(field, " %" SCNu64, &identity->start_time) != 1) {
+        return DWUNW_ERR_BAD_FORMAT;
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/exe", (int)pid);
+    if (stat(path, &st) == 0) {
+        identity->exe_dev = (uint64_t)st.st_dev;
+        identity->exe_ino = (uint64_t)st.st_ino;
+    }
+    return DWUNW_OK;
+}
+
+static dwunw_status_t
+addr_space_cache_fill(struct dwunw_addr_space_cache *cache,
+                      struct dwunw_addr_space_slot *slot,
+                      pid_t pid)
+{
+    struct dwunw_addr_space_identity identity;
+    struct dwunw_addr_space fresh;
+    dwunw_status_t status;
+
+    /* Identity first: a process swapped in between the two reads leaves a
+     * stale identity, which only costs one extra reload later. */
+    status = addr_space_identity(pid, &identity);
+    if (status != DWUNW_OK) {
+        return status;
+    }
+    status = dwunw_addr_space_load(pid, &fresh);
+    if (status != DWUNW_OK) {
+        return status;
+    }
+
+    if (slot->in_use) {
+        dwunw_addr_space_free(&slot->space);
+    }
+    slot->space = fresh;
+    slot->identity = identity;
+    slot->checked_ns = addr_space_now_ns();
+    slot->space.generation = ++cache->generation;
+    slot->last_use = ++cache->clock;
+    slot->in_use = 1;
+    return DWUNW_OK;
+}
+
+/* Whether slot still describes the process now running as pid. */
+static int
+addr_space_slot_current(struct dwunw_addr_space_slot *slot, pid_t pid)
+{
+    struct dwunw_addr_space_identity identity;
+    uint64_t now = addr_space_now_ns();
+
+    if (now - slot->checked_ns < DWUNW_ADDR_SPACE_RECHECK_NS) {
+        return 1;
+    }
+    if (addr_space_identity(pid, &identity) != DWUNW_OK ||
+        memcmp(&identity, &slot->identity, sizeof(identity)) != 0) {
+        return 0;
+    }
+
+    slot->checked_ns = now;
+    return 1;
+}
+
+dwunw_status_t
+dwunw_addr_space_get(struct dwunw_addr_space_cache *cache,
+                     pid_t pid,
+                     struct dwunw_addr_space **space_out)
+{
+    struct dwunw_addr_space_slot *slot;
+    dwunw_status_t status;
+
+    if (!cache || pid <= 0 || !space_out) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    slot = addr_space_cache_find(cache, pid);
+    if (slot && addr_space_slot_current(slot, pid)) {
+        slot->last_use = ++cache->clock;
+        *space_out = &slot->space;
+        return DWUNW_OK;
+    }
+
+    if (slot) {
+        /* Same pid, different process: the old snapshot must not outlive
+         * a failed reload. */
+        dwunw_addr_space_free(&slot->space);
+        slot->in_use = 0;
+    } else {
+        slot = addr_space_cache_victim(cache);
+    }
+    status = addr_space_cache_fill(cache, slot, pid);
+    if (status != DWUNW_OK) {
+        return status;
+    }
+
+    *space_out = &slot->space;
+    return DWUNW_OK;
+}
+
+dwunw_status_t
+dwunw_addr_space_refresh(struct dwunw_addr_space_cache *cache,
+                         pid_t pid,
+                         struct dwunw_addr_space **space_out)
+{
+    struct dwunw_addr_space_slot *slot;
+    dwunw_status_t status;
+
+    if (!cache || pid <= 0 || !space_out) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    slot = addr_space_cache_find(cache, pid);
+    if (!slot) {
+        return dwunw_addr_space_get(cache, pid, space_out);
+    }
+
+    status = addr_space_cache_fill(cache, slot, pid);
+    if (status != DWUNW_OK) {
+        return status;
+    }
+
+    *space_out = &slot->space;
+    return DWUNW_OK;
+}
+
+void
+dwunw_addr_space_invalidate(struct dwunw_addr_space_cache *cache, pid_t pid)
+{
+    struct dwunw_addr_space_slot *slot;
+
+    if (!cache) {
+        return;
+    }
+
+    slot = addr_space_cache_find(cache, pid);
+    if (slot) {
+        dwunw_addr_space_free(&slot->space);
+        slot->in_use = 0;
+    }
+}
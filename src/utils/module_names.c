@@ -0,0 +1,174 @@
+// SPDX-License-Identifier: MIT
+#include <stdlib.h>
+#include <string.h>
+
+#include "dwunw/module_names.h"
+
+#define MODULE_NAMES_MIN_BUCKETS 64u
+
+static uint32_t
+module_names_hash(const char *path, size_t len)
+{
+    uint32_t h = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < len; ++i) {
+        h ^= (uint8_t)path[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static const char *
+module_names_at(const struct dwunw_module_names *names, uint32_t id)
+{
+    return names->names + names->offsets[id - 1];
+}
+
+/* Rehash into twice the buckets once the table is half full. */
+static dwunw_status_t
+module_names_grow_buckets(struct dwunw_module_names *names)
+{
+    uint32_t count = names->bucket_count ? names->bucket_count * 2 : MODULE_NAMES_MIN_BUCKETS;
+    uint32_t *buckets = calloc(count, sizeof(*buckets));
+    uint32_t id;
+
+    if (!buckets) {
+        return DWUNW_ERR_IO;
+    }
+
+    for (id = 1; id <= names->count; ++id) {
+        const char *path = module_names_at(names, id);
+        uint32_t slot = module_names_hash(path, strlen(path)) & (count - 1);
+
+        while (buckets[slot]) {
+            slot = (slot + 1) & (count - 1);
+        }
+        buckets[slot] = id;
+    }
+
+    free(names->buckets);
+    names->buckets = buckets;
+    names->bucket_count = count;
+    return DWUNW_OK;
+}
+
+static dwunw_status_t
+module_names_append(struct dwunw_module_names *names, const char *path, size_t len)
+{
+    if (names->count == names->capacity) {
+        uint32_t capacity = names->capacity ? names->capacity * 2 : 32;
+        uint32_t *offsets = realloc(names->offsets, capacity * sizeof(*offsets));
+
+        if (!offsets) {
+            return DWUNW_ERR_IO;
+        }
+        names->offsets = offsets;
+        names->capacity = capacity;
+    }
+
+    if (names->names_size + len + 1 > names->names_capacity) {
+        size_t capacity = names->names_capacity ? names->names_capacity * 2 : 4096;
+        char *buf;
+
+        while (capacity < names->names_size + len + 1) {
+            capacity *= 2;
+        }
+        if (capacity > UINT32_MAX) {
+            return DWUNW_ERR_IO;
+        }
+        buf = realloc(names->names, capacity);
+        if (!buf) {
+            return DWUNW_ERR_IO;
+        }
+        names->names = buf;
+        names->names_capacity = capacity;
+    }
+
+    memcpy(names->names + names->names_size, path, len + 1);
+    names->offsets[names->count] = (uint32_t)names->names_size;
+    names->names_size += len + 1;
+    names->count++;
+    return DWUNW_OK;
+}
+
+void
+dwunw_module_names_init(struct dwunw_module_names *names)
+{
+    if (names) {
+        memset(names, 0, sizeof(*names));
+    }
+}
+
+void
+dwunw_module_names_flush(struct dwunw_module_names *names)
+{
+    if (!names) {
+        return;
+    }
+
+    free(names->names);
+    free(names->offsets);
+    free(names->buckets);
+    memset(names, 0, sizeof(*names));
+}
+
+dwunw_status_t
+dwunw_module_names_intern(struct dwunw_module_names *names,
+                          const char *path,
+                          uint32_t *id_out)
+{
+    dwunw_status_t status;
+    uint32_t slot;
+    size_t len;
+
+    if (!names || !path || !id_out) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+    if (!*path) {
+        *id_out = 0;
+        return DWUNW_OK;
+    }
+
+    if ((names->count + 1) * 2 > names->bucket_count) {
+        status = module_names_grow_buckets(names);
+        if (status != DWUNW_OK) {
+            return status;
+        }
+    }
+
+    len = strlen(path);
+    slot = module_names_hash(path, len) & (names->bucket_count - 1);
+    while (names->buckets[slot]) {
+        uint32_t id = names->buckets[slot];
+
+        if (strcmp(module_names_at(names, id), path) == 0) {
+            *id_out = id;
+            return DWUNW_OK;
+        }
+        slot = (slot + 1) & (names->bucket_count - 1);
+    }
+
+    status = module_names_append(names, path, len);
+    if (status != DWUNW_OK) {
+        return status;
+    }
+    names->buckets[slot] = names->count;
+    *id_out = names->count;
+    return DWUNW_OK;
+}
+
+const char *
+dwunw_module_names_lookup(const struct dwunw_module_names *names, uint32_t id)
+{
+    if (!names) {
+        return NULL;
+    }
+    if (id == 0) {
+        return "";
+    }
+    if (id > names->count) {
+        return NULL;
+    }
+    return module_names_at(names, id);
+}
@@ -6,6 +6,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/ptrace.h>
 #include <sys/stat.h>
@@ -20,6 +21,11 @@
 #define DWUNW_STACK_READER_BACKEND_PROCESS_VM 1u
 #define DWUNW_STACK_READER_BACKEND_PROC_MEM 2u
 
+/* The window is split into page-sized remote iovecs so that a window
+ * running past the top of the stack still copies every mapped page:
+ * process_vm_readv() never transfers part of an iovec. */
+#define DWUNW_STACK_WINDOW_CHUNK 4096u
+
 static dwunw_status_t
 stack_reader_process_vm_read(struct dwunw_stack_reader_session *session,
                              uint64_t address,
@@ -35,6 +41,7 @@ stack_reader_process_vm_read(struct dwunw_stack_reader_session *session,
         .iov_len = size,
     };
     ssize_t copied = process_vm_readv(session->tid, &local_iov, 1, &remote_iov, 1, 0);
+    session->syscalls++;
     if (copied == (ssize_t)size) {
         return DWUNW_OK;
     }
@@ -55,10 +62,52 @@ stack_reader_process_vm_read(struct dwunw_stack_reader_session *session,
 }
 
 static dwunw_status_t
-stack_reader_proc_mem_read(struct dwunw_stack_reader_session *session,
-                           uint64_t address,
-                           void *dst,
-                           size_t size)
+stack_reader_process_vm_readv(struct dwunw_stack_reader_session *session,
+                              const struct dwunw_read_iov *iov,
+                              size_t count)
+{
+    struct iovec local_iov[DWUNW_STACK_READER_MAX_IOV];
+    struct iovec remote_iov[DWUNW_STACK_READER_MAX_IOV];
+    size_t total = 0;
+    size_t i;
+
+    for (i = 0; i < count; ++i) {
+        local_iov[i].iov_base = iov[i].dst;
+        local_iov[i].iov_len = iov[i].size;
+        remote_iov[i].iov_base = (void *)(uintptr_t)iov[i].address;
+        remote_iov[i].iov_len = iov[i].size;
+        total += iov[i].size;
+    }
+
+    ssize_t copied = process_vm_readv(session->tid,
+                                      local_iov,
+                                      (unsigned long)count,
+                                      remote_iov,
+                                      (unsigned long)count,
+                                      0);
+    session->syscalls++;
+    if (copied == (ssize_t)total) {
+        return DWUNW_OK;
+    }
+
+    /* A short count means some remote range was unmapped. */
+    if (copied >= 0) {
+        return DWUNW_ERR_IO;
+    }
+
+    switch (errno) {
+    case ENOSYS:
+    case EPERM:
+    case ESRCH:
+    case EFAULT:
+        return DWUNW_ERR_NOT_IMPLEMENTED;
+    default:
+        return DWUNW_ERR_IO;
+    }
+}
+
+static dwunw_status_t
+stack_reader_proc_mem_open(struct dwunw_stack_reader_session *session)
 {
     if (session->mem_fd < 0) {
         char path[64];
@@ -74,7 +123,22 @@ stack_reader_proc_mem_read(struct dwunw_stack_reader_session *session,
         session->mem_fd = fd;
     }
 
+    return DWUNW_OK;
+}
+
+static dwunw_status_t
+stack_reader_proc_mem_read(struct dwunw_stack_reader_session *session,
+                           uint64_t address,
+                           void *dst,
+                           size_t size)
+{
+    dwunw_status_t status = stack_reader_proc_mem_open(session);
+    if (status != DWUNW_OK) {
+        return status;
+    }
+
     ssize_t copied = pread(session->mem_fd, dst, size, (off_t)address);
+    session->syscalls++;
     if (copied == (ssize_t)size) {
         return DWUNW_OK;
     }
@@ -82,6 +146,80 @@ stack_reader_proc_mem_read(struct dwunw_stack_reader_session *session,
     return DWUNW_ERR_IO;
 }
 
+/* Copy as much of the window as is mapped, in one syscall. A short copy
+ * just shrinks the window; a failed one leaves it empty so every read goes
+ * to the target as before. */
+static void
+stack_reader_window_fill(struct dwunw_stack_reader_session *session)
+{
+    struct iovec remote_iov[DWUNW_STACK_WINDOW_MAX / DWUNW_STACK_WINDOW_CHUNK + 1];
+    struct iovec local_iov;
+    uint64_t address = session->window_start;
+    uint32_t size = session->window_capacity;
+    unsigned long chunks = 0;
+    uint32_t covered = 0;
+    ssize_t copied = -1;
+
+    session->window_pending = false;
+    session->window_len = 0;
+
+    if (address > UINT64_MAX - size) {
+        size = (uint32_t)(UINT64_MAX - address);
+    }
+
+    if (session->backend == DWUNW_STACK_READER_BACKEND_PROCESS_VM) {
+        while (covered < size) {
+            uint64_t chunk_start = address + covered;
+            uint32_t len = DWUNW_STACK_WINDOW_CHUNK -
+                           (uint32_t)(chunk_start % DWUNW_STACK_WINDOW_CHUNK);
+
+            if (len > size - covered) {
+                len = size - covered;
+            }
+            remote_iov[chunks].iov_base = (void *)(uintptr_t)chunk_start;
+            remote_iov[chunks].iov_len = len;
+            chunks++;
+            covered += len;
+        }
+
+        local_iov.iov_base = session->window;
+        local_iov.iov_len = size;
+        copied = process_vm_readv(session->tid, &local_iov, 1, remote_iov, chunks, 0);
+        session->syscalls++;
+        if (copied < 0 && (errno == ENOSYS || errno == EPERM)) {
+            session->backend = DWUNW_STACK_READER_BACKEND_PROC_MEM;
+        }
+    }
+
+    if (copied < 0 && session->backend == DWUNW_STACK_READER_BACKEND_PROC_MEM &&
+        stack_reader_proc_mem_open(session) == DWUNW_OK) {
+        copied = pread(session->mem_fd, session->window, size, (off_t)address);
+        session->syscalls++;
+    }
+
+    if (copied > 0) {
+        session->window_len = (uint32_t)copied;
+    }
+}
+
+static const uint8_t *
+stack_reader_window_find(struct dwunw_stack_reader_session *session,
+                         uint64_t address,
+                         size_t size)
+{
+    if (session->window_pending) {
+        stack_reader_window_fill(session);
+    }
+
+    if (address < session->window_start ||
+        size > session->window_len ||
+        address - session->window_start > session->window_len - size) {
+        return NULL;
+    }
+
+    return session->window + (address - session->window_start);
+}
+
 dwunw_status_t
 dwunw_stack_reader_init(struct dwunw_stack_reader *reader)
 {
@@ -89,14 +227,57 @@ dwunw_stack_reader_init(struct dwunw_stack_reader *reader)
         return DWUNW_ERR_INVALID_ARG;
     }
 
-    reader->reserved = 0;
+    reader->mode = DWUNW_STACK_READER_MODE_NONSTOP;
+    reader->window_size = DWUNW_STACK_WINDOW_DEFAULT;
+    reader->window = NULL;
     return DWUNW_OK;
 }
 
 void
 dwunw_stack_reader_shutdown(struct dwunw_stack_reader *reader)
 {
-    (void)reader;
+    if (!reader) {
+        return;
+    }
+
+    free(reader->window);
+    reader->window = NULL;
+}
+
+dwunw_status_t
+dwunw_stack_reader_set_mode(struct dwunw_stack_reader *reader,
+                            enum dwunw_stack_reader_mode mode)
+{
+    if (!reader) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    switch (mode) {
+    case DWUNW_STACK_READER_MODE_NONSTOP:
+    case DWUNW_STACK_READER_MODE_ATTACH:
+        reader->mode = mode;
+        return DWUNW_OK;
+    default:
+        return DWUNW_ERR_INVALID_ARG;
+    }
+}
+
+dwunw_status_t
+dwunw_stack_reader_set_window(struct dwunw_stack_reader *reader, uint32_t size)
+{
+    if (!reader) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    if (size != 0 && (size < DWUNW_STACK_WINDOW_MIN || size > DWUNW_STACK_WINDOW_MAX)) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    /* Reallocated lazily by the next attach. */
+    free(reader->window);
+    reader->window = NULL;
+    reader->window_size = size;
+    return DWUNW_OK;
 }
 
 dwunw_status_t
@@ -105,8 +286,7 @@ dwunw_stack_reader_attach(struct dwunw_stack_reader *reader,
                           pid_t tid,
                           struct dwunw_stack_reader_session *session)
 {
-    (void)reader;
-    if (!session || pid <= 0) {
+    if (!reader || !session || pid <= 0) {
         return DWUNW_ERR_INVALID_ARG;
     }
 
@@ -119,6 +299,22 @@ dwunw_stack_reader_attach(struct dwunw_stack_reader *reader,
     session->tid = tid;
     session->mem_fd = -1;
 
+    /* Without a buffer we simply read everything from the target. */
+    if (reader->window_size > 0 && !reader->window) {
+        reader->window = malloc(reader->window_size);
+    }
+    if (reader->window) {
+        session->window = reader->window;
+        session->window_capacity = reader->window_size;
+    }
+
+    /* Non-stop sessions just remember whom to read from; permission
+     * problems surface on the first read. */
+    if (reader->mode != DWUNW_STACK_READER_MODE_ATTACH) {
+        session->backend = DWUNW_STACK_READER_BACKEND_PROCESS_VM;
+        return DWUNW_OK;
+    }
+
     if (ptrace(PTRACE_ATTACH, tid, NULL, NULL) == -1) {
         memset(session, 0, sizeof(*session));
         return DWUNW_ERR_IO;
@@ -167,6 +363,18 @@ dwunw_stack_reader_detach(struct dwunw_stack_reader_session *session)
     memset(session, 0, sizeof(*session));
 }
 
+void
+dwunw_stack_reader_set_sp(struct dwunw_stack_reader_session *session, uint64_t sp)
+{
+    if (!session || !session->window || session->window_capacity == 0) {
+        return;
+    }
+
+    session->window_start = sp;
+    session->window_len = 0;
+    session->window_pending = true;
+}
+
 dwunw_status_t
 dwunw_stack_reader_read(struct dwunw_stack_reader_session *session,
                         uint64_t address,
@@ -177,8 +385,14 @@ dwunw_stack_reader_read(struct dwunw_stack_reader_session *session,
         return DWUNW_ERR_INVALID_ARG;
     }
 
+    const uint8_t *local = stack_reader_window_find(session, address, size);
     dwunw_status_t status;
 
+    if (local) {
+        memcpy(dst, local, size);
+        return DWUNW_OK;
+    }
+
     if (session->backend == DWUNW_STACK_READER_BACKEND_PROCESS_VM) {
         status = stack_reader_process_vm_read(session, address, dst, size);
         if (status == DWUNW_OK) {
@@ -198,3 +412,95 @@ dwunw_stack_reader_read(struct dwunw_stack_reader_session *session,
 
     return DWUNW_ERR_NOT_IMPLEMENTED;
 }
+
+static dwunw_status_t
+stack_reader_readv_remote(struct dwunw_stack_reader_session *session,
+                          const struct dwunw_read_iov *iov,
+                          size_t count)
+{
+    size_t done = 0;
+    size_t i;
+
+    while (done < count && session->backend == DWUNW_STACK_READER_BACKEND_PROCESS_VM) {
+        size_t batch = count - done;
+        dwunw_status_t status;
+
+        if (batch > DWUNW_STACK_READER_MAX_IOV) {
+            batch = DWUNW_STACK_READER_MAX_IOV;
+        }
+
+        status = stack_reader_process_vm_readv(session, iov + done, batch);
+        if (status == DWUNW_OK) {
+            done += batch;
+            continue;
+        }
+
+        if (status != DWUNW_ERR_NOT_IMPLEMENTED) {
+            return status;
+        }
+
+        session->backend = DWUNW_STACK_READER_BACKEND_PROC_MEM;
+    }
+
+    if (done == count) {
+        return DWUNW_OK;
+    }
+
+    /* /proc/<pid>/mem has no scatter read for disjoint remote offsets. */
+    if (session->backend == DWUNW_STACK_READER_BACKEND_PROC_MEM) {
+        for (i = done; i < count; ++i) {
+            dwunw_status_t status = stack_reader_proc_mem_read(session,
+                                                               iov[i].address,
+                                                               iov[i].dst,
+                                                               iov[i].size);
+            if (status != DWUNW_OK) {
+                return status;
+            }
+        }
+        return DWUNW_OK;
+    }
+
+    return DWUNW_ERR_NOT_IMPLEMENTED;
+}
+
+dwunw_status_t
+dwunw_stack_reader_readv(struct dwunw_stack_reader_session *session,
+                         const struct dwunw_read_iov *iov,
+                         size_t count)
+{
+    struct dwunw_read_iov misses[DWUNW_STACK_READER_MAX_IOV];
+    size_t miss_count = 0;
+    size_t i;
+
+    if (!session || (count > 0 && !iov)) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    for (i = 0; i < count; ++i) {
+        if (!iov[i].dst || iov[i].size == 0) {
+            return DWUNW_ERR_INVALID_ARG;
+        }
+    }
+
+    /* Serve what the window holds; only the rest goes to the target, still
+     * batched. */
+    for (i = 0; i < count; ++i) {
+        const uint8_t *local = stack_reader_window_find(session, iov[i].address, iov[i].size);
+
+        if (local) {
+            memcpy(iov[i].dst, local, iov[i].size);
+            continue;
+        }
+
+        misses[miss_count++] = iov[i];
+        if (miss_count == DWUNW_STACK_READER_MAX_IOV) {
+            dwunw_status_t status = stack_reader_readv_remote(session, misses, miss_count);
+            if (status != DWUNW_OK) {
+                return status;
+            }
+            miss_count = 0;
+        }
+    }
+
+    return stack_reader_readv_remote(session, misses, miss_count);
+}
@@ -0,0 +1,63 @@
+// SPDX-License-Identifier: MIT
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "dwunw/unwind.h"
+
+static const uint8_t *
+snapshot_find(const struct dwunw_stack_snapshot *snapshot, uint64_t address, size_t size)
+{
+    if (address < snapshot->base ||
+        size > snapshot->size ||
+        address - snapshot->base > snapshot->size - size) {
+        return NULL;
+    }
+
+    return (const uint8_t *)snapshot->data + (address - snapshot->base);
+}
+
+dwunw_status_t
+dwunw_stack_snapshot_read(void *ctx, uint64_t address, void *dst, size_t size)
+{
+    const struct dwunw_stack_snapshot *snapshot = ctx;
+    const uint8_t *src;
+
+    if (!snapshot || !dst || size == 0 || (!snapshot->data && snapshot->size)) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    src = snapshot_find(snapshot, address, size);
+    if (!src) {
+        return DWUNW_ERR_NO_DEBUG_DATA;
+    }
+
+    memcpy(dst, src, size);
+    return DWUNW_OK;
+}
+
+dwunw_status_t
+dwunw_stack_snapshot_readv(void *ctx, const struct dwunw_read_iov *iov, size_t count)
+{
+    const struct dwunw_stack_snapshot *snapshot = ctx;
+    size_t i;
+
+    if (!snapshot || (count > 0 && !iov) || (!snapshot->data && snapshot->size)) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    /* All or nothing, like one process_vm_readv(). */
+    for (i = 0; i < count; ++i) {
+        if (!iov[i].dst || iov[i].size == 0) {
+            return DWUNW_ERR_INVALID_ARG;
+        }
+        if (!snapshot_find(snapshot, iov[i].address, iov[i].size)) {
+            return DWUNW_ERR_NO_DEBUG_DATA;
+        }
+    }
+
+    for (i = 0; i < count; ++i) {
+        memcpy(iov[i].dst, snapshot_find(snapshot, iov[i].address, iov[i].size), iov[i].size);
+    }
+    return DWUNW_OK;
+}
@@ -0,0 +1,242 @@
+// SPDX-License-Identifier: MIT
+#include <stdlib.h>
+#include <string.h>
+
+#include "dwunw/stack_table.h"
+
+#define STACK_TABLE_MIN_BUCKETS 256u
+
+static uint32_t
+stack_table_hash(uint32_t parent, uint32_t module_id, uint64_t pc)
+{
+    uint64_t h = pc ^ ((uint64_t)parent << 32 | module_id) * 0x9e3779b97f4a7c15ull;
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    return (uint32_t)h;
+}
+
+static dwunw_status_t
+stack_table_grow_buckets(struct dwunw_stack_table *table)
+{
+    uint32_t count = table->bucket_count ? table->bucket_count * 2 : STACK_TABLE_MIN_BUCKETS;
+    uint32_t *buckets;
+    uint32_t id;
+
+    if (count == 0) {
+        return DWUNW_ERR_CACHE_FULL;
+    }
+    buckets = calloc(count, sizeof(*buckets));
+    if (!buckets) {
+        return DWUNW_ERR_IO;
+    }
+
+    for (id = 1; id <= table->count; ++id) {
+        const struct dwunw_stack_node *node = &table->nodes[id - 1];
+        uint32_t slot = stack_table_hash(node->parent, node->module_id, node->pc) & (count - 1);
+
+        while (buckets[slot]) {
+            slot = (slot + 1) & (count - 1);
+        }
+        buckets[slot] = id;
+    }
+
+    free(table->buckets);
+    table->buckets = buckets;
+    table->bucket_count = count;
+    return DWUNW_OK;
+}
+
+static dwunw_status_t
+stack_table_grow_nodes(struct dwunw_stack_table *table)
+{
+    uint32_t capacity = table->capacity ? table->capacity * 2 : 1024;
+    struct dwunw_stack_node *nodes;
+    uint64_t *ends;
+
+    if (capacity < table->capacity) {
+        return DWUNW_ERR_CACHE_FULL;
+    }
+    nodes = realloc(table->nodes, capacity * sizeof(*nodes));
+    if (!nodes) {
+        return DWUNW_ERR_IO;
+    }
+    table->nodes = nodes;
+
+    ends = realloc(table->ends, capacity / 64 * sizeof(*ends));
+    if (!ends) {
+        return DWUNW_ERR_IO;
+    }
+    memset(ends + table->capacity / 64, 0, (capacity - table->capacity) / 64 * sizeof(*ends));
+    table->ends = ends;
+    table->capacity = capacity;
+    return DWUNW_OK;
+}
+
+/* Node for pc called from parent, created on first sight. */
+static dwunw_status_t
+stack_table_child(struct dwunw_stack_table *table,
+                  uint32_t parent,
+                  uint32_t module_id,
+                  uint64_t pc,
+                  uint32_t *id_out)
+{
+    struct dwunw_stack_node *node;
+    dwunw_status_t status;
+    uint32_t slot;
+
+    if (((uint64_t)table->count + 1) * 2 > table->bucket_count) {
+        status = stack_table_grow_buckets(table);
+        if (status != DWUNW_OK) {
+            return status;
+        }
+    }
+
+    slot = stack_table_hash(parent, module_id, pc) & (table->bucket_count - 1);
+    while (table->buckets[slot]) {
+        uint32_t id = table->buckets[slot];
+
+        node = &table->nodes[id - 1];
+        if (node->pc == pc && node->parent == parent && node->module_id == module_id) {
+            *id_out = id;
+            return DWUNW_OK;
+        }
+        slot = (slot + 1) & (table->bucket_count - 1);
+    }
+
+    if (table->max_nodes && table->count >= table->max_nodes) {
+        return DWUNW_ERR_CACHE_FULL;
+    }
+    if (table->count == table->capacity) {
+        status = stack_table_grow_nodes(table);
+        if (status != DWUNW_OK) {
+            return status;
+        }
+    }
+
+    node = &table->nodes[table->count++];
+    node->pc = pc;
+    node->module_id = module_id;
+    node->parent = parent;
+    table->buckets[slot] = table->count;
+    *id_out = table->count;
+    return DWUNW_OK;
+}
+
+/* Walk the trie from the outermost frame in, keyed by frames when given and
+ * by pcs otherwise. */
+static dwunw_status_t
+stack_table_intern(struct dwunw_stack_table *table,
+                   const uint64_t *pcs,
+                   const struct dwunw_compact_frame *frames,
+                   size_t count,
+                   uint32_t *id_out,
+                   bool *inserted)
+{
+    uint32_t id = 0;
+    size_t i;
+
+    if (!table || !id_out) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+    if (inserted) {
+        *inserted = false;
+    }
+
+    for (i = count; i-- > 0;) {
+        dwunw_status_t status = frames ? stack_table_child(table, id, frames[i].module_id,
+                                                           frames[i].rel_pc, &id)
+                                       : stack_table_child(table, id, 0, pcs[i], &id);
+        if (status != DWUNW_OK) {
+            return status;
+        }
+    }
+
+    if (id && !(table->ends[(id - 1) / 64] & (1ull << ((id - 1) % 64)))) {
+        table->ends[(id - 1) / 64] |= 1ull << ((id - 1) % 64);
+        table->stacks++;
+        if (inserted) {
+            *inserted = true;
+        }
+    }
+    *id_out = id;
+    return DWUNW_OK;
+}
+
+void
+dwunw_stack_table_init(struct dwunw_stack_table *table, uint32_t max_nodes)
+{
+    if (!table) {
+        return;
+    }
+
+    memset(table, 0, sizeof(*table));
+    table->max_nodes = max_nodes;
+}
+
+void
+dwunw_stack_table_flush(struct dwunw_stack_table *table)
+{
+    if (!table) {
+        return;
+    }
+
+    free(table->nodes);
+    free(table->ends);
+    free(table->buckets);
+    dwunw_stack_table_init(table, table->max_nodes);
+}
+
+dwunw_status_t
+dwunw_stack_table_intern(struct dwunw_stack_table *table,
+                         const uint64_t *pcs,
+                         size_t count,
+                         uint32_t *id_out,
+                         bool *inserted)
+{
+    if (count > 0 && !pcs) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+    return stack_table_intern(table, pcs, NULL, count, id_out, inserted);
+}
+
+dwunw_status_t
+dwunw_stack_table_intern_compact(struct dwunw_stack_table *table,
+                                 const struct dwunw_compact_frame *frames,
+                                 size_t count,
+                                 uint32_t *id_out,
+                                 bool *inserted)
+{
+    if (count > 0 && !frames) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+    return stack_table_intern(table, NULL, frames, count, id_out, inserted);
+}
+
+dwunw_status_t
+dwunw_stack_table_get(const struct dwunw_stack_table *table,
+                      uint32_t id,
+                      struct dwunw_stack_node *frames,
+                      size_t max,
+                      size_t *depth_out)
+{
+    size_t depth = 0;
+
+    if (!table || !depth_out || (max > 0 && !frames) || id > table->count) {
+        return DWUNW_ERR_INVALID_ARG;
+    }
+
+    while (id) {
+        const struct dwunw_stack_node *node = &table->nodes[id - 1];
+
+        if (depth < max) {
+            frames[depth] = *node;
+        }
+        depth++;
+        id = node->parent;
+    }
+
+    *depth_out = depth;
+    return DWUNW_OK;
+}
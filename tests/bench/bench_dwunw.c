@@ -0,0 +1,630 @@
+#define _GNU_SOURCE
+#include <elf.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/ptrace.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dwunw/dwunw_api.h"
+#include "dwunw/dwarf_index.h"
+#include "dwunw/elf_loader.h"
+#include "dwunw/module_cache.h"
+#include "dwunw/unwind.h"
+#include "dwarf/cfi.h"
+#include "dwarf/rule_cache.h"
+#include "dwarf/unwind_table.h"
+
+/*
+ * Micro-benchmarks for the unwinder hot paths, run against the test fixture
+ * in-process: no BPF, no root. Each case runs BENCH_REPS rounds of a fixed
+ * iteration count and reports the fastest round, so numbers are comparable
+ * between runs on one machine.
+ *
+ * Allocations and syscalls are counted by interposing (ld --wrap, see the
+ * Makefile's BENCH_WRAPS) on what libdwunw.a itself calls, so libc-internal
+ * work is not included.
+ *
+ * DWUNW_BENCH_FIXTURES may list generated large binaries (see
+ * tests/fixtures/gen_large_fixture.c); each gets a "scale" row with index
+ * build time, footprint and lookup latency against its FDE count.
+ */
+
+#define BENCH_REPS 5
+#define BENCH_SCALE_LOOKUPS 1000000
+
+static uint64_t bench_allocs;
+static uint64_t bench_syscalls;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t count, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *
+__wrap_malloc(size_t size)
+{
+    bench_allocs++;
+    return __real_malloc(size);
+}
+
+void *
+__wrap_calloc(size_t count, size_t size)
+{
+    bench_allocs++;
+    return __real_calloc(count, size);
+}
+
+void *
+__wrap_realloc(void *ptr, size_t size)
+{
+    bench_allocs++;
+    return __real_realloc(ptr, size);
+}
+
+#define BENCH_WRAP_SYSCALL(ret, name, params, args) \
+    ret __real_##name params;                       \
+    ret __wrap_##name params;                       \
+    ret __wrap_##name params                        \
+    {                                               \
+        bench_syscalls++;                           \
+        return __real_##name args;                  \
+    }
+
+BENCH_WRAP_SYSCALL(int, close, (int fd), (fd))
+BENCH_WRAP_SYSCALL(int, stat, (const char *path, struct stat *st), (path, st))
+BENCH_WRAP_SYSCALL(int, fstat, (int fd, struct stat *st), (fd, st))
+BENCH_WRAP_SYSCALL(void *, mmap, (void *addr, size_t len, int prot, int flags, int fd, off_t off),
+                   (addr, len, prot, flags, fd, off))
+BENCH_WRAP_SYSCALL(int, munmap, (void *addr, size_t len), (addr, len))
+BENCH_WRAP_SYSCALL(int, posix_madvise, (void *addr, size_t len, int advice), (addr, len, advice))
+BENCH_WRAP_SYSCALL(ssize_t, pread, (int fd, void *buf, size_t count, off_t off), (fd, buf, count, off))
+BENCH_WRAP_SYSCALL(ssize_t, write, (int fd, const void *buf, size_t count), (fd, buf, count))
+BENCH_WRAP_SYSCALL(ssize_t, process_vm_readv,
+                   (pid_t pid, const struct iovec *local, unsigned long liovcnt,
+                    const struct iovec *remote, unsigned long riovcnt, unsigned long flags),
+                   (pid, local, liovcnt, remote, riovcnt, flags))
+BENCH_WRAP_SYSCALL(pid_t, waitpid, (pid_t pid, int *status, int options), (pid, status, options))
+BENCH_WRAP_SYSCALL(int, rename, (const char *from, const char *to), (from, to))
+BENCH_WRAP_SYSCALL(int, unlink, (const char *path), (path))
+BENCH_WRAP_SYSCALL(pid_t, getpid, (void), ())
+
+int __real_open(const char *path, int flags, ...);
+int __wrap_open(const char *path, int flags, ...);
+
+int
+__wrap_open(const char *path, int flags, ...)
+{
+    mode_t mode = 0;
+
+    if (flags & O_CREAT) {
+        va_list ap;
+        va_start(ap, flags);
+        mode = (mode_t)va_arg(ap, int);
+        va_end(ap);
+    }
+    bench_syscalls++;
+    return __real_open(path, flags, mode);
+}
+
+long __real_ptrace(enum __ptrace_request request, ...);
+long __wrap_ptrace(enum __ptrace_request request, ...);
+
+long
+__wrap_ptrace(enum __ptrace_request request, ...)
+{
+    va_list ap;
+    pid_t pid;
+    void *addr;
+    void *data;
+
+    va_start(ap, request);
+    pid = va_arg(ap, pid_t);
+    addr = va_arg(ap, void *);
+    data = va_arg(ap, void *);
+    va_end(ap);
+    bench_syscalls++;
+    return __real_ptrace(request, pid, addr, data);
+}
+
+struct bench_state {
+    const char *fixture;
+    struct dwunw_elf_handle elf;
+    struct dwunw_dwarf_index index;
+    uint64_t *pcs;               /* FDE-covered row starts of the fixture */
+    size_t pc_count;
+    size_t cursor;
+#if defined(__x86_64__)
+    struct dwunw_context ctx;
+    struct dwunw_context no_fp;     /* frame-pointer path off */
+    struct dwunw_context uncached;  /* rule cache off */
+    struct dwunw_context interp;    /* rule cache and row tables off */
+    struct dwunw_fde_record fde;
+    struct dwunw_regset regs;
+    struct dwunw_stack_snapshot snapshot;
+    struct dwunw_memory_reader mem;
+    uint64_t words[8];
+    uint64_t target_pc;
+    uint64_t main_pc;
+    pid_t pid;
+#endif
+};
+
+struct bench_case {
+    const char *name;
+    size_t iters;
+    size_t (*op)(struct bench_state *state);  /* returns frames produced */
+};
+
+static void
+bench_check(dwunw_status_t status, const char *what)
+{
+    if (status != DWUNW_OK) {
+        fprintf(stderr, "bench: %s failed: %d\n", what, status);
+        exit(1);
+    }
+}
+
+static uint64_t
+bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static size_t
+bench_elf_open(struct bench_state *state)
+{
+    struct dwunw_elf_handle elf;
+
+    bench_check(dwunw_elf_open(state->fixture, &elf), "dwunw_elf_open");
+    dwunw_elf_close(&elf);
+    return 0;
+}
+
+static size_t
+bench_index_init(struct bench_state *state)
+{
+    struct dwunw_dwarf_index index;
+
+    memset(&index, 0, sizeof(index));
+    bench_check(dwunw_dwarf_index_init(&index, &state->elf), "dwunw_dwarf_index_init");
+    dwunw_dwarf_index_reset(&index);
+    return 0;
+}
+
+static size_t
+bench_find_fde(struct bench_state *state)
+{
+    struct dwunw_fde_record fde;
+    uint64_t pc = state->pcs[state->cursor++ % state->pc_count];
+
+    bench_check(dwunw_dwarf_index_find_fde(&state->index, pc, &fde), "find_fde");
+    return 0;
+}
+
+#if defined(__x86_64__)
+static uint64_t
+bench_fixture_symbol(const struct dwunw_elf_handle *elf, const char *name)
+{
+    struct dwunw_dwarf_section symtab;
+    struct dwunw_dwarf_section strtab;
+    size_t i;
+
+    bench_check(dwunw_elf_get_section(elf, ".symtab", &symtab), ".symtab");
+    bench_check(dwunw_elf_get_section(elf, ".strtab", &strtab), ".strtab");
+    for (i = 0; i + sizeof(Elf64_Sym) <= symtab.size; i += sizeof(Elf64_Sym)) {
+        Elf64_Sym sym;
+
+        memcpy(&sym, symtab.data + i, sizeof(sym));
+        if (sym.st_name < strtab.size &&
+            strcmp((const char *)strtab.data + sym.st_name, name) == 0) {
+            return sym.st_value;
+        }
+    }
+
+    fprintf(stderr, "bench: fixture has no symbol %s\n", name);
+    exit(1);
+}
+
+static dwunw_status_t
+bench_snapshot_read(void *ctx, uint64_t address, void *dst, size_t size)
+{
+    return dwunw_stack_snapshot_read(ctx, address, dst, size);
+}
+
+static dwunw_status_t
+bench_snapshot_readv(void *ctx, const struct dwunw_read_iov *iov, size_t count)
+{
+    return dwunw_stack_snapshot_readv(ctx, iov, count);
+}
+
+/* Stack the live capture walks: a static buffer, so the default reader's
+ * prefetch window above SP stays inside mapped memory. */
+static uint64_t bench_live_stack[8192];
+
+/* Same frames as the unwinder tests: target_function <- main <- end,
+ * with an rbp chain stored at base. */
+static void
+bench_frame_regs(struct bench_state *state, struct dwunw_regset *regs, uint64_t base)
+{
+    bench_check(dwunw_regset_prepare(regs, DWUNW_ARCH_X86_64), "regset");
+    regs->pc = state->target_pc;
+    regs->regs[6] = base + 32;
+    regs->regs[7] = base;
+    regs->sp = base;
+}
+
+static size_t
+bench_cfi_eval(struct bench_state *state)
+{
+    struct dwunw_regset regs = state->regs;
+    struct dwunw_frame frame;
+
+    bench_check(dwunw_cfi_eval(&state->fde, regs.pc, &regs, &state->mem, &frame),
+                "dwunw_cfi_eval");
+    return 1;
+}
+
+static size_t
+bench_capture_with(struct bench_state *state,
+                   struct dwunw_context *ctx,
+                   pid_t pid,
+                   uint64_t base,
+                   bool compact)
+{
+    struct dwunw_regset regs;
+    struct dwunw_frame frames[8];
+    struct dwunw_compact_frame compact_frames[8];
+    struct dwunw_unwind_request req;
+    size_t written = 0;
+
+    bench_frame_regs(state, &regs, base);
+    memset(&req, 0, sizeof(req));
+    req.module_path = state->fixture;
+    req.regs = &regs;
+    if (compact) {
+        req.compact_frames = compact_frames;
+    } else {
+        req.frames = frames;
+    }
+    req.max_frames = 8;
+    if (pid > 0) {
+        req.pid = pid;
+    } else {
+        req.stack = &state->snapshot;
+    }
+
+    bench_check(dwunw_capture(ctx, &req, &written), "dwunw_capture");
+    if (written != 3) {
+        fprintf(stderr, "bench: capture walked %zu frames, expected 3\n", written);
+        exit(1);
+    }
+    return written;
+}
+
+static size_t
+bench_capture(struct bench_state *state, pid_t pid, uint64_t base, bool compact)
+{
+    return bench_capture_with(state, &state->ctx, pid, base, compact);
+}
+
+static size_t
+bench_capture_snapshot(struct bench_state *state)
+{
+    return bench_capture(state, 0, state->snapshot.base, false);
+}
+
+static size_t
+bench_capture_compact(struct bench_state *state)
+{
+    return bench_capture(state, 0, state->snapshot.base, true);
+}
+
+static size_t
+bench_capture_no_fp(struct bench_state *state)
+{
+    return bench_capture_with(state, &state->no_fp, 0, state->snapshot.base, false);
+}
+
+static size_t
+bench_capture_uncached(struct bench_state *state)
+{
+    return bench_capture_with(state, &state->uncached, 0, state->snapshot.base, false);
+}
+
+static size_t
+bench_capture_interp(struct bench_state *state)
+{
+    return bench_capture_with(state, &state->interp, 0, state->snapshot.base, false);
+}
+
+static size_t
+bench_capture_live(struct bench_state *state)
+{
+    return bench_capture(state, state->pid, (uint64_t)(uintptr_t)bench_live_stack, false);
+}
+#endif
+
+static const struct bench_case bench_cases[] = {
+    { "elf_open", 20000, bench_elf_open },
+    { "index_init", 20000, bench_index_init },
+    { "find_fde", 2000000, bench_find_fde },
+#if defined(__x86_64__)
+    { "cfi_eval", 1000000, bench_cfi_eval },
+    { "capture_snapshot", 200000, bench_capture_snapshot },
+    { "capture_compact", 200000, bench_capture_compact },
+    { "capture_no_fp", 200000, bench_capture_no_fp },
+    { "capture_uncached", 200000, bench_capture_uncached },
+    { "capture_interp", 200000, bench_capture_interp },
+    { "capture_live", 100000, bench_capture_live },
+#endif
+};
+
+static void
+bench_setup(struct bench_state *state)
+{
+    struct dwunw_dwarf_index rows;
+    size_t i;
+
+    memset(state, 0, sizeof(*state));
+    state->fixture = getenv("DWUNW_TEST_FIXTURE");
+    if (!state->fixture) {
+        fprintf(stderr, "bench: DWUNW_TEST_FIXTURE env is required\n");
+        exit(1);
+    }
+    bench_check(dwunw_elf_open(state->fixture, &state->elf), "dwunw_elf_open");
+    bench_check(dwunw_dwarf_index_init(&state->index, &state->elf), "dwunw_dwarf_index_init");
+
+    /* Lookup keys: every row start the compiled table says CFI covers. */
+    memset(&rows, 0, sizeof(rows));
+    bench_check(dwunw_dwarf_index_init(&rows, &state->elf), "dwunw_dwarf_index_init");
+    bench_check(dwunw_dwarf_index_compile(&rows, &state->elf), "dwunw_dwarf_index_compile");
+    state->pcs = calloc(rows.table->count, sizeof(*state->pcs));
+    for (i = 0; state->pcs && i < rows.table->count; ++i) {
+        if (!(rows.table->rows[i].flags & DWUNW_UNWIND_ROW_END)) {
+            state->pcs[state->pc_count++] = rows.table->pcs[i];
+        }
+    }
+    dwunw_dwarf_index_reset(&rows);
+    if (state->pc_count == 0) {
+        fprintf(stderr, "bench: fixture has no CFI rows\n");
+        exit(1);
+    }
+
+#if defined(__x86_64__)
+    state->target_pc = bench_fixture_symbol(&state->elf, "target_function") + 10;
+    state->main_pc = bench_fixture_symbol(&state->elf, "main") + 10;
+    state->pid = getpid();
+    bench_check(dwunw_init(&state->ctx), "dwunw_init");
+    bench_check(dwunw_init(&state->no_fp), "dwunw_init");
+    bench_check(dwunw_init(&state->uncached), "dwunw_init");
+    bench_check(dwunw_init(&state->interp), "dwunw_init");
+    /* Long-running samplers opt into row tables; interp keeps the default. */
+    state->ctx.module_cache.flags |= DWUNW_MODULE_CACHE_COMPILE_TABLES;
+    state->no_fp.module_cache.flags |= DWUNW_MODULE_CACHE_COMPILE_TABLES;
+    state->uncached.module_cache.flags |= DWUNW_MODULE_CACHE_COMPILE_TABLES;
+    dwunw_rule_cache_destroy(state->uncached.rule_cache);
+    state->uncached.rule_cache = NULL;
+    state->no_fp.module_cache.flags &= ~DWUNW_MODULE_CACHE_FRAME_POINTER;
+    dwunw_rule_cache_destroy(state->interp.rule_cache);
+    state->interp.rule_cache = NULL;
+    state->interp.module_cache.flags = 0;
+    bench_check(dwunw_dwarf_index_find_fde(&state->index, state->target_pc, &state->fde),
+                "find_fde");
+
+    state->snapshot.base = 0x7ff000001000ull;
+    state->words[4] = state->snapshot.base + 48;   /* saved rbp -> outer */
+    state->words[5] = state->main_pc;              /* return address */
+    state->snapshot.data = state->words;
+    state->snapshot.size = sizeof(state->words);
+    state->mem.read = bench_snapshot_read;
+    state->mem.readv = bench_snapshot_readv;
+    state->mem.ctx = &state->snapshot;
+    bench_frame_regs(state, &state->regs, state->snapshot.base);
+
+    bench_live_stack[4] = (uint64_t)(uintptr_t)&bench_live_stack[6];
+    bench_live_stack[5] = state->main_pc;
+#endif
+}
+
+static void
+bench_teardown(struct bench_state *state)
+{
+#if defined(__x86_64__)
+    dwunw_shutdown(&state->ctx);
+    dwunw_shutdown(&state->no_fp);
+    dwunw_shutdown(&state->uncached);
+    dwunw_shutdown(&state->interp);
+#endif
+    free(state->pcs);
+    dwunw_dwarf_index_reset(&state->index);
+    dwunw_elf_close(&state->elf);
+}
+
+static void
+bench_run(const struct bench_case *bc, struct bench_state *state)
+{
+    double best = 0.0;
+    uint64_t allocs = 0;
+    uint64_t syscalls = 0;
+    uint64_t frames = 0;
+    int rep;
+
+    for (rep = 0; rep < BENCH_REPS; ++rep) {
+        uint64_t start;
+        double ns;
+        size_t i;
+
+        frames = 0;
+        bench_allocs = 0;
+        bench_syscalls = 0;
+        start = bench_now_ns();
+        for (i = 0; i < bc->iters; ++i) {
+            frames += bc->op(state);
+        }
+        ns = (double)(bench_now_ns() - start) / (double)bc->iters;
+        allocs = bench_allocs;
+        syscalls = bench_syscalls;
+        if (rep == 0 || ns < best) {
+            best = ns;
+        }
+    }
+
+    printf("%-18s %9zu %11.1f %10.2f %12.2f %9.2f",
+           bc->name, bc->iters, best,
+           (double)allocs / (double)bc->iters,
+           (double)syscalls / (double)bc->iters,
+           (double)frames / (double)bc->iters);
+    if (frames > 0) {
+        printf(" %10.1f %14.2f\n",
+               best * (double)bc->iters / (double)frames,
+               (double)syscalls / (double)frames);
+    } else {
+        printf(" %10s %14s\n", "-", "-");
+    }
+}
+
+/* xorshift64: a fixed lookup order, identical on every run. */
+static uint64_t
+bench_next_random(uint64_t *state)
+{
+    uint64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    *state = x;
+    return x;
+}
+
+static void
+bench_scale(const char *path)
+{
+    struct dwunw_elf_handle elf;
+    struct dwunw_dwarf_index index;
+    struct dwunw_module_cache cache;
+    struct dwunw_module_handle *handle;
+    uint64_t *keys;
+    size_t key_count = 0;
+    size_t fdes;
+    size_t footprint;
+    uint64_t init_ns = 0;
+    uint64_t init_allocs = 0;
+    uint64_t compile_ns = 0;
+    uint64_t find_ns;
+    uint64_t seed = 0x9e3779b97f4a7c15ull;
+    uint64_t start;
+    const char *name = strrchr(path, '/');
+    size_t i;
+    int rep;
+
+    bench_check(dwunw_elf_open(path, &elf), path);
+    memset(&index, 0, sizeof(index));
+    for (rep = 0; rep < BENCH_REPS; ++rep) {
+        uint64_t ns;
+
+        bench_allocs = 0;
+        start = bench_now_ns();
+        bench_check(dwunw_dwarf_index_init(&index, &elf), "dwunw_dwarf_index_init");
+        ns = bench_now_ns() - start;
+        init_allocs = bench_allocs;
+        if (rep == 0 || ns < init_ns) {
+            init_ns = ns;
+        }
+
+        start = bench_now_ns();
+        bench_check(dwunw_dwarf_index_compile(&index, &elf), "dwunw_dwarf_index_compile");
+        ns = bench_now_ns() - start;
+        if (rep == 0 || ns < compile_ns) {
+            compile_ns = ns;
+        }
+        if (rep + 1 < BENCH_REPS) {
+            dwunw_dwarf_index_reset(&index);
+        }
+    }
+    fdes = index.fde_count + (index.lazy ? dwunw_cfi_lazy_count(index.lazy) : 0);
+
+    keys = calloc(index.table->count, sizeof(*keys));
+    for (i = 0; keys && i < index.table->count; ++i) {
+        if (!(index.table->rows[i].flags & DWUNW_UNWIND_ROW_END)) {
+            keys[key_count++] = index.table->pcs[i];
+        }
+    }
+    if (key_count == 0) {
+        fprintf(stderr, "bench: %s has no CFI rows\n", path);
+        exit(1);
+    }
+    start = bench_now_ns();
+    for (i = 0; i < BENCH_SCALE_LOOKUPS; ++i) {
+        struct dwunw_fde_record fde;
+        uint64_t pc = keys[bench_next_random(&seed) % key_count];
+
+        bench_check(dwunw_dwarf_index_find_fde(&index, pc, &fde), "find_fde");
+    }
+    find_ns = bench_now_ns() - start;
+    free(keys);
+    dwunw_dwarf_index_reset(&index);
+
+    /* What the module cache charges for the module: image + tables. */
+    dwunw_module_cache_init(&cache);
+    cache.flags = DWUNW_MODULE_CACHE_COMPILE_TABLES;
+    bench_check(dwunw_module_cache_acquire(&cache, path, &handle), "module_cache_acquire");
+    footprint = cache.bytes;
+    dwunw_module_cache_release(&cache, handle);
+    dwunw_module_cache_flush(&cache);
+
+    printf("%-18s %9zu %10zu %10zu %10.1f %11llu %11.1f %11.1f\n",
+           name ? name + 1 : path, fdes,
+           elf.size / 1024, (footprint - elf.size) / 1024,
+           (double)init_ns / 1000.0, (unsigned long long)init_allocs,
+           (double)compile_ns / 1e6,
+           (double)find_ns / BENCH_SCALE_LOOKUPS);
+    dwunw_elf_close(&elf);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct bench_state state;
+    const char *filter = argc > 1 ? argv[1] : NULL;
+    const char *fixtures;
+    char *list;
+    char *path;
+    size_t i;
+
+    bench_setup(&state);
+    printf("%-18s %9s %11s %10s %12s %9s %10s %14s\n",
+           "bench", "iters", "ns/op", "allocs/op", "syscalls/op", "frames/op",
+           "ns/frame", "syscalls/frame");
+    for (i = 0; i < sizeof(bench_cases) / sizeof(bench_cases[0]); ++i) {
+        if (!filter || strstr(bench_cases[i].name, filter)) {
+            bench_run(&bench_cases[i], &state);
+        }
+    }
+    bench_teardown(&state);
+
+    fixtures = getenv("DWUNW_BENCH_FIXTURES");
+    if (!fixtures || !*fixtures || (filter && !strstr("scale", filter))) {
+        return 0;
+    }
+    printf("\n%-18s %9s %10s %10s %10s %11s %11s %11s\n",
+           "scale", "fdes", "image_kib", "tables_kib", "init_us", "init_allocs",
+           "compile_ms", "find_fde_ns");
+    list = strdup(fixtures);
+    for (path = strtok(list, " "); path; path = strtok(NULL, " ")) {
+        bench_scale(path);
+    }
+    free(list);
+    return 0;
+}
@@ -0,0 +1,136 @@
+/*
+ * Writes x86-64 assembly for a synthetic binary with many small functions,
+ * to exercise index build time, footprint and lookup latency at scale:
+ *
+ *   gen_large_fixture FUNCTIONS EH_FRAME_OUT.s DEBUG_FRAME_OUT.s
+ *
+ * Every fourth function goes to the second file, whose CFI is emitted into
+ * .debug_frame; the rest carry .eh_frame (and so .eh_frame_hdr once
+ * linked). Functions rotate through three prologue shapes (frame pointer,
+ * pushed register plus stack adjustment, bare stack adjustment) and call
+ * the next function, forming chains GEN_CHAIN_DEPTH deep that end in a
+ * leaf. Assemble both files with -g so the binary has .debug_info.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#define GEN_CHAIN_DEPTH 128
+
+static void
+emit_function(FILE *out, unsigned long i, unsigned long count)
+{
+    int calls = (i + 1) < count && (i + 1) % GEN_CHAIN_DEPTH != 0;
+
+    fprintf(out,
+            "\t.globl f%lu\n"
+            "\t.type f%lu, @function\n"
+            "f%lu:\n"
+            "\t.cfi_startproc\n",
+            i, i, i);
+
+    switch (i % 3) {
+    case 0:
+        fprintf(out,
+                "\tpushq %%rbp\n"
+                "\t.cfi_def_cfa_offset 16\n"
+                "\t.cfi_offset %%rbp, -16\n"
+                "\tmovq %%rsp, %%rbp\n"
+                "\t.cfi_def_cfa_register %%rbp\n");
+        if (calls) {
+            fprintf(out, "\tcall f%lu\n", i + 1);
+        }
+        fprintf(out,
+                "\tpopq %%rbp\n"
+                "\t.cfi_def_cfa %%rsp, 8\n"
+                "\tret\n");
+        break;
+    case 1:
+        fprintf(out,
+                "\tpushq %%rbx\n"
+                "\t.cfi_def_cfa_offset 16\n"
+                "\t.cfi_offset %%rbx, -16\n"
+                "\tsubq $32, %%rsp\n"
+                "\t.cfi_def_cfa_offset 48\n");
+        if (calls) {
+            fprintf(out, "\tcall f%lu\n", i + 1);
+        }
+        fprintf(out,
+                "\taddq $32, %%rsp\n"
+                "\t.cfi_def_cfa_offset 16\n"
+                "\tpopq %%rbx\n"
+                "\t.cfi_def_cfa_offset 8\n"
+                "\tret\n");
+        break;
+    default:
+        if (calls) {
+            fprintf(out,
+                    "\tsubq $8, %%rsp\n"
+                    "\t.cfi_def_cfa_offset 16\n"
+                    "\tcall f%lu\n"
+                    "\taddq $8, %%rsp\n"
+                    "\t.cfi_def_cfa_offset 8\n",
+                    i + 1);
+        } else {
+            fprintf(out, "\txorl %%eax, %%eax\n");
+        }
+        fprintf(out, "\tret\n");
+        break;
+    }
+
+    fprintf(out,
+            "\t.cfi_endproc\n"
+            "\t.size f%lu, .-f%lu\n",
+            i, i);
+}
+
+int
+main(int argc, char **argv)
+{
+    FILE *eh;
+    FILE *debug;
+    unsigned long count;
+    unsigned long i;
+    char *end;
+
+    if (argc != 4) {
+        fprintf(stderr, "usage: %s FUNCTIONS EH_FRAME_OUT.s DEBUG_FRAME_OUT.s\n", argv[0]);
+        return 2;
+    }
+    count = strtoul(argv[1], &end, 10);
+    if (*end != '\0' || count == 0) {
+        fprintf(stderr, "invalid function count: %s\n", argv[1]);
+        return 2;
+    }
+
+    eh = fopen(argv[2], "w");
+    debug = fopen(argv[3], "w");
+    if (!eh || !debug) {
+        perror("fopen");
+        return 1;
+    }
+
+    fprintf(eh, "\t.cfi_sections .eh_frame\n\t.text\n");
+    fprintf(debug, "\t.cfi_sections .debug_frame\n\t.text\n");
+    for (i = 0; i < count; ++i) {
+        emit_function(i % 4 == 3 ? debug : eh, i, count);
+    }
+
+    /* The binary only has to link and be parsed, never to run the chains. */
+    fprintf(eh,
+            "\t.globl main\n"
+            "\t.type main, @function\n"
+            "main:\n"
+            "\t.cfi_startproc\n"
+            "\txorl %%eax, %%eax\n"
+            "\tret\n"
+            "\t.cfi_endproc\n"
+            "\t.size main, .-main\n"
+            "\t.section .note.GNU-stack,\"\",@progbits\n");
+    fprintf(debug, "\t.section .note.GNU-stack,\"\",@progbits\n");
+
+    if (fclose(eh) != 0 || fclose(debug) != 0) {
+        perror("fclose");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,153 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dwunw/addr_space.h"
+#include "dwunw/dwunw_api.h"
+#include "dwunw/elf_loader.h"
+#include "dwunw/unwind.h"
+
+static uint64_t
+self_pc(void)
+{
+    return (uint64_t)(uintptr_t)&self_pc;
+}
+
+/* Our own text must resolve to our executable with a bias that maps the
+ * runtime PC back inside its .text section. */
+static void
+test_self_mapping_and_bias(void)
+{
+    struct dwunw_addr_space space;
+    struct dwunw_addr_space_mapping *mapping;
+    struct dwunw_elf_handle handle;
+    struct dwunw_dwarf_section text;
+    char exe[PATH_MAX];
+    uint64_t bias = 0;
+    uint64_t rel;
+    size_t i;
+
+    assert(realpath("/proc/self/exe", exe) != NULL);
+    assert(dwunw_addr_space_load(getpid(), &space) == DWUNW_OK);
+    assert(space.count > 0);
+    for (i = 1; i < space.count; ++i) {
+        assert(space.mappings[i - 1].end <= space.mappings[i].start);
+    }
+
+    mapping = dwunw_addr_space_lookup(&space, self_pc());
+    assert(mapping != NULL);
+    assert(strcmp(dwunw_addr_space_path(&space, mapping), exe) == 0);
+    assert(dwunw_addr_space_lookup(&space, 0) == NULL);
+
+    assert(dwunw_elf_open(exe, &handle) == DWUNW_OK);
+    assert(dwunw_elf_load_bias(&handle,
+                               mapping->start,
+                               mapping->offset,
+                               mapping->end - mapping->start,
+                               &bias) == DWUNW_OK);
+    assert(dwunw_elf_get_section(&handle, ".text", &text) == DWUNW_OK);
+    rel = self_pc() - bias;
+    assert(rel >= text.addr && rel < text.addr + text.size);
+
+    dwunw_elf_close(&handle);
+    dwunw_addr_space_free(&space);
+    assert(space.mappings == NULL && space.count == 0);
+}
+
+static void
+test_cache_generations(void)
+{
+    struct dwunw_addr_space_cache cache;
+    struct dwunw_addr_space *first;
+    struct dwunw_addr_space *again;
+    struct dwunw_addr_space_slot *slot;
+    uint64_t generation;
+
+    dwunw_addr_space_cache_init(&cache);
+    assert(dwunw_addr_space_get(&cache, getpid(), &first) == DWUNW_OK);
+    generation = first->generation;
+    assert(generation > 0);
+
+    /* A cached snapshot is served as-is. */
+    assert(dwunw_addr_space_get(&cache, getpid(), &again) == DWUNW_OK);
+    assert(again == first && again->generation == generation);
+
+    assert(dwunw_addr_space_refresh(&cache, getpid(), &again) == DWUNW_OK);
+    assert(again->generation > generation);
+    generation = again->generation;
+
+    dwunw_addr_space_invalidate(&cache, getpid());
+    assert(dwunw_addr_space_get(&cache, getpid(), &again) == DWUNW_OK);
+    assert(again->generation > generation);
+    generation = again->generation;
+
+    /* Once the recheck is due, a pid that now names another process (here
+     * faked through its start time) is reloaded; a matching one is not. */
+    slot = &cache.slots[0];
+    assert(&slot->space == again);
+    slot->checked_ns -= DWUNW_ADDR_SPACE_RECHECK_NS;
+    assert(dwunw_addr_space_get(&cache, getpid(), &again) == DWUNW_OK);
+    assert(again->generation == generation);
+
+    slot->identity.start_time++;
+    slot->checked_ns -= DWUNW_ADDR_SPACE_RECHECK_NS;
+    assert(dwunw_addr_space_get(&cache, getpid(), &again) == DWUNW_OK);
+    assert(again->generation > generation);
+
+    assert(dwunw_addr_space_get(&cache, 0, &again) == DWUNW_ERR_INVALID_ARG);
+    dwunw_addr_space_cache_flush(&cache);
+}
+
+/* Without module_path the root frame names the module found in the maps. */
+static void
+test_capture_resolves_module(void)
+{
+    struct dwunw_context ctx;
+    struct dwunw_regset regs;
+    struct dwunw_frame frame;
+    struct dwunw_compact_frame compact;
+    struct dwunw_unwind_request req;
+    char exe[PATH_MAX];
+    size_t written = 0;
+
+    assert(realpath("/proc/self/exe", exe) != NULL);
+    assert(dwunw_init(&ctx) == DWUNW_OK);
+    assert(dwunw_regset_prepare(&regs, DWUNW_ARCH_X86_64) == DWUNW_OK);
+    regs.pc = self_pc();
+
+    memset(&frame, 0, sizeof(frame));
+    memset(&req, 0, sizeof(req));
+    req.regs = &regs;
+    req.frames = &frame;
+    req.max_frames = 1;
+    req.pid = getpid();
+
+    assert(dwunw_capture(&ctx, &req, &written) == DWUNW_OK);
+    assert(written == 1);
+    assert(strcmp(frame.module_path, exe) == 0);
+
+    req.frames = NULL;
+    req.compact_frames = &compact;
+    assert(dwunw_capture(&ctx, &req, &written) == DWUNW_OK);
+    assert(written == 1);
+    assert(compact.pc == regs.pc);
+    assert(strcmp(dwunw_module_name(&ctx, compact.module_id), exe) == 0);
+
+    req.pid = 0;
+    assert(dwunw_capture(&ctx, &req, &written) == DWUNW_ERR_INVALID_ARG);
+    dwunw_shutdown(&ctx);
+}
+
+int
+main(void)
+{
+    test_self_mapping_and_bias();
+    test_cache_generations();
+    test_capture_resolves_module();
+    puts("addr_space: ok");
+    return 0;
+}
@@ -10,6 +10,8 @@
 struct mock_stack {
     uint64_t base;
     uint8_t bytes[64];
+    unsigned int reads;
+    unsigned int readv_calls;
 };
 
 static const uint8_t simple_debug_frame[] = {
@@ -30,11 +32,67 @@ static const uint8_t simple_debug_frame[] = {
     0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, /* address_range 0x40 */
 };
 
+/* CIE from simple_debug_frame followed by FDEs emitted out of order, with
+ * a duplicate start and an empty (gc'd) range. */
+static const struct {
+    uint64_t pc_begin;
+    uint64_t pc_range;
+} unsorted_fdes[] = {
+    { 0x3000, 0x100 },
+    { 0x1000, 0x80 },
+    { 0x0000, 0x00 },
+    { 0x2000, 0x40 },
+    { 0x1000, 0x20 },
+};
+
+/* An outer FDE with two nested ones, one overlapping its end and one past
+ * everything. */
+static const struct {
+    uint64_t pc_begin;
+    uint64_t pc_range;
+} nested_fdes[] = {
+    { 0x1000, 0x200 },
+    { 0x1040, 0x40 },
+    { 0x1100, 0x20 },
+    { 0x1180, 0x100 },
+    { 0x2000, 0x10 },
+};
+
+#define EMIT_DEBUG_FRAME(buf, ranges) \
+    emit_debug_frame((buf), sizeof(buf), &(ranges)[0].pc_begin, \
+                     sizeof(ranges) / sizeof((ranges)[0]))
+
+/* CIE from simple_debug_frame plus one FDE per {pc_begin, pc_range} pair. */
+static size_t
+emit_debug_frame(uint8_t *buf, size_t cap, const uint64_t *ranges, size_t count)
+{
+    const size_t cie_len = 18;
+    size_t pos = cie_len;
+    size_t i;
+
+    assert(cap >= cie_len + 24 * count);
+    memcpy(buf, simple_debug_frame, cie_len);
+
+    for (i = 0; i < count; ++i) {
+        const uint32_t length = 0x14;
+        const uint32_t cie_pointer = 0;
+
+        memcpy(buf + pos, &length, sizeof(length));
+        memcpy(buf + pos + 4, &cie_pointer, sizeof(cie_pointer));
+        memcpy(buf + pos + 8, &ranges[2 * i], sizeof(uint64_t));
+        memcpy(buf + pos + 16, &ranges[2 * i + 1], sizeof(uint64_t));
+        pos += 24;
+    }
+
+    return pos;
+}
+
 static dwunw_status_t
 mock_reader(void *ctx, uint64_t address, void *dst, size_t size)
 {
-    const struct mock_stack *mem = ctx;
+    struct mock_stack *mem = ctx;
 
+    mem->reads++;
     if (address < mem->base || address + size > mem->base + sizeof(mem->bytes)) {
         return DWUNW_ERR_INVALID_ARG;
     }
@@ -43,6 +101,24 @@ mock_reader(void *ctx, uint64_t address, void *dst, size_t size)
     return DWUNW_OK;
 }
 
+static dwunw_status_t
+mock_readv(void *ctx, const struct dwunw_read_iov *iov, size_t count)
+{
+    struct mock_stack *mem = ctx;
+    unsigned int reads = mem->reads;
+    size_t i;
+
+    mem->readv_calls++;
+    for (i = 0; i < count; ++i) {
+        dwunw_status_t st = mock_reader(ctx, iov[i].address, iov[i].dst, iov[i].size);
+        if (st != DWUNW_OK) {
+            return st;
+        }
+    }
+    mem->reads = reads;
+    return DWUNW_OK;
+}
+
 static void
 build_simple_tables(struct dwunw_cie_record **cies,
                     size_t *cie_count,
@@ -74,6 +150,13 @@ test_cfi_build_parses_simple_section(void)
     assert(cies[0].code_align == 1);
     assert(cies[0].data_align == 8);
     assert(cies[0].return_reg == 0x10);
+    /* CIE initial instructions are replayed once at build time. */
+    assert(cies[0].initial_status == DWUNW_OK);
+    assert(cies[0].initial.cfa_reg == 7);
+    assert(cies[0].initial.cfa_offset == 16);
+    assert(cies[0].initial.regs[0x10].kind == DWUNW_CFI_RULE_OFFSET);
+    assert(cies[0].initial.regs[0x10].offset == 8);
+    assert(cies[0].initial.regs[6].kind == DWUNW_CFI_RULE_SAME_VALUE);
     assert(fdes[0].pc_begin == 0x1000);
     assert(fdes[0].pc_range == 0x40);
 
@@ -92,6 +175,7 @@ test_cfi_eval_reads_return_address(void)
     struct mock_stack stack = {
         .base = 0x1000,
     };
+    struct dwunw_memory_reader mem = { mock_reader, NULL, &stack, NULL };
     const uint64_t saved_ra = 0x5000;
 
     build_simple_tables(&cies, &cie_count, &fdes, &fde_count);
@@ -102,12 +186,137 @@ test_cfi_eval_reads_return_address(void)
     regs.regs[7] = regs.sp;
     memcpy(&stack.bytes[0x18], &saved_ra, sizeof(saved_ra));
 
-    assert(dwunw_cfi_eval(&fdes[0], regs.pc, &regs, mock_reader, &stack, &frame) == DWUNW_OK);
+    assert(dwunw_cfi_eval(&fdes[0], regs.pc, &regs, &mem, &frame) == DWUNW_OK);
     assert(frame.pc == saved_ra);
     assert(frame.ra == saved_ra);
     assert(frame.sp == regs.sp);
     assert(frame.sp == 0x1000 + 16);
     assert(frame.flags == 0);
+    assert(stack.reads == 1);
+    assert(stack.readv_calls == 0);
+
+    dwunw_cfi_free(cies, fdes);
+}
+
+/* Saved registers of a frame are fetched with one vectored read. */
+static void
+test_cfi_eval_batches_reads(void)
+{
+    struct dwunw_cie_record *cies = NULL;
+    struct dwunw_fde_record *fdes = NULL;
+    size_t cie_count = 0;
+    size_t fde_count = 0;
+    struct dwunw_regset regs;
+    struct dwunw_frame frame;
+    struct mock_stack stack = {
+        .base = 0x1000,
+    };
+    struct dwunw_memory_reader mem = { mock_reader, mock_readv, &stack, NULL };
+    const uint64_t saved_ra = 0x5000;
+
+    build_simple_tables(&cies, &cie_count, &fdes, &fde_count);
+
+    assert(dwunw_regset_prepare(&regs, DWUNW_ARCH_X86_64) == DWUNW_OK);
+    regs.sp = 0x1000;
+    regs.pc = 0x1008;
+    regs.regs[7] = regs.sp;
+    memcpy(&stack.bytes[0x18], &saved_ra, sizeof(saved_ra));
+
+    assert(dwunw_cfi_eval(&fdes[0], regs.pc, &regs, &mem, &frame) == DWUNW_OK);
+    assert(frame.pc == saved_ra);
+    assert(regs.regs[0x10] == saved_ra);
+    assert(stack.readv_calls == 1);
+    assert(stack.reads == 0);
+
+    mem.read = NULL;
+    assert(dwunw_cfi_eval(&fdes[0], 0x1008, &regs, &mem, &frame) == DWUNW_ERR_INVALID_ARG);
+
+    dwunw_cfi_free(cies, fdes);
+}
+
+static void
+test_cfi_build_sorts_and_searches(void)
+{
+    uint8_t section_buf[256];
+    struct dwunw_dwarf_sections sections;
+    struct dwunw_cie_record *cies = NULL;
+    struct dwunw_fde_record *fdes = NULL;
+    size_t cie_count = 0;
+    size_t fde_count = 0;
+    uint64_t keys[3];
+    size_t i;
+
+    memset(&sections, 0, sizeof(sections));
+    sections.debug_frame.data = section_buf;
+    sections.debug_frame.size = EMIT_DEBUG_FRAME(section_buf, unsorted_fdes);
+
+    assert(dwunw_cfi_build(&sections, &cies, &cie_count, &fdes, &fde_count) == DWUNW_OK);
+    assert(cie_count == 1);
+
+    /* Empty range dropped, duplicate start keeps the first-parsed FDE. */
+    assert(fde_count == 3);
+    assert(fdes[0].pc_begin == 0x1000 && fdes[0].pc_range == 0x80);
+    assert(fdes[1].pc_begin == 0x2000);
+    assert(fdes[2].pc_begin == 0x3000);
+    for (i = 0; i < fde_count; ++i) {
+        assert(fdes[i].cie == &cies[0]);
+        keys[i] = fdes[i].pc_begin;
+    }
+
+    assert(dwunw_cfi_find_fde(fdes, fde_count, 0x0fff) == NULL);
+    assert(dwunw_cfi_find_fde(fdes, fde_count, 0x1000) == &fdes[0]);
+    assert(dwunw_cfi_find_fde(fdes, fde_count, 0x107f) == &fdes[0]);
+    assert(dwunw_cfi_find_fde(fdes, fde_count, 0x1080) == NULL);
+    assert(dwunw_cfi_find_fde(fdes, fde_count, 0x2010) == &fdes[1]);
+    assert(dwunw_cfi_find_fde(fdes, fde_count, 0x30ff) == &fdes[2]);
+    assert(dwunw_cfi_find_fde(fdes, fde_count, 0x3100) == NULL);
+
+    assert(dwunw_cfi_find_fde_keyed(keys, fdes, fde_count, 0x0fff) == NULL);
+    assert(dwunw_cfi_find_fde_keyed(keys, fdes, fde_count, 0x1040) == &fdes[0]);
+    assert(dwunw_cfi_find_fde_keyed(keys, fdes, fde_count, 0x2000) == &fdes[1]);
+    assert(dwunw_cfi_find_fde_keyed(keys, fdes, fde_count, 0x3000) == &fdes[2]);
+    assert(dwunw_cfi_find_fde_keyed(keys, fdes, fde_count, UINT64_MAX) == NULL);
+
+    dwunw_cfi_free(cies, fdes);
+}
+
+/* A pc past a nested FDE belongs to the FDE enclosing it again. */
+static void
+test_cfi_find_fde_nested(void)
+{
+    uint8_t section_buf[256];
+    struct dwunw_dwarf_sections sections;
+    struct dwunw_cie_record *cies = NULL;
+    struct dwunw_fde_record *fdes = NULL;
+    size_t cie_count = 0;
+    size_t fde_count = 0;
+    uint64_t keys[5];
+    size_t i;
+
+    memset(&sections, 0, sizeof(sections));
+    sections.debug_frame.data = section_buf;
+    sections.debug_frame.size = EMIT_DEBUG_FRAME(section_buf, nested_fdes);
+
+    assert(dwunw_cfi_build(&sections, &cies, &cie_count, &fdes, &fde_count) == DWUNW_OK);
+    assert(fde_count == 5);
+    for (i = 0; i < fde_count; ++i) {
+        keys[i] = fdes[i].pc_begin;
+        assert(!(fdes[i].flags & DWUNW_CFI_NESTED) == (i == 0 || i == 4));
+    }
+
+    assert(dwunw_cfi_find_fde(fdes, fde_count, 0x1020) == &fdes[0]);
+    assert(dwunw_cfi_find_fde(fdes, fde_count, 0x1050) == &fdes[1]);
+    assert(dwunw_cfi_find_fde(fdes, fde_count, 0x1080) == &fdes[0]);
+    assert(dwunw_cfi_find_fde(fdes, fde_count, 0x111f) == &fdes[2]);
+    assert(dwunw_cfi_find_fde(fdes, fde_count, 0x1150) == &fdes[0]);
+    assert(dwunw_cfi_find_fde(fdes, fde_count, 0x11f0) == &fdes[3]);
+    assert(dwunw_cfi_find_fde(fdes, fde_count, 0x1210) == &fdes[3]);
+    assert(dwunw_cfi_find_fde(fdes, fde_count, 0x1280) == NULL);
+    assert(dwunw_cfi_find_fde(fdes, fde_count, 0x2010) == NULL);
+
+    assert(dwunw_cfi_find_fde_keyed(keys, fdes, fde_count, 0x10a0) == &fdes[0]);
+    assert(dwunw_cfi_find_fde_keyed(keys, fdes, fde_count, 0x1140) == &fdes[0]);
+    assert(dwunw_cfi_find_fde_keyed(keys, fdes, fde_count, 0x1fff) == NULL);
 
     dwunw_cfi_free(cies, fdes);
 }
@@ -116,7 +325,10 @@ int
 main(void)
 {
     test_cfi_build_parses_simple_section();
+    test_cfi_build_sorts_and_searches();
+    test_cfi_find_fde_nested();
     test_cfi_eval_reads_return_address();
+    test_cfi_eval_batches_reads();
     puts("cfi: ok");
     return 0;
 }
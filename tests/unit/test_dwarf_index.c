@@ -5,6 +5,7 @@
 
 #include "dwunw/dwarf_index.h"
 #include "dwunw/elf_loader.h"
+#include "dwarf/cfi.h"
 
 static const char *
 get_fixture_path(void)
@@ -56,14 +57,73 @@ test_init_with_fixture(void)
     st = dwunw_dwarf_index_init(&index, &handle);
     assert(st == DWUNW_OK || st == DWUNW_ERR_NO_DEBUG_DATA);
 
+    /* Only the call-frame sections are collected for unwinding. */
+    assert(index.sections.debug_info.data == NULL);
+    assert(index.sections.debug_info.size == 0);
     if (st == DWUNW_OK) {
-        assert(index.sections.debug_info.data != NULL);
-        assert(index.sections.debug_info.size > 0);
-    } else {
-        assert(index.sections.debug_info.data == NULL);
-        assert(index.sections.debug_info.size == 0);
+        assert(index.sections.eh_frame.data || index.sections.debug_frame.data);
+    }
+
+    dwunw_dwarf_index_reset(&index);
+    dwunw_elf_close(&handle);
+}
+
+/* The .eh_frame_hdr path must agree with a full eager parse of .eh_frame. */
+static void
+test_lazy_lookup_matches_eager(void)
+{
+    struct dwunw_dwarf_index index;
+    struct dwunw_elf_handle handle;
+    struct dwunw_cie_record *cies = NULL;
+    struct dwunw_fde_record *fdes = NULL;
+    size_t cie_count = 0;
+    size_t fde_count = 0;
+    size_t i;
+
+    assert(dwunw_elf_open(get_fixture_path(), &handle) == DWUNW_OK);
+    memset(&index, 0, sizeof(index));
+    if (dwunw_dwarf_index_init(&index, &handle) != DWUNW_OK ||
+        !index.sections.eh_frame_hdr.data) {
+        dwunw_dwarf_index_reset(&index);
+        dwunw_elf_close(&handle);
+        return;
+    }
+
+    assert(index.lazy != NULL);
+    assert(index.flags & DWUNW_DWARF_INDEX_FLAG_LAZY_EH_FRAME);
+    assert(dwunw_cfi_lazy_count(index.lazy) > 0);
+
+    assert(dwunw_cfi_build(&index.sections, &cies, &cie_count, &fdes, &fde_count) == DWUNW_OK);
+    assert(fde_count > 0);
+
+    for (i = 0; i < fde_count; ++i) {
+        struct dwunw_fde_record found;
+        uint64_t last = fdes[i].pc_begin + fdes[i].pc_range - 1;
+
+        /* Real code addresses, not pointers into the mapped image. */
+        assert(fdes[i].pc_begin < (uint64_t)handle.size * 16);
+
+        assert(dwunw_dwarf_index_find_fde(&index, fdes[i].pc_begin, &found) == DWUNW_OK);
+        assert(found.pc_begin == fdes[i].pc_begin);
+        assert(found.pc_range == fdes[i].pc_range);
+        assert(found.instructions == fdes[i].instructions);
+        assert(found.cie->return_reg == fdes[i].cie->return_reg);
+
+        assert(dwunw_dwarf_index_find_fde(&index, last, &found) == DWUNW_OK);
+        assert(found.pc_begin == fdes[i].pc_begin);
     }
 
+    /* Below the first FDE nothing is covered; there is no such pc when the
+     * table starts at address 0. */
+    if (fdes[0].pc_begin > 0) {
+        struct dwunw_fde_record found;
+        assert(dwunw_dwarf_index_find_fde(&index, fdes[0].pc_begin - 1, &found) ==
+               DWUNW_ERR_NO_DEBUG_DATA);
+    }
+
+    dwunw_cfi_free(cies, fdes);
+    dwunw_dwarf_index_reset(&index);
+    assert(index.lazy == NULL);
     dwunw_elf_close(&handle);
 }
 
@@ -89,6 +149,7 @@ main(void)
 {
     test_reset_zeroes_everything();
     test_init_with_fixture();
+    test_lazy_lookup_matches_eager();
     test_invalid_args();
     return 0;
 }
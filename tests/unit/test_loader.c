@@ -1,27 +1,70 @@
 #define _GNU_SOURCE
 #include <assert.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "dwunw/dwarf_index.h"
+#include "dwunw/dwunw_api.h"
 #include "dwunw/elf_loader.h"
 #include "dwunw/module_cache.h"
+#include "dwarf/unwind_table.h"
 static struct dwunw_module_cache_entry *
 find_cache_entry(struct dwunw_module_cache *cache,
                  struct dwunw_module_handle *handle)
 {
     size_t i;
 
-    for (i = 0; i < DWUNW_MODULE_CACHE_CAPACITY; ++i) {
-        if (&cache->entries[i].handle == handle) {
-            return &cache->entries[i];
+    for (i = 0; i < cache->bucket_count; ++i) {
+        struct dwunw_module_cache_entry *entry;
+        for (entry = cache->id_buckets[i]; entry; entry = entry->id_next) {
+            if ((entry->shared ? entry->shared : &entry->handle) == handle) {
+                return entry;
+            }
         }
     }
 
     return NULL;
 }
 
+/* Copy the fixture to path; with a nonzero tag, stamp it into the build-id
+ * so the copy counts as a distinct module. */
+static void
+copy_fixture(const char *fixture, const char *path, uint32_t tag)
+{
+    struct dwunw_elf_handle elf;
+    FILE *in;
+    FILE *out;
+    uint8_t *data;
+    uint8_t *note;
+    long size;
+
+    assert(dwunw_elf_open(fixture, &elf) == DWUNW_OK);
+    in = fopen(fixture, "rb");
+    assert(in != NULL);
+    assert(fseek(in, 0, SEEK_END) == 0);
+    size = ftell(in);
+    rewind(in);
+    data = malloc((size_t)size);
+    assert(data && fread(data, 1, (size_t)size, in) == (size_t)size);
+    fclose(in);
+
+    if (tag) {
+        note = memmem(data, (size_t)size, elf.build_id, elf.build_id_len);
+        assert(note != NULL);
+        memcpy(note, &tag, sizeof(tag));
+    }
+    dwunw_elf_close(&elf);
+
+    out = fopen(path, "wb");
+    assert(out && fwrite(data, 1, (size_t)size, out) == (size_t)size);
+    fclose(out);
+    free(data);
+}
+
 
 static const char *
 get_fixture_path(void)
@@ -31,6 +74,14 @@ get_fixture_path(void)
     return path;
 }
 
+static const char *
+get_stripped_fixture_path(void)
+{
+    const char *path = getenv("DWUNW_TEST_STRIPPED_FIXTURE");
+    assert(path && "DWUNW_TEST_STRIPPED_FIXTURE env is required");
+    return path;
+}
+
 static void
 test_loader_invalid_path(void)
 {
@@ -49,12 +100,77 @@ test_loader_valid_fixture(void)
 
     st = dwunw_elf_open(fixture, &handle);
     assert(st == DWUNW_OK);
+    assert(handle.mapped);
+    /* The fixture is linked with --build-id (SHA-1 by default). */
+    assert(handle.build_id_len == 20);
 
     /* Depending on compiler flags, fixture may or may not carry debug data. */
     st = dwunw_elf_collect_dwarf(&handle, &sections);
     assert(st == DWUNW_OK || st == DWUNW_ERR_NO_DEBUG_DATA);
+    if (st == DWUNW_OK && sections.eh_frame.data) {
+        /* Slices must point straight into the mapped image. */
+        assert(sections.eh_frame.data >= (const uint8_t *)handle.image);
+        assert(sections.eh_frame.data + sections.eh_frame.size <=
+               (const uint8_t *)handle.image + handle.size);
+    }
 
     dwunw_elf_close(&handle);
+    assert(handle.image == NULL);
+    assert(handle.mapped == 0);
+    assert(handle.build_id_len == 0);
+}
+
+/* Stripped binaries keep .eh_frame (and the build-id) but no .debug_*;
+ * they must still load, and unwind-only collection must not touch the
+ * debug sections of binaries that do have them. */
+static void
+test_loader_stripped_fixture(void)
+{
+    struct dwunw_elf_handle handle;
+    struct dwunw_elf_handle full;
+    struct dwunw_dwarf_sections sections;
+    struct dwunw_dwarf_section section;
+    struct dwunw_dwarf_index index;
+
+    assert(dwunw_elf_open(get_stripped_fixture_path(), &handle) == DWUNW_OK);
+    assert(handle.build_id_len == 20);
+    assert(handle.sections[DWUNW_ELF_SECTION_DEBUG_INFO] == 0);
+    assert(handle.sections[DWUNW_ELF_SECTION_EH_FRAME] != 0);
+    assert(dwunw_elf_get_section(&handle, ".debug_info", &section) ==
+           DWUNW_ERR_NO_DEBUG_DATA);
+    assert(dwunw_elf_get_section(&handle, ".text", &section) == DWUNW_OK);
+    assert(section.size > 0);
+
+    assert(dwunw_elf_collect_dwarf(&handle, &sections) == DWUNW_OK);
+    assert(sections.debug_info.data == NULL);
+    assert(sections.eh_frame.data != NULL);
+    assert(sections.eh_frame_hdr.data != NULL);
+
+    memset(&index, 0, sizeof(index));
+    assert(dwunw_dwarf_index_init(&index, &handle) == DWUNW_OK);
+    dwunw_dwarf_index_reset(&index);
+
+    assert(dwunw_elf_collect_sections(&handle,
+                                      DWUNW_ELF_WANT(DWUNW_ELF_SECTION_DEBUG_INFO),
+                                      &sections) == DWUNW_ERR_NO_DEBUG_DATA);
+
+    /* Same layout as the unstripped fixture, whose .debug_info is only
+     * sliced when asked for. */
+    assert(dwunw_elf_open(get_fixture_path(), &full) == DWUNW_OK);
+    assert(memcmp(full.build_id, handle.build_id, handle.build_id_len) == 0);
+    assert(full.sections[DWUNW_ELF_SECTION_DEBUG_INFO] != 0);
+    assert(dwunw_elf_collect_sections(&full, DWUNW_ELF_WANT_UNWIND, &sections) == DWUNW_OK);
+    assert(sections.debug_info.data == NULL);
+    assert(sections.eh_frame.size > 0);
+    assert(dwunw_elf_collect_dwarf(&full, &sections) == DWUNW_OK);
+    assert(sections.debug_info.size > 0);
+    /* .debug_info alone is no call-frame information. */
+    assert(dwunw_elf_collect_sections(&full,
+                                      DWUNW_ELF_WANT(DWUNW_ELF_SECTION_DEBUG_INFO),
+                                      &sections) == DWUNW_ERR_NO_DEBUG_DATA);
+
+    dwunw_elf_close(&full);
+    dwunw_elf_close(&handle);
 }
 
 static void
@@ -81,6 +197,7 @@ test_module_cache_basic(void)
 
     assert(dwunw_module_cache_release(&cache, handle_a) == DWUNW_OK);
     assert(dwunw_module_cache_release(&cache, handle_b) == DWUNW_OK);
+    dwunw_module_cache_flush(&cache);
 }
 
 static void
@@ -115,43 +232,304 @@ test_module_cache_warm_reuse(void)
     assert(entry->refcnt == 1);
 
     assert(dwunw_module_cache_release(&cache, handle_b) == DWUNW_OK);
+    dwunw_module_cache_flush(&cache);
 }
 
+/* Warm modules are closed least recently released first once the cache
+ * holds more than its byte budget; active ones are never touched. */
 static void
 test_module_cache_warm_eviction(void)
 {
+    char dir_template[] = "/tmp/dwunw-loader-XXXXXX";
+    char other[256];
     struct dwunw_module_cache cache;
-    struct dwunw_module_handle *handle;
+    struct dwunw_module_handle *fixture_handle;
+    struct dwunw_module_handle *other_handle;
     const char *fixture = get_fixture_path();
-    dwunw_status_t st;
+    const char *dir;
+    size_t other_bytes;
+
+    dir = mkdtemp(dir_template);
+    assert(dir != NULL);
+    snprintf(other, sizeof(other), "%s/other", dir);
+    copy_fixture(fixture, other, 0x5a5a5a5au);
+
+    dwunw_module_cache_init(&cache);
+    assert(cache.budget == DWUNW_MODULE_CACHE_BUDGET);
+
+    assert(dwunw_module_cache_acquire(&cache, fixture, &fixture_handle) == DWUNW_OK);
+    assert(dwunw_module_cache_acquire(&cache, other, &other_handle) == DWUNW_OK);
+    assert(fixture_handle != other_handle);
+    assert(cache.count == 2);
+    other_bytes = find_cache_entry(&cache, other_handle)->bytes;
+    assert(other_bytes >= other_handle->elf.size);
+    assert(cache.bytes == other_bytes + find_cache_entry(&cache, fixture_handle)->bytes);
+
+    /* Active modules stay whatever the budget. */
+    dwunw_module_cache_set_budget(&cache, 0);
+    assert(cache.count == 2);
+
+    /* Room for one warm module: the least recently released goes. */
+    dwunw_module_cache_set_budget(&cache, other_bytes);
+    assert(dwunw_module_cache_release(&cache, fixture_handle) == DWUNW_OK);
+    assert(dwunw_module_cache_release(&cache, other_handle) == DWUNW_OK);
+    assert(cache.count == 1);
+    assert(cache.lru_head == cache.lru_tail);
+    assert(find_cache_entry(&cache, other_handle)->state == DWUNW_MODULE_SLOT_WARM);
+    assert(cache.bytes == other_bytes);
+
+    /* Reloading the fixture pushes the warm module out. */
+    assert(dwunw_module_cache_acquire(&cache, fixture, &fixture_handle) == DWUNW_OK);
+    assert(cache.count == 1);
+    assert(cache.lru_head == NULL);
+    assert(find_cache_entry(&cache, fixture_handle)->state == DWUNW_MODULE_SLOT_ACTIVE);
+    assert(dwunw_module_cache_release(&cache, fixture_handle) == DWUNW_OK);
+    dwunw_module_cache_flush(&cache);
+    assert(cache.count == 0 && cache.bytes == 0);
+
+    assert(unlink(other) == 0);
+    assert(rmdir(dir) == 0);
+}
+
+/* More distinct modules than the initial bucket count: the index grows and
+ * every module keeps its own entry and handle. */
+static void
+test_module_cache_many_modules(void)
+{
+    enum { MODULES = 40 };
+    char dir_template[] = "/tmp/dwunw-loader-XXXXXX";
+    char paths[MODULES][256];
+    struct dwunw_module_handle *handles[MODULES];
+    struct dwunw_module_handle *again;
+    struct dwunw_module_cache cache;
+    const char *fixture = get_fixture_path();
+    const char *dir;
     size_t i;
+    size_t j;
 
+    dir = mkdtemp(dir_template);
+    assert(dir != NULL);
     dwunw_module_cache_init(&cache);
 
-    /* Pretend every slot already holds a warm entry so acquire() must evict
-     * the oldest one before loading the real module. */
-    for (i = 0; i < DWUNW_MODULE_CACHE_CAPACITY; ++i) {
-        struct dwunw_module_cache_entry *entry = &cache.entries[i];
-        snprintf(entry->path, sizeof(entry->path), "dummy-%zu", i);
-        entry->state = DWUNW_MODULE_SLOT_WARM;
-        entry->warm_seq = (uint64_t)(i + 1);
-        entry->refcnt = 0;
+    for (i = 0; i < MODULES; ++i) {
+        snprintf(paths[i], sizeof(paths[i]), "%s/m%zu", dir, i);
+        copy_fixture(fixture, paths[i], (uint32_t)(0x5a5a0000u + i));
+        assert(dwunw_module_cache_acquire(&cache, paths[i], &handles[i]) == DWUNW_OK);
+        for (j = 0; j < i; ++j) {
+            assert(handles[j] != handles[i]);
+        }
     }
-    cache.warm_clock = DWUNW_MODULE_CACHE_CAPACITY;
+    assert(cache.count == MODULES);
+    assert(cache.bucket_count >= MODULES);
 
-    st = dwunw_module_cache_acquire(&cache, fixture, &handle);
-    assert(st == DWUNW_OK || st == DWUNW_ERR_NO_DEBUG_DATA);
-    if (st != DWUNW_OK) {
-        return;
+    for (i = 0; i < MODULES; ++i) {
+        assert(dwunw_module_cache_release(&cache, handles[i]) == DWUNW_OK);
+        assert(dwunw_module_cache_acquire(&cache, paths[i], &again) == DWUNW_OK);
+        assert(again == handles[i]);
+        assert(dwunw_module_cache_release(&cache, again) == DWUNW_OK);
+    }
+    /* Double release of a warm module is rejected. */
+    assert(dwunw_module_cache_release(&cache, handles[0]) == DWUNW_ERR_INVALID_ARG);
+
+    dwunw_module_cache_flush(&cache);
+    for (i = 0; i < MODULES; ++i) {
+        assert(unlink(paths[i]) == 0);
+    }
+    assert(rmdir(dir) == 0);
+}
+
+/* Different paths to the same file, and copies with the same build-id,
+ * must share one parsed module. */
+static void
+test_module_cache_shared_identity(void)
+{
+    char dir_template[] = "/tmp/dwunw-loader-XXXXXX";
+    char link_path[256];
+    char copy_path[256];
+    struct dwunw_module_cache cache;
+    struct dwunw_module_handle *direct;
+    struct dwunw_module_handle *via_link;
+    struct dwunw_module_handle *via_copy;
+    struct dwunw_stats stats;
+    const char *fixture = get_fixture_path();
+    char fixture_abs[4096];
+    const char *dir;
+
+    dir = mkdtemp(dir_template);
+    assert(dir != NULL);
+    assert(realpath(fixture, fixture_abs) != NULL);
+
+    snprintf(link_path, sizeof(link_path), "%s/exe", dir);
+    assert(symlink(fixture_abs, link_path) == 0);
+
+    snprintf(copy_path, sizeof(copy_path), "%s/copy", dir);
+    copy_fixture(fixture, copy_path, 0);
+
+    memset(&stats, 0, sizeof(stats));
+    dwunw_module_cache_init(&cache);
+    assert(dwunw_module_cache_acquire(&cache, fixture, &direct) == DWUNW_OK);
+    assert(dwunw_module_cache_acquire(&cache, link_path, &via_link) == DWUNW_OK);
+    assert(dwunw_module_cache_acquire(&cache, copy_path, &via_copy) == DWUNW_OK);
+    assert(direct == via_link);
+    assert(direct == via_copy);
+
+    assert(cache.count == 1);
+    assert(find_cache_entry(&cache, direct)->refcnt == 3);
+
+    /* The copy is remembered by its own identity, so acquiring it again
+     * is a plain hit rather than another open. */
+    cache.stats = &stats;
+    assert(dwunw_module_cache_release(&cache, via_copy) == DWUNW_OK);
+    assert(dwunw_module_cache_acquire(&cache, copy_path, &via_copy) == DWUNW_OK);
+    assert(via_copy == direct);
+    assert(stats.module_hits == 1 && stats.module_misses == 0);
+
+    assert(dwunw_module_cache_release(&cache, direct) == DWUNW_OK);
+    assert(dwunw_module_cache_release(&cache, via_link) == DWUNW_OK);
+    assert(dwunw_module_cache_release(&cache, via_copy) == DWUNW_OK);
+
+    /* Evicting the module drops the alias along with it. */
+    dwunw_module_cache_set_budget(&cache, 0);
+    assert(cache.count == 0);
+    assert(dwunw_module_cache_acquire(&cache, copy_path, &via_copy) == DWUNW_OK);
+    assert(stats.module_misses == 1);
+    assert(dwunw_module_cache_release(&cache, via_copy) == DWUNW_OK);
+    dwunw_module_cache_flush(&cache);
+
+    assert(unlink(link_path) == 0);
+    assert(unlink(copy_path) == 0);
+    assert(rmdir(dir) == 0);
+}
+
+#define STORE_THREADS 4
+
+struct store_worker {
+    struct dwunw_module_cache cache;
+    struct dwunw_module_handle *seen;
+    int failures;
+};
+
+static void *
+store_worker_run(void *arg)
+{
+    struct store_worker *worker = arg;
+    int round;
+
+    for (round = 0; round < 200; ++round) {
+        struct dwunw_module_handle *handle = NULL;
+        struct dwunw_fde_record fde;
+        uint64_t pc;
+
+        if (dwunw_module_cache_acquire(&worker->cache, get_fixture_path(), &handle) != DWUNW_OK) {
+            worker->failures++;
+            continue;
+        }
+        if (worker->seen && worker->seen != handle) {
+            worker->failures++;
+        }
+        worker->seen = handle;
+
+        /* Concurrent lookups go through the shared lazy CIE memo. */
+        pc = handle->index.table->pcs[round % handle->index.table->count];
+        if (dwunw_dwarf_index_find_fde(&handle->index, pc, &fde) == DWUNW_OK &&
+            fde.cie == NULL) {
+            worker->failures++;
+        }
+        dwunw_module_cache_release(&worker->cache, handle);
+    }
+
+    return NULL;
+}
+
+/* Per-thread caches over one store: every thread sees the same parsed
+ * module, which exists once and is pinned by each thread's warm slot. */
+static void
+test_module_store_threads(void)
+{
+    struct dwunw_module_store store;
+    struct store_worker workers[STORE_THREADS];
+    pthread_t threads[STORE_THREADS];
+    size_t i;
+
+    assert(dwunw_module_store_init(&store) == DWUNW_OK);
+    store.cache.flags |= DWUNW_MODULE_CACHE_COMPILE_TABLES;
+    memset(workers, 0, sizeof(workers));
+    for (i = 0; i < STORE_THREADS; ++i) {
+        dwunw_module_cache_init(&workers[i].cache);
+        assert(dwunw_module_cache_set_store(&workers[i].cache, &store) == DWUNW_OK);
+        assert(pthread_create(&threads[i], NULL, store_worker_run, &workers[i]) == 0);
+    }
+    for (i = 0; i < STORE_THREADS; ++i) {
+        assert(pthread_join(threads[i], NULL) == 0);
+        assert(workers[i].failures == 0);
+        assert(workers[i].seen == workers[0].seen);
+    }
+
+    assert(store.cache.count == 1);
+    assert(find_cache_entry(&store.cache, workers[0].seen)->refcnt == STORE_THREADS);
+
+    for (i = 0; i < STORE_THREADS; ++i) {
+        dwunw_module_cache_flush(&workers[i].cache);
+    }
+    assert(find_cache_entry(&store.cache, workers[0].seen)->refcnt == 0);
+    assert(dwunw_module_cache_set_store(&store.cache, &store) == DWUNW_ERR_INVALID_ARG);
+    dwunw_module_store_destroy(&store);
+}
+
+/* Shared contexts reach the on-disk row tables through the store. */
+static void
+test_module_store_table_dir(void)
+{
+    char dir_template[] = "/tmp/dwunw-store-XXXXXX";
+    char path[DWUNW_MAX_PATH_LEN + 64];
+    struct dwunw_module_store first;
+    struct dwunw_module_store second;
+    struct dwunw_context ctx;
+    struct dwunw_module_handle *handle;
+    const char *dir;
+    size_t i;
+
+    dir = mkdtemp(dir_template);
+    assert(dir != NULL);
+
+    /* By default opening decodes no FDE: no table, lazy .eh_frame lookups. */
+    assert(dwunw_init(&ctx) == DWUNW_OK);
+    assert(dwunw_module_cache_acquire(&ctx.module_cache, get_fixture_path(), &handle) ==
+           DWUNW_OK);
+    assert(handle->index.table == NULL);
+    assert(handle->index.lazy != NULL);
+    assert(dwunw_module_cache_release(&ctx.module_cache, handle) == DWUNW_OK);
+    dwunw_shutdown(&ctx);
+
+    assert(dwunw_module_store_init(&first) == DWUNW_OK);
+    first.cache.flags |= DWUNW_MODULE_CACHE_COMPILE_TABLES;
+    assert(dwunw_module_store_set_table_dir(&first, dir) == DWUNW_OK);
+    assert(dwunw_init_shared(&ctx, &first) == DWUNW_OK);
+    assert(dwunw_module_cache_acquire(&ctx.module_cache, get_fixture_path(), &handle) ==
+           DWUNW_OK);
+    assert(handle->index.table != NULL);
+    assert(!(handle->index.flags & DWUNW_DWARF_INDEX_FLAG_TABLE_CACHED));
+    snprintf(path, sizeof(path), "%s/", dir);
+    for (i = 0; i < handle->elf.build_id_len; ++i) {
+        snprintf(path + strlen(path), 3, "%02x", handle->elf.build_id[i]);
     }
+    strcat(path, ".dwunw-table");
+    assert(dwunw_module_cache_release(&ctx.module_cache, handle) == DWUNW_OK);
+    dwunw_shutdown(&ctx);
+    dwunw_module_store_destroy(&first);
 
-    /* Oldest warm entry (warm_seq == 1) must now host the fixture module. */
-    assert(strncmp(cache.entries[0].path, fixture, sizeof(cache.entries[0].path)) == 0);
-    assert(cache.entries[0].state == DWUNW_MODULE_SLOT_ACTIVE);
+    /* Without COMPILE_TABLES an existing table file is still mapped. */
+    assert(dwunw_module_store_init(&second) == DWUNW_OK);
+    assert(!(second.cache.flags & DWUNW_MODULE_CACHE_COMPILE_TABLES));
+    assert(dwunw_module_store_set_table_dir(&second, dir) == DWUNW_OK);
+    assert(dwunw_module_store_acquire(&second, get_fixture_path(), &handle) == DWUNW_OK);
+    assert(handle->index.flags & DWUNW_DWARF_INDEX_FLAG_TABLE_CACHED);
+    assert(dwunw_module_store_release(&second, handle) == DWUNW_OK);
+    dwunw_module_store_destroy(&second);
+    assert(dwunw_module_store_set_table_dir(NULL, dir) == DWUNW_ERR_INVALID_ARG);
 
-    assert(dwunw_module_cache_release(&cache, handle) == DWUNW_OK);
-    assert(cache.entries[0].state == DWUNW_MODULE_SLOT_WARM);
-    assert(cache.entries[0].warm_seq == cache.warm_clock);
+    assert(unlink(path) == 0);
+    assert(rmdir(dir) == 0);
 }
 
 int
@@ -159,9 +537,14 @@ main(void)
 {
     test_loader_invalid_path();
     test_loader_valid_fixture();
+    test_loader_stripped_fixture();
     test_module_cache_basic();
     test_module_cache_warm_reuse();
     test_module_cache_warm_eviction();
+    test_module_cache_many_modules();
+    test_module_cache_shared_identity();
+    test_module_store_threads();
+    test_module_store_table_dir();
     puts("loader: ok");
     return 0;
 }
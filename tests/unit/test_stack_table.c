@@ -0,0 +1,142 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "dwunw/stack_table.h"
+
+/* Stacks sharing their callers share trie nodes; ids are stable and
+ * resolve back to the frames, innermost first. */
+static void
+test_intern_and_get(void)
+{
+    struct dwunw_stack_table table;
+    struct dwunw_stack_node frames[8];
+    const uint64_t a[] = { 0x1010, 0x2020, 0x3030 };   /* leaf .. main */
+    const uint64_t b[] = { 0x1111, 0x2020, 0x3030 };   /* sibling leaf */
+    const uint64_t c[] = { 0x2020, 0x3030 };           /* prefix of both */
+    uint32_t id_a = 0, id_b = 0, id_c = 0, again = 0;
+    bool inserted = false;
+    size_t depth = 0;
+
+    dwunw_stack_table_init(&table, 0);
+
+    assert(dwunw_stack_table_intern(&table, a, 3, &id_a, &inserted) == DWUNW_OK);
+    assert(inserted && id_a != 0);
+    assert(table.count == 3);
+    assert(dwunw_stack_table_intern(&table, a, 3, &again, &inserted) == DWUNW_OK);
+    assert(!inserted && again == id_a);
+
+    assert(dwunw_stack_table_intern(&table, b, 3, &id_b, &inserted) == DWUNW_OK);
+    assert(inserted && id_b != id_a);
+    assert(table.count == 4);
+
+    /* Already in the trie as a prefix, but new as a stack of its own. */
+    assert(dwunw_stack_table_intern(&table, c, 2, &id_c, &inserted) == DWUNW_OK);
+    assert(inserted && table.count == 4);
+    assert(table.stacks == 3);
+
+    assert(dwunw_stack_table_get(&table, id_b, frames, 8, &depth) == DWUNW_OK);
+    assert(depth == 3);
+    assert(frames[0].pc == 0x1111 && frames[1].pc == 0x2020 && frames[2].pc == 0x3030);
+    assert(frames[2].parent == 0);
+
+    assert(dwunw_stack_table_get(&table, id_a, frames, 1, &depth) == DWUNW_OK);
+    assert(depth == 3 && frames[0].pc == 0x1010);
+
+    assert(dwunw_stack_table_intern(&table, NULL, 0, &again, &inserted) == DWUNW_OK);
+    assert(again == 0 && !inserted);
+    assert(dwunw_stack_table_get(&table, 0, frames, 8, &depth) == DWUNW_OK && depth == 0);
+    assert(dwunw_stack_table_get(&table, table.count + 1, frames, 8, &depth) ==
+           DWUNW_ERR_INVALID_ARG);
+
+    dwunw_stack_table_flush(&table);
+    assert(table.count == 0 && table.stacks == 0);
+}
+
+/* Compact frames are keyed by module and link-time pc, so the same code
+ * loaded at two addresses yields one stack. */
+static void
+test_intern_compact(void)
+{
+    struct dwunw_stack_table table;
+    struct dwunw_compact_frame p1[2];
+    struct dwunw_compact_frame p2[2];
+    struct dwunw_stack_node frames[2];
+    uint32_t id1 = 0, id2 = 0;
+    size_t depth = 0;
+
+    memset(p1, 0, sizeof(p1));
+    p1[0].pc = 0x555500001234;
+    p1[0].rel_pc = 0x1234;
+    p1[0].module_id = 1;
+    p1[1].pc = 0x555500000100;
+    p1[1].rel_pc = 0x100;
+    p1[1].module_id = 1;
+    memcpy(p2, p1, sizeof(p2));
+    p2[0].pc = 0x566600001234;
+    p2[1].pc = 0x566600000100;
+
+    dwunw_stack_table_init(&table, 0);
+    assert(dwunw_stack_table_intern_compact(&table, p1, 2, &id1, NULL) == DWUNW_OK);
+    assert(dwunw_stack_table_intern_compact(&table, p2, 2, &id2, NULL) == DWUNW_OK);
+    assert(id1 == id2);
+
+    p2[1].module_id = 2;
+    assert(dwunw_stack_table_intern_compact(&table, p2, 2, &id2, NULL) == DWUNW_OK);
+    assert(id1 != id2);
+    assert(dwunw_stack_table_get(&table, id2, frames, 2, &depth) == DWUNW_OK);
+    assert(depth == 2 && frames[0].pc == 0x1234 && frames[1].module_id == 2);
+    dwunw_stack_table_flush(&table);
+}
+
+/* Many distinct stacks: growth keeps every id resolvable, and the node
+ * limit stops new paths without disturbing known ones. */
+static void
+test_growth_and_limit(void)
+{
+    struct dwunw_stack_table table;
+    struct dwunw_stack_node frames[4];
+    uint64_t pcs[4];
+    uint32_t ids[5000];
+    uint32_t id = 0;
+    size_t depth = 0;
+    size_t i;
+
+    dwunw_stack_table_init(&table, 0);
+    for (i = 0; i < 5000; ++i) {
+        pcs[0] = 0x400000 + i;
+        pcs[1] = 0x500000 + i % 50;
+        pcs[2] = 0x600000 + i % 5;
+        pcs[3] = 0x700000;
+        assert(dwunw_stack_table_intern(&table, pcs, 4, &ids[i], NULL) == DWUNW_OK);
+    }
+    assert(table.stacks == 5000);
+    assert(table.count == 5000 + 50 + 5 + 1);
+    for (i = 0; i < 5000; i += 97) {
+        assert(dwunw_stack_table_get(&table, ids[i], frames, 4, &depth) == DWUNW_OK);
+        assert(depth == 4 && frames[0].pc == 0x400000 + i && frames[1].pc == 0x500000 + i % 50);
+    }
+    dwunw_stack_table_flush(&table);
+
+    dwunw_stack_table_init(&table, 3);
+    pcs[0] = 1;
+    pcs[1] = 2;
+    pcs[2] = 3;
+    assert(dwunw_stack_table_intern(&table, pcs, 3, &ids[0], NULL) == DWUNW_OK);
+    pcs[0] = 4;
+    assert(dwunw_stack_table_intern(&table, pcs, 3, &id, NULL) == DWUNW_ERR_CACHE_FULL);
+    pcs[0] = 1;
+    assert(dwunw_stack_table_intern(&table, pcs, 3, &id, NULL) == DWUNW_OK);
+    assert(id == ids[0]);
+    dwunw_stack_table_flush(&table);
+}
+
+int
+main(void)
+{
+    test_intern_and_get();
+    test_intern_compact();
+    test_growth_and_limit();
+    puts("stack_table: ok");
+    return 0;
+}
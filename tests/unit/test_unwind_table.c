@@ -0,0 +1,439 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <elf.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dwunw/arch_ops.h"
+#include "dwunw/dwarf_index.h"
+#include "dwunw/elf_loader.h"
+#include "dwarf/cfi.h"
+#include "dwarf/unwind_table.h"
+
+static const char *
+get_fixture_path(void)
+{
+    const char *path = getenv("DWUNW_TEST_FIXTURE");
+    assert(path && "DWUNW_TEST_FIXTURE env is required");
+    return path;
+}
+
+/* Fake stack: every slot holds a value derived from its address. */
+static dwunw_status_t
+mock_reader(void *ctx, uint64_t address, void *dst, size_t size)
+{
+    uint64_t value = address * 3u + 1u;
+
+    (void)ctx;
+    assert(size == sizeof(value));
+    memcpy(dst, &value, size);
+    return DWUNW_OK;
+}
+
+static void
+seed_regs(struct dwunw_regset *regs, enum dwunw_arch_id arch)
+{
+    size_t i;
+
+    assert(dwunw_regset_prepare(regs, arch) == DWUNW_OK);
+    for (i = 0; i < DWUNW_REGSET_SLOTS; ++i) {
+        regs->regs[i] = 0x7ff000000000ull + i * 0x100u;
+    }
+}
+
+/* Every PC covered by a compact row must unwind exactly like the interpreter. */
+static void
+test_rows_match_interpreter(void)
+{
+    struct dwunw_dwarf_index index;
+    struct dwunw_elf_handle handle;
+    const struct dwunw_arch_ops *ops;
+    struct dwunw_cie_record *cies = NULL;
+    struct dwunw_fde_record *fdes = NULL;
+    size_t cie_count = 0;
+    size_t fde_count = 0;
+    struct dwunw_memory_reader mem = { mock_reader, NULL, NULL, NULL };
+    size_t compact = 0;
+    size_t i;
+
+    assert(dwunw_elf_open(get_fixture_path(), &handle) == DWUNW_OK);
+    ops = dwunw_arch_from_elf_machine(handle.machine);
+    assert(ops != NULL);
+
+    memset(&index, 0, sizeof(index));
+    assert(dwunw_dwarf_index_init(&index, &handle) == DWUNW_OK);
+    assert(dwunw_dwarf_index_compile(&index, &handle) == DWUNW_OK);
+    assert(index.table != NULL);
+    assert(index.table->count > 0);
+    assert(index.flags & DWUNW_DWARF_INDEX_FLAG_COMPILED);
+
+    for (i = 1; i < index.table->count; ++i) {
+        assert(index.table->pcs[i - 1] < index.table->pcs[i]);
+    }
+    assert(index.table->rows[index.table->count - 1].flags & DWUNW_UNWIND_ROW_END);
+
+    assert(dwunw_cfi_build(&index.sections, &cies, &cie_count, &fdes, &fde_count) == DWUNW_OK);
+    assert(fde_count > 0);
+    assert(dwunw_unwind_table_find(index.table, fdes[0].pc_begin - 1) == NULL);
+
+    for (i = 0; i < fde_count; ++i) {
+        uint64_t pc;
+
+        for (pc = fdes[i].pc_begin; pc < fdes[i].pc_begin + fdes[i].pc_range; ++pc) {
+            const struct dwunw_unwind_row *row = dwunw_unwind_table_find(index.table, pc);
+            struct dwunw_regset expect_regs;
+            struct dwunw_regset got_regs;
+            struct dwunw_frame expect;
+            struct dwunw_frame got;
+            struct dwunw_cfi_rules rules;
+
+            assert(row != NULL);
+            if (row->flags & DWUNW_UNWIND_ROW_FALLBACK) {
+                continue;
+            }
+
+            seed_regs(&expect_regs, ops->arch);
+            expect_regs.pc = pc;
+            got_regs = expect_regs;
+            memset(&expect, 0, sizeof(expect));
+            memset(&got, 0, sizeof(got));
+
+            assert(dwunw_cfi_eval(&fdes[i], pc, &expect_regs, &mem, &expect) == DWUNW_OK);
+            assert(dwunw_unwind_row_rules(index.table, row, &rules) == DWUNW_OK);
+            assert(dwunw_cfi_rules_apply(&rules, &got_regs, &mem, &got) == DWUNW_OK);
+
+            assert(memcmp(&expect, &got, sizeof(expect)) == 0);
+            assert(memcmp(&expect_regs, &got_regs, sizeof(expect_regs)) == 0);
+            assert(got_regs.regs[ops->sp_reg] == got.cfa);
+            compact++;
+        }
+
+        assert(dwunw_unwind_table_find(index.table, fdes[i].pc_begin + fdes[i].pc_range) == NULL ||
+               (i + 1 < fde_count &&
+                fdes[i + 1].pc_begin == fdes[i].pc_begin + fdes[i].pc_range));
+    }
+
+    /* -O0 prologues only ever save the frame pointer and return address. */
+    assert(compact > 0);
+
+    dwunw_cfi_free(cies, fdes);
+    dwunw_dwarf_index_reset(&index);
+    assert(index.table == NULL);
+    dwunw_elf_close(&handle);
+}
+
+/* The -O0 fixture keeps frame pointers everywhere it makes calls; whatever
+ * does not (startup code, PLT) is listed as an exception. */
+static void
+test_frame_pointer_ranges(void)
+{
+    struct dwunw_dwarf_index index;
+    struct dwunw_elf_handle handle;
+    const struct dwunw_unwind_table *table;
+    const struct dwunw_arch_ops *ops;
+    size_t fp_rows = 0;
+    size_t i;
+
+    assert(dwunw_elf_open(get_fixture_path(), &handle) == DWUNW_OK);
+    ops = dwunw_arch_from_elf_machine(handle.machine);
+    assert(ops != NULL);
+
+    memset(&index, 0, sizeof(index));
+    assert(dwunw_dwarf_index_init(&index, &handle) == DWUNW_OK);
+    assert(dwunw_dwarf_index_compile(&index, &handle) == DWUNW_OK);
+    table = index.table;
+
+    if (ops->arch != DWUNW_ARCH_X86_64) {
+        assert(!dwunw_unwind_table_fp_safe(table, table->pcs[0]));
+        dwunw_dwarf_index_reset(&index);
+        dwunw_elf_close(&handle);
+        return;
+    }
+
+    assert(table->flags & DWUNW_UNWIND_TABLE_FRAME_POINTER);
+    assert(table->fp_exception_count <= DWUNW_UNWIND_FP_EXCEPTIONS_MAX);
+    for (i = 0; i < table->fp_exception_count; ++i) {
+        const struct dwunw_unwind_range *range = &table->fp_exceptions[i];
+
+        assert(range->begin < range->end);
+        assert(i == 0 || table->fp_exceptions[i - 1].end <= range->begin);
+        assert(!dwunw_unwind_table_fp_safe(table, range->begin));
+        assert(!dwunw_unwind_table_fp_safe(table, range->end - 1));
+    }
+
+    for (i = 0; i + 1 < table->count; ++i) {
+        const struct dwunw_unwind_row *row = &table->rows[i];
+
+        if (!(row->flags & (DWUNW_UNWIND_ROW_END | DWUNW_UNWIND_ROW_FALLBACK)) &&
+            row->cfa_reg == ops->fp_reg &&
+            dwunw_unwind_table_fp_safe(table, table->pcs[i])) {
+            assert(row->cfa_offset == 16);
+            assert(row->ra_rule == DWUNW_UNWIND_RULE_OFFSET && row->ra_offset == -8);
+            assert(row->fp_rule == DWUNW_UNWIND_RULE_OFFSET && row->fp_offset == -16);
+            fp_rows++;
+        }
+    }
+    assert(fp_rows > 0);
+
+    /* Nothing outside the CFI the table was built from. */
+    assert(!dwunw_unwind_table_fp_safe(table, table->pcs[0] - 1));
+    assert(!dwunw_unwind_table_fp_safe(table, table->pcs[table->count - 1]));
+    assert(!dwunw_unwind_table_fp_safe(NULL, table->pcs[0]));
+
+    dwunw_dwarf_index_reset(&index);
+    dwunw_elf_close(&handle);
+}
+
+/* x86_64 CIE for an FP-body frame (CFA = rbp+16, rbp at CFA-16, return
+ * address at CFA-8) and two FDEs using it with a hole in between. */
+static const uint8_t fp_gap_debug_frame[] = {
+    0x10, 0x00, 0x00, 0x00,             /* length */
+    0xff, 0xff, 0xff, 0xff,             /* CIE id */
+    0x01,                               /* version */
+    0x00,                               /* augmentation */
+    0x01,                               /* code align */
+    0x78,                               /* data align -8 */
+    0x10,                               /* return register */
+    0x0c, 0x06, 0x10,                   /* def_cfa rbp+16 */
+    0x90, 0x01,                         /* offset r16 @ CFA-8 */
+    0x86, 0x02,                         /* offset rbp @ CFA-16 */
+    /* FDE [0x1000, 0x1040) */
+    0x14, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    /* FDE [0x2000, 0x2040) */
+    0x14, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x20, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+/* Code between FDEs has no CFI and must not be unwound through FP. */
+static void
+test_frame_pointer_gap(void)
+{
+    struct dwunw_dwarf_index index;
+    struct dwunw_unwind_table *table = NULL;
+
+    memset(&index, 0, sizeof(index));
+    index.sections.debug_frame.data = fp_gap_debug_frame;
+    index.sections.debug_frame.size = sizeof(fp_gap_debug_frame);
+    assert(dwunw_cfi_build(&index.sections,
+                           &index.cies,
+                           &index.cie_count,
+                           &index.fdes,
+                           &index.fde_count) == DWUNW_OK);
+    assert(index.fde_count == 2);
+
+    assert(dwunw_unwind_table_build(&index, EM_X86_64, &table) == DWUNW_OK);
+    assert(table->flags & DWUNW_UNWIND_TABLE_FRAME_POINTER);
+    assert(table->fp_exception_count == 0);
+
+    assert(dwunw_unwind_table_fp_safe(table, 0x1000));
+    assert(dwunw_unwind_table_fp_safe(table, 0x103f));
+    assert(!dwunw_unwind_table_fp_safe(table, 0x1040));
+    assert(!dwunw_unwind_table_fp_safe(table, 0x1800));
+    assert(!dwunw_unwind_table_fp_safe(table, 0x1fff));
+    assert(dwunw_unwind_table_fp_safe(table, 0x2000));
+    assert(!dwunw_unwind_table_fp_safe(table, 0x2040));
+
+    dwunw_unwind_table_free(table);
+    dwunw_dwarf_index_reset(&index);
+}
+
+/* The FP CIE above with an FDE [0x1040, 0x1080) nested in [0x1000, 0x1100). */
+static const uint8_t nested_debug_frame[] = {
+    0x10, 0x00, 0x00, 0x00,
+    0xff, 0xff, 0xff, 0xff,
+    0x01,
+    0x00,
+    0x01,
+    0x78,
+    0x10,
+    0x0c, 0x06, 0x10,
+    0x90, 0x01,
+    0x86, 0x02,
+    /* FDE [0x1000, 0x1100) */
+    0x14, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x00, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    /* FDE [0x1040, 0x1080) */
+    0x14, 0x00, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00,
+    0x40, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+    0x40, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+};
+
+/* Past a nested FDE the table hands the pc back to the interpreter, whose
+ * lookup finds the enclosing FDE again. */
+static void
+test_nested_fde(void)
+{
+    struct dwunw_dwarf_index index;
+    struct dwunw_unwind_table *table = NULL;
+    const struct dwunw_unwind_row *row;
+
+    memset(&index, 0, sizeof(index));
+    index.sections.debug_frame.data = nested_debug_frame;
+    index.sections.debug_frame.size = sizeof(nested_debug_frame);
+    assert(dwunw_cfi_build(&index.sections,
+                           &index.cies,
+                           &index.cie_count,
+                           &index.fdes,
+                           &index.fde_count) == DWUNW_OK);
+    assert(index.fde_count == 2);
+
+    assert(dwunw_unwind_table_build(&index, EM_X86_64, &table) == DWUNW_OK);
+    row = dwunw_unwind_table_find(table, 0x1000);
+    assert(row && !(row->flags & DWUNW_UNWIND_ROW_FALLBACK));
+    row = dwunw_unwind_table_find(table, 0x107f);
+    assert(row && !(row->flags & DWUNW_UNWIND_ROW_FALLBACK));
+    row = dwunw_unwind_table_find(table, 0x1080);
+    assert(row && (row->flags & DWUNW_UNWIND_ROW_FALLBACK));
+    row = dwunw_unwind_table_find(table, 0x10ff);
+    assert(row && (row->flags & DWUNW_UNWIND_ROW_FALLBACK));
+    assert(dwunw_unwind_table_find(table, 0x1100) == NULL);
+
+    assert(dwunw_cfi_find_fde(index.fdes, index.fde_count, 0x1080) == &index.fdes[0]);
+    assert(dwunw_unwind_table_fp_safe(table, 0x1040));
+    assert(!dwunw_unwind_table_fp_safe(table, 0x1080));
+
+    dwunw_unwind_table_free(table);
+    dwunw_dwarf_index_reset(&index);
+}
+
+/* Swap the two size-byte elements at offset in a stored table file. */
+static void
+corrupt_table_file(const char *path, size_t offset, size_t size)
+{
+    uint8_t a[32];
+    uint8_t b[32];
+    FILE *file;
+
+    assert(size <= sizeof(a));
+    file = fopen(path, "r+b");
+    assert(file != NULL);
+    assert(fseek(file, (long)offset, SEEK_SET) == 0);
+    assert(fread(a, 1, size, file) == size && fread(b, 1, size, file) == size);
+    assert(fseek(file, (long)offset, SEEK_SET) == 0);
+    assert(fwrite(b, 1, size, file) == size && fwrite(a, 1, size, file) == size);
+    fclose(file);
+}
+
+/* A table persisted under the build-id maps back bit-for-bit; files for
+ * other builds are refused. */
+static void
+test_table_cache_roundtrip(void)
+{
+    char dir_template[] = "/tmp/dwunw-table-XXXXXX";
+    struct dwunw_dwarf_index first;
+    struct dwunw_dwarf_index second;
+    struct dwunw_elf_handle handle;
+    struct dwunw_unwind_table *table = NULL;
+    uint8_t other_id[DWUNW_BUILD_ID_MAX];
+    char path[DWUNW_MAX_PATH_LEN + 64];
+    const char *dir;
+    size_t i;
+
+    dir = mkdtemp(dir_template);
+    assert(dir != NULL);
+
+    assert(dwunw_elf_open(get_fixture_path(), &handle) == DWUNW_OK);
+    assert(handle.build_id_len > 0);
+
+    memset(&first, 0, sizeof(first));
+    assert(dwunw_dwarf_index_init(&first, &handle) == DWUNW_OK);
+    assert(dwunw_dwarf_index_compile_cached(&first, &handle, dir) == DWUNW_OK);
+    assert(first.table && first.table->map == NULL);
+    assert(!(first.flags & DWUNW_DWARF_INDEX_FLAG_TABLE_CACHED));
+
+    memset(&second, 0, sizeof(second));
+    assert(dwunw_dwarf_index_init(&second, &handle) == DWUNW_OK);
+    assert(dwunw_dwarf_index_compile_cached(&second, &handle, dir) == DWUNW_OK);
+    assert(second.flags & DWUNW_DWARF_INDEX_FLAG_TABLE_CACHED);
+    assert(second.table && second.table->map != NULL);
+    assert(second.table->count == first.table->count);
+    assert(second.table->sp_reg == first.table->sp_reg);
+    assert(second.table->flags == first.table->flags);
+    assert(second.table->fp_exception_count == first.table->fp_exception_count);
+    assert(memcmp(second.table->fp_exceptions, first.table->fp_exceptions,
+                  first.table->fp_exception_count * sizeof(*first.table->fp_exceptions)) == 0);
+    for (i = 0; i < first.table->count; ++i) {
+        assert(second.table->pcs[i] == first.table->pcs[i]);
+        assert(memcmp(&second.table->rows[i], &first.table->rows[i],
+                      sizeof(first.table->rows[i])) == 0);
+    }
+
+    snprintf(path, sizeof(path), "%s/", dir);
+    for (i = 0; i < handle.build_id_len; ++i) {
+        snprintf(path + strlen(path), 3, "%02x", handle.build_id[i]);
+    }
+    strcat(path, ".dwunw-table");
+
+    memcpy(other_id, handle.build_id, handle.build_id_len);
+    other_id[0] ^= 0xff;
+    assert(dwunw_unwind_table_load(path, handle.machine, other_id,
+                                   handle.build_id_len, &table) == DWUNW_ERR_BAD_FORMAT);
+    assert(dwunw_unwind_table_load(path, (uint16_t)(handle.machine + 1), handle.build_id,
+                                   handle.build_id_len, &table) == DWUNW_ERR_BAD_FORMAT);
+    assert(table == NULL);
+
+    /* Out-of-order rows or exceptions are refused, not binary searched. */
+    assert(first.table->count >= 2);
+    corrupt_table_file(path, sizeof(struct dwunw_unwind_table_file_header),
+                       sizeof(uint64_t));
+    assert(dwunw_unwind_table_load(path, handle.machine, handle.build_id,
+                                   handle.build_id_len, &table) == DWUNW_ERR_BAD_FORMAT);
+    corrupt_table_file(path, sizeof(struct dwunw_unwind_table_file_header),
+                       sizeof(uint64_t));
+    if (first.table->fp_exception_count >= 2) {
+        size_t ranges = sizeof(struct dwunw_unwind_table_file_header) +
+                        first.table->count *
+                        (sizeof(uint64_t) + sizeof(struct dwunw_unwind_row));
+
+        corrupt_table_file(path, ranges, sizeof(struct dwunw_unwind_range));
+        assert(dwunw_unwind_table_load(path, handle.machine, handle.build_id,
+                                       handle.build_id_len, &table) == DWUNW_ERR_BAD_FORMAT);
+        corrupt_table_file(path, ranges, sizeof(struct dwunw_unwind_range));
+    }
+    assert(dwunw_unwind_table_load(path, handle.machine, handle.build_id,
+                                   handle.build_id_len, &table) == DWUNW_OK);
+    dwunw_unwind_table_free(table);
+
+    dwunw_dwarf_index_reset(&second);
+    dwunw_dwarf_index_reset(&first);
+    dwunw_elf_close(&handle);
+    assert(unlink(path) == 0);
+    assert(rmdir(dir) == 0);
+}
+
+static void
+test_invalid_args(void)
+{
+    struct dwunw_unwind_table *table = NULL;
+    struct dwunw_dwarf_index index;
+
+    memset(&index, 0, sizeof(index));
+    assert(dwunw_unwind_table_build(NULL, 0, &table) == DWUNW_ERR_INVALID_ARG);
+    assert(dwunw_unwind_table_build(&index, 0xffffu, &table) == DWUNW_ERR_UNSUPPORTED_ARCH);
+    assert(table == NULL);
+    assert(dwunw_unwind_table_find(NULL, 0) == NULL);
+    assert(dwunw_dwarf_index_compile(NULL, NULL) == DWUNW_ERR_INVALID_ARG);
+    dwunw_unwind_table_free(NULL);
+}
+
+int
+main(void)
+{
+    test_rows_match_interpreter();
+    test_frame_pointer_ranges();
+    test_frame_pointer_gap();
+    test_nested_fde();
+    test_table_cache_roundtrip();
+    test_invalid_args();
+    return 0;
+}
@@ -1,9 +1,13 @@
+#define _GNU_SOURCE
 #include <assert.h>
+#include <elf.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include "dwunw/dwunw_api.h"
+#include "dwunw/elf_loader.h"
 #include "dwunw/unwind.h"
 
 static const char *
@@ -14,6 +18,14 @@ get_fixture_path(void)
     return path;
 }
 
+static const char *
+get_stripped_fixture_path(void)
+{
+    const char *path = getenv("DWUNW_TEST_STRIPPED_FIXTURE");
+    assert(path && "DWUNW_TEST_STRIPPED_FIXTURE env is required");
+    return path;
+}
+
 static void
 test_single_frame(void)
 {
@@ -46,6 +58,750 @@ test_single_frame(void)
     dwunw_shutdown(&ctx);
 }
 
+#if defined(__x86_64__)
+static uint64_t
+fixture_symbol(const char *name)
+{
+    struct dwunw_elf_handle handle;
+    struct dwunw_dwarf_section symtab;
+    struct dwunw_dwarf_section strtab;
+    uint64_t value = 0;
+    size_t i;
+
+    assert(dwunw_elf_open(get_fixture_path(), &handle) == DWUNW_OK);
+    assert(dwunw_elf_get_section(&handle, ".symtab", &symtab) == DWUNW_OK);
+    assert(dwunw_elf_get_section(&handle, ".strtab", &strtab) == DWUNW_OK);
+
+    for (i = 0; i + sizeof(Elf64_Sym) <= symtab.size; i += sizeof(Elf64_Sym)) {
+        Elf64_Sym sym;
+
+        memcpy(&sym, symtab.data + i, sizeof(sym));
+        if (sym.st_name < strtab.size &&
+            strcmp((const char *)strtab.data + sym.st_name, name) == 0) {
+            value = sym.st_value;
+            break;
+        }
+    }
+
+    dwunw_elf_close(&handle);
+    assert(value != 0);
+    return value;
+}
+
+/* Walk a hand-built rbp chain in our own memory using the fixture's CFI:
+ * target_function <- main <- (null return address). The default non-stop
+ * reader serves the reads without ptrace-stopping anyone. */
+static void
+test_nonstop_multi_frame(void)
+{
+    struct dwunw_context ctx;
+    struct dwunw_regset regs;
+    struct dwunw_frame frames[8];
+    struct dwunw_unwind_request req;
+    uint64_t target = fixture_symbol("target_function");
+    uint64_t main_pc = fixture_symbol("main") + 10;
+    uint64_t outer[2] = { 0, 0 };
+    uint64_t inner[2];
+    size_t written = 0;
+
+    inner[0] = (uint64_t)(uintptr_t)outer;  /* saved rbp */
+    inner[1] = main_pc;                     /* return address */
+
+    assert(dwunw_init(&ctx) == DWUNW_OK);
+    assert(ctx.stack_reader.mode == DWUNW_STACK_READER_MODE_NONSTOP);
+    assert(dwunw_regset_prepare(&regs, DWUNW_ARCH_X86_64) == DWUNW_OK);
+
+    /* Past the prologue, the CFA is rbp + 16 in both functions. */
+    regs.pc = target + 10;
+    regs.regs[6] = (uint64_t)(uintptr_t)inner;
+    regs.regs[7] = (uint64_t)(uintptr_t)inner - 32;
+    regs.sp = regs.regs[7];
+
+    memset(frames, 0, sizeof(frames));
+    memset(&req, 0, sizeof(req));
+    req.module_path = get_fixture_path();
+    req.regs = &regs;
+    req.frames = frames;
+    req.max_frames = 8;
+    req.pid = getpid();
+
+    assert(dwunw_capture(&ctx, &req, &written) == DWUNW_OK);
+    assert(written == 3);
+    assert(frames[1].pc == main_pc);
+    assert(frames[1].cfa == (uint64_t)(uintptr_t)inner + 16);
+    assert(!(frames[1].flags & DWUNW_FRAME_FLAG_PARTIAL));
+    assert(frames[2].pc == 0);
+    assert(frames[2].cfa == (uint64_t)(uintptr_t)outer + 16);
+    assert(strcmp(frames[2].module_path, req.module_path) == 0);
+
+    assert(dwunw_stack_reader_set_mode(&ctx.stack_reader, 7) == DWUNW_ERR_INVALID_ARG);
+    assert(dwunw_stack_reader_set_mode(&ctx.stack_reader,
+                                       DWUNW_STACK_READER_MODE_ATTACH) == DWUNW_OK);
+    dwunw_shutdown(&ctx);
+}
+
+/* Same chain, but laid out in a sampled copy at a made-up address: no pid,
+ * no syscalls. A snapshot too short for the outer frame ends the walk
+ * cleanly one frame earlier. */
+static void
+test_snapshot_multi_frame(void)
+{
+    struct dwunw_context ctx;
+    struct dwunw_regset regs;
+    struct dwunw_frame frames[8];
+    struct dwunw_unwind_request req;
+    struct dwunw_stack_snapshot snapshot;
+    const uint64_t base = 0x7ff000001000ull;
+    uint64_t main_pc = fixture_symbol("main") + 10;
+    uint64_t words[8] = { 0 };
+    size_t written = 0;
+
+    words[4] = base + 48;   /* inner: saved rbp -> outer */
+    words[5] = main_pc;     /* inner: return address */
+
+    assert(dwunw_init(&ctx) == DWUNW_OK);
+    assert(dwunw_regset_prepare(&regs, DWUNW_ARCH_X86_64) == DWUNW_OK);
+    regs.pc = fixture_symbol("target_function") + 10;
+    regs.regs[6] = base + 32;
+    regs.regs[7] = base;
+    regs.sp = base;
+
+    snapshot.base = base;
+    snapshot.data = words;
+    snapshot.size = sizeof(words);
+
+    memset(frames, 0, sizeof(frames));
+    memset(&req, 0, sizeof(req));
+    req.module_path = get_fixture_path();
+    req.regs = &regs;
+    req.frames = frames;
+    req.max_frames = 8;
+    req.stack = &snapshot;
+
+    assert(dwunw_capture(&ctx, &req, &written) == DWUNW_OK);
+    assert(written == 3);
+    assert(frames[1].pc == main_pc);
+    assert(frames[1].cfa == base + 48);
+    assert(frames[2].pc == 0);
+    assert(frames[2].cfa == base + 64);
+
+    snapshot.size = 48;
+    memset(frames, 0, sizeof(frames));
+    assert(dwunw_capture(&ctx, &req, &written) == DWUNW_OK);
+    assert(written == 2);
+    assert(frames[1].pc == main_pc);
+
+    dwunw_shutdown(&ctx);
+}
+
+/* A stripped copy of the fixture carries only .eh_frame; walking it through
+ * the CFI path must give the same frames as the fixture with debug info. */
+static void
+test_stripped_module(void)
+{
+    struct dwunw_context ctx;
+    struct dwunw_regset regs;
+    struct dwunw_frame frames[8];
+    struct dwunw_unwind_request req;
+    struct dwunw_stack_snapshot snapshot;
+    const uint64_t base = 0x7ff000001000ull;
+    uint64_t main_pc = fixture_symbol("main") + 10;
+    uint64_t words[8] = { 0 };
+    size_t written = 0;
+
+    words[4] = base + 48;
+    words[5] = main_pc;
+
+    assert(dwunw_init(&ctx) == DWUNW_OK);
+    ctx.module_cache.flags &= ~DWUNW_MODULE_CACHE_FRAME_POINTER;
+    assert(dwunw_regset_prepare(&regs, DWUNW_ARCH_X86_64) == DWUNW_OK);
+    regs.pc = fixture_symbol("target_function") + 10;
+    regs.regs[6] = base + 32;
+    regs.regs[7] = base;
+    regs.sp = base;
+
+    snapshot.base = base;
+    snapshot.data = words;
+    snapshot.size = sizeof(words);
+
+    memset(frames, 0, sizeof(frames));
+    memset(&req, 0, sizeof(req));
+    req.module_path = get_stripped_fixture_path();
+    req.regs = &regs;
+    req.frames = frames;
+    req.max_frames = 8;
+    req.stack = &snapshot;
+
+    assert(dwunw_capture(&ctx, &req, &written) == DWUNW_OK);
+    assert(written == 3);
+    assert(frames[1].pc == main_pc);
+    assert(frames[1].cfa == base + 48);
+    assert(frames[2].cfa == base + 64);
+
+    dwunw_shutdown(&ctx);
+}
+
+/* Two snapshot captures of the same module: one parse, one cache hit, and
+ * every frame and read accounted in the context's counters. */
+static void
+test_capture_stats(void)
+{
+    struct dwunw_context ctx;
+    struct dwunw_regset regs;
+    struct dwunw_frame frames[8];
+    struct dwunw_unwind_request req;
+    struct dwunw_stack_snapshot snapshot;
+    struct dwunw_stats stats;
+    struct dwunw_stats total;
+    const uint64_t base = 0x7ff000001000ull;
+    uint64_t words[8] = { 0 };
+    uint64_t histogram = 0;
+    size_t written = 0;
+    size_t i;
+
+    words[4] = base + 48;
+    words[5] = fixture_symbol("main") + 10;
+
+    assert(dwunw_init(&ctx) == DWUNW_OK);
+    ctx.module_cache.flags |= DWUNW_MODULE_CACHE_COMPILE_TABLES;
+    assert(dwunw_regset_prepare(&regs, DWUNW_ARCH_X86_64) == DWUNW_OK);
+    regs.pc = fixture_symbol("target_function") + 10;
+    regs.regs[6] = base + 32;
+    regs.regs[7] = base;
+    regs.sp = base;
+
+    snapshot.base = base;
+    snapshot.data = words;
+    snapshot.size = sizeof(words);
+
+    memset(&req, 0, sizeof(req));
+    req.module_path = get_fixture_path();
+    req.regs = &regs;
+    req.frames = frames;
+    req.max_frames = 8;
+    req.stack = &snapshot;
+
+    assert(dwunw_capture(&ctx, &req, &written) == DWUNW_OK);
+    assert(written == 3);
+    snapshot.size = 48;
+    assert(dwunw_capture(&ctx, &req, &written) == DWUNW_OK);
+    assert(written == 2);
+
+    assert(dwunw_stats_snapshot(NULL, &stats) == DWUNW_ERR_INVALID_ARG);
+    assert(dwunw_stats_snapshot(&ctx, &stats) == DWUNW_OK);
+    assert(stats.captures == 2);
+    assert(stats.frames == 5);
+    assert(stats.status[0] == 2);
+    assert(stats.module_misses == 1);
+    assert(stats.module_hits == 1);
+    assert(stats.module_evictions == 0);
+    /* main is left through its frame record; the second capture replays
+     * target_function's rules from the rule cache. */
+    assert(stats.fp_steps == 1);
+    assert(stats.rule_hits == 1);
+    assert(stats.rule_misses >= 1);
+    assert(stats.table_lookups + stats.fde_lookups <= stats.rule_misses);
+    assert(stats.table_lookups + stats.fde_lookups >= 1);
+    assert(stats.mem_reads >= 3);
+    assert(stats.mem_bytes == stats.mem_reads * sizeof(uint64_t));
+    assert(stats.syscalls == 0);
+    for (i = 0; i < DWUNW_STATS_LATENCY_BUCKETS; ++i) {
+        histogram += stats.latency[i];
+    }
+    assert(histogram == 2);
+
+    memset(&total, 0, sizeof(total));
+    dwunw_stats_merge(&total, &stats);
+    dwunw_stats_merge(&total, &stats);
+    assert(total.captures == 4);
+    assert(total.mem_bytes == 2 * stats.mem_bytes);
+
+    dwunw_shutdown(&ctx);
+}
+
+/* Replayed rules give the same frames as resolved ones, and closing a
+ * module invalidates whatever was cached for it. */
+static void
+test_rule_cache(void)
+{
+    struct dwunw_context ctx;
+    struct dwunw_regset regs;
+    struct dwunw_frame first[8];
+    struct dwunw_frame again[8];
+    struct dwunw_unwind_request req;
+    struct dwunw_stack_snapshot snapshot;
+    struct dwunw_stats stats;
+    const uint64_t base = 0x7ff000001000ull;
+    uint64_t words[8] = { 0 };
+    uint64_t misses;
+    size_t written = 0;
+    size_t i;
+
+    words[4] = base + 48;
+    words[5] = fixture_symbol("main") + 10;
+
+    assert(dwunw_init(&ctx) == DWUNW_OK);
+    assert(ctx.rule_cache != NULL);
+    ctx.module_cache.flags &= ~DWUNW_MODULE_CACHE_FRAME_POINTER;
+    assert(dwunw_regset_prepare(&regs, DWUNW_ARCH_X86_64) == DWUNW_OK);
+    regs.pc = fixture_symbol("target_function") + 10;
+    regs.regs[6] = base + 32;
+    regs.regs[7] = base;
+    regs.sp = base;
+
+    snapshot.base = base;
+    snapshot.data = words;
+    snapshot.size = sizeof(words);
+
+    memset(&req, 0, sizeof(req));
+    req.module_path = get_fixture_path();
+    req.regs = &regs;
+    req.frames = first;
+    req.max_frames = 8;
+    req.stack = &snapshot;
+    assert(dwunw_capture(&ctx, &req, &written) == DWUNW_OK);
+    assert(written == 3);
+    assert(dwunw_stats_snapshot(&ctx, &stats) == DWUNW_OK);
+    assert(stats.rule_hits == 0);
+    misses = stats.rule_misses;
+
+    req.frames = again;
+    assert(dwunw_capture(&ctx, &req, &written) == DWUNW_OK);
+    assert(written == 3);
+    for (i = 0; i < written; ++i) {
+        assert(again[i].pc == first[i].pc);
+        assert(again[i].cfa == first[i].cfa);
+        assert(strcmp(again[i].module_path, first[i].module_path) == 0);
+    }
+    assert(dwunw_stats_snapshot(&ctx, &stats) == DWUNW_OK);
+    assert(stats.rule_hits == 2);
+    assert(stats.rule_misses == misses + 1);
+
+    /* A zero budget closes the module on release; its entries must miss. */
+    dwunw_module_cache_set_budget(&ctx.module_cache, 0);
+    memset(again, 0, sizeof(again));
+    assert(dwunw_capture(&ctx, &req, &written) == DWUNW_OK);
+    assert(written == 3);
+    for (i = 0; i < written; ++i) {
+        assert(again[i].pc == first[i].pc);
+        assert(again[i].cfa == first[i].cfa);
+    }
+    assert(dwunw_stats_snapshot(&ctx, &stats) == DWUNW_OK);
+    assert(stats.rule_hits == 2);
+    assert(stats.rule_misses == 2 * misses + 1);
+
+    dwunw_shutdown(&ctx);
+    assert(ctx.rule_cache == NULL);
+}
+
+/* Return addresses in a frame-pointer module follow the frame record and
+ * give the same frames as the CFI; a record that cannot belong to an outer
+ * frame falls back to the CFI. */
+static void
+test_frame_pointer_path(void)
+{
+    struct dwunw_context fp_ctx;
+    struct dwunw_context cfi_ctx;
+    struct dwunw_regset regs;
+    struct dwunw_frame via_fp[8];
+    struct dwunw_frame via_cfi[8];
+    struct dwunw_unwind_request req;
+    struct dwunw_stack_snapshot snapshot;
+    struct dwunw_stats stats;
+    const uint64_t base = 0x7ff000001000ull;
+    uint64_t words[16] = { 0 };
+    size_t fp_written = 0;
+    size_t cfi_written = 0;
+    size_t i;
+
+    /* target_function -> main -> outer frame whose record ends the chain */
+    words[4] = base + 48;
+    words[5] = fixture_symbol("main") + 10;
+    words[6] = base + 96;
+    words[7] = fixture_symbol("main") + 10;
+
+    assert(dwunw_init(&fp_ctx) == DWUNW_OK);
+    assert(dwunw_init(&cfi_ctx) == DWUNW_OK);
+    assert(fp_ctx.module_cache.flags & DWUNW_MODULE_CACHE_FRAME_POINTER);
+    fp_ctx.module_cache.flags |= DWUNW_MODULE_CACHE_COMPILE_TABLES;
+    cfi_ctx.module_cache.flags = DWUNW_MODULE_CACHE_COMPILE_TABLES;
+
+    assert(dwunw_regset_prepare(&regs, DWUNW_ARCH_X86_64) == DWUNW_OK);
+    regs.pc = fixture_symbol("target_function") + 10;
+    regs.regs[6] = base + 32;
+    regs.regs[7] = base;
+    regs.sp = base;
+
+    snapshot.base = base;
+    snapshot.data = words;
+    snapshot.size = sizeof(words);
+
+    memset(&req, 0, sizeof(req));
+    req.module_path = get_fixture_path();
+    req.regs = &regs;
+    req.max_frames = 8;
+    req.stack = &snapshot;
+
+    req.frames = via_fp;
+    assert(dwunw_capture(&fp_ctx, &req, &fp_written) == DWUNW_OK);
+    req.frames = via_cfi;
+    assert(dwunw_capture(&cfi_ctx, &req, &cfi_written) == DWUNW_OK);
+    assert(fp_written == cfi_written);
+    assert(fp_written >= 3);
+    for (i = 0; i < fp_written; ++i) {
+        assert(via_fp[i].pc == via_cfi[i].pc);
+        assert(via_fp[i].cfa == via_cfi[i].cfa);
+        assert(via_fp[i].sp == via_cfi[i].sp);
+    }
+
+    assert(dwunw_stats_snapshot(&fp_ctx, &stats) == DWUNW_OK);
+    assert(stats.fp_steps >= 2);
+    assert(dwunw_stats_snapshot(&cfi_ctx, &stats) == DWUNW_OK);
+    assert(stats.fp_steps == 0);
+
+    /* A saved FP below the stack pointer is not a frame record. */
+    words[4] = base - 64;
+    memset(&fp_ctx.stats, 0, sizeof(fp_ctx.stats));
+    req.frames = via_fp;
+    assert(dwunw_capture(&fp_ctx, &req, &fp_written) == DWUNW_OK);
+    assert(dwunw_stats_snapshot(&fp_ctx, &stats) == DWUNW_OK);
+    assert(stats.fp_steps == 0);
+    assert(stats.rule_hits + stats.rule_misses >= 2);
+
+    dwunw_shutdown(&cfi_ctx);
+    dwunw_shutdown(&fp_ctx);
+}
+
+/* Compact output matches the full frames and names the module by an id
+ * that is interned once per context. */
+static void
+test_compact_frames(void)
+{
+    struct dwunw_context ctx;
+    struct dwunw_regset regs;
+    struct dwunw_frame frames[8];
+    struct dwunw_compact_frame compact[8];
+    struct dwunw_unwind_request req;
+    struct dwunw_stack_snapshot snapshot;
+    const uint64_t base = 0x7ff000001000ull;
+    uint64_t words[8] = { 0 };
+    size_t written = 0;
+    size_t compact_written = 0;
+    uint32_t id = 0;
+    size_t i;
+
+    words[4] = base + 48;
+    words[5] = fixture_symbol("main") + 10;
+
+    assert(sizeof(struct dwunw_compact_frame) == 32);
+    assert(dwunw_init(&ctx) == DWUNW_OK);
+    assert(dwunw_regset_prepare(&regs, DWUNW_ARCH_X86_64) == DWUNW_OK);
+    regs.pc = fixture_symbol("target_function") + 10;
+    regs.regs[6] = base + 32;
+    regs.regs[7] = base;
+    regs.sp = base;
+
+    snapshot.base = base;
+    snapshot.data = words;
+    snapshot.size = sizeof(words);
+
+    memset(&req, 0, sizeof(req));
+    req.module_path = get_fixture_path();
+    req.regs = &regs;
+    req.frames = frames;
+    req.max_frames = 8;
+    req.stack = &snapshot;
+    assert(dwunw_capture(&ctx, &req, &written) == DWUNW_OK);
+
+    /* Exactly one output format per request. */
+    req.compact_frames = compact;
+    assert(dwunw_capture(&ctx, &req, &compact_written) == DWUNW_ERR_INVALID_ARG);
+    req.frames = NULL;
+    assert(dwunw_capture(&ctx, &req, &compact_written) == DWUNW_OK);
+    assert(compact_written == written);
+
+    for (i = 0; i < written; ++i) {
+        assert(compact[i].pc == frames[i].pc);
+        assert(compact[i].cfa == frames[i].cfa);
+        assert(compact[i].flags == frames[i].flags);
+        assert(compact[i].rel_pc == frames[i].pc);  /* fixed module: no bias */
+        assert(compact[i].module_id == compact[0].module_id);
+    }
+    assert(compact[0].module_id != 0);
+    assert(strcmp(dwunw_module_name(&ctx, compact[0].module_id), get_fixture_path()) == 0);
+    assert(strcmp(dwunw_module_name(&ctx, 0), "") == 0);
+    assert(dwunw_module_name(&ctx, compact[0].module_id + 1) == NULL);
+
+    /* Same path, same id; a new path gets the next one. */
+    assert(dwunw_module_names_intern(&ctx.module_names, get_fixture_path(), &id) == DWUNW_OK);
+    assert(id == compact[0].module_id);
+    for (i = 0; i < 200; ++i) {
+        char path[32];
+
+        snprintf(path, sizeof(path), "/lib/mod%zu.so", i);
+        assert(dwunw_module_names_intern(&ctx.module_names, path, &id) == DWUNW_OK);
+        assert(id == compact[0].module_id + 1 + i);
+    }
+    assert(dwunw_module_names_intern(&ctx.module_names, "/lib/mod7.so", &id) == DWUNW_OK);
+    assert(strcmp(dwunw_module_name(&ctx, id), "/lib/mod7.so") == 0);
+    assert(strcmp(dwunw_module_name(&ctx, compact[0].module_id), get_fixture_path()) == 0);
+
+    dwunw_shutdown(&ctx);
+}
+
+struct counting_reader {
+    struct dwunw_stack_snapshot snapshot;
+    unsigned int reads;
+    unsigned int readvs;
+};
+
+static dwunw_status_t
+counting_read(void *ctx, uint64_t address, void *dst, size_t size)
+{
+    struct counting_reader *reader = ctx;
+
+    reader->reads++;
+    return dwunw_stack_snapshot_read(&reader->snapshot, address, dst, size);
+}
+
+static dwunw_status_t
+counting_readv(void *ctx, const struct dwunw_read_iov *iov, size_t count)
+{
+    struct counting_reader *reader = ctx;
+
+    reader->readvs++;
+    return dwunw_stack_snapshot_readv(&reader->snapshot, iov, count);
+}
+
+/* Request-level callbacks replace the built-in reader; each unwound frame
+ * costs one vectored call. */
+static void
+test_custom_reader(void)
+{
+    struct dwunw_context ctx;
+    struct dwunw_regset regs;
+    struct dwunw_frame frames[8];
+    struct dwunw_unwind_request req;
+    struct counting_reader reader;
+    const uint64_t base = 0x7ff000001000ull;
+    uint64_t main_pc = fixture_symbol("main") + 10;
+    uint64_t words[8] = { 0 };
+    size_t written = 0;
+
+    words[4] = base + 48;
+    words[5] = main_pc;
+
+    memset(&reader, 0, sizeof(reader));
+    reader.snapshot.base = base;
+    reader.snapshot.data = words;
+    reader.snapshot.size = sizeof(words);
+
+    assert(dwunw_init(&ctx) == DWUNW_OK);
+    assert(dwunw_regset_prepare(&regs, DWUNW_ARCH_X86_64) == DWUNW_OK);
+    regs.pc = fixture_symbol("target_function") + 10;
+    regs.regs[6] = base + 32;
+    regs.regs[7] = base;
+    regs.sp = base;
+
+    memset(frames, 0, sizeof(frames));
+    memset(&req, 0, sizeof(req));
+    req.module_path = get_fixture_path();
+    req.regs = &regs;
+    req.frames = frames;
+    req.max_frames = 8;
+    req.read_memory_v = counting_readv;
+    req.reader_ctx = &reader;
+    assert(dwunw_capture(&ctx, &req, &written) == DWUNW_ERR_INVALID_ARG);
+
+    req.read_memory = counting_read;
+    assert(dwunw_capture(&ctx, &req, &written) == DWUNW_OK);
+    assert(written == 3);
+    assert(frames[1].pc == main_pc);
+    assert(reader.readvs == 2);
+    assert(reader.reads == 0);
+
+    dwunw_shutdown(&ctx);
+}
+
+/* Results land at each request's own index whatever order the batch runs
+ * them in; a bad request fails alone. */
+static void
+test_capture_batch(void)
+{
+    struct dwunw_context ctx;
+    struct dwunw_regset regs[2];
+    struct dwunw_frame frames[3][8];
+    struct dwunw_unwind_request reqs[3];
+    struct dwunw_stack_snapshot snapshot;
+    size_t written[3] = { 9, 9, 9 };
+    dwunw_status_t statuses[3];
+    const uint64_t base = 0x7ff000001000ull;
+    uint64_t main_pc = fixture_symbol("main") + 10;
+    uint64_t words[8] = { 0 };
+    size_t i;
+
+    words[4] = base + 48;
+    words[5] = main_pc;
+    snapshot.base = base;
+    snapshot.data = words;
+    snapshot.size = sizeof(words);
+
+    assert(dwunw_init(&ctx) == DWUNW_OK);
+    assert(dwunw_regset_prepare(&regs[0], DWUNW_ARCH_X86_64) == DWUNW_OK);
+    regs[0].pc = fixture_symbol("target_function") + 10;
+    regs[0].regs[6] = base + 32;
+    regs[0].regs[7] = base;
+    regs[0].sp = base;
+    regs[1] = regs[0];
+    regs[1].pc = main_pc;
+    regs[1].regs[6] = base + 48;
+    regs[1].regs[7] = base + 40;
+    regs[1].sp = base + 40;
+
+    memset(frames, 0, sizeof(frames));
+    memset(reqs, 0, sizeof(reqs));
+    for (i = 0; i < 3; ++i) {
+        reqs[i].module_path = get_fixture_path();
+        reqs[i].regs = &regs[i % 2];
+        reqs[i].frames = frames[i];
+        reqs[i].max_frames = 8;
+        reqs[i].stack = &snapshot;
+    }
+    reqs[1].regs = &regs[1];
+    reqs[2].regs = NULL;
+
+    assert(dwunw_capture_batch(&ctx, reqs, 3, written, statuses) == DWUNW_ERR_INVALID_ARG);
+    assert(statuses[0] == DWUNW_OK && written[0] == 3);
+    assert(frames[0][1].pc == main_pc);
+    assert(statuses[1] == DWUNW_OK && written[1] == 2);
+    assert(frames[1][0].pc == main_pc && frames[1][1].pc == 0);
+    assert(statuses[2] == DWUNW_ERR_INVALID_ARG && written[2] == 0);
+
+    assert(dwunw_capture_batch(&ctx, reqs, 2, NULL, NULL) == DWUNW_OK);
+    assert(dwunw_capture_batch(&ctx, NULL, 0, NULL, NULL) == DWUNW_OK);
+    assert(dwunw_capture_batch(NULL, reqs, 1, NULL, NULL) == DWUNW_ERR_INVALID_ARG);
+    assert(dwunw_capture_batch(&ctx, reqs, SIZE_MAX, NULL, NULL) == DWUNW_ERR_INVALID_ARG);
+    dwunw_shutdown(&ctx);
+}
+#endif
+
+/* A vectored read of our own memory costs one process_vm_readv(). */
+static void
+test_stack_reader_readv(void)
+{
+    struct dwunw_stack_reader reader;
+    struct dwunw_stack_reader_session session;
+    uint64_t source[3] = { 0x1111, 0x2222, 0x3333 };
+    uint64_t copy[3] = { 0, 0, 0 };
+    struct dwunw_read_iov iov[3];
+    size_t i;
+
+    for (i = 0; i < 3; ++i) {
+        iov[i].address = (uint64_t)(uintptr_t)&source[2 - i];
+        iov[i].dst = &copy[i];
+        iov[i].size = sizeof(copy[i]);
+    }
+
+    assert(dwunw_stack_reader_init(&reader) == DWUNW_OK);
+    assert(dwunw_stack_reader_attach(&reader, getpid(), 0, &session) == DWUNW_OK);
+    assert(dwunw_stack_reader_readv(&session, iov, 3) == DWUNW_OK);
+    assert(copy[0] == 0x3333 && copy[1] == 0x2222 && copy[2] == 0x1111);
+    assert(dwunw_stack_reader_readv(&session, iov, 0) == DWUNW_OK);
+
+    iov[1].address = 0;
+    assert(dwunw_stack_reader_readv(&session, iov, 3) != DWUNW_OK);
+    assert(dwunw_stack_reader_readv(NULL, iov, 3) == DWUNW_ERR_INVALID_ARG);
+
+    dwunw_stack_reader_detach(&session);
+    dwunw_stack_reader_shutdown(&reader);
+}
+
+/* After set_sp the first read copies the window; reads inside it are then
+ * served locally, reads outside still reach the target. */
+static void
+test_stack_reader_window(void)
+{
+    struct dwunw_stack_reader reader;
+    struct dwunw_stack_reader_session session;
+    uint64_t slots[4] = { 1, 2, 3, 4 };
+    static uint64_t outside = 0x4444;
+    uint64_t value = 0;
+    struct dwunw_read_iov iov[2];
+
+    assert(dwunw_stack_reader_init(&reader) == DWUNW_OK);
+    assert(reader.window_size == DWUNW_STACK_WINDOW_DEFAULT);
+    assert(dwunw_stack_reader_set_window(&reader, 1024) == DWUNW_ERR_INVALID_ARG);
+    assert(dwunw_stack_reader_set_window(&reader, DWUNW_STACK_WINDOW_MAX + 1) ==
+           DWUNW_ERR_INVALID_ARG);
+    assert(dwunw_stack_reader_set_window(&reader, DWUNW_STACK_WINDOW_MIN) == DWUNW_OK);
+
+    assert(dwunw_stack_reader_attach(&reader, getpid(), 0, &session) == DWUNW_OK);
+    dwunw_stack_reader_set_sp(&session, (uint64_t)(uintptr_t)slots);
+
+    assert(dwunw_stack_reader_read(&session, (uint64_t)(uintptr_t)&slots[2],
+                                   &value, sizeof(value)) == DWUNW_OK);
+    assert(value == 3);
+    assert(session.syscalls == 1);
+    assert(session.window_len >= sizeof(slots));
+
+    iov[0].address = (uint64_t)(uintptr_t)&slots[0];
+    iov[0].dst = &slots[3];
+    iov[0].size = sizeof(slots[0]);
+    iov[1].address = (uint64_t)(uintptr_t)&slots[1];
+    iov[1].dst = &value;
+    iov[1].size = sizeof(value);
+    assert(dwunw_stack_reader_readv(&session, iov, 2) == DWUNW_OK);
+    assert(slots[3] == 1 && value == 2);
+    assert(session.syscalls == 1);
+
+    assert(dwunw_stack_reader_read(&session, (uint64_t)(uintptr_t)&outside,
+                                   &value, sizeof(value)) == DWUNW_OK);
+    assert(value == 0x4444);
+    assert(session.syscalls == 2);
+
+    dwunw_stack_reader_detach(&session);
+    assert(dwunw_stack_reader_set_window(&reader, 0) == DWUNW_OK);
+    assert(dwunw_stack_reader_attach(&reader, getpid(), 0, &session) == DWUNW_OK);
+    dwunw_stack_reader_set_sp(&session, (uint64_t)(uintptr_t)slots);
+    assert(dwunw_stack_reader_read(&session, (uint64_t)(uintptr_t)&slots[0],
+                                   &value, sizeof(value)) == DWUNW_OK);
+    assert(session.window_len == 0);
+    dwunw_stack_reader_detach(&session);
+    dwunw_stack_reader_shutdown(&reader);
+}
+
+static void
+test_snapshot_reader(void)
+{
+    uint8_t bytes[16];
+    struct dwunw_stack_snapshot snapshot = { 0x1000, bytes, sizeof(bytes) };
+    struct dwunw_read_iov iov[2];
+    uint64_t a = 0;
+    uint64_t b = 0;
+    size_t i;
+
+    for (i = 0; i < sizeof(bytes); ++i) {
+        bytes[i] = (uint8_t)i;
+    }
+
+    assert(dwunw_stack_snapshot_read(&snapshot, 0x1008, &a, sizeof(a)) == DWUNW_OK);
+    assert(memcmp(&a, bytes + 8, sizeof(a)) == 0);
+    assert(dwunw_stack_snapshot_read(&snapshot, 0x1009, &a, sizeof(a)) == DWUNW_ERR_NO_DEBUG_DATA);
+    assert(dwunw_stack_snapshot_read(&snapshot, 0xff8, &a, sizeof(a)) == DWUNW_ERR_NO_DEBUG_DATA);
+
+    iov[0].address = 0x1000;
+    iov[0].dst = &a;
+    iov[0].size = sizeof(a);
+    iov[1].address = 0x1010;
+    iov[1].dst = &b;
+    iov[1].size = sizeof(b);
+    assert(dwunw_stack_snapshot_readv(&snapshot, iov, 2) == DWUNW_ERR_NO_DEBUG_DATA);
+    assert(b == 0);
+    iov[1].address = 0x1008;
+    assert(dwunw_stack_snapshot_readv(&snapshot, iov, 2) == DWUNW_OK);
+    assert(memcmp(&a, bytes, sizeof(a)) == 0 && memcmp(&b, bytes + 8, sizeof(b)) == 0);
+}
+
 static void
 test_invalid_inputs(void)
 {
@@ -64,6 +820,20 @@ main(void)
 {
     test_invalid_inputs();
     test_single_frame();
+    test_stack_reader_readv();
+    test_stack_reader_window();
+    test_snapshot_reader();
+#if defined(__x86_64__)
+    test_nonstop_multi_frame();
+    test_snapshot_multi_frame();
+    test_stripped_module();
+    test_capture_stats();
+    test_rule_cache();
+    test_frame_pointer_path();
+    test_compact_frames();
+    test_custom_reader();
+    test_capture_batch();
+#endif
     puts("unwinder: ok");
     return 0;
 }